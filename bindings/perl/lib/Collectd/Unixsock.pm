@@ -394,37 +394,48 @@ sub listval
 	my $msg;
 	my @ret = ();
 	my $status;
+	my $after;
 	my $fh = $obj->{'sock'} or confess;
 
-	_debug "LISTVAL\n";
-	print $fh "LISTVAL\n";
-
-	$msg = <$fh>;
-	chomp ($msg);
-	_debug "<- $msg\n";
-	($status, $msg) = split (' ', $msg, 2);
-	if ($status < 0)
+	# The daemon returns a limited number of identifiers per command, so the
+	# list is requested in pages.
+	do
 	{
-		$obj->{'error'} = $msg;
-		return;
-	}
+		$msg = "LISTVAL limit=1024";
+		$msg .= ' after=' . _escape_argument ($after) if (defined ($after));
+		$msg .= "\n";
 
-	for (my $i = 0; $i < $status; $i++)
-	{
-		my $time;
-		my $ident;
+		_debug "-> $msg";
+		print $fh $msg;
 
 		$msg = <$fh>;
 		chomp ($msg);
 		_debug "<- $msg\n";
+		($status, $msg) = split (' ', $msg, 2);
+		if ($status < 0)
+		{
+			$obj->{'error'} = $msg;
+			return;
+		}
+
+		for (my $i = 0; $i < $status; $i++)
+		{
+			my $time;
+			my $ident;
+
+			$msg = <$fh>;
+			chomp ($msg);
+			_debug "<- $msg\n";
 
-		($time, $ident) = split (' ', $msg, 2);
+			($time, $ident) = split (' ', $msg, 2);
+			$after = $ident;
 
-		$ident = _parse_identifier ($ident);
-		$ident->{'time'} = int ($time);
+			$ident = _parse_identifier ($ident);
+			$ident->{'time'} = int ($time);
 
-		push (@ret, $ident);
-	} # for (i = 0 .. $status)
+			push (@ret, $ident);
+		} # for (i = 0 .. $status)
+	} while ($status == 1024);
 
 	return (@ret);
 } # listval
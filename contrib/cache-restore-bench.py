@@ -0,0 +1,111 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Measures how long collectd takes to restore a large value cache.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Usage: cache-restore-bench.py [-c <collectd>] [-p <plugindir>] [-t <typesdb>]
+                              [-n <identifiers>]
+
+Starts a private instance of collectd with the unixsock and logfile plugins
+and the "CacheFile" option set, fills its value cache with the given number
+of identifiers using PUTVALS, and stops it, which writes the cache to disk.
+The daemon is then started again and the time it took to restore the cache,
+as logged by the daemon, is printed together with the size of the file.
+"""
+
+import getopt
+import os
+import re
+import shutil
+import sys
+import tempfile
+
+from collectd_bench import COLLECTD, PLUGINDIR, TYPESDB, \
+        write_config, start, stop, putvals
+
+CONFIG = """
+CacheFile "%(dir)s/cache.dat"
+
+LoadPlugin unixsock
+<Plugin unixsock>
+  SocketFile "%(dir)s/collectd.sock"
+</Plugin>
+"""
+
+def fill(path, identifiers):
+    putvals(path, ['cache-bench/bench-%i/derive-%i 1:%i\n'
+        % (i // 1000, i % 1000, i) for i in range(identifiers)])
+
+def main():
+    collectd = COLLECTD
+    plugindir = PLUGINDIR
+    typesdb = TYPESDB
+    identifiers = 500000
+
+    opts, args = getopt.getopt(sys.argv[1:], 'c:p:t:n:h')
+    for (opt, value) in opts:
+        if opt == '-c':
+            collectd = value
+        elif opt == '-p':
+            plugindir = value
+        elif opt == '-t':
+            typesdb = value
+        elif opt == '-n':
+            identifiers = int(value)
+        else:
+            sys.stdout.write(__doc__)
+            return 0
+
+    tmpdir = tempfile.mkdtemp(prefix='cache-bench-')
+    config = write_config({'dir': tmpdir, 'plugindir': plugindir,
+        'typesdb': typesdb}, CONFIG)
+    sockpath = os.path.join(tmpdir, 'collectd.sock')
+    logfile = os.path.join(tmpdir, 'collectd.log')
+
+    try:
+        proc = start(collectd, config, sockpath)
+        fill(sockpath, identifiers)
+        stop(proc)
+
+        size = os.path.getsize(os.path.join(tmpdir, 'cache.dat'))
+
+        proc = start(collectd, config, sockpath)
+        stop(proc)
+
+        restored = None
+        with open(logfile) as fh:
+            for line in fh:
+                match = re.search(r'Restored (\d+) entries .* in ([0-9.]+) '
+                        r'seconds', line)
+                if match:
+                    restored = (int(match.group(1)), float(match.group(2)))
+        if restored is None:
+            sys.stderr.write('The log file does not contain the restore '
+                    'time; see %s\n' % logfile)
+            return 1
+
+        sys.stdout.write('Cache file:  %10.1f MB\n' % (size / 1048576.0))
+        sys.stdout.write('Restored:    %10i entries\n' % restored[0])
+        sys.stdout.write('Time:        %10.3f s (%.0f entries/s)\n'
+                % (restored[1], restored[0] / max(restored[1], 0.001)))
+    finally:
+        shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
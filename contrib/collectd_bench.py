@@ -0,0 +1,103 @@
+# vim: sts=4 sw=4 et
+
+# Helpers shared by the *-bench.py scripts in this directory.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Starting and stopping private collectd instances for benchmarks. The
+instances run in the foreground, keep all their files in one directory and
+log to "collectd.log" in that directory.
+"""
+
+import os
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+COLLECTD = 'collectd'
+PLUGINDIR = '/opt/collectd/lib/collectd'
+TYPESDB = '/opt/collectd/share/collectd/types.db'
+
+# Start of every configuration. The parameters "dir", "plugindir" and
+# "typesdb" have to be set.
+CONFIG_HEAD = """
+BaseDir "%(dir)s"
+PIDFile "%(dir)s/collectd.pid"
+PluginDir "%(plugindir)s"
+TypesDB "%(typesdb)s"
+Interval 3600
+
+LoadPlugin logfile
+<Plugin logfile>
+  LogLevel info
+  File "%(dir)s/collectd.log"
+</Plugin>
+"""
+
+def wait_for(predicate, timeout=600.0):
+    end = time.time() + timeout
+    while time.time() < end:
+        if predicate():
+            return True
+        time.sleep(0.05)
+    return False
+
+def grep_log(path, regex):
+    """Returns the first match of "regex" in the file "path", or None."""
+    if not os.path.exists(path):
+        return None
+    with open(path) as fh:
+        for line in fh:
+            match = regex.search(line)
+            if match:
+                return match
+    return None
+
+def write_config(params, body):
+    """Writes CONFIG_HEAD followed by "body", both formatted with "params",
+    to "collectd.conf" in params['dir'] and returns its path."""
+    config = os.path.join(params['dir'], 'collectd.conf')
+    with open(config, 'w') as fh:
+        fh.write((CONFIG_HEAD + body) % params)
+    return config
+
+def start(collectd, config, path=None):
+    """Starts collectd and, if "path" is given, waits for it to create that
+    file, usually the unixsock socket."""
+    proc = subprocess.Popen([collectd, '-f', '-C', config])
+    if (path is not None) and not wait_for(lambda: os.path.exists(path)):
+        stop(proc)
+        raise RuntimeError('collectd did not create %s' % path)
+    return proc
+
+def stop(proc):
+    proc.send_signal(signal.SIGTERM)
+    proc.wait()
+
+def putvals(path, lines):
+    """Sends "lines", each a PUTVAL argument list ending in a newline, as one
+    PUTVALS block to the unixsock socket "path"."""
+    payload = 'PUTVALS\n' + ''.join(lines) + '\n'
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    sock.sendall(payload.encode('ascii'))
+    answer = sock.makefile('r').readline()
+    sock.close()
+    if not answer.startswith('0 '):
+        sys.stderr.write('Unexpected answer: %r\n' % answer)
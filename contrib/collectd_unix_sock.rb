@@ -63,12 +63,22 @@ class CollectdUnixSock
   #   ...
   # end
   def each_value
-    n_lines = cmd("LISTVAL")
-    n_lines.times do
-      line = @socket.readline
-      time_s, identifier = line.split(' ', 2)
-      time = Time.at(time_s.to_i)
-      yield time, identifier
+    # the daemon returns a limited number of identifiers
+    # per command, so the list is requested in pages
+    command = "LISTVAL limit=1024"
+    loop do
+      n_lines = cmd(command)
+      after = nil
+      n_lines.times do
+        line = @socket.readline
+        time_s, identifier = line.split(' ', 2)
+        time = Time.at(time_s.to_i)
+        after = identifier.chomp
+        yield time, identifier
+      end
+      break if n_lines < 1024
+      escaped = after.gsub('\\') { '\\\\' }.gsub('"') { '\\"' }
+      command = "LISTVAL limit=1024 after=\"#{escaped}\""
     end
   end
 
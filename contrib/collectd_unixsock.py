@@ -98,10 +98,21 @@ class Collectd():
             http://collectd.org/wiki/index.php/Plain_text_protocol#LISTVAL
 
         """
-        numvalues = self._cmd('LISTVAL')
+        # The daemon returns a limited number of identifiers per command, so
+        # the list is requested in pages.
         lines = []
-        if numvalues:
-            lines = self._readlines(numvalues)
+        command = 'LISTVAL limit=1024'
+        while True:
+            numvalues = self._cmd(command)
+            if not numvalues or numvalues < 0:
+                break
+            page = self._readlines(numvalues)
+            lines.extend(page)
+            if numvalues < 1024 or len(page) < numvalues:
+                break
+            after = page[-1].split(' ', 1)[1]
+            command = 'LISTVAL limit=1024 after="%s"' % (
+                after.replace('\\', '\\\\').replace('"', '\\"'))
         return lines
 
     def putnotif(self, message, options={}):
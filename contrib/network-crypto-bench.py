@@ -0,0 +1,165 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Compares the throughput of the network plugin for plain and encrypted packets.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Usage: network-crypto-bench.py [-c <collectd>] [-g <collectd-tg>]
+                               [-p <plugindir>] [-t <typesdb>]
+                               [-r <values/s>] [-d <seconds>]
+
+Starts a private instance of collectd with the network plugin capturing the
+packets it receives and sends it traffic with collectd-tg, once in plain text
+and once encrypted. Both captures are then fed through the receive path of a
+fresh daemon using a "Replay" block, and the throughput logged by the daemon
+is printed.
+"""
+
+import getopt
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from collectd_bench import COLLECTD, PLUGINDIR, TYPESDB, \
+        wait_for, grep_log, write_config, start, stop
+
+PORT = '25827'
+USERNAME = 'bench'
+PASSWORD = 'secret'
+
+CONFIG_CAPTURE = """
+LoadPlugin network
+<Plugin network>
+  <Listen "127.0.0.1" "%(port)s">
+    AuthFile "%(dir)s/passwd"
+  </Listen>
+  CaptureFile "%(pcap)s"
+</Plugin>
+"""
+
+CONFIG_REPLAY = """
+LoadPlugin network
+<Plugin network>
+  <Replay "%(pcap)s">
+    SecurityLevel "%(level)s"
+    AuthFile "%(dir)s/passwd"
+  </Replay>
+</Plugin>
+"""
+
+REPLAYED = re.compile(r'Replayed (\d+) packets with (\d+) values .* in '
+        r'([0-9.]+) seconds \(([0-9.]+) values/s\)')
+
+def run_collectd(collectd, tmpdir, params, body, predicate):
+    config = write_config(params, body)
+    if os.path.exists(params['log']):
+        os.unlink(params['log'])
+
+    proc = start(collectd, config)
+    try:
+        if not wait_for(predicate):
+            raise RuntimeError('collectd did not finish; see %s'
+                    % params['log'])
+    finally:
+        stop(proc)
+
+def capture(collectd, tg, tmpdir, params, pcap, rate, duration, level):
+    params = dict(params, pcap=pcap)
+    started = re.compile(r'Capturing received packets')
+
+    def send():
+        if not grep_log(params['log'], started):
+            return False
+        args = [tg, '-d', '127.0.0.1', '-D', PORT, '-r', str(rate),
+                '-T', str(duration)]
+        if level != 'none':
+            args += ['-s', level, '-u', USERNAME, '-k', PASSWORD]
+        subprocess.check_call(args, stdout=open(os.devnull, 'w'))
+        return True
+
+    run_collectd(collectd, tmpdir, params, CONFIG_CAPTURE, send)
+
+def replay(collectd, tmpdir, params, pcap, level):
+    params = dict(params, pcap=pcap, level=level)
+    result = []
+
+    def done():
+        match = grep_log(params['log'], REPLAYED)
+        if match:
+            result.append(match)
+        return match is not None
+
+    run_collectd(collectd, tmpdir, params, CONFIG_REPLAY, done)
+    return result[0]
+
+def main():
+    collectd = COLLECTD
+    tg = 'collectd-tg'
+    plugindir = PLUGINDIR
+    typesdb = TYPESDB
+    rate = 100000
+    duration = 5
+
+    opts, args = getopt.getopt(sys.argv[1:], 'c:g:p:t:r:d:h')
+    for (opt, value) in opts:
+        if opt == '-c':
+            collectd = value
+        elif opt == '-g':
+            tg = value
+        elif opt == '-p':
+            plugindir = value
+        elif opt == '-t':
+            typesdb = value
+        elif opt == '-r':
+            rate = int(value)
+        elif opt == '-d':
+            duration = int(value)
+        else:
+            sys.stdout.write(__doc__)
+            return 0
+
+    tmpdir = tempfile.mkdtemp(prefix='network-bench-')
+    params = {'dir': tmpdir, 'plugindir': plugindir, 'typesdb': typesdb,
+            'log': os.path.join(tmpdir, 'collectd.log'), 'port': PORT}
+    with open(os.path.join(tmpdir, 'passwd'), 'w') as fh:
+        fh.write('%s: %s\n' % (USERNAME, PASSWORD))
+
+    try:
+        results = {}
+        for level in ('none', 'encrypt'):
+            pcap = os.path.join(tmpdir, '%s.pcap' % level)
+            capture(collectd, tg, tmpdir, params, pcap, rate, duration, level)
+            results[level] = replay(collectd, tmpdir, params, pcap, level)
+
+        for level in ('none', 'encrypt'):
+            match = results[level]
+            sys.stdout.write('%-8s %8s packets %9s values %8.3f s '
+                    '%10.0f values/s\n' % (level, match.group(1),
+                        match.group(2), float(match.group(3)),
+                        float(match.group(4))))
+        sys.stdout.write('Encrypted throughput: %.1f%% of plain text\n'
+                % (100.0 * float(results['encrypt'].group(4))
+                    / max(float(results['none'].group(4)), 1.0)))
+    finally:
+        shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
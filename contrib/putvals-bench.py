@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Compares the throughput of PUTVAL and PUTVALS on the unixsock plugin.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Usage: putvals-bench.py [-s <socket>] [-n <lines>] [-i <identifiers>]
+
+Sends the same number of value lines to collectd's unixsock plugin, once as
+individual (pipelined) PUTVAL commands and once as a single PUTVALS block,
+and prints the number of lines per second achieved by each method. The
+values are dispatched for real, so use a throw-away host name or a test
+instance of the daemon.
+"""
+
+import getopt
+import socket
+import sys
+import threading
+import time
+
+def read_answers(sock, count, result):
+    """Reads "count" status lines from "sock", storing errors in "result"."""
+    data = b''
+    lines = 0
+    while lines < count:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+        while b'\n' in data:
+            line, data = data.split(b'\n', 1)
+            lines += 1
+            if not line.startswith(b'0 '):
+                result.append(line)
+    result.append(lines)
+
+def run(path, payload, answers):
+    """Sends "payload" and waits for "answers" status lines. Returns the
+    elapsed time in seconds."""
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+
+    result = []
+    reader = threading.Thread(target=read_answers,
+            args=(sock, answers, result))
+    reader.start()
+
+    start = time.time()
+    sock.sendall(payload)
+    reader.join()
+    elapsed = time.time() - start
+
+    sock.close()
+
+    errors = result[:-1]
+    if errors or (result[-1] != answers):
+        sys.stderr.write('Unexpected answer: %r\n' % (errors or result[-1]))
+    return elapsed
+
+def main():
+    path = '/var/run/collectd-unixsock'
+    lines = 100000
+    identifiers = 1000
+
+    opts, args = getopt.getopt(sys.argv[1:], 's:n:i:h')
+    for (opt, value) in opts:
+        if opt == '-s':
+            path = value
+        elif opt == '-n':
+            lines = int(value)
+        elif opt == '-i':
+            identifiers = int(value)
+        else:
+            sys.stdout.write(__doc__)
+            return 0
+
+    values = [('putvals-bench/bench/gauge-%i N:%i' % (i % identifiers, i))
+            for i in range(lines)]
+
+    payload = ''.join(['PUTVAL %s\n' % v for v in values]).encode('ascii')
+    t_putval = run(path, payload, lines)
+
+    payload = ('PUTVALS\n' + ''.join(['%s\n' % v for v in values])
+            + '\n').encode('ascii')
+    t_putvals = run(path, payload, 1)
+
+    sys.stdout.write('PUTVAL:  %10.0f lines/s\n' % (lines / t_putval))
+    sys.stdout.write('PUTVALS: %10.0f lines/s (%.1fx)\n'
+            % (lines / t_putvals, t_putval / t_putvals))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,208 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Compares the ways the tcpconns plugin can read the TCP sockets on Linux.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Usage: tcpconns-bench.py [-n <connections>] [-p <ports>] [-r <repetitions>]
+
+Opens the given number of TCP connections on the loopback interface to a port
+which is not collected, and ten connections to each of the given number of
+collected ports. It then reads the sockets the same three ways the tcpconns
+plugin does, with its "LocalPort" option set to the collected ports:
+
+  sock_diag  SOCK_DIAG_BY_FAMILY with a port filter, IPv4 and IPv6
+  netlink    TCPDIAG_GETSOCK, all IPv4 sockets
+  proc       /proc/net/tcp and /proc/net/tcp6
+
+For each method the best time of all repetitions, the number of sockets read
+and the number of sockets using a collected port is printed. The times include
+decoding the sockets in Python, so only compare them with each other. Every
+connection takes two file descriptors, so raise "ulimit -n" for large numbers.
+"""
+
+import getopt
+import os
+import resource
+import socket
+import struct
+import sys
+import time
+
+NETLINK_INET_DIAG = 4
+TCPDIAG_GETSOCK = 18
+SOCK_DIAG_BY_FAMILY = 20
+NLM_F_REQUEST = 0x01
+NLM_F_ROOT = 0x100
+NLM_F_MATCH = 0x200
+NLMSG_ERROR = 2
+NLMSG_DONE = 3
+INET_DIAG_REQ_BYTECODE = 1
+INET_DIAG_BC_JMP = 1
+INET_DIAG_BC_S_GE = 2
+INET_DIAG_BC_S_LE = 3
+TCP_STATES = 0xfff
+
+# struct nlmsghdr, struct inet_diag_sockid (all zero), struct inet_diag_req
+# and struct inet_diag_req_v2.
+NLMSGHDR = '=IHHII'
+SOCKID = 48 * b'\0'
+INET_DIAG_REQ = '=BBBB48sII'
+INET_DIAG_REQ_V2 = '=BBBBI48s'
+
+def port_filter(ports):
+    """Builds the filter the plugin passes to the kernel: one range check per
+    port, which jumps to the end of the filter to accept the socket."""
+    ops = []
+    for port in ports:
+        ops.append([INET_DIAG_BC_S_GE, 8, 20])
+        ops.append([0, 0, port])
+        ops.append([INET_DIAG_BC_S_LE, 8, 12])
+        ops.append([0, 0, port])
+        ops.append([INET_DIAG_BC_JMP, 4, 0])
+    for i in range(4, len(ops), 5):
+        ops[i][2] = (len(ops) + 1 - i) * 4
+    ops.append([INET_DIAG_BC_JMP, 4, 8])
+    return b''.join([struct.pack('=BBH', *op) for op in ops])
+
+def netlink_dump(fd, seq, msg_type, payload):
+    """Sends a dump request and returns (local port, remote port, state) of
+    all sockets in the answer."""
+    fd.send(struct.pack(NLMSGHDR, 16 + len(payload), msg_type,
+        NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST, seq, 0) + payload)
+
+    sockets = []
+    while True:
+        data = fd.recv(32768)
+        offset = 0
+        while offset + 16 <= len(data):
+            (length, msg_type, flags, msg_seq, pid) = struct.unpack_from(
+                    NLMSGHDR, data, offset)
+            if length < 16:
+                return sockets
+            if msg_seq == seq:
+                if msg_type == NLMSG_DONE:
+                    return sockets
+                if msg_type == NLMSG_ERROR:
+                    raise RuntimeError('netlink error %i'
+                            % struct.unpack_from('=i', data, offset + 16))
+                (state, sport, dport) = struct.unpack_from('!xBxxHH', data,
+                        offset + 16)
+                sockets.append((sport, dport, state))
+            offset += (length + 3) & ~3
+
+def read_sock_diag(ports, seq):
+    fd = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_INET_DIAG)
+    bytecode = port_filter(ports)
+    attr = struct.pack('=HH', 4 + len(bytecode),
+            INET_DIAG_REQ_BYTECODE) + bytecode
+    sockets = []
+    for family in (socket.AF_INET, socket.AF_INET6):
+        req = struct.pack(INET_DIAG_REQ_V2, family, socket.IPPROTO_TCP, 0, 0,
+                TCP_STATES, SOCKID)
+        sockets += netlink_dump(fd, seq, SOCK_DIAG_BY_FAMILY, req + attr)
+    fd.close()
+    return sockets
+
+def read_netlink(ports, seq):
+    fd = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_INET_DIAG)
+    req = struct.pack(INET_DIAG_REQ, socket.AF_INET, 0, 0, 0, SOCKID,
+            TCP_STATES, 0)
+    sockets = netlink_dump(fd, seq, TCPDIAG_GETSOCK, req)
+    fd.close()
+    return sockets
+
+def read_proc(ports, seq):
+    sockets = []
+    for path in ('/proc/net/tcp', '/proc/net/tcp6'):
+        if not os.path.exists(path):
+            continue
+        with open(path) as fh:
+            fh.readline()
+            for line in fh:
+                fields = line.split(None, 4)
+                sockets.append((int(fields[1].rsplit(':', 1)[1], 16),
+                    int(fields[2].rsplit(':', 1)[1], 16),
+                    int(fields[3], 16)))
+    return sockets
+
+METHODS = (('sock_diag', read_sock_diag), ('netlink', read_netlink),
+        ('proc', read_proc))
+
+def listen():
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.bind(('127.0.0.1', 0))
+    server.listen(128)
+    return server
+
+def connect(server, num, keep):
+    for i in range(num):
+        client = socket.create_connection(server.getsockname())
+        keep.append(client)
+        keep.append(server.accept()[0])
+
+def main():
+    connections = 5000
+    ports_num = 3
+    repetitions = 10
+
+    opts, args = getopt.getopt(sys.argv[1:], 'n:p:r:h')
+    for (opt, value) in opts:
+        if opt == '-n':
+            connections = int(value)
+        elif opt == '-p':
+            ports_num = int(value)
+        elif opt == '-r':
+            repetitions = int(value)
+        else:
+            sys.stdout.write(__doc__)
+            return 0
+
+    (soft, hard) = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+    keep = []
+    other = listen()
+    connect(other, connections, keep)
+    servers = [listen() for i in range(ports_num)]
+    for server in servers:
+        connect(server, 10, keep)
+    ports = sorted([server.getsockname()[1] for server in servers])
+
+    seq = 0
+    for (name, method) in METHODS:
+        best = None
+        for i in range(repetitions):
+            seq += 1
+            begin = time.time()
+            try:
+                sockets = method(ports, seq)
+            except (socket.error, RuntimeError) as e:
+                sys.stdout.write('%-10s failed: %s\n' % (name, e))
+                break
+            elapsed = time.time() - begin
+            if (best is None) or (elapsed < best):
+                best = elapsed
+        else:
+            wanted = len([s for s in sockets if s[0] in ports])
+            sys.stdout.write('%-10s %10.3f ms %8i sockets %8i collected\n'
+                    % (name, 1000.0 * best, len(sockets), wanted))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,167 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Measures the cost of checking thresholds for a large number of series.
+# Copyright (C) 2026  agent
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; only version 2 of the License is applicable.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+"""
+Usage: threshold-bench.py [-c <collectd>] [-p <plugindir>] [-t <typesdb>]
+                          [-n <series>] [-r <rounds>] [-w <window>]
+
+Starts a private instance of collectd with the unixsock, logfile and threshold
+plugins once without a threshold for the benchmark series and once for each
+threshold function ("Value", "Mean", "Percentile", "RateOfChange" and
+"Deviation"). Each instance is sent one value for every series per round
+using PUTVALS. A single "marker" series with its own threshold is sent after
+each round; since values are written in order with one write thread, the
+notification of the marker tells when all values of the round have been
+checked. The time per value, and the difference to the run without a
+threshold, is printed for each function.
+"""
+
+import getopt
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+from collectd_bench import COLLECTD, PLUGINDIR, TYPESDB, \
+        wait_for, write_config, start, stop, putvals
+
+CONFIG = """
+WriteThreads 1
+
+LoadPlugin unixsock
+<Plugin unixsock>
+  SocketFile "%(dir)s/collectd.sock"
+</Plugin>
+
+LoadPlugin threshold
+<Plugin threshold>
+  <Plugin "marker">
+    <Type "gauge">
+      WarningMax 0.5
+      Persist true
+    </Type>
+  </Plugin>
+%(threshold)s
+</Plugin>
+"""
+
+THRESHOLD = """
+  <Plugin "bench">
+    <Type "gauge">
+      Function "%(function)s"
+      Window %(window)i
+      Percentile 95
+      WarningMax 1000000
+    </Type>
+  </Plugin>
+"""
+
+FUNCTIONS = ('Value', 'Mean', 'Percentile', 'RateOfChange', 'Deviation')
+
+def count_markers(path):
+    if not os.path.exists(path):
+        return 0
+    with open(path) as fh:
+        return sum(1 for line in fh
+                if 'Notification:' in line and 'marker' in line)
+
+def send_round(path, series, round_num):
+    lines = ['threshold-bench/bench/gauge-%i N:%i\n'
+            % (i, (i * 7 + round_num * 13) % 100) for i in range(series)]
+    lines.append('threshold-bench/marker/gauge N:1\n')
+    putvals(path, lines)
+
+def run(collectd, tmpdir, params, function, series, rounds):
+    """Returns the time in seconds it took to dispatch and check "rounds"
+    rounds of values, not counting the first round which creates the
+    series."""
+    sockpath = os.path.join(tmpdir, 'collectd.sock')
+    logfile = os.path.join(tmpdir, 'collectd.log')
+    for path in (sockpath, logfile):
+        if os.path.exists(path):
+            os.unlink(path)
+
+    threshold = ''
+    if function is not None:
+        threshold = THRESHOLD % dict(params, function=function)
+    config = write_config(dict(params, threshold=threshold), CONFIG)
+
+    proc = start(collectd, config, sockpath)
+    try:
+        send_round(sockpath, series, 0)
+        if not wait_for(lambda: count_markers(logfile) >= 1):
+            raise RuntimeError('No marker notification; see %s' % logfile)
+
+        began = time.time()
+        for i in range(1, rounds + 1):
+            send_round(sockpath, series, i)
+        if not wait_for(lambda: count_markers(logfile) >= rounds + 1):
+            raise RuntimeError('Missing marker notifications; see %s'
+                    % logfile)
+        return time.time() - began
+    finally:
+        stop(proc)
+
+def main():
+    collectd = COLLECTD
+    plugindir = PLUGINDIR
+    typesdb = TYPESDB
+    series = 500000
+    rounds = 5
+    window = 10
+
+    opts, args = getopt.getopt(sys.argv[1:], 'c:p:t:n:r:w:h')
+    for (opt, value) in opts:
+        if opt == '-c':
+            collectd = value
+        elif opt == '-p':
+            plugindir = value
+        elif opt == '-t':
+            typesdb = value
+        elif opt == '-n':
+            series = int(value)
+        elif opt == '-r':
+            rounds = int(value)
+        elif opt == '-w':
+            window = int(value)
+        else:
+            sys.stdout.write(__doc__)
+            return 0
+
+    tmpdir = tempfile.mkdtemp(prefix='threshold-bench-')
+    params = {'dir': tmpdir, 'plugindir': plugindir, 'typesdb': typesdb,
+            'window': window}
+    values = float(series * rounds)
+
+    try:
+        baseline = run(collectd, tmpdir, params, None, series, rounds)
+        sys.stdout.write('%-14s %8.3f s %8.3f us/value\n'
+                % ('(none)', baseline, 1000000.0 * baseline / values))
+        for function in FUNCTIONS:
+            elapsed = run(collectd, tmpdir, params, function, series, rounds)
+            sys.stdout.write('%-14s %8.3f s %8.3f us/value (%+.3f)\n'
+                    % (function, elapsed, 1000000.0 * elapsed / values,
+                        1000000.0 * (elapsed - baseline) / values))
+    finally:
+        shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
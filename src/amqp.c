@@ -31,7 +31,9 @@
 #include "plugin.h"
 #include "utils_cmd_putval.h"
 #include "utils_format_json.h"
+#include "utils_format_network.h"
 #include "utils_format_graphite.h"
+#include "utils_avltree.h"
 
 #include <pthread.h>
 
@@ -46,6 +48,11 @@
 #define CAMQP_FORMAT_COMMAND    1
 #define CAMQP_FORMAT_JSON       2
 #define CAMQP_FORMAT_GRAPHITE   3
+#define CAMQP_FORMAT_BINARY     4
+
+#define CAMQP_GROUP_NONE        0
+#define CAMQP_GROUP_HOST        1
+#define CAMQP_GROUP_PLUGIN      2
 
 #define CAMQP_CHANNEL 1
 
@@ -75,6 +82,11 @@ struct camqp_config_s
     char    *postfix;
     char    escape_char;
     unsigned int graphite_flags;
+    /* publish & batching only */
+    size_t   batch_size;
+    cdtime_t batch_timeout;
+    int      batch_group;
+    c_avl_tree_t *batches;
 
     /* subscribe only */
     char   *exchange_type;
@@ -85,6 +97,24 @@ struct camqp_config_s
 };
 typedef struct camqp_config_s camqp_config_t;
 
+/* A message being assembled from multiple value lists. One batch exists per
+ * routing key, see the "BatchGroupBy" option. */
+struct camqp_batch_s
+{
+    char    *routing_key;
+    /* Used by the "Command", "Graphite" and "Binary" formats. */
+    char    *buffer;
+    size_t   buffer_fill;
+    size_t   buffer_free;
+    /* Used by the "Binary" format: fields already present in the buffer. */
+    value_list_t vl_def;
+    /* Used by the "JSON" format. */
+    format_json_buffer_t *json;
+    size_t   values_num;
+    cdtime_t init_time;
+};
+typedef struct camqp_batch_s camqp_batch_t;
+
 /*
  * Global variables
  */
@@ -103,6 +133,8 @@ static _Bool      subscriber_threads_running = 1;
 /*
  * Functions
  */
+static void camqp_batches_free (camqp_config_t *conf);
+
 static void camqp_close_connection (camqp_config_t *conf) /* {{{ */
 {
     int sockfd;
@@ -125,6 +157,9 @@ static void camqp_config_free (void *ptr) /* {{{ */
     if (conf == NULL)
         return;
 
+    if (conf->batches != NULL)
+        camqp_batches_free (conf);
+
     camqp_close_connection (conf);
 
     sfree (conf->name);
@@ -488,14 +523,21 @@ static int camqp_shutdown (void) /* {{{ */
 static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         size_t body_size, const char *content_type)
 {
-    char body[body_size + 1];
+    char *body;
     char *body_ptr;
     size_t received;
     amqp_frame_t frame;
     int status;
 
-    memset (body, 0, sizeof (body));
-    body_ptr = &body[0];
+    /* Batched messages may be much larger than a single value list, so the
+     * body is not kept on the stack. */
+    body = calloc (1, body_size + 1);
+    if (body == NULL)
+    {
+        ERROR ("amqp plugin: calloc failed.");
+        return (ENOMEM);
+    }
+    body_ptr = body;
     received = 0;
 
     while (received < body_size)
@@ -508,6 +550,7 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
             ERROR ("amqp plugin: amqp_simple_wait_frame failed: %s",
                     sstrerror (status, errbuf, sizeof (errbuf)));
             camqp_close_connection (conf);
+            sfree (body);
             return (status);
         }
 
@@ -515,12 +558,14 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         {
             NOTICE ("amqp plugin: Unexpected frame type: %#"PRIx8,
                     frame.frame_type);
+            sfree (body);
             return (-1);
         }
 
         if ((body_size - received) < frame.payload.body_fragment.len)
         {
             WARNING ("amqp plugin: Body is larger than indicated by header.");
+            sfree (body);
             return (-1);
         }
 
@@ -532,27 +577,39 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
 
     if (strcasecmp ("text/collectd", content_type) == 0)
     {
-        status = handle_putval (stderr, body);
-        if (status != 0)
-            ERROR ("amqp plugin: handle_putval failed with status %i.",
-                    status);
-        return (status);
+        char *line;
+        char *saveptr = NULL;
+
+        /* Batched messages contain one command per line. */
+        status = 0;
+        for (line = strtok_r (body, "\r\n", &saveptr);
+                line != NULL;
+                line = strtok_r (NULL, "\r\n", &saveptr))
+        {
+            status = handle_putval (stderr, line);
+            if (status != 0)
+            {
+                ERROR ("amqp plugin: handle_putval failed with status %i.",
+                        status);
+                break;
+            }
+        }
     }
     else if (strcasecmp ("application/json", content_type) == 0)
     {
         ERROR ("amqp plugin: camqp_read_body: Parsing JSON data has not "
                 "been implemented yet. FIXME!");
-        return (0);
+        status = 0;
     }
     else
     {
         ERROR ("amqp plugin: camqp_read_body: Unknown content type \"%s\".",
                 content_type);
-        return (EINVAL);
+        status = EINVAL;
     }
 
-    /* not reached */
-    return (0);
+    sfree (body);
+    return (status);
 } /* }}} int camqp_read_body */
 
 static int camqp_read_header (camqp_config_t *conf) /* {{{ */
@@ -694,9 +751,10 @@ static int camqp_subscribe_init (camqp_config_t *conf) /* {{{ */
  */
 /* XXX: You must hold "conf->lock" when calling this function! */
 static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
-        const char *buffer, const char *routing_key)
+        const char *buffer, size_t buffer_size, const char *routing_key)
 {
     amqp_basic_properties_t props;
+    amqp_bytes_t body;
     int status;
 
     status = camqp_connect (conf);
@@ -713,11 +771,17 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
         props.content_type = amqp_cstring_bytes("application/json");
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
         props.content_type = amqp_cstring_bytes("text/graphite");
+    else if (conf->format == CAMQP_FORMAT_BINARY)
+        props.content_type = amqp_cstring_bytes(FORMAT_NETWORK_CONTENT_TYPE);
     else
         assert (23 == 42);
     props.delivery_mode = conf->delivery_mode;
     props.app_id = amqp_cstring_bytes("collectd");
 
+    /* The binary format may contain null bytes. */
+    body.len = buffer_size;
+    body.bytes = (void *) buffer;
+
     status = amqp_basic_publish(conf->connection,
                 /* channel = */ 1,
                 amqp_cstring_bytes(CONF(conf, exchange)),
@@ -725,7 +789,7 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
                 /* mandatory = */ 0,
                 /* immediate = */ 0,
                 &props,
-                amqp_cstring_bytes(buffer));
+                body);
     if (status != 0)
     {
         ERROR ("amqp plugin: amqp_basic_publish failed with status %i.",
@@ -736,45 +800,55 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
     return (status);
 } /* }}} int camqp_write_locked */
 
-static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
-        user_data_t *user_data)
+static int camqp_format_routing_key (camqp_config_t *conf, /* {{{ */
+        const value_list_t *vl, char *buffer, size_t buffer_size)
 {
-    camqp_config_t *conf = user_data->data;
-    char routing_key[6 * DATA_MAX_NAME_LEN];
-    char buffer[4096];
-    int status;
-
-    if ((ds == NULL) || (vl == NULL) || (conf == NULL))
-        return (EINVAL);
-
-    memset (buffer, 0, sizeof (buffer));
+    size_t i;
 
     if (conf->routing_key != NULL)
     {
-        sstrncpy (routing_key, conf->routing_key, sizeof (routing_key));
+        sstrncpy (buffer, conf->routing_key, buffer_size);
+        return (0);
     }
+
+    if ((conf->batch_size > 0) && (conf->batch_group == CAMQP_GROUP_NONE))
+        sstrncpy (buffer, "collectd", buffer_size);
+    else if ((conf->batch_size > 0) && (conf->batch_group == CAMQP_GROUP_HOST))
+        ssnprintf (buffer, buffer_size, "collectd/%s", vl->host);
+    else if ((conf->batch_size > 0) && (conf->batch_group == CAMQP_GROUP_PLUGIN))
+        ssnprintf (buffer, buffer_size, "collectd/%s/%s/%s",
+                vl->host, vl->plugin, vl->plugin_instance);
     else
-    {
-        size_t i;
-        ssnprintf (routing_key, sizeof (routing_key), "collectd/%s/%s/%s/%s/%s",
+        ssnprintf (buffer, buffer_size, "collectd/%s/%s/%s/%s/%s",
                 vl->host,
                 vl->plugin, vl->plugin_instance,
                 vl->type, vl->type_instance);
 
-        /* Switch slashes (the only character forbidden by collectd) and dots
-         * (the separation character used by AMQP). */
-        for (i = 0; routing_key[i] != 0; i++)
-        {
-            if (routing_key[i] == '.')
-                routing_key[i] = '/';
-            else if (routing_key[i] == '/')
-                routing_key[i] = '.';
-        }
+    /* Switch slashes (the only character forbidden by collectd) and dots
+     * (the separation character used by AMQP). */
+    for (i = 0; buffer[i] != 0; i++)
+    {
+        if (buffer[i] == '.')
+            buffer[i] = '/';
+        else if (buffer[i] == '/')
+            buffer[i] = '.';
     }
 
+    return (0);
+} /* }}} int camqp_format_routing_key */
+
+/* Formats a single value list as text. Not used for the JSON and binary
+ * formats: JSON needs to be embedded in an array, the binary format depends
+ * on the preceding value lists. */
+static int camqp_format_text (camqp_config_t *conf, /* {{{ */
+        const data_set_t *ds, const value_list_t *vl,
+        char *buffer, size_t buffer_size)
+{
+    int status;
+
     if (conf->format == CAMQP_FORMAT_COMMAND)
     {
-        status = create_putval (buffer, sizeof (buffer), ds, vl);
+        status = create_putval (buffer, buffer_size, ds, vl);
         if (status != 0)
         {
             ERROR ("amqp plugin: create_putval failed with status %i.",
@@ -782,18 +856,9 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
             return (status);
         }
     }
-    else if (conf->format == CAMQP_FORMAT_JSON)
-    {
-        size_t bfree = sizeof (buffer);
-        size_t bfill = 0;
-
-        format_json_initialize (buffer, &bfill, &bfree);
-        format_json_value_list (buffer, &bfill, &bfree, ds, vl, conf->store_rates);
-        format_json_finalize (buffer, &bfill, &bfree);
-    }
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
     {
-        status = format_graphite (buffer, sizeof (buffer), ds, vl,
+        status = format_graphite (buffer, buffer_size, ds, vl,
                     conf->prefix, conf->postfix, conf->escape_char,
                     conf->graphite_flags);
         if (status != 0)
@@ -809,13 +874,382 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         return (-1);
     }
 
+    return (0);
+} /* }}} int camqp_format_text */
+
+/*
+ * Batching code
+ */
+static void camqp_batch_reset (camqp_config_t *conf, /* {{{ */
+        camqp_batch_t *batch)
+{
+    batch->values_num = 0;
+    batch->init_time = 0;
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        format_json_buffer_reset (batch->json);
+        return;
+    }
+
+    batch->buffer[0] = 0;
+    batch->buffer_fill = 0;
+    batch->buffer_free = conf->batch_size;
+    memset (&batch->vl_def, 0, sizeof (batch->vl_def));
+} /* }}} void camqp_batch_reset */
+
+static void camqp_batch_free (camqp_batch_t *batch) /* {{{ */
+{
+    if (batch == NULL)
+        return;
+
+    sfree (batch->routing_key);
+    sfree (batch->buffer);
+    format_json_buffer_destroy (batch->json);
+    sfree (batch);
+} /* }}} void camqp_batch_free */
+
+/* XXX: You must hold "conf->lock" when calling this function! */
+static int camqp_batch_send (camqp_config_t *conf, /* {{{ */
+        camqp_batch_t *batch)
+{
+    const char *buffer = batch->buffer;
+    size_t buffer_size = batch->buffer_fill;
+    int status;
+
+    if (batch->values_num == 0)
+        return (0);
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        status = format_json_buffer_finalize (batch->json);
+        if (status == 0)
+        {
+            buffer = format_json_buffer_string (batch->json);
+            buffer_size = format_json_buffer_length (batch->json);
+        }
+        if ((status != 0) || (buffer == NULL))
+        {
+            ERROR ("amqp plugin: format_json_buffer_finalize failed.");
+            camqp_batch_reset (conf, batch);
+            return (-1);
+        }
+    }
+
+    DEBUG ("amqp plugin: Publishing %zu values with routing key \"%s\".",
+            batch->values_num, batch->routing_key);
+
+    status = camqp_write_locked (conf, buffer, buffer_size,
+            batch->routing_key);
+    camqp_batch_reset (conf, batch);
+
+    return (status);
+} /* }}} int camqp_batch_send */
+
+/* XXX: You must hold "conf->lock" when calling this function! */
+static camqp_batch_t *camqp_batch_get (camqp_config_t *conf, /* {{{ */
+        const char *routing_key)
+{
+    camqp_batch_t *batch = NULL;
+    int status;
+
+    if (c_avl_get (conf->batches, routing_key, (void *) &batch) == 0)
+        return (batch);
+
+    batch = malloc (sizeof (*batch));
+    if (batch == NULL)
+    {
+        ERROR ("amqp plugin: malloc failed.");
+        return (NULL);
+    }
+    memset (batch, 0, sizeof (*batch));
+
+    batch->routing_key = strdup (routing_key);
+    if (conf->format == CAMQP_FORMAT_JSON)
+        batch->json = format_json_buffer_create (conf->batch_size);
+    else
+        batch->buffer = malloc (conf->batch_size);
+    if ((batch->routing_key == NULL)
+            || ((batch->buffer == NULL) && (batch->json == NULL)))
+    {
+        ERROR ("amqp plugin: malloc failed.");
+        camqp_batch_free (batch);
+        return (NULL);
+    }
+    camqp_batch_reset (conf, batch);
+
+    status = c_avl_insert (conf->batches, batch->routing_key, batch);
+    if (status != 0)
+    {
+        ERROR ("amqp plugin: c_avl_insert (%s) failed.", routing_key);
+        camqp_batch_free (batch);
+        return (NULL);
+    }
+
+    return (batch);
+} /* }}} camqp_batch_t *camqp_batch_get */
+
+/* Sends all batches older than "timeout". A timeout of zero sends all
+ * batches. XXX: You must hold "conf->lock" when calling this function! */
+static int camqp_batches_flush (camqp_config_t *conf, /* {{{ */
+        cdtime_t timeout)
+{
+    c_avl_iterator_t *iter;
+    camqp_batch_t *batch;
+    char *key;
+    cdtime_t now;
+    int status = 0;
+
+    if (conf->batches == NULL)
+        return (0);
+
+    now = cdtime ();
+
+    iter = c_avl_get_iterator (conf->batches);
+    while (c_avl_iterator_next (iter, (void *) &key, (void *) &batch) == 0)
+    {
+        if (batch->values_num == 0)
+            continue;
+        if ((timeout > 0) && ((batch->init_time + timeout) > now))
+            continue;
+
+        if (camqp_batch_send (conf, batch) != 0)
+            status = -1;
+    }
+    c_avl_iterator_destroy (iter);
+
+    return (status);
+} /* }}} int camqp_batches_flush */
+
+static void camqp_batches_free (camqp_config_t *conf) /* {{{ */
+{
+    camqp_batch_t *batch;
+    char *key;
+
+    camqp_batches_flush (conf, /* timeout = */ 0);
+
+    while (c_avl_pick (conf->batches, (void *) &key, (void *) &batch) == 0)
+        camqp_batch_free (batch);
+
+    c_avl_destroy (conf->batches);
+    conf->batches = NULL;
+} /* }}} void camqp_batches_free */
+
+/* XXX: You must hold "conf->lock" when calling this function! */
+static int camqp_batch_add (camqp_config_t *conf, /* {{{ */
+        camqp_batch_t *batch, const data_set_t *ds, const value_list_t *vl)
+{
+    int status;
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        status = format_json_buffer_add (batch->json, ds, vl,
+                conf->store_rates);
+        if ((status == (-ENOMEM)) && (batch->values_num > 0))
+        {
+            status = camqp_batch_send (conf, batch);
+            if (status != 0)
+                return (status);
+
+            status = format_json_buffer_add (batch->json, ds, vl,
+                    conf->store_rates);
+        }
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: Value list does not fit into a batch of "
+                    "%zu bytes.", conf->batch_size);
+            return (status);
+        }
+    }
+    else if (conf->format == CAMQP_FORMAT_BINARY)
+    {
+        status = format_network_value_list (batch->buffer + batch->buffer_fill,
+                (int) batch->buffer_free, &batch->vl_def, ds, vl);
+        if ((status < 0) && (batch->values_num > 0))
+        {
+            /* Sending resets "vl_def", too. */
+            status = camqp_batch_send (conf, batch);
+            if (status != 0)
+                return (status);
+
+            status = format_network_value_list (batch->buffer,
+                    (int) batch->buffer_free, &batch->vl_def, ds, vl);
+        }
+        if (status < 0)
+        {
+            ERROR ("amqp plugin: Value list does not fit into a batch of "
+                    "%zu bytes.", conf->batch_size);
+            camqp_batch_reset (conf, batch);
+            return (-ENOMEM);
+        }
+
+        batch->buffer_fill += (size_t) status;
+        batch->buffer_free -= (size_t) status;
+    }
+    else
+    {
+        char buffer[4096];
+        size_t buffer_len;
+
+        status = camqp_format_text (conf, ds, vl, buffer, sizeof (buffer) - 1);
+        if (status != 0)
+            return (status);
+
+        buffer_len = strlen (buffer);
+        if ((buffer_len == 0) || (buffer[buffer_len - 1] != '\n'))
+        {
+            buffer[buffer_len] = '\n';
+            buffer_len++;
+            buffer[buffer_len] = 0;
+        }
+
+        /* Leave room for the terminating null byte. */
+        if (buffer_len >= batch->buffer_free)
+        {
+            status = camqp_batch_send (conf, batch);
+            if (status != 0)
+                return (status);
+        }
+
+        if (buffer_len >= batch->buffer_free)
+        {
+            ERROR ("amqp plugin: Value list does not fit into a batch of "
+                    "%zu bytes.", conf->batch_size);
+            return (-ENOMEM);
+        }
+
+        memcpy (batch->buffer + batch->buffer_fill, buffer, buffer_len + 1);
+        batch->buffer_fill += buffer_len;
+        batch->buffer_free -= buffer_len;
+    }
+
+    /* The timeout starts with the first value of a message. */
+    if (batch->values_num == 0)
+        batch->init_time = cdtime ();
+    batch->values_num++;
+    return (0);
+} /* }}} int camqp_batch_add */
+
+static int camqp_write_batch (camqp_config_t *conf, /* {{{ */
+        const data_set_t *ds, const value_list_t *vl, const char *routing_key)
+{
+    camqp_batch_t *batch;
+    int status;
+
+    pthread_mutex_lock (&conf->lock);
+
+    batch = camqp_batch_get (conf, routing_key);
+    if (batch == NULL)
+    {
+        pthread_mutex_unlock (&conf->lock);
+        return (-1);
+    }
+
+    status = camqp_batch_add (conf, batch, ds, vl);
+
+    if ((status == 0)
+            && (((conf->batch_timeout > 0)
+                    && ((batch->init_time + conf->batch_timeout) <= cdtime ()))))
+        status = camqp_batch_send (conf, batch);
+
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_write_batch */
+
+static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+        user_data_t *user_data)
+{
+    camqp_config_t *conf = user_data->data;
+    char routing_key[6 * DATA_MAX_NAME_LEN];
+    char buffer[4096];
+    size_t buffer_size;
+    int status;
+
+    if ((ds == NULL) || (vl == NULL) || (conf == NULL))
+        return (EINVAL);
+
+    camqp_format_routing_key (conf, vl, routing_key, sizeof (routing_key));
+
+    if (conf->batch_size > 0)
+        return (camqp_write_batch (conf, ds, vl, routing_key));
+
+    memset (buffer, 0, sizeof (buffer));
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        size_t bfree = sizeof (buffer);
+        size_t bfill = 0;
+
+        format_json_initialize (buffer, &bfill, &bfree);
+        format_json_value_list (buffer, &bfill, &bfree, ds, vl, conf->store_rates);
+        format_json_finalize (buffer, &bfill, &bfree);
+        buffer_size = bfill;
+    }
+    else if (conf->format == CAMQP_FORMAT_BINARY)
+    {
+        value_list_t vl_def;
+
+        memset (&vl_def, 0, sizeof (vl_def));
+        status = format_network_value_list (buffer, (int) sizeof (buffer),
+                &vl_def, ds, vl);
+        if (status < 0)
+        {
+            ERROR ("amqp plugin: format_network_value_list failed.");
+            return (-1);
+        }
+        buffer_size = (size_t) status;
+    }
+    else
+    {
+        status = camqp_format_text (conf, ds, vl, buffer, sizeof (buffer));
+        if (status != 0)
+            return (status);
+        buffer_size = strlen (buffer);
+    }
+
     pthread_mutex_lock (&conf->lock);
-    status = camqp_write_locked (conf, buffer, routing_key);
+    status = camqp_write_locked (conf, buffer, buffer_size, routing_key);
     pthread_mutex_unlock (&conf->lock);
 
     return (status);
 } /* }}} int camqp_write */
 
+static int camqp_flush (cdtime_t timeout, /* {{{ */
+        const char __attribute__((unused)) *identifier,
+        user_data_t *user_data)
+{
+    camqp_config_t *conf;
+    int status;
+
+    if (user_data == NULL)
+        return (-EINVAL);
+
+    conf = user_data->data;
+    if (conf->batches == NULL)
+        return (0);
+
+    pthread_mutex_lock (&conf->lock);
+    status = camqp_batches_flush (conf, timeout);
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_flush */
+
+/* Publishes batches which are older than "BatchTimeout", also for routing keys
+ * which don't receive any more values. */
+static int camqp_batches_expire (user_data_t *user_data) /* {{{ */
+{
+    camqp_config_t *conf = user_data->data;
+    int status;
+
+    pthread_mutex_lock (&conf->lock);
+    status = camqp_batches_flush (conf, conf->batch_timeout);
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_batches_expire */
+
 /*
  * Config handling
  */
@@ -837,6 +1271,8 @@ static int camqp_config_set_format (oconfig_item_t *ci, /* {{{ */
         conf->format = CAMQP_FORMAT_JSON;
     else if (strcasecmp ("Graphite", string) == 0)
         conf->format = CAMQP_FORMAT_GRAPHITE;
+    else if (strcasecmp ("Binary", string) == 0)
+        conf->format = CAMQP_FORMAT_BINARY;
     else
     {
         WARNING ("amqp plugin: Invalid format string: %s",
@@ -848,6 +1284,35 @@ static int camqp_config_set_format (oconfig_item_t *ci, /* {{{ */
     return (0);
 } /* }}} int config_set_string */
 
+static int camqp_config_set_batch_group (oconfig_item_t *ci, /* {{{ */
+        camqp_config_t *conf)
+{
+    char *string;
+    int status;
+
+    string = NULL;
+    status = cf_util_get_string (ci, &string);
+    if (status != 0)
+        return (status);
+
+    assert (string != NULL);
+    if (strcasecmp ("None", string) == 0)
+        conf->batch_group = CAMQP_GROUP_NONE;
+    else if (strcasecmp ("Host", string) == 0)
+        conf->batch_group = CAMQP_GROUP_HOST;
+    else if (strcasecmp ("Plugin", string) == 0)
+        conf->batch_group = CAMQP_GROUP_PLUGIN;
+    else
+    {
+        WARNING ("amqp plugin: Invalid value for \"BatchGroupBy\": %s",
+                string);
+    }
+
+    free (string);
+
+    return (0);
+} /* }}} int camqp_config_set_batch_group */
+
 static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
         _Bool publish)
 {
@@ -881,6 +1346,11 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     conf->prefix = NULL;
     conf->postfix = NULL;
     conf->escape_char = '_';
+    /* publish & batching only */
+    conf->batch_size = 0;
+    conf->batch_timeout = 0;
+    conf->batch_group = CAMQP_GROUP_NONE;
+    conf->batches = NULL;
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
@@ -956,6 +1426,22 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             conf->escape_char = tmp_buff[0];
             sfree (tmp_buff);
         }
+        else if ((strcasecmp ("BatchSize", child->key) == 0) && publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 0))
+            {
+                WARNING ("amqp plugin: The option \"BatchSize\" must not "
+                        "be negative.");
+                tmp = 0;
+            }
+            conf->batch_size = (size_t) tmp;
+        }
+        else if ((strcasecmp ("BatchTimeout", child->key) == 0) && publish)
+            status = cf_util_get_cdtime (child, &conf->batch_timeout);
+        else if ((strcasecmp ("BatchGroupBy", child->key) == 0) && publish)
+            status = camqp_config_set_batch_group (child, conf);
         else
             WARNING ("amqp plugin: Ignoring unknown "
                     "configuration option \"%s\".", child->key);
@@ -995,12 +1481,42 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
         ssnprintf (cbname, sizeof (cbname), "amqp/%s", conf->name);
 
+        if (conf->batch_size > 0)
+        {
+            conf->batches = c_avl_create ((void *) strcmp);
+            if (conf->batches == NULL)
+            {
+                ERROR ("amqp plugin: c_avl_create failed.");
+                camqp_config_free (conf);
+                return (-1);
+            }
+        }
+
         status = plugin_register_write (cbname, camqp_write, &ud);
         if (status != 0)
         {
             camqp_config_free (conf);
             return (status);
         }
+
+        if (conf->batch_size > 0)
+        {
+            /* "conf" is freed by the write callback. */
+            user_data_t flush_ud = { conf, NULL };
+            plugin_register_flush (cbname, camqp_flush, &flush_ud);
+        }
+
+        if ((conf->batch_size > 0) && (conf->batch_timeout > 0))
+        {
+            /* Check twice per timeout, so no batch waits much longer than
+             * "BatchTimeout". */
+            user_data_t read_ud = { conf, NULL };
+            struct timespec cb_interval;
+
+            CDTIME_T_TO_TIMESPEC (conf->batch_timeout / 2, &cb_interval);
+            plugin_register_complex_read (/* group = */ NULL, cbname,
+                    camqp_batches_expire, &cb_interval, &read_ud);
+        }
     }
     else
     {
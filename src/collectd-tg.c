@@ -1,6 +1,6 @@
 /**
  * collectd-td - collectd traffic generator
- * Copyright (C) 2010-2012  Florian octo Forster
+ * Copyright (C) 2010-2013  Florian octo Forster
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -43,11 +43,21 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 
 #include "utils_heap.h"
+#include "utils_pcap.h"
 
 #include "libcollectdclient/collectd/client.h"
 #include "libcollectdclient/collectd/network.h"
@@ -57,6 +67,12 @@
 #define DEF_NUM_PLUGINS    20
 #define DEF_NUM_VALUES 100000
 #define DEF_INTERVAL       10.0
+#define DEF_NUM_THREADS     1
+#define DEF_REPLAY_LOOPS    1
+
+/* Partially filled packets are sent after this many seconds, so that low
+ * rates don't hold values back indefinitely. */
+#define MAX_BUFFER_AGE      1.0
 
 static int conf_num_hosts = DEF_NUM_HOSTS;
 static int conf_num_plugins = DEF_NUM_PLUGINS;
@@ -65,14 +81,75 @@ static double conf_interval = DEF_INTERVAL;
 static const char *conf_destination = NET_DEFAULT_V6_ADDR;
 static const char *conf_service = NET_DEFAULT_PORT;
 
+static int conf_num_threads = DEF_NUM_THREADS;
+static double conf_values_rate = 0.0;
+static double conf_packets_rate = 0.0;
+static double conf_duration = 0.0;
+static double conf_churn_rate = 0.0;
+static double conf_host_skew = 0.0;
+static const char *conf_replay_file = NULL;
+static int conf_replay_loops = DEF_REPLAY_LOOPS;
+static lcc_security_level_t conf_security_level = NONE;
+static const char *conf_username = NULL;
+static const char *conf_password = NULL;
+
 static lcc_network_t *net;
 
 static c_heap_t *values_heap = NULL;
 
+/* Cumulative distribution of the hosts if "-z" is used. */
+static double *host_cdf = NULL;
+
+struct replay_packet_s
+{
+  double time;
+  int values_num;
+  size_t size;
+  char *data;
+};
+typedef struct replay_packet_s replay_packet_t;
+
+static replay_packet_t *replay_packets = NULL;
+static size_t replay_packets_num = 0;
+
+/* State of one sender thread in load mode. The counters are only written by
+ * the thread itself; the main thread reads them for the progress output
+ * without locking, which is good enough for that purpose. The summary is
+ * printed after all threads have been joined. */
+struct sender_s
+{
+  pthread_t thread;
+  int index;
+  int fd;
+  unsigned int seed;
+
+  lcc_network_buffer_t *buffer;
+  int buffer_values;
+  double buffer_since;
+
+  lcc_value_list_t **series;
+  size_t series_num;
+  size_t series_next;
+
+  uint64_t values_sent;
+  uint64_t packets_sent;
+  uint64_t bytes_sent;
+  uint64_t series_churned;
+  uint64_t errors;
+
+  volatile _Bool done;
+};
+typedef struct sender_s sender_t;
+
 static struct sigaction sigint_action;
 static struct sigaction sigterm_action;
 
-static _Bool loop = 1;
+static volatile _Bool loop = 1;
+
+/* Set by the first sender thread which can't fit the number of values per
+ * packet requested with "-r" and "-P", so that the warning is printed once. */
+static pthread_mutex_t packet_warning_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Bool packet_warning_printed = 0;
 
 __attribute__((noreturn))
 static void exit_usage (int exit_status) /* {{{ */
@@ -91,13 +168,35 @@ static void exit_usage (int exit_status) /* {{{ */
       "                   (Default: %s)\n"
       "    -D <port>      Destination port of the network packets.\n"
       "                   (Default: %s)\n"
+      "    -z <exponent>  Distribute value lists over the hosts following a\n"
+      "                   Zipf distribution with this exponent. (Default: 0,\n"
+      "                   i.e. uniform)\n"
+      "    -s <level>     Security level: \"none\", \"sign\" or \"encrypt\".\n"
+      "                   (Default: none)\n"
+      "    -u <user>      Username for signed and encrypted packets.\n"
+      "    -k <password>  Password for signed and encrypted packets.\n"
       "    -h             Print usage information (this output).\n"
       "\n"
-      "Copyright (C) 2010-2012  Florian Forster\n"
+      "  Load mode options:\n"
+      "    -t <number>    Number of sender threads. (Default: %i)\n"
+      "    -r <rate>      Target rate in values per second.\n"
+      "                   (Default: number of value lists / interval)\n"
+      "    -P <rate>      Target rate in packets per second.\n"
+      "    -c <rate>      Replace this many value lists per second with new\n"
+      "                   ones. (Default: 0)\n"
+      "    -T <seconds>   Stop after this many seconds. (Default: run until\n"
+      "                   interrupted)\n"
+      "    -R <file>      Replay the UDP payloads of a pcap file instead of\n"
+      "                   generating values.\n"
+      "    -l <number>    Number of times the file is replayed, zero means\n"
+      "                   forever. (Default: %i)\n"
+      "\n"
+      "Copyright (C) 2010-2013  Florian Forster\n"
       "Licensed under the GNU General Public License, version 2 (GPLv2)\n",
       DEF_NUM_VALUES, DEF_NUM_HOSTS, DEF_NUM_PLUGINS,
       DEF_INTERVAL,
-      NET_DEFAULT_V6_ADDR, NET_DEFAULT_PORT);
+      NET_DEFAULT_V6_ADDR, NET_DEFAULT_PORT,
+      DEF_NUM_THREADS, DEF_REPLAY_LOOPS);
   exit (exit_status);
 } /* }}} void exit_usage */
 
@@ -133,6 +232,96 @@ static int get_boundet_random (int min, int max) /* {{{ */
   return (min + ((int) (((double) range) * ((double) random ()) / (((double) RAND_MAX) + 1.0))));
 } /* }}} int get_boundet_random */
 
+static double mono_time (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0));
+} /* }}} double mono_time */
+
+static double wall_time (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0));
+} /* }}} double wall_time */
+
+/* Sleeps until the monotonic clock reaches `target'. The sleep is split into
+ * short steps so that signals are noticed in time. */
+static void wait_until (double target) /* {{{ */
+{
+  while (loop)
+  {
+    struct timespec ts;
+    double delta;
+
+    delta = target - mono_time ();
+    if (delta <= 0.0)
+      return;
+    if (delta > 0.1)
+      delta = 0.1;
+
+    ts.tv_sec = (time_t) delta;
+    ts.tv_nsec = (long) ((delta - ((double) ts.tv_sec)) * 1000000000.0);
+    nanosleep (&ts, /* remaining = */ NULL);
+  }
+} /* }}} void wait_until */
+
+static int host_cdf_create (void) /* {{{ */
+{
+  double sum = 0.0;
+  int i;
+
+  host_cdf = calloc ((size_t) conf_num_hosts, sizeof (*host_cdf));
+  if (host_cdf == NULL)
+  {
+    fprintf (stderr, "calloc failed.\n");
+    return (-1);
+  }
+
+  for (i = 0; i < conf_num_hosts; i++)
+  {
+    sum += 1.0 / pow ((double) (i + 1), conf_host_skew);
+    host_cdf[i] = sum;
+  }
+
+  for (i = 0; i < conf_num_hosts; i++)
+    host_cdf[i] /= sum;
+
+  return (0);
+} /* }}} int host_cdf_create */
+
+/* Picks a host number, either uniformly or, if "-z" was given, following the
+ * Zipf distribution in `host_cdf', so that a few hosts have many value lists
+ * and many hosts have only a few. */
+static int get_host_num (void) /* {{{ */
+{
+  double r;
+  int lo;
+  int hi;
+
+  if (host_cdf == NULL)
+    return (get_boundet_random (0, conf_num_hosts));
+
+  r = ((double) random ()) / (((double) RAND_MAX) + 1.0);
+
+  lo = 0;
+  hi = conf_num_hosts - 1;
+  while (lo < hi)
+  {
+    int mid = lo + ((hi - lo) / 2);
+
+    if (host_cdf[mid] <= r)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return (lo);
+} /* }}} int get_host_num */
+
 static lcc_value_list_t *create_value_list (void) /* {{{ */
 {
   lcc_value_list_t *vl;
@@ -165,7 +354,7 @@ static lcc_value_list_t *create_value_list (void) /* {{{ */
 
   vl->values_len = 1;
 
-  host_num = get_boundet_random (0, conf_num_hosts);
+  host_num = get_host_num ();
 
   vl->interval = conf_interval;
   vl->time = 1.0 + time (NULL)
@@ -217,6 +406,614 @@ static int send_value (lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int send_value */
 
+static int compare_identifier (const void *v0, const void *v1) /* {{{ */
+{
+  const lcc_value_list_t *vl0 = *((const lcc_value_list_t * const *) v0);
+  const lcc_value_list_t *vl1 = *((const lcc_value_list_t * const *) v1);
+  int status;
+
+  status = strcmp (vl0->identifier.host, vl1->identifier.host);
+  if (status == 0)
+    status = strcmp (vl0->identifier.plugin, vl1->identifier.plugin);
+  return (status);
+} /* }}} int compare_identifier */
+
+/*
+ * Load mode
+ */
+static int sender_connect (sender_t *s) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+
+  status = getaddrinfo (conf_destination, conf_service, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    fprintf (stderr, "getaddrinfo (%s, %s) failed: %s\n",
+        conf_destination, conf_service, gai_strerror (status));
+    return (-1);
+  }
+
+  s->fd = -1;
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    int ttl = 42;
+
+    s->fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (s->fd < 0)
+      continue;
+
+    /* Same TTL as used by the classic mode via lcc_server_set_ttl. Failures
+     * are not fatal; unicast destinations don't need this at all. */
+#ifdef IP_MULTICAST_TTL
+    if (ai_ptr->ai_family == AF_INET)
+      setsockopt (s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl));
+#endif
+    if (ai_ptr->ai_family == AF_INET6)
+      setsockopt (s->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+          &ttl, sizeof (ttl));
+
+    if (connect (s->fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+      break;
+
+    close (s->fd);
+    s->fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (s->fd < 0)
+  {
+    fprintf (stderr, "Unable to create a socket for %s:%s.\n",
+        conf_destination, conf_service);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int sender_connect */
+
+static int sender_send (sender_t *s, const void *data, size_t size, /* {{{ */
+    int values_num)
+{
+  if (send (s->fd, data, size, /* flags = */ 0) < 0)
+  {
+    s->errors++;
+    return (-1);
+  }
+
+  s->values_sent += (uint64_t) values_num;
+  s->packets_sent++;
+  s->bytes_sent += (uint64_t) size;
+  return (0);
+} /* }}} int sender_send */
+
+static int sender_flush (sender_t *s) /* {{{ */
+{
+  char buffer[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t buffer_size = sizeof (buffer);
+  int values_num = s->buffer_values;
+
+  if (values_num == 0)
+    return (0);
+
+  lcc_network_buffer_finalize (s->buffer);
+  lcc_network_buffer_get (s->buffer, buffer, &buffer_size);
+  lcc_network_buffer_initialize (s->buffer);
+  s->buffer_values = 0;
+
+  if (buffer_size > sizeof (buffer))
+    buffer_size = sizeof (buffer);
+
+  return (sender_send (s, buffer, buffer_size, values_num));
+} /* }}} int sender_flush */
+
+/* Updates the next value list of this thread and adds it to the packet
+ * buffer. Returns non-zero if the buffer is full; the value list is then
+ * retried with the next call. */
+static int sender_add_value (sender_t *s) /* {{{ */
+{
+  lcc_value_list_t *vl = s->series[s->series_next];
+  int r = rand_r (&s->seed);
+
+  if (vl->values_types[0] == LCC_TYPE_GAUGE)
+    vl->values[0].gauge = 100.0 * ((gauge_t) r) / (((gauge_t) RAND_MAX) + 1.0);
+  else
+    vl->values[0].derive += r % 100;
+  vl->time = wall_time ();
+
+  if (lcc_network_buffer_add_value (s->buffer, vl) != 0)
+    return (-1);
+
+  if (s->buffer_values == 0)
+    s->buffer_since = mono_time ();
+  s->buffer_values++;
+
+  s->series_next = (s->series_next + 1) % s->series_num;
+  return (0);
+} /* }}} int sender_add_value */
+
+/* Replaces value lists with new ones at the rate given with "-c", so that the
+ * receiver sees series appear and disappear. */
+static void sender_churn (sender_t *s, double elapsed, double rate) /* {{{ */
+{
+  while (((double) s->series_churned) < (elapsed * rate))
+  {
+    lcc_value_list_t *vl;
+    size_t i;
+
+    vl = create_value_list ();
+    if (vl == NULL)
+      return;
+
+    i = ((size_t) rand_r (&s->seed)) % s->series_num;
+    vl->time = wall_time ();
+    destroy_value_list (s->series[i]);
+    s->series[i] = vl;
+
+    s->series_churned++;
+  }
+} /* }}} void sender_churn */
+
+static void warn_packet_full (int values_fit, int values_per_packet) /* {{{ */
+{
+  pthread_mutex_lock (&packet_warning_lock);
+  if (!packet_warning_printed)
+  {
+    fprintf (stderr, "Warning: Only %i values fit into a packet, but the "
+        "options \"-r\" and \"-P\" require %i values per packet. Fewer "
+        "values than requested will be sent; lower the value rate or raise "
+        "the packet rate.\n", values_fit, values_per_packet);
+    packet_warning_printed = 1;
+  }
+  pthread_mutex_unlock (&packet_warning_lock);
+} /* }}} void warn_packet_full */
+
+static void *generate_thread (void *arg) /* {{{ */
+{
+  sender_t *s = arg;
+  double values_rate;
+  double packets_rate;
+  double churn_rate;
+  double unit_interval;
+  int values_per_packet = 0;
+  uint64_t units = 0;
+  double start;
+
+  values_rate = conf_values_rate / ((double) conf_num_threads);
+  packets_rate = conf_packets_rate / ((double) conf_num_threads);
+  churn_rate = conf_churn_rate / ((double) conf_num_threads);
+
+  /* If a packet rate is given, whole packets are paced and each one carries
+   * values_rate / packets_rate values, or as many as fit if no value rate has
+   * been set. Otherwise single values are paced and packets are sent when
+   * they are full. */
+  if (packets_rate > 0.0)
+  {
+    unit_interval = 1.0 / packets_rate;
+    if (values_rate > 0.0)
+      values_per_packet = (int) ceil (values_rate / packets_rate);
+  }
+  else
+  {
+    unit_interval = 1.0 / values_rate;
+  }
+
+  start = mono_time ();
+  while (loop)
+  {
+    double now;
+
+    /* The schedule is absolute, so that the time spent sending and the
+     * inaccuracy of nanosleep(2) don't add up. */
+    wait_until (start + (((double) units) * unit_interval));
+    if (!loop)
+      break;
+
+    if (packets_rate > 0.0)
+    {
+      int i;
+
+      for (i = 0; (values_per_packet == 0) || (i < values_per_packet); i++)
+        if (sender_add_value (s) != 0)
+          break;
+      if ((values_per_packet > 0) && (i < values_per_packet))
+        warn_packet_full (i, values_per_packet);
+      sender_flush (s);
+    }
+    else if (sender_add_value (s) != 0)
+    {
+      sender_flush (s);
+      sender_add_value (s);
+    }
+    units++;
+
+    now = mono_time ();
+    if (churn_rate > 0.0)
+      sender_churn (s, now - start, churn_rate);
+
+    if ((s->buffer_values > 0) && ((now - s->buffer_since) >= MAX_BUFFER_AGE))
+      sender_flush (s);
+  }
+
+  sender_flush (s);
+  return (NULL);
+} /* }}} void *generate_thread */
+
+static void *replay_thread (void *arg) /* {{{ */
+{
+  sender_t *s = arg;
+  double packets_rate = conf_packets_rate / ((double) conf_num_threads);
+  uint64_t units = 0;
+  double start;
+  int loop_num;
+
+  start = mono_time ();
+  for (loop_num = 0;
+      loop && ((conf_replay_loops == 0) || (loop_num < conf_replay_loops));
+      loop_num++)
+  {
+    double loop_start = mono_time ();
+    size_t i;
+
+    /* Thread n sends packets n, n + threads, n + 2 * threads, ... */
+    for (i = (size_t) s->index; loop && (i < replay_packets_num);
+        i += (size_t) conf_num_threads)
+    {
+      replay_packet_t *p = replay_packets + i;
+
+      if (packets_rate > 0.0)
+        wait_until (start + (((double) units) / packets_rate));
+      else
+        wait_until (loop_start + (p->time - replay_packets[0].time));
+      if (!loop)
+        break;
+
+      sender_send (s, p->data, p->size, p->values_num);
+      units++;
+    }
+  }
+
+  s->done = 1;
+  return (NULL);
+} /* }}} void *replay_thread */
+
+static uint16_t net_16 (const char *ptr) /* {{{ */
+{
+  const unsigned char *p = (const unsigned char *) ptr;
+  return ((uint16_t) ((p[0] << 8) | p[1]));
+} /* }}} uint16_t net_16 */
+
+/* Counts the "values" parts of a collectd packet. Encrypted packets can't be
+ * looked into and are counted as zero. */
+static int payload_count_values (const char *data, size_t size) /* {{{ */
+{
+  int values_num = 0;
+
+  while (size >= 4)
+  {
+    uint16_t type = net_16 (data);
+    uint16_t length = net_16 (data + 2);
+
+    if ((length < 4) || (length > size))
+      break;
+    if (type == 0x0006) /* TYPE_VALUES */
+      values_num++;
+
+    data += length;
+    size -= length;
+  }
+
+  return (values_num);
+} /* }}} int payload_count_values */
+
+static int replay_read_file (const char *file) /* {{{ */
+{
+  c_pcap_t *pcap;
+  size_t packets_alloc = 0;
+  int status;
+
+  pcap = c_pcap_open_read (file);
+  if (pcap == NULL)
+  {
+    fprintf (stderr, "Opening \"%s\" failed: %s\n", file, strerror (errno));
+    return (-1);
+  }
+
+  while (42)
+  {
+    replay_packet_t *p;
+    const void *payload;
+    size_t payload_size;
+    double time;
+
+    status = c_pcap_read_udp (pcap, &time, &payload, &payload_size);
+    if (status != 0)
+      break;
+
+    if (replay_packets_num >= packets_alloc)
+    {
+      size_t tmp_alloc = (packets_alloc == 0) ? 1024 : (2 * packets_alloc);
+      replay_packet_t *tmp;
+
+      tmp = realloc (replay_packets, tmp_alloc * sizeof (*tmp));
+      if (tmp == NULL)
+      {
+        status = ENOMEM;
+        break;
+      }
+      replay_packets = tmp;
+      packets_alloc = tmp_alloc;
+    }
+
+    p = replay_packets + replay_packets_num;
+    p->data = malloc (payload_size);
+    if (p->data == NULL)
+    {
+      status = ENOMEM;
+      break;
+    }
+    memcpy (p->data, payload, payload_size);
+    p->size = payload_size;
+    p->time = time;
+    p->values_num = payload_count_values (p->data, payload_size);
+    replay_packets_num++;
+  }
+  c_pcap_close (pcap);
+
+  if (status != ENOENT)
+  {
+    fprintf (stderr, "Reading \"%s\" failed: %s\n", file, strerror (status));
+    return (-1);
+  }
+  else if (replay_packets_num == 0)
+  {
+    fprintf (stderr, "\"%s\" does not contain any UDP packets.\n", file);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int replay_read_file */
+
+static void replay_free (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < replay_packets_num; i++)
+    free (replay_packets[i].data);
+  free (replay_packets);
+  replay_packets = NULL;
+  replay_packets_num = 0;
+} /* }}} void replay_free */
+
+static void print_rates (sender_t *senders, double elapsed, /* {{{ */
+    _Bool summary)
+{
+  uint64_t values = 0;
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+  uint64_t churned = 0;
+  uint64_t errors = 0;
+  int i;
+
+  for (i = 0; i < conf_num_threads; i++)
+  {
+    values += senders[i].values_sent;
+    packets += senders[i].packets_sent;
+    bytes += senders[i].bytes_sent;
+    churned += senders[i].series_churned;
+    errors += senders[i].errors;
+  }
+
+  if (elapsed <= 0.0)
+    elapsed = 1.0;
+
+  if (!summary)
+  {
+    printf ("%"PRIu64" values have been sent (%.0f values/s, "
+        "%.0f packets/s).\n", values, ((double) values) / elapsed,
+        ((double) packets) / elapsed);
+    return;
+  }
+
+  printf ("\n"
+      "Summary:\n"
+      "  Duration:   %12.3f s\n"
+      "  Values:     %12"PRIu64"  (%.1f values/s",
+      elapsed, values, ((double) values) / elapsed);
+  if ((conf_replay_file == NULL) && (conf_values_rate > 0.0))
+    printf (", target %.1f", conf_values_rate);
+  printf (")\n"
+      "  Packets:    %12"PRIu64"  (%.1f packets/s",
+      packets, ((double) packets) / elapsed);
+  if (conf_packets_rate > 0.0)
+    printf (", target %.1f", conf_packets_rate);
+  printf (")\n"
+      "  Bytes:      %12"PRIu64"  (%.2f MBit/s)\n",
+      bytes, 8.0 * ((double) bytes) / (elapsed * 1000000.0));
+  if (conf_replay_file == NULL)
+    printf ("  Churned:    %12"PRIu64"  value lists\n", churned);
+  printf ("  Errors:     %12"PRIu64"\n", errors);
+} /* }}} void print_rates */
+
+static int run_load (void) /* {{{ */
+{
+  lcc_value_list_t **series = NULL;
+  sender_t *senders;
+  double start;
+  double last_print;
+  int status = 0;
+  int i;
+
+  if (conf_replay_file != NULL)
+  {
+    if (replay_read_file (conf_replay_file) != 0)
+      return (-1);
+    fprintf (stdout, "Read %zu packets from \"%s\".\n",
+        replay_packets_num, conf_replay_file);
+  }
+  else
+  {
+    if (conf_num_values < conf_num_threads)
+    {
+      fprintf (stderr, "Every thread needs at least one value list.\n");
+      return (-1);
+    }
+
+    if ((conf_values_rate <= 0.0) && (conf_packets_rate <= 0.0))
+      conf_values_rate = ((double) conf_num_values) / conf_interval;
+
+    series = calloc ((size_t) conf_num_values, sizeof (*series));
+    if (series == NULL)
+    {
+      fprintf (stderr, "calloc failed.\n");
+      return (-1);
+    }
+
+    fprintf (stdout, "Creating %i values ... ", conf_num_values);
+    fflush (stdout);
+    for (i = 0; i < conf_num_values; i++)
+    {
+      series[i] = create_value_list ();
+      if (series[i] == NULL)
+      {
+        fprintf (stderr, "create_value_list failed.\n");
+        exit (EXIT_FAILURE);
+      }
+    }
+    /* Real clients send all values of a host together, which lets the
+     * network buffer omit repeated host and plugin names. */
+    qsort (series, (size_t) conf_num_values, sizeof (*series),
+        compare_identifier);
+    fprintf (stdout, "done\n");
+  }
+
+  senders = calloc ((size_t) conf_num_threads, sizeof (*senders));
+  if (senders == NULL)
+  {
+    fprintf (stderr, "calloc failed.\n");
+    free (series);
+    replay_free ();
+    return (-1);
+  }
+
+  for (i = 0; i < conf_num_threads; i++)
+  {
+    sender_t *s = senders + i;
+
+    s->index = i;
+    s->seed = (unsigned int) random ();
+    if (sender_connect (s) != 0)
+      exit (EXIT_FAILURE);
+
+    if (series != NULL)
+    {
+      size_t first = ((size_t) i) * ((size_t) conf_num_values)
+        / ((size_t) conf_num_threads);
+      size_t last = ((size_t) (i + 1)) * ((size_t) conf_num_values)
+        / ((size_t) conf_num_threads);
+
+      s->series = series + first;
+      s->series_num = last - first;
+
+      s->buffer = lcc_network_buffer_create (/* size = */ 0);
+      if (s->buffer == NULL)
+      {
+        fprintf (stderr, "lcc_network_buffer_create failed.\n");
+        exit (EXIT_FAILURE);
+      }
+
+      if ((conf_security_level != NONE)
+          && (lcc_network_buffer_set_security_level (s->buffer,
+              conf_security_level, conf_username, conf_password) != 0))
+      {
+        fprintf (stderr, "Setting the security level failed. Was "
+            "libcollectdclient built with libgcrypt?\n");
+        exit (EXIT_FAILURE);
+      }
+    }
+  }
+
+  start = mono_time ();
+  for (i = 0; i < conf_num_threads; i++)
+  {
+    status = pthread_create (&senders[i].thread, /* attr = */ NULL,
+        (conf_replay_file != NULL) ? replay_thread : generate_thread,
+        senders + i);
+    if (status != 0)
+    {
+      fprintf (stderr, "pthread_create failed: %s\n", strerror (status));
+      loop = 0;
+      conf_num_threads = i;
+      break;
+    }
+  }
+
+  last_print = start;
+  while (loop)
+  {
+    struct timespec ts = { 0, 10000000 };
+    double now;
+
+    nanosleep (&ts, /* remaining = */ NULL);
+    now = mono_time ();
+
+    if ((conf_duration > 0.0) && ((now - start) >= conf_duration))
+      loop = 0;
+
+    if ((now - last_print) >= 1.0)
+    {
+      print_rates (senders, now - start, /* summary = */ 0);
+      last_print = now;
+    }
+
+    /* In replay mode, the threads return when the file has been sent. */
+    if (conf_replay_file != NULL)
+    {
+      int running = 0;
+
+      for (i = 0; i < conf_num_threads; i++)
+        if (!senders[i].done)
+          running++;
+      if (running == 0)
+        break;
+    }
+  }
+  loop = 0;
+
+  fprintf (stdout, "Shutting down.\n");
+  fflush (stdout);
+
+  for (i = 0; i < conf_num_threads; i++)
+    pthread_join (senders[i].thread, /* retval = */ NULL);
+
+  print_rates (senders, mono_time () - start, /* summary = */ 1);
+
+  for (i = 0; i < conf_num_threads; i++)
+  {
+    if (senders[i].buffer != NULL)
+      lcc_network_buffer_destroy (senders[i].buffer);
+    if (senders[i].fd >= 0)
+      close (senders[i].fd);
+  }
+  free (senders);
+
+  if (series != NULL)
+  {
+    for (i = 0; i < conf_num_values; i++)
+      destroy_value_list (series[i]);
+    free (series);
+  }
+  replay_free ();
+
+  return (status);
+} /* }}} int run_load */
+
 static int get_integer_opt (const char *str, int *ret_value) /* {{{ */
 {
   char *endptr;
@@ -279,7 +1076,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 {
   int opt;
 
-  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:h")) != -1)
+  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:z:s:u:k:t:r:P:c:T:R:l:h")) != -1)
   {
     switch (opt)
     {
@@ -307,6 +1104,60 @@ static int read_options (int argc, char **argv) /* {{{ */
         conf_service = optarg;
         break;
 
+      case 'z':
+        get_double_opt (optarg, &conf_host_skew);
+        break;
+
+      case 's':
+        if (strcasecmp ("none", optarg) == 0)
+          conf_security_level = NONE;
+        else if (strcasecmp ("sign", optarg) == 0)
+          conf_security_level = SIGN;
+        else if (strcasecmp ("encrypt", optarg) == 0)
+          conf_security_level = ENCRYPT;
+        else
+        {
+          fprintf (stderr, "Invalid security level: %s\n", optarg);
+          exit_usage (EXIT_FAILURE);
+        }
+        break;
+
+      case 'u':
+        conf_username = optarg;
+        break;
+
+      case 'k':
+        conf_password = optarg;
+        break;
+
+      case 't':
+        get_integer_opt (optarg, &conf_num_threads);
+        break;
+
+      case 'r':
+        get_double_opt (optarg, &conf_values_rate);
+        break;
+
+      case 'P':
+        get_double_opt (optarg, &conf_packets_rate);
+        break;
+
+      case 'c':
+        get_double_opt (optarg, &conf_churn_rate);
+        break;
+
+      case 'T':
+        get_double_opt (optarg, &conf_duration);
+        break;
+
+      case 'R':
+        conf_replay_file = optarg;
+        break;
+
+      case 'l':
+        get_integer_opt (optarg, &conf_replay_loops);
+        break;
+
       case 'h':
         exit_usage (EXIT_SUCCESS);
 
@@ -315,12 +1166,32 @@ static int read_options (int argc, char **argv) /* {{{ */
     } /* switch (opt) */
   } /* while (getopt) */
 
+  if ((conf_num_values < 1) || (conf_num_hosts < 1) || (conf_num_plugins < 1)
+      || (conf_num_threads < 1) || (conf_interval <= 0.0)
+      || (conf_values_rate < 0.0) || (conf_packets_rate < 0.0)
+      || (conf_churn_rate < 0.0) || (conf_host_skew < 0.0)
+      || (conf_duration < 0.0) || (conf_replay_loops < 0))
+  {
+    fprintf (stderr, "Numeric options must not be negative and counts "
+        "must be positive.\n");
+    exit_usage (EXIT_FAILURE);
+  }
+
+  if ((conf_security_level != NONE)
+      && ((conf_username == NULL) || (conf_password == NULL)))
+  {
+    fprintf (stderr, "Signing and encrypting packets requires a username "
+        "and a password.\n");
+    exit_usage (EXIT_FAILURE);
+  }
+
   return (0);
 } /* }}} int read_options */
 
 int main (int argc, char **argv) /* {{{ */
 {
   int i;
+  time_t start_time;
   time_t last_time;
   int values_sent = 0;
 
@@ -332,6 +1203,20 @@ int main (int argc, char **argv) /* {{{ */
   sigterm_action.sa_handler = signal_handler;
   sigaction (SIGTERM, &sigterm_action, /* old = */ NULL);
 
+  if ((conf_host_skew > 0.0) && (host_cdf_create () != 0))
+    exit (EXIT_FAILURE);
+
+  /* Any of the load mode options switches from the classic, interval based
+   * schedule to rate controlled sender threads. */
+  if ((conf_num_threads > 1) || (conf_values_rate > 0.0)
+      || (conf_packets_rate > 0.0) || (conf_churn_rate > 0.0)
+      || (conf_replay_file != NULL))
+  {
+    int status = run_load ();
+
+    free (host_cdf);
+    exit ((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
 
   values_heap = c_heap_create (compare_time);
   if (values_heap == NULL)
@@ -358,10 +1243,15 @@ int main (int argc, char **argv) /* {{{ */
     }
 
     lcc_server_set_ttl (srv, 42);
-#if 0
-    lcc_server_set_security_level (srv, ENCRYPT,
-        "admin", "password1");
-#endif
+
+    if ((conf_security_level != NONE)
+        && (lcc_server_set_security_level (srv, conf_security_level,
+            conf_username, conf_password) != 0))
+    {
+      fprintf (stderr, "Setting the security level failed. Was "
+          "libcollectdclient built with libgcrypt?\n");
+      exit (EXIT_FAILURE);
+    }
   }
 
   fprintf (stdout, "Creating %i values ... ", conf_num_values);
@@ -381,6 +1271,7 @@ int main (int argc, char **argv) /* {{{ */
   }
   fprintf (stdout, "done\n");
 
+  start_time = time (NULL);
   last_time = 0;
   while (loop)
   {
@@ -389,6 +1280,10 @@ int main (int argc, char **argv) /* {{{ */
     if (vl == NULL)
       break;
 
+    if ((conf_duration > 0.0)
+        && (((double) (time (NULL) - start_time)) >= conf_duration))
+      break;
+
     if (vl->time != last_time)
     {
       printf ("%i values have been sent.\n", values_sent);
@@ -428,6 +1323,7 @@ int main (int argc, char **argv) /* {{{ */
   c_heap_destroy (values_heap);
 
   lcc_network_destroy (net);
+  free (host_cdf);
   exit (EXIT_SUCCESS);
   return (0);
 } /* }}} int main */
@@ -86,7 +86,7 @@ static void exit_usage (const char *name, int status) {
 
       " * getval <identifier>\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
-      " * listval\n"
+      " * listval [prefix=<prefix>] [pattern=<pattern>]\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
 
       "\nIdentifiers:\n\n"
@@ -348,14 +348,36 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
   lcc_identifier_t *ret_ident     = NULL;
   size_t            ret_ident_num = 0;
 
+  char *prefix  = NULL;
+  char *pattern = NULL;
+
   int status;
-  size_t i;
+  int i;
 
   assert (strcasecmp (argv[0], "listval") == 0);
 
-  if (argc != 1) {
-    fprintf (stderr, "ERROR: listval: Does not accept any arguments.\n");
-    return (-1);
+  for (i = 1; i < argc; ++i) {
+    char *key, *value;
+
+    key   = argv[i];
+    value = strchr (argv[i], (int)'=');
+
+    if (! value) {
+      fprintf (stderr, "ERROR: listval: Invalid option ``%s''.\n", argv[i]);
+      return (-1);
+    }
+
+    *value = '\0';
+    ++value;
+
+    if (strcasecmp (key, "prefix") == 0)
+      prefix = value;
+    else if (strcasecmp (key, "pattern") == 0)
+      pattern = value;
+    else {
+      fprintf (stderr, "ERROR: listval: Unknown option `%s'.\n", key);
+      return (-1);
+    }
   }
 
 #define BAIL_OUT(s) \
@@ -366,13 +388,14 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
     return (s); \
   } while (0)
 
-  status = lcc_listval (c, &ret_ident, &ret_ident_num);
+  status = lcc_listval_filter (c, prefix, pattern,
+      &ret_ident, &ret_ident_num);
   if (status != 0) {
     fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
     BAIL_OUT (status);
   }
 
-  for (i = 0; i < ret_ident_num; ++i) {
+  for (i = 0; (size_t) i < ret_ident_num; ++i) {
     char id[1024];
 
     status = lcc_identifier_to_string (c, id, sizeof (id), ret_ident + i);
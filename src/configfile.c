@@ -111,7 +111,9 @@ static cf_global_option_t cf_global_options[] =
 	{"WriteThreads", NULL, "5"},
 	{"Timeout",     NULL, "2"},
 	{"PreCacheChain",  NULL, "PreCache"},
-	{"PostCacheChain", NULL, "PostCache"}
+	{"PostCacheChain", NULL, "PostCache"},
+	{"CacheFile",      NULL, NULL},
+	{"CacheCheckpointInterval", NULL, "0"}
 };
 static int cf_global_options_num = STATIC_ARRAY_SIZE (cf_global_options);
 
@@ -26,6 +26,32 @@
 #include "common.h"
 #include "utils_cache.h"
 #include "utils_parse_option.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
+
+/*
+ * Private data types
+ */
+/* An open CSV file. Entries are kept in `cache', keyed by the file name
+ * without the date suffix, and in a doubly linked list ordered by last use so
+ * that the least recently used file can be closed when `max_open_files' is
+ * exceeded. */
+struct csv_file_s;
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s
+{
+	char    *key;
+	char    *filename;
+	int      fd;
+
+	char    *buffer;
+	size_t   buffer_fill;
+	cdtime_t first_value;
+
+	csv_file_t *lru_prev;
+	csv_file_t *lru_next;
+};
 
 /*
  * Private variables
@@ -33,7 +59,10 @@
 static const char *config_keys[] =
 {
 	"DataDir",
-	"StoreRates"
+	"StoreRates",
+	"MaxOpenFiles",
+	"BufferSize",
+	"FlushTimeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -41,6 +70,22 @@ static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
 
+static int      max_open_files = 128;
+static size_t   buffer_size    = 0;
+static cdtime_t flush_timeout  = 0;
+
+static c_avl_tree_t   *cache = NULL;
+static csv_file_t     *lru_head = NULL;
+static csv_file_t     *lru_tail = NULL;
+static cdtime_t        cache_flush_last = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The date suffix only changes at midnight, so `localtime_r' and `strftime'
+ * are only called when `date_suffix_until' has been reached. Protected by
+ * `cache_lock'. */
+static char   date_suffix[16] = "";
+static time_t date_suffix_until = 0;
+
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
 {
@@ -164,54 +209,339 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 		return (-1);
 	offset += status;
 
-	if (!use_stdio)
+	return (0);
+} /* int value_list_to_filename */
+
+/* Returns the "-YYYY-MM-DD" suffix appended to all file names.
+ * You must hold "cache_lock" when calling this function! */
+static const char *csv_date_suffix (void)
+{
+	time_t now;
+	struct tm stm;
+
+	now = time (NULL);
+	if (now < date_suffix_until)
+		return (date_suffix);
+
+	if (localtime_r (&now, &stm) == NULL)
 	{
-		time_t now;
-		struct tm stm;
+		ERROR ("csv plugin: localtime_r failed");
+		return (NULL);
+	}
 
-		/* TODO: Find a way to minimize the calls to `localtime_r',
-		 * since they are pretty expensive.. */
-		now = time (NULL);
-		if (localtime_r (&now, &stm) == NULL)
-		{
-			ERROR ("csv plugin: localtime_r failed");
-			return (1);
-		}
+	strftime (date_suffix, sizeof (date_suffix), "-%Y-%m-%d", &stm);
+
+	/* Next local midnight. Let mktime(3) figure out DST changes. */
+	stm.tm_mday++;
+	stm.tm_hour = 0;
+	stm.tm_min = 0;
+	stm.tm_sec = 0;
+	stm.tm_isdst = -1;
+	date_suffix_until = mktime (&stm);
+	if (date_suffix_until == ((time_t) -1))
+		date_suffix_until = now + 1;
+
+	return (date_suffix);
+} /* const char *csv_date_suffix */
+
+static int csv_write_locked (csv_file_t *cf, const char *data, size_t data_len)
+{
+	struct flock fl;
+	int status;
+
+	memset (&fl, '\0', sizeof (fl));
+	fl.l_start  = 0;
+	fl.l_len    = 0; /* till end of file */
+	fl.l_pid    = getpid ();
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
 
-		strftime (buffer + offset, buffer_len - offset,
-				"-%Y-%m-%d", &stm);
+	status = fcntl (cf->fd, F_SETLK, &fl);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: flock (%s) failed: %s", cf->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
-	return (0);
-} /* int value_list_to_filename */
+	status = swrite (cf->fd, data, data_len);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: write (%s) failed: %s", cf->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+
+	fl.l_type = F_UNLCK;
+	fcntl (cf->fd, F_SETLK, &fl);
 
-static int csv_create_file (const char *filename, const data_set_t *ds)
+	return (status);
+} /* int csv_write_locked */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static int csv_file_flush (csv_file_t *cf)
 {
-	FILE *csv;
-	int i;
+	int status;
+
+	if ((cf->fd < 0) || (cf->buffer_fill == 0))
+		return (0);
+
+	status = csv_write_locked (cf, cf->buffer, cf->buffer_fill);
+
+	/* On error the buffered lines are dropped rather than retried forever. */
+	cf->buffer_fill = 0;
+	cf->first_value = 0;
+
+	return (status);
+} /* int csv_file_flush */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void csv_file_close (csv_file_t *cf)
+{
+	if (cf->fd < 0)
+		return;
 
-	if (check_create_dir (filename))
+	csv_file_flush (cf);
+	close (cf->fd);
+	cf->fd = -1;
+} /* void csv_file_close */
+
+/* Opens `cf->filename' for appending and writes the header line if the file
+ * is new. You must hold "cache_lock" when calling this function! */
+static int csv_file_open (csv_file_t *cf, const data_set_t *ds)
+{
+	struct stat statbuf;
+	int fd;
+
+	if (check_create_dir (cf->filename))
 		return (-1);
 
-	csv = fopen (filename, "w");
-	if (csv == NULL)
+	fd = open (cf->filename, O_WRONLY | O_APPEND | O_CREAT,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd < 0)
 	{
 		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s",
-				filename,
+		ERROR ("csv plugin: open (%s) failed: %s", cf->filename,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	fprintf (csv, "epoch");
-	for (i = 0; i < ds->ds_num; i++)
-		fprintf (csv, ",%s", ds->ds[i].name);
+	if (fstat (fd, &statbuf) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("stat(%s) failed: %s", cf->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
+	else if (!S_ISREG (statbuf.st_mode))
+	{
+		ERROR ("stat(%s): Not a regular file!", cf->filename);
+		close (fd);
+		return (-1);
+	}
+
+	cf->fd = fd;
+
+	if (statbuf.st_size == 0)
+	{
+		char header[4096];
+		int offset;
+		int status;
+		int i;
+
+		offset = ssnprintf (header, sizeof (header), "epoch");
+		for (i = 0; i < ds->ds_num; i++)
+		{
+			status = ssnprintf (header + offset, sizeof (header) - offset,
+					",%s", ds->ds[i].name);
+			if ((status < 1) || ((size_t) status >= (sizeof (header) - offset - 1)))
+			{
+				csv_file_close (cf);
+				return (-1);
+			}
+			offset += status;
+		}
+		header[offset++] = '\n';
+
+		if (csv_write_locked (cf, header, (size_t) offset) != 0)
+		{
+			csv_file_close (cf);
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* int csv_file_open */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void csv_lru_unlink (csv_file_t *cf)
+{
+	if (cf->lru_prev != NULL)
+		cf->lru_prev->lru_next = cf->lru_next;
+	else
+		lru_head = cf->lru_next;
+
+	if (cf->lru_next != NULL)
+		cf->lru_next->lru_prev = cf->lru_prev;
+	else
+		lru_tail = cf->lru_prev;
+
+	cf->lru_prev = NULL;
+	cf->lru_next = NULL;
+} /* void csv_lru_unlink */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void csv_lru_push (csv_file_t *cf)
+{
+	cf->lru_prev = NULL;
+	cf->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = cf;
+	lru_head = cf;
+	if (lru_tail == NULL)
+		lru_tail = cf;
+} /* void csv_lru_push */
+
+static void csv_file_free (csv_file_t *cf)
+{
+	if (cf == NULL)
+		return;
+
+	csv_file_close (cf);
+	sfree (cf->key);
+	sfree (cf->filename);
+	sfree (cf->buffer);
+	sfree (cf);
+} /* void csv_file_free */
+
+/* Closes least recently used files until at most `max_open_files' remain.
+ * You must hold "cache_lock" when calling this function! */
+static void csv_cache_evict (void)
+{
+	while (c_avl_size (cache) > max_open_files)
+	{
+		csv_file_t *cf = lru_tail;
+
+		if (cf == NULL)
+			break;
+
+		csv_lru_unlink (cf);
+		c_avl_remove (cache, cf->key, NULL, NULL);
+		DEBUG ("csv plugin: Closing least recently used file %s.",
+				cf->filename);
+		csv_file_free (cf);
+	}
+} /* void csv_cache_evict */
 
-	fprintf (csv, "\n");
-	fclose (csv);
+/* Returns the cache entry for `key', (re)opening the file if the date suffix
+ * has changed. You must hold "cache_lock" when calling this function! */
+static csv_file_t *csv_cache_get (const char *key, const char *filename,
+		const data_set_t *ds)
+{
+	csv_file_t *cf = NULL;
 
-	return 0;
-} /* int csv_create_file */
+	if (c_avl_get (cache, key, (void *) &cf) == 0)
+	{
+		if (strcmp (cf->filename, filename) != 0)
+		{
+			char *tmp;
+
+			/* Date rotation: flush the remaining lines to the old file. */
+			csv_file_close (cf);
+
+			tmp = strdup (filename);
+			if (tmp == NULL)
+				return (NULL);
+			sfree (cf->filename);
+			cf->filename = tmp;
+		}
+
+		csv_lru_unlink (cf);
+		csv_lru_push (cf);
+	}
+	else
+	{
+		cf = malloc (sizeof (*cf));
+		if (cf == NULL)
+		{
+			ERROR ("csv plugin: malloc failed.");
+			return (NULL);
+		}
+		memset (cf, 0, sizeof (*cf));
+		cf->fd = -1;
+
+		cf->key = strdup (key);
+		cf->filename = strdup (filename);
+		if (buffer_size > 0)
+			cf->buffer = malloc (buffer_size);
+		if ((cf->key == NULL) || (cf->filename == NULL)
+				|| ((buffer_size > 0) && (cf->buffer == NULL)))
+		{
+			ERROR ("csv plugin: malloc failed.");
+			csv_file_free (cf);
+			return (NULL);
+		}
+
+		if (c_avl_insert (cache, cf->key, cf) != 0)
+		{
+			ERROR ("csv plugin: c_avl_insert (%s) failed.", key);
+			csv_file_free (cf);
+			return (NULL);
+		}
+		csv_lru_push (cf);
+
+		csv_cache_evict ();
+	}
+
+	if ((cf->fd < 0) && (csv_file_open (cf, ds) != 0))
+		return (NULL);
+
+	return (cf);
+} /* csv_file_t *csv_cache_get */
+
+/* Flushes all buffers holding lines older than `timeout'. A timeout of zero
+ * flushes everything. You must hold "cache_lock" when calling this function! */
+static void csv_cache_flush (cdtime_t timeout)
+{
+	csv_file_t *cf;
+	cdtime_t now;
+
+	now = cdtime ();
+
+	for (cf = lru_head; cf != NULL; cf = cf->lru_next)
+	{
+		if (cf->buffer_fill == 0)
+			continue;
+		if ((timeout != 0) && ((now - cf->first_value) < timeout))
+			continue;
+		csv_file_flush (cf);
+	}
+
+	cache_flush_last = now;
+} /* void csv_cache_flush */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static int csv_append (csv_file_t *cf, const char *line, size_t line_len)
+{
+	if (line_len > buffer_size)
+	{
+		csv_file_flush (cf);
+		return (csv_write_locked (cf, line, line_len));
+	}
+
+	if ((cf->buffer_fill + line_len) > buffer_size)
+		csv_file_flush (cf);
+
+	if (cf->buffer_fill == 0)
+		cf->first_value = cdtime ();
+
+	memcpy (cf->buffer + cf->buffer_fill, line, line_len);
+	cf->buffer_fill += line_len;
+
+	return (0);
+} /* int csv_append */
 
 static int csv_config (const char *key, const char *value)
 {
@@ -252,6 +582,37 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if (strcasecmp ("MaxOpenFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			WARNING ("csv plugin: MaxOpenFiles must be at least 1. "
+					"Using 1 instead of %i.", tmp);
+			tmp = 1;
+		}
+		max_open_files = tmp;
+	}
+	else if (strcasecmp ("BufferSize", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			WARNING ("csv plugin: BufferSize must not be negative.");
+			tmp = 0;
+		}
+		buffer_size = (size_t) tmp;
+	}
+	else if (strcasecmp ("FlushTimeout", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			WARNING ("csv plugin: FlushTimeout must not be negative.");
+			tmp = 0.0;
+		}
+		flush_timeout = DOUBLE_TO_CDTIME_T (tmp);
+	}
 	else
 	{
 		return (-1);
@@ -262,12 +623,12 @@ static int csv_config (const char *key, const char *value)
 static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
+	char         key[512];
 	char         filename[512];
 	char         values[4096];
-	FILE        *csv;
-	int          csv_fd;
-	struct flock fl;
+	const char  *suffix;
+	csv_file_t  *cf;
+	size_t       values_len;
 	int          status;
 
 	if (0 != strcmp (ds->type, vl->type)) {
@@ -275,19 +636,17 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		return -1;
 	}
 
-	if (value_list_to_filename (filename, sizeof (filename), ds, vl) != 0)
+	if (value_list_to_filename (key, sizeof (key), ds, vl) != 0)
 		return (-1);
 
-	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
-
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
+	if (value_list_to_string (values, sizeof (values) - 1, ds, vl) != 0)
 		return (-1);
 
 	if (use_stdio)
 	{
 		size_t i;
 
-		escape_string (filename, sizeof (filename));
+		escape_string (key, sizeof (key));
 
 		/* Replace commas by colons for PUTVAL compatible output. */
 		for (i = 0; i < sizeof (values); i++)
@@ -300,74 +659,162 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 
 		fprintf (use_stdio == 1 ? stdout : stderr,
 			 "PUTVAL %s interval=%.3f %s\n",
-			 filename,
+			 key,
 			 CDTIME_T_TO_DOUBLE (vl->interval),
 			 values);
 		return (0);
 	}
 
-	if (stat (filename, &statbuf) == -1)
+	values_len = strlen (values);
+	values[values_len++] = '\n';
+
+	pthread_mutex_lock (&cache_lock);
+
+	if (cache == NULL)
 	{
-		if (errno == ENOENT)
-		{
-			if (csv_create_file (filename, ds))
-				return (-1);
-		}
-		else
-		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			return (-1);
-		}
+		pthread_mutex_unlock (&cache_lock);
+		return (-1);
 	}
-	else if (!S_ISREG (statbuf.st_mode))
+
+	suffix = csv_date_suffix ();
+	if (suffix == NULL)
 	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
+		pthread_mutex_unlock (&cache_lock);
 		return (-1);
 	}
 
-	csv = fopen (filename, "a");
-	if (csv == NULL)
+	status = ssnprintf (filename, sizeof (filename), "%s%s", key, suffix);
+	if ((status < 1) || ((size_t) status >= sizeof (filename)))
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		pthread_mutex_unlock (&cache_lock);
 		return (-1);
 	}
-	csv_fd = fileno (csv);
 
-	memset (&fl, '\0', sizeof (fl));
-	fl.l_start  = 0;
-	fl.l_len    = 0; /* till end of file */
-	fl.l_pid    = getpid ();
-	fl.l_type   = F_WRLCK;
-	fl.l_whence = SEEK_SET;
+	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
 
-	status = fcntl (csv_fd, F_SETLK, &fl);
-	if (status != 0)
+	cf = csv_cache_get (key, filename, ds);
+	if (cf == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: flock (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (csv);
+		pthread_mutex_unlock (&cache_lock);
 		return (-1);
 	}
 
-	fprintf (csv, "%s\n", values);
+	status = csv_append (cf, values, values_len);
 
-	/* The lock is implicitely released. I we don't release it explicitely
-	 * because the `FILE *' may need to flush a cache first */
-	fclose (csv);
+	if ((flush_timeout > 0)
+			&& ((cdtime () - cache_flush_last) >= flush_timeout))
+		csv_cache_flush (flush_timeout);
 
-	return (0);
+	pthread_mutex_unlock (&cache_lock);
+
+	return (status);
 } /* int csv_write */
 
+static int csv_flush (cdtime_t timeout, const char *identifier,
+		__attribute__((unused)) user_data_t *user_data)
+{
+	char key[512];
+	csv_file_t *cf;
+
+	pthread_mutex_lock (&cache_lock);
+
+	if (cache == NULL)
+	{
+		pthread_mutex_unlock (&cache_lock);
+		return (0);
+	}
+
+	if (identifier == NULL)
+	{
+		csv_cache_flush (timeout);
+		pthread_mutex_unlock (&cache_lock);
+		return (0);
+	}
+
+	if (datadir == NULL)
+		sstrncpy (key, identifier, sizeof (key));
+	else
+		ssnprintf (key, sizeof (key), "%s/%s", datadir, identifier);
+
+	if (c_avl_get (cache, key, (void *) &cf) == 0)
+	{
+		if ((timeout == 0) || (cf->buffer_fill == 0)
+				|| ((cdtime () - cf->first_value) >= timeout))
+			csv_file_flush (cf);
+	}
+
+	pthread_mutex_unlock (&cache_lock);
+	return (0);
+} /* int csv_flush */
+
+/* Writes buffers holding lines older than `FlushTimeout', so that lines are
+ * written on time even when no more values arrive. */
+static int csv_read (__attribute__((unused)) user_data_t *user_data)
+{
+	pthread_mutex_lock (&cache_lock);
+	if (cache != NULL)
+		csv_cache_flush (flush_timeout);
+	pthread_mutex_unlock (&cache_lock);
+
+	return (0);
+} /* int csv_read */
+
+static int csv_init (void)
+{
+	pthread_mutex_lock (&cache_lock);
+	if (cache == NULL)
+		cache = c_avl_create ((void *) strcmp);
+	pthread_mutex_unlock (&cache_lock);
+
+	if (cache == NULL)
+	{
+		ERROR ("csv plugin: c_avl_create failed.");
+		return (-1);
+	}
+
+	if ((buffer_size > 0) && (flush_timeout > 0))
+	{
+		struct timespec cb_interval;
+
+		/* Check twice per timeout, so no line waits much longer than
+		 * `FlushTimeout'. */
+		CDTIME_T_TO_TIMESPEC (flush_timeout / 2, &cb_interval);
+		plugin_register_complex_read (/* group = */ NULL, "csv", csv_read,
+				&cb_interval, /* user data = */ NULL);
+	}
+
+	return (0);
+} /* int csv_init */
+
+static int csv_shutdown (void)
+{
+	csv_file_t *cf;
+
+	pthread_mutex_lock (&cache_lock);
+
+	while ((cf = lru_head) != NULL)
+	{
+		csv_lru_unlink (cf);
+		csv_file_free (cf);
+	}
+
+	if (cache != NULL)
+	{
+		c_avl_destroy (cache);
+		cache = NULL;
+	}
+
+	pthread_mutex_unlock (&cache_lock);
+
+	return (0);
+} /* int csv_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("csv", csv_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
@@ -35,16 +35,75 @@
 #include <pcap.h>
 #include <pcap-bpf.h>
 
+#if KERNEL_LINUX && HAVE_LINUX_IF_PACKET_H
+# include <sys/mman.h>
+# include <netinet/in.h>
+# include <net/if.h>
+# include <net/if_arp.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
+#endif
+
+/* The memory-mapped packet ring needs TPACKET_V3 and fanout groups, i.e.
+ * Linux 3.2 or later. */
+#if KERNEL_LINUX && HAVE_LINUX_IF_PACKET_H \
+	&& defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT)
+# define DNS_HAVE_PACKET_RING 1
+#else
+# define DNS_HAVE_PACKET_RING 0
+#endif
+
 /*
  * Private data types
  */
-struct counter_list_s
+/* Counters of one capture thread. Only that thread writes to them, the read
+ * callback reads the counters of all threads atomically and adds them up. */
+struct dns_counters_s
 {
-	unsigned int key;
-	unsigned int value;
-	struct counter_list_s *next;
+	derive_t queries;   /* octets */
+	derive_t responses; /* octets */
+
+	derive_t qtype[T_MAX];
+	/* Bit field of the query types seen, so the read callback doesn't have
+	 * to look at all T_MAX counters. */
+	uint64_t qtype_seen[T_MAX / 64];
+	derive_t opcode[OP_MAX];
+	derive_t rcode[RC_MAX];
+
+	/* Packets which passed the filter and packets dropped by the kernel,
+	 * only valid if "have_stats" is set. */
+	int have_stats;
+	derive_t packets;
+	derive_t drops;
 };
-typedef struct counter_list_s counter_list_t;
+typedef struct dns_counters_s dns_counters_t;
+
+#if DNS_HAVE_PACKET_RING
+struct dns_ring_s
+{
+	int fd;
+	uint8_t *map;
+	unsigned int block;
+
+	dns_counters_t *counters;
+
+	pthread_t thread;
+	_Bool thread_running;
+};
+typedef struct dns_ring_s dns_ring_t;
+
+/* Same layout as "struct sock_fprog" from <linux/filter.h>, which can't be
+ * included together with <pcap-bpf.h>. "struct bpf_insn" has the same layout
+ * as "struct sock_filter". */
+struct dns_ring_fprog_s
+{
+	unsigned short len;
+	struct bpf_insn *filter;
+};
+typedef struct dns_ring_fprog_s dns_ring_fprog_t;
+#endif
+
+#define DNS_COUNTER_GET(c) __sync_add_and_fetch (&(c), 0)
 
 /*
  * Private variables
@@ -53,89 +112,102 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSource",
-	"SelectNumericQueryTypes"
+	"SelectNumericQueryTypes",
+	"PacketRingThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int select_numeric_qtype = 1;
+#if DNS_HAVE_PACKET_RING
+static int ring_threads_num = 0;
+#endif
 
 #define PCAP_SNAPLEN 1460
 static char   *pcap_device = NULL;
 
-static derive_t       tr_queries;
-static derive_t       tr_responses;
-static counter_list_t *qtype_list;
-static counter_list_t *opcode_list;
-static counter_list_t *rcode_list;
+/* Counters of all capture threads. The lock only protects the list. */
+static dns_counters_t **counters_list = NULL;
+static size_t           counters_list_num = 0;
+static pthread_mutex_t  counters_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Counters of the current capture thread */
+static pthread_key_t    counters_key;
+static _Bool            counters_key_init = 0;
 
 static pthread_t       listen_thread;
 static int             listen_thread_init = 0;
-/* The `traffic' mutex if for `tr_queries' and `tr_responses' */
-static pthread_mutex_t traffic_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t qtype_mutex   = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t opcode_mutex  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rcode_mutex   = PTHREAD_MUTEX_INITIALIZER;
+
+#if DNS_HAVE_PACKET_RING
+/* 32 blocks of 256 KiB, i.e. 8 MiB per thread. A block is handed to user
+ * space when it is full or after DNS_RING_TIMEOUT_MS milliseconds. */
+# define DNS_RING_BLOCK_SIZE (1 << 18)
+# define DNS_RING_BLOCKS     32
+# define DNS_RING_FRAME_SIZE 2048
+# define DNS_RING_TIMEOUT_MS 100
+
+static dns_ring_t *rings = NULL;
+static size_t      rings_num = 0;
+static _Bool       rings_do_shutdown = 0;
+
+/* Equivalent to the "udp port 53" filter used with libpcap, for packets
+ * without link layer header. Fragments are dropped, since only the first one
+ * contains the UDP header. */
+static struct bpf_insn ring_filter[] =
+{
+	BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 0),                    /*  0 */
+	BPF_STMT (BPF_ALU | BPF_AND | BPF_K,   0xf0),                 /*  1 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   0x40, 0, 9),           /*  2 */
+	/* IPv4 */
+	BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 9),                    /*  3 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 15),   /*  4 */
+	BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 6),                    /*  5 */
+	BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K,  0x1fff, 13, 0),        /*  6 */
+	BPF_STMT (BPF_LDX | BPF_B   | BPF_MSH, 0),                    /*  7 */
+	BPF_STMT (BPF_LD  | BPF_H   | BPF_IND, 0),                    /*  8 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 9, 0),             /*  9 */
+	BPF_STMT (BPF_LD  | BPF_H   | BPF_IND, 2),                    /* 10 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 7, 8),             /* 11 */
+	/* IPv6 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   0x60, 0, 7),           /* 12 */
+	BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 6),                    /* 13 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 5),    /* 14 */
+	BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 40),                   /* 15 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 2, 0),             /* 16 */
+	BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 42),                   /* 17 */
+	BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 0, 1),             /* 18 */
+	BPF_STMT (BPF_RET | BPF_K, PCAP_SNAPLEN),                     /* 19 */
+	BPF_STMT (BPF_RET | BPF_K, 0)                                 /* 20 */
+};
+#endif /* DNS_HAVE_PACKET_RING */
 
 /*
  * Private functions
  */
-static counter_list_t *counter_list_search (counter_list_t **list, unsigned int key)
+/* Allocates the counters for a new capture thread and adds them to
+ * "counters_list". */
+static dns_counters_t *dns_counters_create (void)
 {
-	counter_list_t *entry;
+	dns_counters_t *c;
+	dns_counters_t **tmp;
 
-	for (entry = *list; entry != NULL; entry = entry->next)
-		if (entry->key == key)
-			break;
-
-	return (entry);
-}
-
-static counter_list_t *counter_list_create (counter_list_t **list,
-		unsigned int key, unsigned int value)
-{
-	counter_list_t *entry;
-
-	entry = (counter_list_t *) malloc (sizeof (counter_list_t));
-	if (entry == NULL)
+	c = calloc (1, sizeof (*c));
+	if (c == NULL)
 		return (NULL);
 
-	memset (entry, 0, sizeof (counter_list_t));
-	entry->key = key;
-	entry->value = value;
-
-	if (*list == NULL)
+	pthread_mutex_lock (&counters_lock);
+	tmp = realloc (counters_list,
+			sizeof (*counters_list) * (counters_list_num + 1));
+	if (tmp == NULL)
 	{
-		*list = entry;
+		pthread_mutex_unlock (&counters_lock);
+		sfree (c);
+		return (NULL);
 	}
-	else
-	{
-		counter_list_t *last;
+	counters_list = tmp;
+	counters_list[counters_list_num] = c;
+	counters_list_num++;
+	pthread_mutex_unlock (&counters_lock);
 
-		last = *list;
-		while (last->next != NULL)
-			last = last->next;
-
-		last->next = entry;
-	}
-
-	return (entry);
-}
-
-static void counter_list_add (counter_list_t **list,
-		unsigned int key, unsigned int increment)
-{
-	counter_list_t *entry;
-
-	entry = counter_list_search (list, key);
-
-	if (entry != NULL)
-	{
-		entry->value += increment;
-	}
-	else
-	{
-		counter_list_create (list, key, increment);
-	}
-}
+	return (c);
+} /* dns_counters_t *dns_counters_create */
 
 static int dns_config (const char *key, const char *value)
 {
@@ -158,6 +230,23 @@ static int dns_config (const char *key, const char *value)
 		else
 			select_numeric_qtype = 1;
 	}
+	else if (strcasecmp (key, "PacketRingThreads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			ERROR ("dns plugin: PacketRingThreads must not be negative.");
+			return (1);
+		}
+#if DNS_HAVE_PACKET_RING
+		ring_threads_num = tmp;
+#else
+		if (tmp > 0)
+			WARNING ("dns plugin: The packet ring is not supported on "
+					"this system. The PacketRingThreads option will be "
+					"ignored.");
+#endif
+	}
 	else
 	{
 		return (-1);
@@ -168,51 +257,39 @@ static int dns_config (const char *key, const char *value)
 
 static void dns_child_callback (const rfc1035_header_t *dns)
 {
+	dns_counters_t *c = pthread_getspecific (counters_key);
+
+	if (c == NULL)
+		return;
+
 	if (dns->qr == 0)
 	{
 		/* This is a query */
-		int skip = 0;
-		if (!select_numeric_qtype)
-		{
-			const char *str = qtype_str(dns->qtype);
-			if ((str == NULL) || (str[0] == '#'))
-				skip = 1;
-		}
-
-		pthread_mutex_lock (&traffic_mutex);
-		tr_queries += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
+		uint64_t bit = ((uint64_t) 1) << (dns->qtype % 64);
 
-		if (skip == 0)
-		{
-			pthread_mutex_lock (&qtype_mutex);
-			counter_list_add (&qtype_list, dns->qtype,  1);
-			pthread_mutex_unlock (&qtype_mutex);
-		}
+		c->queries += dns->length;
+		c->qtype[dns->qtype]++;
+		if ((c->qtype_seen[dns->qtype / 64] & bit) == 0)
+			c->qtype_seen[dns->qtype / 64] |= bit;
 	}
 	else
 	{
 		/* This is a reply */
-		pthread_mutex_lock (&traffic_mutex);
-		tr_responses += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
-
-		pthread_mutex_lock (&rcode_mutex);
-		counter_list_add (&rcode_list,  dns->rcode,  1);
-		pthread_mutex_unlock (&rcode_mutex);
+		c->responses += dns->length;
+		c->rcode[dns->rcode]++;
 	}
 
 	/* FIXME: Are queries, replies or both interesting? */
-	pthread_mutex_lock (&opcode_mutex);
-	counter_list_add (&opcode_list, dns->opcode, 1);
-	pthread_mutex_unlock (&opcode_mutex);
+	c->opcode[dns->opcode]++;
 }
 
-static void *dns_child_loop (__attribute__((unused)) void *dummy)
+static void *dns_child_loop (void *arg)
 {
+	dns_counters_t *counters = arg;
 	pcap_t *pcap_obj;
 	char    pcap_error[PCAP_ERRBUF_SIZE];
 	struct  bpf_program fp;
+	cdtime_t stats_time = 0;
 
 	int status;
 
@@ -223,6 +300,8 @@ static void *dns_child_loop (__attribute__((unused)) void *dummy)
 		pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
 	}
 
+	pthread_setspecific (counters_key, counters);
+
 	/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
 	DEBUG ("dns plugin: Creating PCAP object..");
 	pcap_obj = pcap_open_live ((pcap_device != NULL) ? pcap_device : "any",
@@ -254,12 +333,34 @@ static void *dns_child_loop (__attribute__((unused)) void *dummy)
 	DEBUG ("dns plugin: PCAP object created.");
 
 	dnstop_set_pcap_obj (pcap_obj);
-	dnstop_set_callback (dns_child_callback);
 
-	status = pcap_loop (pcap_obj,
-			-1 /* loop forever */,
-			handle_pcap /* callback */,
-			NULL /* Whatever this means.. */);
+	while (42)
+	{
+		struct pcap_stat ps;
+		cdtime_t now;
+
+		status = pcap_dispatch (pcap_obj,
+				-1 /* all packets of one buffer */,
+				handle_pcap /* callback */,
+				NULL /* Whatever this means.. */);
+		if (status < 0)
+			break;
+
+		/* Update the drop statistics about once per second. */
+		now = cdtime ();
+		if ((now - stats_time) < TIME_T_TO_CDTIME_T (1))
+			continue;
+		stats_time = now;
+
+		memset (&ps, 0, sizeof (ps));
+		if (pcap_stats (pcap_obj, &ps) == 0)
+		{
+			counters->packets = (derive_t) ps.ps_recv;
+			counters->drops = (derive_t) ps.ps_drop;
+			counters->have_stats = 1;
+		}
+	}
+
 	if (status < 0)
 		ERROR ("dns plugin: Listener thread is exiting "
 				"abnormally: %s", pcap_geterr (pcap_obj));
@@ -273,21 +374,309 @@ static void *dns_child_loop (__attribute__((unused)) void *dummy)
 	return (NULL);
 } /* static void dns_child_loop (void) */
 
-static int dns_init (void)
+#if DNS_HAVE_PACKET_RING
+/* Adds the kernel's statistics to the counters. The kernel resets them
+ * whenever they are read. */
+static void dns_ring_update_stats (dns_ring_t *r)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t stats_len = sizeof (stats);
+
+	memset (&stats, 0, sizeof (stats));
+	if (getsockopt (r->fd, SOL_PACKET, PACKET_STATISTICS,
+				&stats, &stats_len) != 0)
+		return;
+
+	/* tp_packets includes the dropped packets. */
+	r->counters->packets += (derive_t) stats.tp_packets;
+	r->counters->drops += (derive_t) stats.tp_drops;
+	r->counters->have_stats = 1;
+} /* void dns_ring_update_stats */
+
+static void dns_ring_handle_block (struct tpacket_block_desc *bd)
 {
-	/* clean up an old thread */
+	uint8_t *ptr;
+	uint32_t i;
+
+	ptr = ((uint8_t *) bd) + bd->hdr.bh1.offset_to_first_pkt;
+	for (i = 0; i < bd->hdr.bh1.num_pkts; i++)
+	{
+		struct tpacket3_hdr *hdr = (void *) ptr;
+		struct sockaddr_ll *sll = (void *) (ptr
+				+ TPACKET_ALIGN (sizeof (*hdr)));
+
+		ptr += hdr->tp_next_offset;
+
+		/* Like libpcap, ignore outgoing packets on loopback
+		 * devices. Otherwise they would be counted twice. */
+		if ((sll->sll_pkttype == PACKET_OUTGOING)
+				&& (sll->sll_hatype == ARPHRD_LOOPBACK))
+			continue;
+
+		handle_ip_packet (((u_char *) hdr) + hdr->tp_net,
+				(int) hdr->tp_snaplen);
+	}
+} /* void dns_ring_handle_block */
+
+static void *dns_ring_thread (void *arg)
+{
+	dns_ring_t *r = arg;
+
+	pthread_setspecific (counters_key, r->counters);
+
+	while (!rings_do_shutdown)
+	{
+		struct tpacket_block_desc *bd;
+
+		bd = (void *) (r->map + (r->block * DNS_RING_BLOCK_SIZE));
+		if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			struct pollfd pfd;
+
+			dns_ring_update_stats (r);
+
+			memset (&pfd, 0, sizeof (pfd));
+			pfd.fd = r->fd;
+			pfd.events = POLLIN | POLLERR;
+			poll (&pfd, 1, /* timeout = */ 1000);
+			continue;
+		}
+
+		/* Make sure the packets are read after the block status. */
+		__sync_synchronize ();
+		dns_ring_handle_block (bd);
+		__sync_synchronize ();
+
+		/* Hand the block back to the kernel. */
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		r->block = (r->block + 1) % DNS_RING_BLOCKS;
+
+		if (r->block == 0)
+			dns_ring_update_stats (r);
+	}
+
+	return ((void *) 0);
+} /* void *dns_ring_thread */
+
+static int dns_ring_open (dns_ring_t *r, int fanout_id)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	dns_ring_fprog_t fprog;
+	char errbuf[1024];
+	int version = TPACKET_V3;
+	int fanout;
 	int status;
 
-	pthread_mutex_lock (&traffic_mutex);
-	tr_queries   = 0;
-	tr_responses = 0;
-	pthread_mutex_unlock (&traffic_mutex);
+	r->fd = socket (AF_PACKET, SOCK_DGRAM, /* protocol = */ 0);
+	if (r->fd < 0)
+	{
+		ERROR ("dns plugin: socket(AF_PACKET) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&fprog, 0, sizeof (fprog));
+	fprog.len = (unsigned short) STATIC_ARRAY_SIZE (ring_filter);
+	fprog.filter = ring_filter;
+	status = setsockopt (r->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			&fprog, sizeof (fprog));
+	if (status != 0)
+	{
+		ERROR ("dns plugin: setsockopt(SO_ATTACH_FILTER) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	status = setsockopt (r->fd, SOL_PACKET, PACKET_VERSION,
+			&version, sizeof (version));
+	if (status != 0)
+	{
+		ERROR ("dns plugin: setsockopt(PACKET_VERSION) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.tp_block_size = DNS_RING_BLOCK_SIZE;
+	req.tp_block_nr = DNS_RING_BLOCKS;
+	req.tp_frame_size = DNS_RING_FRAME_SIZE;
+	req.tp_frame_nr = (DNS_RING_BLOCK_SIZE / DNS_RING_FRAME_SIZE)
+		* DNS_RING_BLOCKS;
+	req.tp_retire_blk_tov = DNS_RING_TIMEOUT_MS;
+	status = setsockopt (r->fd, SOL_PACKET, PACKET_RX_RING,
+			&req, sizeof (req));
+	if (status != 0)
+	{
+		ERROR ("dns plugin: setsockopt(PACKET_RX_RING) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	r->map = mmap (NULL, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCKS,
+			PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, /* offset = */ 0);
+	if (r->map == MAP_FAILED)
+	{
+		r->map = NULL;
+		ERROR ("dns plugin: mmap(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&sll, 0, sizeof (sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons (ETH_P_ALL);
+	if ((pcap_device != NULL) && (strcmp ("any", pcap_device) != 0))
+	{
+		sll.sll_ifindex = (int) if_nametoindex (pcap_device);
+		if (sll.sll_ifindex == 0)
+		{
+			ERROR ("dns plugin: Unknown interface `%s'.", pcap_device);
+			return (-1);
+		}
+	}
+	status = bind (r->fd, (struct sockaddr *) &sll, sizeof (sll));
+	if (status != 0)
+	{
+		ERROR ("dns plugin: bind(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* All sockets join the same fanout group, so each packet is received
+	 * by exactly one of the threads. */
+	fanout = (fanout_id & 0xffff) | (PACKET_FANOUT_HASH << 16);
+	status = setsockopt (r->fd, SOL_PACKET, PACKET_FANOUT,
+			&fanout, sizeof (fanout));
+	if (status != 0)
+	{
+		ERROR ("dns plugin: setsockopt(PACKET_FANOUT) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* int dns_ring_open */
+
+static void dns_ring_stop (void)
+{
+	size_t i;
+
+	rings_do_shutdown = 1;
+	for (i = 0; i < rings_num; i++)
+	{
+		if (rings[i].thread_running)
+			pthread_join (rings[i].thread, /* retval = */ NULL);
+		rings[i].thread_running = 0;
+
+		if (rings[i].map != NULL)
+			munmap (rings[i].map, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCKS);
+		if (rings[i].fd >= 0)
+			close (rings[i].fd);
+	}
+
+	sfree (rings);
+	rings_num = 0;
+	rings_do_shutdown = 0;
+} /* void dns_ring_stop */
+
+static int dns_ring_start (void)
+{
+	int fanout_id = (int) getpid ();
+	size_t i;
+
+	rings = calloc ((size_t) ring_threads_num, sizeof (*rings));
+	if (rings == NULL)
+		return (-1);
+	rings_num = (size_t) ring_threads_num;
+
+	for (i = 0; i < rings_num; i++)
+		rings[i].fd = -1;
+
+	/* Set up all sockets before starting to read, so a failure leaves no
+	 * thread behind. */
+	for (i = 0; i < rings_num; i++)
+	{
+		if (dns_ring_open (rings + i, fanout_id) != 0)
+		{
+			dns_ring_stop ();
+			return (-1);
+		}
+	}
+
+	for (i = 0; i < rings_num; i++)
+	{
+		int status;
+
+		rings[i].counters = dns_counters_create ();
+		if (rings[i].counters == NULL)
+		{
+			ERROR ("dns plugin: dns_counters_create failed.");
+			dns_ring_stop ();
+			return (-1);
+		}
+
+		status = plugin_thread_create (&rings[i].thread, /* attr = */ NULL,
+				dns_ring_thread, rings + i);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			dns_ring_stop ();
+			return (-1);
+		}
+		rings[i].thread_running = 1;
+	}
+
+	INFO ("dns plugin: Capturing with %zu packet ring threads.", rings_num);
+	return (0);
+} /* int dns_ring_start */
+#endif /* DNS_HAVE_PACKET_RING */
+
+static int dns_init (void)
+{
+	dns_counters_t *counters;
+	int status;
 
 	if (listen_thread_init != 0)
 		return (-1);
 
+	if (!counters_key_init)
+	{
+		status = pthread_key_create (&counters_key, /* destructor = */ NULL);
+		if (status != 0)
+		{
+			ERROR ("dns plugin: pthread_key_create failed.");
+			return (-1);
+		}
+		counters_key_init = 1;
+	}
+
+	dnstop_set_callback (dns_child_callback);
+
+#if DNS_HAVE_PACKET_RING
+	if (ring_threads_num > 0)
+	{
+		if (dns_ring_start () == 0)
+		{
+			listen_thread_init = 1;
+			return (0);
+		}
+		WARNING ("dns plugin: Setting up the packet ring failed. "
+				"Falling back to libpcap.");
+	}
+#endif
+
+	counters = dns_counters_create ();
+	if (counters == NULL)
+	{
+		ERROR ("dns plugin: dns_counters_create failed.");
+		return (-1);
+	}
+
 	status = plugin_thread_create (&listen_thread, NULL, dns_child_loop,
-			(void *) 0);
+			counters);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -301,6 +690,19 @@ static int dns_init (void)
 	return (0);
 } /* int dns_init */
 
+static int dns_shutdown (void)
+{
+#if DNS_HAVE_PACKET_RING
+	if (rings != NULL)
+	{
+		dns_ring_stop ();
+		listen_thread_init = 0;
+	}
+#endif
+
+	return (0);
+} /* int dns_shutdown */
+
 static void submit_derive (const char *type, const char *type_instance,
 		derive_t value)
 {
@@ -338,67 +740,93 @@ static void submit_octets (derive_t queries, derive_t responses)
 
 static int dns_read (void)
 {
-	unsigned int keys[T_MAX];
-	unsigned int values[T_MAX];
-	int len;
-	int i;
+	/* Only used by the read callback */
+	static dns_counters_t sum;
+	size_t i;
+	int j;
 
-	counter_list_t *ptr;
+	memset (&sum, 0, sizeof (sum));
 
-	pthread_mutex_lock (&traffic_mutex);
-	values[0] = tr_queries;
-	values[1] = tr_responses;
-	pthread_mutex_unlock (&traffic_mutex);
+	pthread_mutex_lock (&counters_lock);
+	for (i = 0; i < counters_list_num; i++)
+	{
+		dns_counters_t *c = counters_list[i];
 
-	if ((values[0] != 0) || (values[1] != 0))
-		submit_octets (values[0], values[1]);
+		sum.queries += DNS_COUNTER_GET (c->queries);
+		sum.responses += DNS_COUNTER_GET (c->responses);
 
-	pthread_mutex_lock (&qtype_mutex);
-	for (ptr = qtype_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
-	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
-	}
-	pthread_mutex_unlock (&qtype_mutex);
+		for (j = 0; j < (T_MAX / 64); j++)
+		{
+			uint64_t seen = DNS_COUNTER_GET (c->qtype_seen[j]);
+			int k;
 
-	for (i = 0; i < len; i++)
-	{
-		DEBUG ("dns plugin: qtype = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_qtype", qtype_str (keys[i]), values[i]);
+			if (seen == 0)
+				continue;
+
+			sum.qtype_seen[j] |= seen;
+			for (k = 0; k < 64; k++)
+				if (seen & (((uint64_t) 1) << k))
+					sum.qtype[(64 * j) + k]
+						+= DNS_COUNTER_GET (c->qtype[(64 * j) + k]);
+		}
+
+		for (j = 0; j < OP_MAX; j++)
+			sum.opcode[j] += DNS_COUNTER_GET (c->opcode[j]);
+		for (j = 0; j < RC_MAX; j++)
+			sum.rcode[j] += DNS_COUNTER_GET (c->rcode[j]);
+
+		if (DNS_COUNTER_GET (c->have_stats))
+		{
+			sum.have_stats = 1;
+			sum.packets += DNS_COUNTER_GET (c->packets);
+			sum.drops += DNS_COUNTER_GET (c->drops);
+		}
 	}
+	pthread_mutex_unlock (&counters_lock);
 
-	pthread_mutex_lock (&opcode_mutex);
-	for (ptr = opcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	if ((sum.queries != 0) || (sum.responses != 0))
+		submit_octets (sum.queries, sum.responses);
+
+	for (j = 0; j < T_MAX; j++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		const char *str;
+
+		if ((sum.qtype_seen[j / 64] & (((uint64_t) 1) << (j % 64))) == 0)
+			continue;
+
+		str = qtype_str (j);
+		if (!select_numeric_qtype && ((str == NULL) || (str[0] == '#')))
+			continue;
+
+		DEBUG ("dns plugin: qtype = %i; counter = %"PRIi64";",
+				j, sum.qtype[j]);
+		submit_derive ("dns_qtype", str, sum.qtype[j]);
 	}
-	pthread_mutex_unlock (&opcode_mutex);
 
-	for (i = 0; i < len; i++)
+	for (j = 0; j < OP_MAX; j++)
 	{
-		DEBUG ("dns plugin: opcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_opcode", opcode_str (keys[i]), values[i]);
+		if (sum.opcode[j] == 0)
+			continue;
+
+		DEBUG ("dns plugin: opcode = %i; counter = %"PRIi64";",
+				j, sum.opcode[j]);
+		submit_derive ("dns_opcode", opcode_str (j), sum.opcode[j]);
 	}
 
-	pthread_mutex_lock (&rcode_mutex);
-	for (ptr = rcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (j = 0; j < RC_MAX; j++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		if (sum.rcode[j] == 0)
+			continue;
+
+		DEBUG ("dns plugin: rcode = %i; counter = %"PRIi64";",
+				j, sum.rcode[j]);
+		submit_derive ("dns_rcode", rcode_str (j), sum.rcode[j]);
 	}
-	pthread_mutex_unlock (&rcode_mutex);
 
-	for (i = 0; i < len; i++)
+	if (sum.have_stats)
 	{
-		DEBUG ("dns plugin: rcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_rcode", rcode_str (keys[i]), values[i]);
+		submit_derive ("if_rx_packets", "capture", sum.packets);
+		submit_derive ("if_rx_dropped", "capture", sum.drops);
 	}
 
 	return (0);
@@ -409,4 +837,5 @@ void module_register (void)
 	plugin_register_config ("dns", dns_config, config_keys, config_keys_num);
 	plugin_register_init ("dns", dns_init);
 	plugin_register_read ("dns", dns_read);
+	plugin_register_shutdown ("dns", dns_shutdown);
 } /* void module_register */
@@ -30,6 +30,7 @@
 #include "plugin.h"
 
 #include "utils_cmd_putval.h"
+#include "utils_cmd_putvals.h"
 #include "utils_cmd_putnotif.h"
 
 #include <sys/types.h>
@@ -44,6 +45,9 @@
 
 #define PL_RUNNING       0x10
 
+/* Maximum length of a line read from a program, including the newline. */
+#define EXEC_READ_BUFFER_SIZE 16384
+
 /*
  * Private data types
  */
@@ -531,9 +535,31 @@ static int fork_child (program_list_t *pl, int *fd_in, int *fd_out, int *fd_err)
   return (pid);
 } /* int fork_child }}} */
 
-static int parse_line (char *buffer) /* {{{ */
+/* "putvals" points to the open PUTVALS block of the program, if any. */
+static int parse_line (char *buffer, cmd_putvals_t **putvals) /* {{{ */
 {
-  if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
+  if (*putvals != NULL)
+  {
+    int status;
+
+    if (buffer[0] != 0)
+      return (cmd_putvals_add (*putvals, buffer));
+
+    /* An empty line ends the block. */
+    status = cmd_putvals_finish (*putvals, stdout);
+    cmd_putvals_destroy (*putvals);
+    *putvals = NULL;
+    return (status);
+  }
+
+  if ((strncasecmp ("PUTVALS", buffer, strlen ("PUTVALS")) == 0)
+      && ((buffer[strlen ("PUTVALS")] == 0)
+        || isspace ((int) buffer[strlen ("PUTVALS")])))
+  {
+    *putvals = cmd_putvals_create (stdout, buffer);
+    return ((*putvals != NULL) ? 0 : -1);
+  }
+  else if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
     return (handle_putval (stdout, buffer));
   else if (strncasecmp ("PUTNOTIF", buffer, strlen ("PUTNOTIF")) == 0)
     return (handle_putnotif (stdout, buffer));
@@ -551,10 +577,12 @@ static void *exec_read_one (void *arg) /* {{{ */
   int fd, fd_err, highest_fd;
   fd_set fdset, copy;
   int status;
-  char buffer[1200];  /* if not completely read */
+  char buffer[EXEC_READ_BUFFER_SIZE];  /* if not completely read */
   char buffer_err[1024];
   char *pbuffer = buffer;
   char *pbuffer_err = buffer_err;
+  _Bool discarding = 0;
+  cmd_putvals_t *putvals = NULL;
 
   status = fork_child (pl, NULL, &fd, &fd_err);
   if (status < 0)
@@ -595,6 +623,16 @@ static void *exec_read_one (void *arg) /* {{{ */
     {
       char *pnl;
 
+      /* A line which does not fit into the buffer is dropped. The rest of
+       * it is discarded up to the next newline. */
+      if (pbuffer - buffer >= (int) sizeof (buffer) - 1)
+      {
+        WARNING ("exec plugin: Program `%s' sent a line longer than "
+            "%zu bytes. Ignoring it.", pl->exec, sizeof (buffer) - 1);
+        pbuffer = buffer;
+        discarding = 1;
+      }
+
       len = read(fd, pbuffer, sizeof(buffer) - 1 - (pbuffer - buffer));
 
       if (len < 0)
@@ -609,12 +647,22 @@ static void *exec_read_one (void *arg) /* {{{ */
       len += pbuffer - buffer;
       pbuffer = buffer;
 
+      if (discarding)
+      {
+        pnl = strchr (pbuffer, '\n');
+        if (pnl == NULL)
+          continue;
+
+        pbuffer = pnl + 1;
+        discarding = 0;
+      }
+
       while ((pnl = strchr(pbuffer, '\n')))
       {
         *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+        if ((pnl > pbuffer) && (*(pnl-1) == '\r')) *(pnl-1) = '\0';
 
-        parse_line (pbuffer);
+        parse_line (pbuffer, &putvals);
 
         pbuffer = ++pnl;
       }
@@ -684,6 +732,13 @@ static void *exec_read_one (void *arg) /* {{{ */
     copy = fdset;
   }
 
+  /* The program may exit without ending the block. */
+  if (putvals != NULL)
+  {
+    cmd_putvals_finish (putvals, stdout);
+    cmd_putvals_destroy (putvals);
+  }
+
   DEBUG ("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
   if (waitpid (pl->pid, &status, 0) > 0)
     pl->status = status;
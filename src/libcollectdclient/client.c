@@ -104,6 +104,23 @@ struct lcc_connection_s
 {
   FILE *fh;
   char errbuf[1024];
+
+  /* Pipelined PUTVAL commands, see lcc_putval_async. `queued' commands are
+   * in `queue' and have not been sent yet, `pending' commands have been sent
+   * but their status line has not been read yet. */
+  char *queue;
+  size_t queue_size;
+  size_t queue_fill;
+  size_t queued;
+  size_t pending;
+
+  /* Responses read since the last call to lcc_putval_drain. */
+  size_t responses;
+  size_t failed;
+  char first_error[512];
+
+  lcc_putval_callback_t callback;
+  void *callback_data;
 };
 
 struct lcc_response_s
@@ -354,6 +371,8 @@ static int lcc_receive (lcc_connection_t *c, /* {{{ */
   return (0);
 } /* }}} int lcc_receive */
 
+static int lcc_receive_pending (lcc_connection_t *c);
+
 static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     const char *command, lcc_response_t *ret_res)
 {
@@ -366,6 +385,16 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
+  /* Read the responses to pipelined commands first, so they are not mistaken
+   * for the response to this command. Failures are reported to the callback
+   * only. */
+  if ((c->queued > 0) || (c->pending > 0))
+  {
+    status = lcc_receive_pending (c);
+    if (status != 0)
+      return (status);
+  }
+
   status = lcc_send (c, command);
   if (status != 0)
     return (status);
@@ -605,12 +634,16 @@ int lcc_disconnect (lcc_connection_t *c) /* {{{ */
   if (c == NULL)
     return (-1);
 
+  if ((c->fh != NULL) && ((c->queued > 0) || (c->pending > 0)))
+    lcc_receive_pending (c);
+
   if (c->fh != NULL)
   {
     fclose (c->fh);
     c->fh = NULL;
   }
 
+  free (c->queue);
   free (c);
   return (0);
 } /* }}} int lcc_disconnect */
@@ -743,12 +776,13 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return (0);
 } /* }}} int lcc_getval */
 
-int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+/* Formats the PUTVAL command for `vl' into `ret_command'. */
+static int lcc_format_putval (lcc_connection_t *c, /* {{{ */
+    char *ret_command, size_t ret_command_size, const lcc_value_list_t *vl)
 {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
   char command[1024] = "";
-  lcc_response_t res;
   int status;
   size_t i;
 
@@ -793,6 +827,21 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 
   } /* for (i = 0; i < vl->values_len; i++) */
 
+  strncpy (ret_command, command, ret_command_size);
+  ret_command[ret_command_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_format_putval */
+
+int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  status = lcc_format_putval (c, command, sizeof (command), vl);
+  if (status != 0)
+    return (status);
+
   status = lcc_sendreceive (c, command, &res);
   if (status != 0)
     return (status);
@@ -808,6 +857,183 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int lcc_putval */
 
+/* Sends all queued commands with a single write(2), if possible. */
+static int lcc_send_queue (lcc_connection_t *c) /* {{{ */
+{
+  size_t offset = 0;
+  int fd;
+
+  if (c->queue_fill == 0)
+    return (0);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  /* Commands sent using the stdio stream must go out first. */
+  fflush (c->fh);
+  fd = fileno (c->fh);
+
+  while (offset < c->queue_fill)
+  {
+    ssize_t status;
+
+    status = write (fd, c->queue + offset, c->queue_fill - offset);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      lcc_set_errno (c, errno);
+      c->queue_fill = 0;
+      c->queued = 0;
+      return (-1);
+    }
+    offset += (size_t) status;
+  }
+
+  LCC_DEBUG ("send:    --> %zu queued commands (%zu bytes)\n",
+      c->queued, c->queue_fill);
+
+  c->pending += c->queued;
+  c->queued = 0;
+  c->queue_fill = 0;
+  return (0);
+} /* }}} int lcc_send_queue */
+
+int lcc_putval_async (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  char command[1024] = "";
+  size_t command_len;
+  int status;
+
+  status = lcc_format_putval (c, command, sizeof (command), vl);
+  if (status != 0)
+    return (status);
+
+  /* Limit the number of unread responses, so the daemon never blocks writing
+   * a response while we block writing more commands. */
+  if ((c->queued + c->pending) >= LCC_PIPELINE_MAX)
+  {
+    status = lcc_receive_pending (c);
+    if (status != 0)
+      return (status);
+  }
+
+  command_len = strlen (command);
+  if ((c->queue_fill + command_len + 2) > c->queue_size)
+  {
+    size_t new_size = (c->queue_size > 0) ? 2 * c->queue_size : 4096;
+    char *tmp;
+
+    while ((c->queue_fill + command_len + 2) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (c->queue, new_size);
+    if (tmp == NULL)
+    {
+      lcc_set_errno (c, ENOMEM);
+      return (-1);
+    }
+    c->queue = tmp;
+    c->queue_size = new_size;
+  }
+
+  memcpy (c->queue + c->queue_fill, command, command_len);
+  memcpy (c->queue + c->queue_fill + command_len, "\r\n", 2);
+  c->queue_fill += command_len + 2;
+  c->queued++;
+
+  if (c->queue_fill >= LCC_QUEUE_SIZE)
+    return (lcc_send_queue (c));
+
+  return (0);
+} /* }}} int lcc_putval_async */
+
+/* Sends the queued commands and reads all outstanding responses. Rejected
+ * values are counted, so lcc_putval_drain can report them even if the
+ * responses were read implicitly. */
+static int lcc_receive_pending (lcc_connection_t *c) /* {{{ */
+{
+  int status;
+
+  status = lcc_send_queue (c);
+  if (status != 0)
+    return (status);
+
+  while (c->pending > 0)
+  {
+    lcc_response_t res;
+
+    memset (&res, 0, sizeof (res));
+    status = lcc_receive (c, &res);
+    if (status != 0)
+    {
+      /* The connection is unusable now; the remaining responses are lost. */
+      c->pending = 0;
+      return (-1);
+    }
+    c->pending--;
+    c->responses++;
+
+    if (c->callback != NULL)
+      (*c->callback) (res.status, res.message, c->callback_data);
+
+    if (res.status != 0)
+    {
+      if (c->failed == 0)
+        SSTRCPY (c->first_error, res.message);
+      c->failed++;
+    }
+
+    lcc_response_free (&res);
+  }
+
+  return (0);
+} /* }}} int lcc_receive_pending */
+
+int lcc_putval_drain (lcc_connection_t *c) /* {{{ */
+{
+  size_t failed;
+  size_t responses;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_receive_pending (c);
+
+  failed = c->failed;
+  responses = c->responses;
+  c->failed = 0;
+  c->responses = 0;
+
+  if (status != 0)
+    return (status);
+
+  if (failed > 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %zu of %zu values failed, "
+        "the first with: %s", failed, responses, c->first_error);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_putval_drain */
+
+int lcc_putval_set_callback (lcc_connection_t *c, /* {{{ */
+    lcc_putval_callback_t callback, void *user_data)
+{
+  if (c == NULL)
+    return (-1);
+
+  c->callback = callback;
+  c->callback_data = user_data;
+  return (0);
+} /* }}} int lcc_putval_set_callback */
+
 int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
     lcc_identifier_t *ident, int timeout)
 {
@@ -863,15 +1089,44 @@ int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
 
 /* TODO: Implement lcc_putnotif */
 
+/* Returns a pointer to the identifier in a line returned by LISTVAL. The first
+ * field, the time, is terminated in place. */
+static char *lcc_listval_ident_str (char *line) /* {{{ */
+{
+  char *ident_str;
+
+  /* Set `ident_str' to the beginning of the second field. */
+  ident_str = line;
+  while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
+    ident_str++;
+  while ((*ident_str == ' ') || (*ident_str == '\t'))
+  {
+    *ident_str = 0;
+    ident_str++;
+  }
+
+  if (*ident_str == 0)
+    return (NULL);
+
+  return (ident_str);
+} /* }}} char *lcc_listval_ident_str */
+
 int lcc_listval (lcc_connection_t *c, /* {{{ */
     lcc_identifier_t **ret_ident, size_t *ret_ident_num)
 {
-  lcc_response_t res;
-  size_t i;
-  int status;
+  return (lcc_listval_filter (c, /* prefix = */ NULL, /* pattern = */ NULL,
+        ret_ident, ret_ident_num));
+} /* }}} int lcc_listval */
 
-  lcc_identifier_t *ident;
-  size_t ident_num;
+int lcc_listval_filter (lcc_connection_t *c, /* {{{ */
+    const char *prefix, const char *pattern,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  char after[6 * LCC_NAME_LEN] = "";
+  lcc_identifier_t *ident = NULL;
+  size_t ident_num = 0;
+  size_t i;
+  int status = 0;
 
   if (c == NULL)
     return (-1);
@@ -882,57 +1137,85 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
-  status = lcc_sendreceive (c, "LISTVAL", &res);
-  if (status != 0)
-    return (status);
-
-  if (res.status != 0)
-  {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
-    return (-1);
-  }
-
-  ident_num = res.lines_num;
-  ident = (lcc_identifier_t *) malloc (ident_num * sizeof (*ident));
-  if (ident == NULL)
-  {
-    lcc_response_free (&res);
-    lcc_set_errno (c, ENOMEM);
-    return (-1);
-  }
-
-  for (i = 0; i < res.lines_num; i++)
+  /* Request the list in pages of LCC_LISTVAL_PAGE_SIZE identifiers, so that
+   * the server never has to copy more than one page at a time. */
+  while (42)
   {
-    char *time_str;
-    char *ident_str;
+    char command[4096];
+    char buffer[12 * LCC_NAME_LEN];
+    lcc_response_t res;
+    lcc_identifier_t *tmp;
+
+    SSTRCPY (command, "LISTVAL");
+    SSTRCATF (command, " limit=%i", LCC_LISTVAL_PAGE_SIZE);
+    if (prefix != NULL)
+      SSTRCATF (command, " prefix=%s",
+          lcc_strescape (buffer, prefix, sizeof (buffer)));
+    if (pattern != NULL)
+      SSTRCATF (command, " pattern=%s",
+          lcc_strescape (buffer, pattern, sizeof (buffer)));
+    if (after[0] != 0)
+      SSTRCATF (command, " after=%s",
+          lcc_strescape (buffer, after, sizeof (buffer)));
+
+    status = lcc_sendreceive (c, command, &res);
+    if (status != 0)
+      break;
 
-    /* First field is the time. */
-    time_str = res.lines[i];
+    if (res.status != 0)
+    {
+      LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+      lcc_response_free (&res);
+      status = -1;
+      break;
+    }
 
-    /* Set `ident_str' to the beginning of the second field. */
-    ident_str = time_str;
-    while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
-      ident_str++;
-    while ((*ident_str == ' ') || (*ident_str == '\t'))
+    if (res.lines_num == 0)
     {
-      *ident_str = 0;
-      ident_str++;
+      lcc_response_free (&res);
+      break;
     }
 
-    if (*ident_str == 0)
+    tmp = (lcc_identifier_t *) realloc (ident,
+        (ident_num + res.lines_num) * sizeof (*ident));
+    if (tmp == NULL)
     {
-      lcc_set_errno (c, EILSEQ);
+      lcc_response_free (&res);
+      lcc_set_errno (c, ENOMEM);
       status = -1;
       break;
     }
+    ident = tmp;
 
-    status = lcc_string_to_identifier (c, ident + i, ident_str);
-    if (status != 0)
+    for (i = 0; i < res.lines_num; i++)
+    {
+      char *ident_str;
+
+      ident_str = lcc_listval_ident_str (res.lines[i]);
+      if (ident_str == NULL)
+      {
+        lcc_set_errno (c, EILSEQ);
+        status = -1;
+        break;
+      }
+
+      status = lcc_string_to_identifier (c, ident + ident_num, ident_str);
+      if (status != 0)
+        break;
+      ident_num++;
+
+      if (i == (res.lines_num - 1))
+        SSTRCPY (after, ident_str);
+    }
+
+    if ((status != 0) || (res.lines_num < LCC_LISTVAL_PAGE_SIZE))
+    {
+      lcc_response_free (&res);
       break;
-  }
+    }
 
-  lcc_response_free (&res);
+    lcc_response_free (&res);
+  }
 
   if (status != 0)
   {
@@ -944,7 +1227,7 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
   *ret_ident_num = ident_num;
 
   return (0);
-} /* }}} int lcc_listval */
+} /* }}} int lcc_listval_filter */
 
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
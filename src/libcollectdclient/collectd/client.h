@@ -42,6 +42,9 @@
  * Defines
  */
 #define LCC_NAME_LEN 64
+#define LCC_LISTVAL_PAGE_SIZE 1024
+#define LCC_QUEUE_SIZE 65536
+#define LCC_PIPELINE_MAX 1024
 #define LCC_DEFAULT_PORT "25826"
 
 /*
@@ -94,6 +97,9 @@ typedef struct lcc_value_list_s lcc_value_list_t;
 struct lcc_connection_s;
 typedef struct lcc_connection_s lcc_connection_t;
 
+typedef void (*lcc_putval_callback_t) (int status, const char *message,
+    void *user_data);
+
 /*
  * Functions
  */
@@ -106,12 +112,34 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Pipelined version of lcc_putval: The command is queued and sent together
+ * with other queued commands once LCC_QUEUE_SIZE bytes have been collected.
+ * The responses are read by lcc_putval_drain, which also sends the remaining
+ * queued commands, and passed to the callback set with
+ * lcc_putval_set_callback in the order the values were queued. At most
+ * LCC_PIPELINE_MAX responses are left unread, i.e. lcc_putval_async drains
+ * implicitly once that many commands are outstanding. The other functions
+ * drain before sending their own command, too. lcc_putval_drain returns
+ * non-zero if any of the values queued since its last call was rejected by
+ * the daemon. */
+int lcc_putval_async (lcc_connection_t *c, const lcc_value_list_t *vl);
+int lcc_putval_drain (lcc_connection_t *c);
+int lcc_putval_set_callback (lcc_connection_t *c,
+    lcc_putval_callback_t callback, void *user_data);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
+/* Like lcc_listval, but only returns identifiers starting with "prefix" and
+ * matching the shell wildcard "pattern". Either may be NULL. Both functions
+ * request the list in pages of LCC_LISTVAL_PAGE_SIZE identifiers. */
+int lcc_listval_filter (lcc_connection_t *c,
+    const char *prefix, const char *pattern,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num);
+
 /* TODO: putnotif */
 
 const char *lcc_strerror (lcc_connection_t *c);
@@ -0,0 +1,128 @@
+/**
+ * collectd - src/libcollectdclient/collectd/shm.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_SHM_H
+#define LIBCOLLECTDCLIENT_SHM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Layout of the file exported by the "write_shm" plugin. The file is mapped
+ * into memory by both, the daemon and the readers, and consists of:
+ *
+ *   +--------+-------------------------+-------------------------------+
+ *   ! header ! index (uint32_t * size) ! slots (lcc_shm_slot_t * num)  !
+ *   +--------+-------------------------+-------------------------------+
+ *
+ * The index is an open addressing hash table with linear probing, keyed by
+ * the LCC_SHM_HASH of the identifier. Each entry holds the slot number plus
+ * one, zero denotes an empty entry. Slots and index entries are only ever
+ * added, never removed, so readers can look up identifiers without locking.
+ *
+ * The values of a slot are protected by a sequence lock: The daemon increments
+ * `seq' before and after updating a slot, so readers have to retry if `seq' is
+ * odd or has changed while copying the values.
+ */
+#define LCC_SHM_MAGIC      0x63647368 /* "cdsh" */
+#define LCC_SHM_VERSION    1
+#define LCC_SHM_NAME_LEN   384 /* 6 * DATA_MAX_NAME_LEN */
+#define LCC_SHM_VALUES_MAX 16
+
+struct lcc_shm_header_s
+{
+  volatile uint32_t magic;
+  uint32_t version;
+  uint32_t slots_num;
+  uint32_t index_size;
+  volatile uint32_t slots_used;
+  uint32_t reserved;
+};
+typedef struct lcc_shm_header_s lcc_shm_header_t;
+
+struct lcc_shm_slot_s
+{
+  volatile uint32_t seq;
+  uint32_t values_num;
+  uint64_t time;     /* cdtime_t, i.e. 2^-30 seconds since the epoch */
+  uint64_t interval; /* cdtime_t */
+  double values[LCC_SHM_VALUES_MAX];
+  char name[LCC_SHM_NAME_LEN];
+};
+typedef struct lcc_shm_slot_s lcc_shm_slot_t;
+
+#define LCC_SHM_INDEX(hdr) \
+  ((volatile uint32_t *) (((char *) (hdr)) + sizeof (lcc_shm_header_t)))
+#define LCC_SHM_SLOTS(hdr) \
+  ((lcc_shm_slot_t *) (((char *) LCC_SHM_INDEX (hdr)) \
+                       + ((hdr)->index_size * sizeof (uint32_t))))
+/* Computed with 64 bits, so that it cannot overflow for any 32 bit sizes. */
+#define LCC_SHM_SIZE(slots_num, index_size) \
+  ((uint64_t) sizeof (lcc_shm_header_t) \
+   + (((uint64_t) (index_size)) * sizeof (uint32_t)) \
+   + (((uint64_t) (slots_num)) * sizeof (lcc_shm_slot_t)))
+
+/* FNV-1a, used to position identifiers in the index. */
+#define LCC_SHM_HASH(ret, str) do { \
+  const unsigned char *lcc_shm_hash_ptr = (const unsigned char *) (str); \
+  (ret) = 2166136261U; \
+  while (*lcc_shm_hash_ptr != 0) { \
+    (ret) ^= (uint32_t) *lcc_shm_hash_ptr; \
+    (ret) *= 16777619U; \
+    lcc_shm_hash_ptr++; \
+  } \
+} while (0)
+
+/*
+ * Reader API. All functions return zero or an errno value.
+ */
+struct lcc_shm_s;
+typedef struct lcc_shm_s lcc_shm_t;
+
+int lcc_shm_open (const char *file, lcc_shm_t **ret_shm);
+int lcc_shm_close (lcc_shm_t *shm);
+
+/* Returns the number of identifiers currently available. Identifiers are
+ * numbered from zero to this number minus one; the number only grows. */
+size_t lcc_shm_num (lcc_shm_t *shm);
+
+/* Returns the identifier with the number `index' or NULL. */
+const char *lcc_shm_name (lcc_shm_t *shm, size_t index);
+
+/* Looks up the number of the identifier `name'. Returns ENOENT if it has not
+ * been exported (yet). */
+int lcc_shm_lookup (lcc_shm_t *shm, const char *name, size_t *ret_index);
+
+/* Copies the current values of the identifier with number `index' into
+ * `values', which must have room for `*values_num' elements. Upon return,
+ * `*values_num' is set to the number of values of the identifier. `ret_time'
+ * may be NULL. Returns ENOMEM if `values' is too small and ESTALE if the
+ * daemon has shut down; the file has to be opened again in that case. */
+int lcc_shm_read (lcc_shm_t *shm, size_t index,
+    double *values, size_t *values_num, double *ret_time);
+
+#endif /* LIBCOLLECTDCLIENT_SHM_H */
+/* vim: set sw=2 sts=2 et : */
@@ -566,7 +566,7 @@ static int nb_add_encryption (lcc_network_buffer_t *nb) /* {{{ */
   memcpy (nb->buffer + 2, &pkg_length, sizeof (pkg_length));
 
   /* Calculate what to hash */
-  hash_ptr = nb->buffer + PART_ENCRYPTION_AES256_SIZE;
+  hash_ptr = nb->buffer + nb->encr_header_len;
   hash_size = package_length - nb->encr_header_len;
 
   /* Calculate what to encrypt */
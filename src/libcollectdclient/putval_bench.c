@@ -0,0 +1,154 @@
+/**
+ * collectd - src/libcollectdclient/putval_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Compares the number of values per second which can be submitted using
+ * lcc_putval and lcc_putval_async. Build with "make putval_bench". The values
+ * are dispatched for real, so use a test instance of the daemon.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "collectd/client.h"
+
+static double now (void) /* {{{ */
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, /* tz = */ NULL);
+  return (((double) tv.tv_sec) + (((double) tv.tv_usec) / 1000000.0));
+} /* }}} double now */
+
+static int run (lcc_connection_t *c, int num, int identifiers, /* {{{ */
+    _Bool async, double *ret_elapsed)
+{
+  lcc_value_list_t vl = LCC_VALUE_LIST_INIT;
+  value_t value;
+  int type = LCC_TYPE_GAUGE;
+  double start;
+  int status;
+  int i;
+
+  vl.values = &value;
+  vl.values_types = &type;
+  vl.values_len = 1;
+  strncpy (vl.identifier.host, "putval-bench",
+      sizeof (vl.identifier.host));
+  strncpy (vl.identifier.plugin, "bench", sizeof (vl.identifier.plugin));
+  strncpy (vl.identifier.type, "gauge", sizeof (vl.identifier.type));
+
+  start = now ();
+  for (i = 0; i < num; i++)
+  {
+    snprintf (vl.identifier.type_instance,
+        sizeof (vl.identifier.type_instance), "%i", i % identifiers);
+    value.gauge = (gauge_t) i;
+
+    if (async)
+      status = lcc_putval_async (c, &vl);
+    else
+      status = lcc_putval (c, &vl);
+
+    if (status != 0)
+    {
+      fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+      return (-1);
+    }
+  }
+
+  if (async)
+  {
+    status = lcc_putval_drain (c);
+    if (status != 0)
+    {
+      fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+      return (-1);
+    }
+  }
+
+  *ret_elapsed = now () - start;
+  return (0);
+} /* }}} int run */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  const char *address = "/var/run/collectd-unixsock";
+  int num = 100000;
+  int identifiers = 1000;
+  lcc_connection_t *c = NULL;
+  double t_sync = 0.0;
+  double t_async = 0.0;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:n:i:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': address = optarg; break;
+      case 'n': num = atoi (optarg); break;
+      case 'i': identifiers = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-s <socket>] [-n <values>] "
+            "[-i <identifiers>]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+  }
+
+  if ((num < 1) || (identifiers < 1))
+  {
+    fprintf (stderr, "ERROR: The number of values and identifiers "
+        "must be positive.\n");
+    return (EXIT_FAILURE);
+  }
+
+  if (lcc_connect (address, &c) != 0)
+  {
+    fprintf (stderr, "ERROR: Connecting to %s failed.\n", address);
+    return (EXIT_FAILURE);
+  }
+
+  if ((run (c, num, identifiers, /* async = */ 0, &t_sync) != 0)
+      || (run (c, num, identifiers, /* async = */ 1, &t_async) != 0))
+  {
+    LCC_DESTROY (c);
+    return (EXIT_FAILURE);
+  }
+
+  printf ("lcc_putval:       %10.0f values/s\n", num / t_sync);
+  printf ("lcc_putval_async: %10.0f values/s (%.1fx)\n",
+      num / t_async, t_sync / t_async);
+
+  LCC_DESTROY (c);
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,240 @@
+/**
+ * collectd - src/libcollectdclient/shm.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "collectd/shm.h"
+
+/* Number of attempts to read a consistent copy of a slot before giving up. */
+#define LCC_SHM_READ_RETRIES 1000
+
+struct lcc_shm_s
+{
+  void *map;
+  size_t map_size;
+
+  lcc_shm_header_t *header;
+  volatile uint32_t *index;
+  lcc_shm_slot_t *slots;
+};
+
+int lcc_shm_open (const char *file, lcc_shm_t **ret_shm) /* {{{ */
+{
+  lcc_shm_t *shm;
+  lcc_shm_header_t *header;
+  struct stat statbuf;
+  int fd;
+  int status;
+
+  if ((file == NULL) || (ret_shm == NULL))
+    return (EINVAL);
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    return (errno);
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    status = errno;
+    close (fd);
+    return (status);
+  }
+
+  if ((size_t) statbuf.st_size < sizeof (*header))
+  {
+    close (fd);
+    return (EINVAL);
+  }
+
+  shm = malloc (sizeof (*shm));
+  if (shm == NULL)
+  {
+    close (fd);
+    return (ENOMEM);
+  }
+  memset (shm, 0, sizeof (*shm));
+
+  shm->map_size = (size_t) statbuf.st_size;
+  shm->map = mmap (/* addr = */ NULL, shm->map_size, PROT_READ, MAP_SHARED,
+      fd, /* offset = */ 0);
+  status = errno;
+  close (fd);
+  if (shm->map == MAP_FAILED)
+  {
+    free (shm);
+    return (status);
+  }
+
+  header = shm->map;
+  if ((header->magic != LCC_SHM_MAGIC)
+      || (header->version != LCC_SHM_VERSION)
+      || (header->index_size == 0)
+      || ((header->index_size & (header->index_size - 1)) != 0)
+      || (LCC_SHM_SIZE (header->slots_num, header->index_size)
+        > (uint64_t) shm->map_size))
+  {
+    munmap (shm->map, shm->map_size);
+    free (shm);
+    return (EINVAL);
+  }
+
+  shm->header = header;
+  shm->index = LCC_SHM_INDEX (header);
+  shm->slots = LCC_SHM_SLOTS (header);
+
+  *ret_shm = shm;
+  return (0);
+} /* }}} int lcc_shm_open */
+
+int lcc_shm_close (lcc_shm_t *shm) /* {{{ */
+{
+  if (shm == NULL)
+    return (EINVAL);
+
+  munmap (shm->map, shm->map_size);
+  free (shm);
+
+  return (0);
+} /* }}} int lcc_shm_close */
+
+size_t lcc_shm_num (lcc_shm_t *shm) /* {{{ */
+{
+  size_t num;
+
+  if (shm == NULL)
+    return (0);
+
+  num = (size_t) shm->header->slots_used;
+  /* Make sure the slots are read after `slots_used'. */
+  __sync_synchronize ();
+
+  return (num);
+} /* }}} size_t lcc_shm_num */
+
+const char *lcc_shm_name (lcc_shm_t *shm, size_t index) /* {{{ */
+{
+  if ((shm == NULL) || (index >= lcc_shm_num (shm)))
+    return (NULL);
+
+  return (shm->slots[index].name);
+} /* }}} const char *lcc_shm_name */
+
+int lcc_shm_lookup (lcc_shm_t *shm, const char *name, /* {{{ */
+    size_t *ret_index)
+{
+  uint32_t hash;
+  uint32_t mask;
+  uint32_t i;
+
+  if ((shm == NULL) || (name == NULL) || (ret_index == NULL))
+    return (EINVAL);
+
+  LCC_SHM_HASH (hash, name);
+  mask = shm->header->index_size - 1;
+
+  for (i = 0; i <= mask; i++)
+  {
+    uint32_t entry;
+
+    entry = shm->index[(hash + i) & mask];
+    if (entry == 0)
+      break;
+    /* Make sure the slot is read after the index entry. */
+    __sync_synchronize ();
+
+    if ((entry > shm->header->slots_num)
+        || (strcmp (shm->slots[entry - 1].name, name) != 0))
+      continue;
+
+    *ret_index = (size_t) (entry - 1);
+    return (0);
+  }
+
+  return (ENOENT);
+} /* }}} int lcc_shm_lookup */
+
+int lcc_shm_read (lcc_shm_t *shm, size_t index, /* {{{ */
+    double *values, size_t *values_num, double *ret_time)
+{
+  lcc_shm_slot_t *slot;
+  uint32_t seq;
+  uint32_t num;
+  uint64_t time;
+  int i;
+
+  if ((shm == NULL) || (values == NULL) || (values_num == NULL))
+    return (EINVAL);
+
+  if (shm->header->magic != LCC_SHM_MAGIC)
+    return (ESTALE);
+
+  if (index >= lcc_shm_num (shm))
+    return (ENOENT);
+  slot = shm->slots + index;
+
+  for (i = 0; i < LCC_SHM_READ_RETRIES; i++)
+  {
+    seq = slot->seq;
+    if ((seq & 1) != 0)
+      continue;
+    __sync_synchronize ();
+
+    num = slot->values_num;
+    if (num > LCC_SHM_VALUES_MAX)
+      num = LCC_SHM_VALUES_MAX;
+    if (num <= *values_num)
+      memcpy (values, slot->values, num * sizeof (*values));
+    time = slot->time;
+
+    __sync_synchronize ();
+    if (slot->seq != seq)
+      continue;
+
+    if (num > *values_num)
+    {
+      *values_num = (size_t) num;
+      return (ENOMEM);
+    }
+
+    *values_num = (size_t) num;
+    if (ret_time != NULL)
+      *ret_time = ((double) time) / 1073741824.0;
+    return (0);
+  }
+
+  return (EAGAIN);
+} /* }}} int lcc_shm_read */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -32,6 +32,8 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_format_network.h"
+#include "utils_pcap.h"
 
 #include "network.h"
 
@@ -114,20 +116,41 @@ struct sockent_client
 	int security_level;
 	char *username;
 	char *password;
-	gcry_cipher_hd_t cypher;
 	unsigned char password_hash[32];
 #endif
 };
 
+/* Number of buckets of the latency histograms. Bucket `n' counts packets
+ * which took less than 2^n microseconds, the last bucket everything else. */
+#define LATENCY_BUCKETS 24
+
+struct network_replay_s
+{
+	char *file;
+	double speed;
+
+	/* Statistics of the current run, only used by the replay thread. */
+	uint64_t packets;
+	uint64_t values;
+	cdtime_t parse_time;
+	cdtime_t dispatch_time;
+	cdtime_t packet_dispatch_time;
+	uint64_t latency[LATENCY_BUCKETS];
+};
+typedef struct network_replay_s network_replay_t;
+
 struct sockent_server
 {
 	int *fd;
 	size_t fd_num;
+	network_replay_t *replay;
+	/* Only updated by the receive thread. */
+	derive_t stats_octets_rx;
+	derive_t stats_packets_rx;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
 #endif
 };
 
@@ -267,11 +290,61 @@ struct receive_list_entry_s
 {
   char *data;
   int  data_len;
-  int  fd;
+  sockent_t *se;
+  cdtime_t received;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+/* Each dispatch thread has its own queue. Packets are assigned to the queues
+ * by their source address, so the packets of one sender are handled in
+ * order. */
+struct receive_queue_s
+{
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t length;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  pthread_t thread_id;
+  _Bool thread_running;
+};
+typedef struct receive_queue_s receive_queue_t;
+
+/* The receive thread collects packets for a busy queue in a private list. Once
+ * the list is this long, or no packet arrived for this many milliseconds, it
+ * waits for the queue's lock instead of trying again later. */
+#define RECEIVE_LIST_BLOCK_LENGTH 1024
+#define RECEIVE_LIST_BLOCK_TIMEOUT 10
+
+#if HAVE_LIBGCRYPT
+/* Cipher and HMAC handles with the key of one user already set. Looking up
+ * the password and setting up the keys is much more expensive than handling a
+ * packet, so every thread keeps the handles of the users it has seen recently
+ * in a `network_crypto_cache_t'. On the server, entries are dropped when the
+ * user DB has been re-read. */
+struct network_crypto_s
+{
+  const sockent_t *se;
+  char *username;
+  uint64_t generation;
+  cdtime_t checked;
+
+  gcry_cipher_hd_t cypher; /* AES-256-OFB, keyed with SHA-256 (password) */
+  gcry_md_hd_t hmac;       /* HMAC-SHA-256, keyed with the password */
+};
+typedef struct network_crypto_s network_crypto_t;
+
+#define NETWORK_CRYPTO_CACHE_SIZE 16
+struct network_crypto_cache_s
+{
+  network_crypto_t entries[NETWORK_CRYPTO_CACHE_SIZE];
+  size_t next; /* Entry to be replaced next. */
+};
+typedef struct network_crypto_cache_s network_crypto_cache_t;
+#endif
+
 /*
  * Private variables
  */
@@ -280,17 +353,23 @@ static int network_config_ttl = 0;
 static size_t network_config_packet_size = 1452;
 static int network_config_forward = 0;
 static int network_config_stats = 0;
+static char *network_config_capture_file = NULL;
+static int network_config_capture_limit = 0;
+static int network_config_dispatch_threads = 1;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t       receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t        receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t              receive_list_length = 0;
+#if HAVE_LIBGCRYPT
+static pthread_key_t  crypto_cache_key;
+static pthread_once_t crypto_cache_once = PTHREAD_ONCE_INIT;
+#endif
+
+static receive_queue_t *receive_queues = NULL;
+static size_t           receive_queues_num = 0;
 
 static sockent_t     *listen_sockets = NULL;
 static struct pollfd *listen_sockets_pollfd = NULL;
+static sockent_t    **listen_sockets_sockent = NULL; /* parallel to pollfd */
 static size_t         listen_sockets_num = 0;
 
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
@@ -298,8 +377,19 @@ static size_t         listen_sockets_num = 0;
 static int       listen_loop = 0;
 static int       receive_thread_running = 0;
 static pthread_t receive_thread_id;
-static int       dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
+
+/* Capture of received packets. Only used by the receive thread once it has
+ * been started. `capture_local' holds the local address of each listening
+ * socket. */
+static c_pcap_t                *capture = NULL;
+static struct sockaddr_storage *capture_local = NULL;
+static uint64_t                 capture_packets = 0;
+
+/* Replays of capture files, handled one after another by the replay
+ * thread. */
+static sockent_t *replay_sockets = NULL;
+static int        replay_thread_running = 0;
+static pthread_t  replay_thread_id;
 
 /* Buffer in which to-be-sent network packets are constructed. */
 static char            *send_buffer;
@@ -308,21 +398,48 @@ static int              send_buffer_fill;
 static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
 static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
-static derive_t stats_octets_rx  = 0;
-static derive_t stats_octets_tx  = 0;
-static derive_t stats_packets_rx = 0;
-static derive_t stats_packets_tx = 0;
-static derive_t stats_values_dispatched = 0;
-static derive_t stats_values_not_dispatched = 0;
-static derive_t stats_values_sent = 0;
-static derive_t stats_values_not_sent = 0;
-static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Statistics about the plugin itself. The counters are grouped by the threads
+ * updating them and each group has its own cache line, so that the threads
+ * don't contend for it. Counters with a single writer (the receive thread, or
+ * code holding send_buffer_lock) are incremented directly, all others
+ * atomically, so no lock is needed. The read callback reads them atomically,
+ * too, because writing 8 bytes is not atomic on all platforms. */
+#define STATS_CACHE_LINE 64
+#define STATS_INC(c)    ((void) __sync_add_and_fetch (&(c), 1))
+#define STATS_GET(c)    __sync_add_and_fetch (&(c), 0)
+
+/* Receive thread */
+static struct
+{
+  derive_t octets_rx;
+  derive_t packets_rx;
+} stats_receive __attribute__((aligned (STATS_CACHE_LINE)));
+
+/* Dispatch and replay threads, updated atomically */
+static struct
+{
+  derive_t values_dispatched;
+  derive_t values_not_dispatched;
+  derive_t parse_errors;
+  derive_t decrypt_errors;
+  derive_t signature_errors;
+  /* Time packets spent in the receive list, see LATENCY_BUCKETS. */
+  derive_t queue_latency[LATENCY_BUCKETS];
+} stats_dispatch __attribute__((aligned (STATS_CACHE_LINE)));
+
+/* Send path; values_not_sent is updated atomically, everything else while
+ * holding send_buffer_lock */
+static struct
+{
+  derive_t octets_tx;
+  derive_t packets_tx;
+  derive_t values_sent;
+  derive_t values_not_sent;
+} stats_send __attribute__((aligned (STATS_CACHE_LINE)));
+
+/* Histogram of the queue latency at the last read, to calculate the
+ * percentiles of the last interval. Only used by the read callback. */
+static derive_t stats_queue_latency_last[LATENCY_BUCKETS];
 
 /*
  * Private functions
@@ -406,6 +523,38 @@ static _Bool check_send_notify_okay (const notification_t *n) /* {{{ */
   return (!received);
 } /* }}} _Bool check_send_notify_okay */
 
+static int latency_bucket (cdtime_t latency) /* {{{ */
+{
+  uint64_t us = (uint64_t) CDTIME_T_TO_US (latency);
+  int i;
+
+  for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+    if (us < (((uint64_t) 1) << i))
+      break;
+
+  return (i);
+} /* }}} int latency_bucket */
+
+/* Returns the upper bound of the given percentile of a latency histogram in
+ * microseconds. */
+static uint64_t latency_percentile (const uint64_t *histogram, /* {{{ */
+    uint64_t total, double percent)
+{
+  uint64_t sum = 0;
+  uint64_t limit;
+  int i;
+
+  limit = (uint64_t) ((((double) total) * percent) / 100.0);
+  for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+  {
+    sum += histogram[i];
+    if (sum > limit)
+      break;
+  }
+
+  return (((uint64_t) 1) << i);
+} /* }}} uint64_t latency_percentile */
+
 static int network_dispatch_values (value_list_t *vl, /* {{{ */
     const char *username)
 {
@@ -426,7 +575,7 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
     DEBUG ("network plugin: network_dispatch_values: "
 	"NOT dispatching %s.", name);
 #endif
-    stats_values_not_dispatched++;
+    STATS_INC (stats_dispatch.values_not_dispatched);
     return (0);
   }
 
@@ -461,7 +610,7 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
   }
 
   plugin_dispatch_values (vl);
-  stats_values_dispatched++;
+  STATS_INC (stats_dispatch.values_dispatched);
 
   meta_data_destroy (vl->meta);
   vl->meta = NULL;
@@ -469,6 +618,22 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
   return (0);
 } /* }}} int network_dispatch_values */
 
+/* Like network_dispatch_values, but accounts the time spent dispatching to the
+ * statistics of a replay. */
+static int network_replay_dispatch_values (network_replay_t *r, /* {{{ */
+    value_list_t *vl, const char *username)
+{
+  cdtime_t start;
+  int status;
+
+  start = cdtime ();
+  status = network_dispatch_values (vl, username);
+  r->packet_dispatch_time += cdtime () - start;
+  r->values++;
+
+  return (status);
+} /* }}} int network_replay_dispatch_values */
+
 static int network_dispatch_notification (notification_t *n) /* {{{ */
 {
   int status;
@@ -493,254 +658,186 @@ static int network_dispatch_notification (notification_t *n) /* {{{ */
 } /* }}} int network_dispatch_notification */
 
 #if HAVE_LIBGCRYPT
-static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
-    const void *iv, size_t iv_size, const char *username)
+static void network_crypto_clear (network_crypto_t *c) /* {{{ */
+{
+  if (c->cypher != NULL)
+    gcry_cipher_close (c->cypher);
+  if (c->hmac != NULL)
+    gcry_md_close (c->hmac);
+  sfree (c->username);
+  memset (c, 0, sizeof (*c));
+} /* }}} void network_crypto_clear */
+
+static void network_crypto_cache_destroy (void *arg) /* {{{ */
+{
+  network_crypto_cache_t *cache = arg;
+  size_t i;
+
+  for (i = 0; i < NETWORK_CRYPTO_CACHE_SIZE; i++)
+    network_crypto_clear (cache->entries + i);
+  sfree (cache);
+} /* }}} void network_crypto_cache_destroy */
+
+static void network_crypto_cache_init (void) /* {{{ */
+{
+  pthread_key_create (&crypto_cache_key, network_crypto_cache_destroy);
+} /* }}} void network_crypto_cache_init */
+
+/* Sets up the handles of `c' for the user `username' of `se'. */
+static int network_crypto_fill (network_crypto_t *c, /* {{{ */
+    const sockent_t *se, const char *username)
 {
-  gcry_error_t err;
-  gcry_cipher_hd_t *cyper_ptr;
   unsigned char password_hash[32];
+  char *secret;
+  uint64_t generation = 0;
+  gcry_error_t err;
 
   if (se->type == SOCKENT_TYPE_CLIENT)
   {
-	  cyper_ptr = &se->data.client.cypher;
-	  memcpy (password_hash, se->data.client.password_hash,
-			  sizeof (password_hash));
+    secret = strdup (se->data.client.password);
+    memcpy (password_hash, se->data.client.password_hash,
+        sizeof (password_hash));
   }
   else
   {
-	  char *secret;
+    if ((username == NULL) || (se->data.server.userdb == NULL))
+      return (-1);
 
-	  cyper_ptr = &se->data.server.cypher;
+    generation = fbh_generation (se->data.server.userdb);
+    secret = fbh_get (se->data.server.userdb, username);
+    if (secret == NULL)
+      return (-1);
 
-	  if (username == NULL)
-		  return (NULL);
+    gcry_md_hash_buffer (GCRY_MD_SHA256, password_hash,
+        secret, strlen (secret));
+  }
 
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
-		  return (NULL);
+  if (secret == NULL)
+    return (-1);
 
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
+  c->se = se;
+  c->username = strdup ((username != NULL) ? username : "");
+  c->generation = generation;
+  c->checked = cdtime ();
+
+  err = gcry_cipher_open (&c->cypher,
+      GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
+  if (err == 0)
+    err = gcry_cipher_setkey (c->cypher,
+        password_hash, sizeof (password_hash));
+  if (err == 0)
+    err = gcry_md_open (&c->hmac, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+  if (err == 0)
+    err = gcry_md_setkey (c->hmac, secret, strlen (secret));
 
-	  sfree (secret);
-  }
+  sfree (secret);
 
-  if (*cyper_ptr == NULL)
+  if ((err != 0) || (c->username == NULL))
   {
-    err = gcry_cipher_open (cyper_ptr,
-        GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
     if (err != 0)
-    {
-      ERROR ("network plugin: gcry_cipher_open returned: %s",
+      ERROR ("network plugin: Setting up the keys failed: %s",
           gcry_strerror (err));
-      *cyper_ptr = NULL;
-      return (NULL);
-    }
-  }
-  else
-  {
-    gcry_cipher_reset (*cyper_ptr);
-  }
-  assert (*cyper_ptr != NULL);
-
-  err = gcry_cipher_setkey (*cyper_ptr,
-      password_hash, sizeof (password_hash));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
-        gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
-    return (NULL);
-  }
-
-  err = gcry_cipher_setiv (*cyper_ptr, iv, iv_size);
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
-        gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
-    return (NULL);
+    network_crypto_clear (c);
+    return (-1);
   }
 
-  return (*cyper_ptr);
-} /* }}} int network_get_aes256_cypher */
-#endif /* HAVE_LIBGCRYPT */
-
-static int write_part_values (char **ret_buffer, int *ret_buffer_len,
-		const data_set_t *ds, const value_list_t *vl)
-{
-	char *packet_ptr;
-	int packet_len;
-	int num_values;
-
-	part_header_t pkg_ph;
-	uint16_t      pkg_num_values;
-	uint8_t      *pkg_values_types;
-	value_t      *pkg_values;
-
-	int offset;
-	int i;
-
-	num_values = vl->values_len;
-	packet_len = sizeof (part_header_t) + sizeof (uint16_t)
-		+ (num_values * sizeof (uint8_t))
-		+ (num_values * sizeof (value_t));
-
-	if (*ret_buffer_len < packet_len)
-		return (-1);
-
-	pkg_values_types = (uint8_t *) malloc (num_values * sizeof (uint8_t));
-	if (pkg_values_types == NULL)
-	{
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
-
-	pkg_values = (value_t *) malloc (num_values * sizeof (value_t));
-	if (pkg_values == NULL)
-	{
-		free (pkg_values_types);
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
-
-	pkg_ph.type = htons (TYPE_VALUES);
-	pkg_ph.length = htons (packet_len);
-
-	pkg_num_values = htons ((uint16_t) vl->values_len);
-
-	for (i = 0; i < num_values; i++)
-	{
-		pkg_values_types[i] = (uint8_t) ds->ds[i].type;
-		switch (ds->ds[i].type)
-		{
-			case DS_TYPE_COUNTER:
-				pkg_values[i].counter = htonll (vl->values[i].counter);
-				break;
-
-			case DS_TYPE_GAUGE:
-				pkg_values[i].gauge = htond (vl->values[i].gauge);
-				break;
-
-			case DS_TYPE_DERIVE:
-				pkg_values[i].derive = htonll (vl->values[i].derive);
-				break;
-
-			case DS_TYPE_ABSOLUTE:
-				pkg_values[i].absolute = htonll (vl->values[i].absolute);
-				break;
-
-			default:
-				free (pkg_values_types);
-				free (pkg_values);
-				ERROR ("network plugin: write_part_values: "
-						"Unknown data source type: %i",
-						ds->ds[i].type);
-				return (-1);
-		} /* switch (ds->ds[i].type) */
-	} /* for (num_values) */
-
-	/*
-	 * Use `memcpy' to write everything to the buffer, because the pointer
-	 * may be unaligned and some architectures, such as SPARC, can't handle
-	 * that.
-	 */
-	packet_ptr = *ret_buffer;
-	offset = 0;
-	memcpy (packet_ptr + offset, &pkg_ph, sizeof (pkg_ph));
-	offset += sizeof (pkg_ph);
-	memcpy (packet_ptr + offset, &pkg_num_values, sizeof (pkg_num_values));
-	offset += sizeof (pkg_num_values);
-	memcpy (packet_ptr + offset, pkg_values_types, num_values * sizeof (uint8_t));
-	offset += num_values * sizeof (uint8_t);
-	memcpy (packet_ptr + offset, pkg_values, num_values * sizeof (value_t));
-	offset += num_values * sizeof (value_t);
-
-	assert (offset == packet_len);
-
-	*ret_buffer = packet_ptr + packet_len;
-	*ret_buffer_len -= packet_len;
-
-	free (pkg_values_types);
-	free (pkg_values);
-
-	return (0);
-} /* int write_part_values */
+  return (0);
+} /* }}} int network_crypto_fill */
 
-static int write_part_number (char **ret_buffer, int *ret_buffer_len,
-		int type, uint64_t value)
+/* Returns the handles of the calling thread for the user `username' of `se'.
+ * The username is ignored for client sockets. */
+static network_crypto_t *network_crypto_get (const sockent_t *se, /* {{{ */
+    const char *username)
 {
-	char *packet_ptr;
-	int packet_len;
+  network_crypto_cache_t *cache;
+  network_crypto_t *c;
+  network_crypto_t tmp;
+  size_t i;
 
-	part_header_t pkg_head;
-	uint64_t pkg_value;
+  pthread_once (&crypto_cache_once, network_crypto_cache_init);
 
-	int offset;
+  cache = pthread_getspecific (crypto_cache_key);
+  if (cache == NULL)
+  {
+    cache = calloc (1, sizeof (*cache));
+    if (cache == NULL)
+      return (NULL);
+    pthread_setspecific (crypto_cache_key, cache);
+  }
 
-	packet_len = sizeof (pkg_head) + sizeof (pkg_value);
+  if (se->type == SOCKENT_TYPE_CLIENT)
+    username = NULL;
+  else if (username == NULL)
+    return (NULL);
 
-	if (*ret_buffer_len < packet_len)
-		return (-1);
+  for (i = 0; i < NETWORK_CRYPTO_CACHE_SIZE; i++)
+  {
+    c = cache->entries + i;
+    if ((c->se != se)
+        || ((username != NULL) && (strcmp (c->username, username) != 0)))
+      continue;
 
-	pkg_head.type = htons (type);
-	pkg_head.length = htons (packet_len);
-	pkg_value = htonll (value);
+    /* Stat the user DB at most once per second. */
+    if ((se->type == SOCKENT_TYPE_SERVER)
+        && ((cdtime () - c->checked) >= TIME_T_TO_CDTIME_T (1)))
+    {
+      c->checked = cdtime ();
+      if (fbh_generation (se->data.server.userdb) != c->generation)
+      {
+        /* If the user is gone from the DB, the old key must not be used
+         * any longer either. */
+        memset (&tmp, 0, sizeof (tmp));
+        if (network_crypto_fill (&tmp, se, username) != 0)
+        {
+          network_crypto_clear (c);
+          return (NULL);
+        }
+        network_crypto_clear (c);
+        memcpy (c, &tmp, sizeof (*c));
+      }
+    }
 
-	packet_ptr = *ret_buffer;
-	offset = 0;
-	memcpy (packet_ptr + offset, &pkg_head, sizeof (pkg_head));
-	offset += sizeof (pkg_head);
-	memcpy (packet_ptr + offset, &pkg_value, sizeof (pkg_value));
-	offset += sizeof (pkg_value);
+    return (c);
+  }
 
-	assert (offset == packet_len);
+  /* Set up the handles before evicting an entry, so that packets with
+   * unknown usernames don't push valid keys out of the cache. */
+  memset (&tmp, 0, sizeof (tmp));
+  if (network_crypto_fill (&tmp, se, username) != 0)
+    return (NULL);
 
-	*ret_buffer = packet_ptr + packet_len;
-	*ret_buffer_len -= packet_len;
+  c = cache->entries + cache->next;
+  cache->next = (cache->next + 1) % NETWORK_CRYPTO_CACHE_SIZE;
+  network_crypto_clear (c);
+  memcpy (c, &tmp, sizeof (*c));
 
-	return (0);
-} /* int write_part_number */
+  return (c);
+} /* }}} network_crypto_t *network_crypto_get */
 
-static int write_part_string (char **ret_buffer, int *ret_buffer_len,
-		int type, const char *str, int str_len)
+static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
+    const void *iv, size_t iv_size, const char *username)
 {
-	char *buffer;
-	int buffer_len;
-
-	uint16_t pkg_type;
-	uint16_t pkg_length;
-
-	int offset;
-
-	buffer_len = 2 * sizeof (uint16_t) + str_len + 1;
-	if (*ret_buffer_len < buffer_len)
-		return (-1);
-
-	pkg_type = htons (type);
-	pkg_length = htons (buffer_len);
-
-	buffer = *ret_buffer;
-	offset = 0;
-	memcpy (buffer + offset, (void *) &pkg_type, sizeof (pkg_type));
-	offset += sizeof (pkg_type);
-	memcpy (buffer + offset, (void *) &pkg_length, sizeof (pkg_length));
-	offset += sizeof (pkg_length);
-	memcpy (buffer + offset, str, str_len);
-	offset += str_len;
-	memset (buffer + offset, '\0', 1);
-	offset += 1;
+  network_crypto_t *c;
+  gcry_error_t err;
 
-	assert (offset == buffer_len);
+  c = network_crypto_get (se, username);
+  if (c == NULL)
+    return (NULL);
 
-	*ret_buffer = buffer + buffer_len;
-	*ret_buffer_len -= buffer_len;
+  /* Resetting keeps the key schedule, so only the IV has to be set. */
+  gcry_cipher_reset (c->cypher);
+  err = gcry_cipher_setiv (c->cypher, iv, iv_size);
+  if (err != 0)
+  {
+    ERROR ("network plugin: gcry_cipher_setiv returned: %s",
+        gcry_strerror (err));
+    network_crypto_clear (c);
+    return (NULL);
+  }
 
-	return (0);
-} /* int write_part_string */
+  return (c->cypher);
+} /* }}} int network_get_aes256_cypher */
+#endif /* HAVE_LIBGCRYPT */
 
 static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		value_t **ret_values, int *ret_num_values)
@@ -978,7 +1075,9 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
 } /* int parse_part_string */
 
 /* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
- * parse_packet and vice versa. */
+ * parse_packet and vice versa. They set `ret_payload_status' if the signed or
+ * encrypted payload could not be parsed, so that parse errors are only
+ * counted once, by the outermost parse_packet. */
 #define PP_SIGNED    0x01
 #define PP_ENCRYPTED 0x02
 static int parse_packet (sockent_t *se,
@@ -992,7 +1091,8 @@ static int parse_packet (sockent_t *se,
 
 #if HAVE_LIBGCRYPT
 static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_len, int flags)
+    void **ret_buffer, size_t *ret_buffer_len, int flags,
+    int *ret_payload_status)
 {
   static c_complain_t complain_no_users = C_COMPLAIN_INIT_STATIC;
 
@@ -1001,14 +1101,12 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof (pss.hash)];
 
-  gcry_md_hd_t hd;
-  gcry_error_t err;
+  network_crypto_t *crypto;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -1055,67 +1153,42 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == pss_head_length);
 
-  /* Query the password */
-  secret = fbh_get (se->data.server.userdb, pss.username);
-  if (secret == NULL)
+  /* Get the HMAC handle of the user, with the password set as key */
+  crypto = network_crypto_get (se, pss.username);
+  if (crypto == NULL)
   {
     ERROR ("network plugin: Unknown user: %s", pss.username);
     sfree (pss.username);
     return (-ENOENT);
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
-        gcry_strerror (err));
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  err = gcry_md_setkey (hd, secret, strlen (secret));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
-    gcry_md_close (hd);
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  gcry_md_write (hd,
+  /* Resetting the handle keeps the key. */
+  gcry_md_reset (crypto->hmac);
+  gcry_md_write (crypto->hmac,
       buffer     + PART_SIGNATURE_SHA256_SIZE,
       buffer_len - PART_SIGNATURE_SHA256_SIZE);
-  hash_ptr = gcry_md_read (hd, GCRY_MD_SHA256);
+  hash_ptr = gcry_md_read (crypto->hmac, GCRY_MD_SHA256);
   if (hash_ptr == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
   memcpy (hash, hash_ptr, sizeof (hash));
 
-  /* Clean up */
-  gcry_md_close (hd);
-  hd = NULL;
-
   if (memcmp (pss.hash, hash, sizeof (pss.hash)) != 0)
   {
     WARNING ("network plugin: Verifying HMAC-SHA-256 signature failed: "
         "Hash mismatch.");
+    STATS_INC (stats_dispatch.signature_errors);
   }
   else
   {
-    parse_packet (se, buffer + buffer_offset, buffer_len - buffer_offset,
-        flags | PP_SIGNED, pss.username);
+    if (parse_packet (se, buffer + buffer_offset, buffer_len - buffer_offset,
+          flags | PP_SIGNED, pss.username) != 0)
+      *ret_payload_status = -1;
   }
 
-  sfree (secret);
   sfree (pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1127,7 +1200,8 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 
 #else /* if !HAVE_LIBGCRYPT */
 static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_size, int flags)
+    void **ret_buffer, size_t *ret_buffer_size, int flags,
+    int *ret_payload_status)
 {
   static int warning_has_been_printed = 0;
 
@@ -1161,8 +1235,9 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
     warning_has_been_printed = 1;
   }
 
-  parse_packet (se, buffer + part_len, buffer_size - part_len, flags,
-      /* username = */ NULL);
+  if (parse_packet (se, buffer + part_len, buffer_size - part_len,
+        flags | PP_SIGNED, /* username = */ NULL) != 0)
+    *ret_payload_status = -1;
 
   *ret_buffer = buffer + buffer_size;
   *ret_buffer_size = 0;
@@ -1174,7 +1249,7 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 #if HAVE_LIBGCRYPT
 static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 		void **ret_buffer, size_t *ret_buffer_len,
-		int flags)
+		int flags, int *ret_payload_status)
 {
   char  *buffer = *ret_buffer;
   size_t buffer_len = *ret_buffer_len;
@@ -1280,8 +1355,9 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
     return (-1);
   }
 
-  parse_packet (se, buffer + buffer_offset, payload_len,
-      flags | PP_ENCRYPTED, pea.username);
+  if (parse_packet (se, buffer + buffer_offset, payload_len,
+        flags | PP_ENCRYPTED, pea.username) != 0)
+    *ret_payload_status = -1;
 
   /* XXX: Free pea.username?!? */
 
@@ -1297,7 +1373,8 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 
 #else /* if !HAVE_LIBGCRYPT */
 static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_size, int flags)
+    void **ret_buffer, size_t *ret_buffer_size, int flags,
+    int __attribute__((unused)) *ret_payload_status)
 {
   static int warning_has_been_printed = 0;
 
@@ -1349,6 +1426,9 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		const char *username)
 {
 	int status;
+	_Bool crypto_failed = 0;
+	/* Set if a signed or encrypted payload could not be parsed. */
+	int payload_status = 0;
 
 	value_list_t vl = VALUE_LIST_INIT;
 	notification_t n;
@@ -1389,12 +1469,15 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		if (pkg_type == TYPE_ENCR_AES256)
 		{
 			status = parse_part_encr_aes256 (se,
-					&buffer, &buffer_size, flags);
+					&buffer, &buffer_size, flags,
+					&payload_status);
 			if (status != 0)
 			{
 				ERROR ("network plugin: Decrypting AES256 "
 						"part failed "
 						"with status %i.", status);
+				STATS_INC (stats_dispatch.decrypt_errors);
+				crypto_failed = 1;
 				break;
 			}
 		}
@@ -1415,12 +1498,15 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		else if (pkg_type == TYPE_SIGN_SHA256)
 		{
 			status = parse_part_sign_sha256 (se,
-                                        &buffer, &buffer_size, flags);
+                                        &buffer, &buffer_size, flags,
+					&payload_status);
 			if (status != 0)
 			{
 				ERROR ("network plugin: Verifying HMAC-SHA-256 "
 						"signature failed "
 						"with status %i.", status);
+				STATS_INC (stats_dispatch.signature_errors);
+				crypto_failed = 1;
 				break;
 			}
 		}
@@ -1446,7 +1532,11 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			if (status != 0)
 				break;
 
-			network_dispatch_values (&vl, username);
+			if (se->data.server.replay != NULL)
+				network_replay_dispatch_values (se->data.server.replay,
+						&vl, username);
+			else
+				network_dispatch_values (&vl, username);
 
 			sfree (vl.values);
 		}
@@ -1584,6 +1674,17 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		WARNING ("network plugin: parse_packet: Received truncated "
 				"packet, try increasing `MaxPacketSize'");
 
+	/* Crypto failures are counted separately. A parse error in a signed
+	 * or encrypted payload is handed up to the outermost call, which
+	 * counts it once for the whole packet. */
+	if (crypto_failed)
+		status = 0;
+	else if (status == 0)
+		status = payload_status;
+
+	if ((status != 0) && ((flags & (PP_SIGNED | PP_ENCRYPTED)) == 0))
+		STATS_INC (stats_dispatch.parse_errors);
+
 	return (status);
 } /* }}} int parse_packet */
 
@@ -1598,8 +1699,6 @@ static void free_sockent_client (struct sockent_client *sec) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (sec->username);
   sfree (sec->password);
-  if (sec->cypher != NULL)
-    gcry_cipher_close (sec->cypher);
 #endif
 } /* }}} void free_sockent_client */
 
@@ -1617,11 +1716,14 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
   }
 
   sfree (ses->fd);
+  if (ses->replay != NULL)
+  {
+    sfree (ses->replay->file);
+    sfree (ses->replay);
+  }
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1988,11 +2090,11 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 	{
 		se->type = SOCKENT_TYPE_SERVER;
 		se->data.server.fd = NULL;
+		se->data.server.replay = NULL;
 #if HAVE_LIBGCRYPT
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
 #endif
 	}
 	else
@@ -2003,27 +2105,15 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.client.security_level = SECURITY_LEVEL_NONE;
 		se->data.client.username = NULL;
 		se->data.client.password = NULL;
-		se->data.client.cypher = NULL;
 #endif
 	}
 
 	return (0);
 } /* }}} int sockent_init */
 
-/* Open the file descriptors for a initialized sockent structure. */
-static int sockent_open (sockent_t *se) /* {{{ */
+/* Set up the security structures of an initialized sockent structure. */
+static int sockent_init_crypto (sockent_t *se) /* {{{ */
 {
-	struct addrinfo  ai_hints;
-	struct addrinfo *ai_list, *ai_ptr;
-	int              ai_return;
-
-        const char *node;
-        const char *service;
-
-	if (se == NULL)
-		return (-1);
-
-	/* Set up the security structures. */
 #if HAVE_LIBGCRYPT /* {{{ */
 	if (se->type == SOCKENT_TYPE_CLIENT)
 	{
@@ -2070,6 +2160,26 @@ static int sockent_open (sockent_t *se) /* {{{ */
 	}
 #endif /* }}} HAVE_LIBGCRYPT */
 
+	return (0);
+} /* }}} int sockent_init_crypto */
+
+/* Open the file descriptors for a initialized sockent structure. */
+static int sockent_open (sockent_t *se) /* {{{ */
+{
+	struct addrinfo  ai_hints;
+	struct addrinfo *ai_list, *ai_ptr;
+	int              ai_return;
+
+        const char *node;
+        const char *service;
+
+	if (se == NULL)
+		return (-1);
+
+	/* Set up the security structures. */
+	if (sockent_init_crypto (se) != 0)
+		return (-1);
+
         node = se->node;
         service = se->service;
 
@@ -2206,6 +2316,7 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	if (se->type == SOCKENT_TYPE_SERVER)
 	{
 		struct pollfd *tmp;
+		sockent_t **sockent_tmp;
 		size_t i;
 
 		tmp = realloc (listen_sockets_pollfd,
@@ -2219,12 +2330,24 @@ static int sockent_add (sockent_t *se) /* {{{ */
 		listen_sockets_pollfd = tmp;
 		tmp = listen_sockets_pollfd + listen_sockets_num;
 
+		sockent_tmp = realloc (listen_sockets_sockent,
+				sizeof (*sockent_tmp) * (listen_sockets_num
+					+ se->data.server.fd_num));
+		if (sockent_tmp == NULL)
+		{
+			ERROR ("network plugin: realloc failed.");
+			return (-1);
+		}
+		listen_sockets_sockent = sockent_tmp;
+		sockent_tmp = listen_sockets_sockent + listen_sockets_num;
+
 		for (i = 0; i < se->data.server.fd_num; i++)
 		{
 			memset (tmp + i, 0, sizeof (*tmp));
 			tmp[i].fd = se->data.server.fd[i];
 			tmp[i].events = POLLIN | POLLPRI;
 			tmp[i].revents = 0;
+			sockent_tmp[i] = se;
 		}
 
 		listen_sockets_num += se->data.server.fd_num;
@@ -2253,58 +2376,38 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_add */
 
-static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
+static void *dispatch_thread (void *arg) /* {{{ */
 {
+  receive_queue_t *q = arg;
+
   while (42)
   {
     receive_list_entry_t *ent;
-    sockent_t *se;
 
     /* Lock and wait for more data to come in */
-    pthread_mutex_lock (&receive_list_lock);
+    pthread_mutex_lock (&q->lock);
     while ((listen_loop == 0)
-        && (receive_list_head == NULL))
-      pthread_cond_wait (&receive_list_cond, &receive_list_lock);
+        && (q->head == NULL))
+      pthread_cond_wait (&q->cond, &q->lock);
 
     /* Remove the head entry and unlock */
-    ent = receive_list_head;
+    ent = q->head;
     if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock (&receive_list_lock);
+    {
+      q->head = ent->next;
+      q->length--;
+    }
+    pthread_mutex_unlock (&q->lock);
 
     /* Check whether we are supposed to exit. We do NOT check `listen_loop'
      * because we dispatch all missing packets before shutting down. */
     if (ent == NULL)
       break;
 
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL)
-    {
-      size_t i;
-
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
-
-      if (i < se->data.server.fd_num)
-        break;
-
-      se = se->next;
-    }
-
-    if (se == NULL)
-    {
-      ERROR ("network plugin: Got packet from FD %i, but can't "
-          "find an appropriate socket entry.",
-          ent->fd);
-      sfree (ent->data);
-      sfree (ent);
-      continue;
-    }
+    STATS_INC (stats_dispatch.queue_latency[latency_bucket (cdtime ()
+          - ent->received)]);
 
-    parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
+    parse_packet (ent->se, ent->data, ent->data_len, /* flags = */ 0,
 	/* username = */ NULL);
     sfree (ent->data);
     sfree (ent);
@@ -2313,61 +2416,221 @@ static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
   return (NULL);
 } /* }}} void *dispatch_thread */
 
-static int network_receive (void) /* {{{ */
+/* Appends the list `head' ... `tail' to the queue `q'. The caller must hold
+ * the lock of `q'. */
+static void receive_queue_append (receive_queue_t *q, /* {{{ */
+    receive_list_entry_t *head, receive_list_entry_t *tail, uint64_t length)
 {
-	char buffer[network_config_packet_size];
-	int  buffer_len;
+  assert (((q->head == NULL) && (q->length == 0))
+      || ((q->head != NULL) && (q->length != 0)));
 
-	int i;
-	int status;
+  if (q->head == NULL)
+    q->head = head;
+  else
+    q->tail->next = head;
+  q->tail = tail;
+  q->length += length;
 
-	receive_list_entry_t *private_list_head;
-	receive_list_entry_t *private_list_tail;
-	uint64_t              private_list_length;
+  pthread_cond_signal (&q->cond);
+} /* }}} void receive_queue_append */
 
-        assert (listen_sockets_num > 0);
+/* Returns the queue responsible for packets from `src'. */
+static size_t receive_queue_index (const struct sockaddr_storage *src, /* {{{ */
+    socklen_t src_len)
+{
+  const unsigned char *ptr = (const unsigned char *) src;
+  uint32_t hash = 2166136261U;
+  socklen_t i;
 
-	private_list_head = NULL;
-	private_list_tail = NULL;
-	private_list_length = 0;
+  if (receive_queues_num < 2)
+    return (0);
 
-	while (listen_loop == 0)
-	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+  /* FNV-1a over the address and port */
+  for (i = 0; i < src_len; i++)
+  {
+    hash ^= (uint32_t) ptr[i];
+    hash *= 16777619U;
+  }
 
-		if (status <= 0)
-		{
-			char errbuf[1024];
-			if (errno == EINTR)
-				continue;
-			ERROR ("poll failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			return (-1);
-		}
+  return ((size_t) (hash % receive_queues_num));
+} /* }}} size_t receive_queue_index */
 
-		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
-		{
-			receive_list_entry_t *ent;
+static void network_capture_close (void) /* {{{ */
+{
+	int status;
 
-			if ((listen_sockets_pollfd[i].revents
+	if (capture == NULL)
+		return;
+
+	status = c_pcap_close (capture);
+	capture = NULL;
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Writing the capture file \"%s\" "
+				"failed: %s", network_config_capture_file,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	INFO ("network plugin: Captured %"PRIu64" packets to \"%s\".",
+			capture_packets, network_config_capture_file);
+} /* }}} void network_capture_close */
+
+static int network_capture_open (void) /* {{{ */
+{
+	size_t i;
+
+	capture_local = calloc (listen_sockets_num, sizeof (*capture_local));
+	if (capture_local == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < listen_sockets_num; i++)
+	{
+		socklen_t len = sizeof (capture_local[i]);
+
+		if (getsockname (listen_sockets_pollfd[i].fd,
+					(struct sockaddr *) &capture_local[i],
+					&len) != 0)
+			memset (&capture_local[i], 0, sizeof (capture_local[i]));
+	}
+
+	capture = c_pcap_open_write (network_config_capture_file);
+	if (capture == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Opening the capture file \"%s\" "
+				"failed: %s", network_config_capture_file,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (capture_local);
+		return (-1);
+	}
+
+	capture_packets = 0;
+	INFO ("network plugin: Capturing received packets to \"%s\".",
+			network_config_capture_file);
+	return (0);
+} /* }}} int network_capture_open */
+
+/* Appends a received packet to the capture file. Called by the receive thread
+ * only. */
+static void network_capture_packet (size_t index, /* {{{ */
+		const char *buffer, size_t buffer_len,
+		const struct sockaddr_storage *src)
+{
+	const struct sockaddr *dst;
+	int status;
+
+	dst = (const struct sockaddr *) &capture_local[index];
+	if (dst->sa_family != src->ss_family)
+		dst = NULL;
+
+	status = c_pcap_write_udp (capture, CDTIME_T_TO_DOUBLE (cdtime ()),
+			(const struct sockaddr *) src, dst, buffer, buffer_len);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Writing to the capture file failed, "
+				"stopping the capture: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		network_capture_close ();
+		return;
+	}
+
+	capture_packets++;
+	if ((network_config_capture_limit > 0)
+			&& (capture_packets >= (uint64_t) network_config_capture_limit))
+		network_capture_close ();
+} /* }}} void network_capture_packet */
+
+static int network_receive (void) /* {{{ */
+{
+	char buffer[network_config_packet_size];
+	int  buffer_len;
+
+	int i;
+	int status;
+
+	/* Packets not yet handed to the dispatch threads, one list per queue */
+	struct
+	{
+		receive_list_entry_t *head;
+		receive_list_entry_t *tail;
+		uint64_t length;
+	} *private_lists;
+	size_t q;
+
+	struct sockaddr_storage src;
+	socklen_t               src_len;
+
+	/* Milliseconds to wait for the next packet, -1 while no packets are
+	 * waiting in `private_lists'. */
+	int poll_timeout = -1;
+	_Bool timed_out;
+
+        assert (listen_sockets_num > 0);
+        assert (receive_queues_num > 0);
+
+	private_lists = calloc (receive_queues_num, sizeof (*private_lists));
+	if (private_lists == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
+		return (-1);
+	}
+
+	while (listen_loop == 0)
+	{
+		status = poll (listen_sockets_pollfd, listen_sockets_num,
+				poll_timeout);
+
+		if (status < 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("poll failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			sfree (private_lists);
+			return (-1);
+		}
+		timed_out = (status == 0);
+
+		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
+		{
+			receive_list_entry_t *ent;
+
+			if ((listen_sockets_pollfd[i].revents
 						& (POLLIN | POLLPRI)) == 0)
 				continue;
 			status--;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
+			src_len = sizeof (src);
+			buffer_len = recvfrom (listen_sockets_pollfd[i].fd,
 					buffer, sizeof (buffer),
-					0 /* no flags */);
+					0 /* no flags */,
+					(struct sockaddr *) &src, &src_len);
 			if (buffer_len < 0)
 			{
 				char errbuf[1024];
 				ERROR ("recv failed: %s",
 						sstrerror (errno, errbuf,
 							sizeof (errbuf)));
+				sfree (private_lists);
 				return (-1);
 			}
 
-			stats_octets_rx += ((uint64_t) buffer_len);
-			stats_packets_rx++;
+			stats_receive.octets_rx += (derive_t) buffer_len;
+			stats_receive.packets_rx++;
+			listen_sockets_sockent[i]->data.server.stats_octets_rx
+				+= (derive_t) buffer_len;
+			listen_sockets_sockent[i]->data.server.stats_packets_rx++;
+
+			if (capture != NULL)
+				network_capture_packet ((size_t) i, buffer,
+						(size_t) buffer_len, &src);
 
 			/* TODO: Possible performance enhancement: Do not free
 			 * these entries in the dispatch thread but put them in
@@ -2377,6 +2640,7 @@ static int network_receive (void) /* {{{ */
 			if (ent == NULL)
 			{
 				ERROR ("network plugin: malloc failed.");
+				sfree (private_lists);
 				return (-1);
 			}
 			memset (ent, 0, sizeof (receive_list_entry_t));
@@ -2385,65 +2649,74 @@ static int network_receive (void) /* {{{ */
 			{
 				sfree (ent);
 				ERROR ("network plugin: malloc failed.");
+				sfree (private_lists);
 				return (-1);
 			}
-			ent->fd = listen_sockets_pollfd[i].fd;
+			ent->se = listen_sockets_sockent[i];
+			ent->received = cdtime ();
 			ent->next = NULL;
 
 			memcpy (ent->data, buffer, buffer_len);
 			ent->data_len = buffer_len;
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
+			q = receive_queue_index (&src, src_len);
+			if (private_lists[q].head == NULL)
+				private_lists[q].head = ent;
 			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+				private_lists[q].tail->next = ent;
+			private_lists[q].tail = ent;
+			private_lists[q].length++;
+		} /* for (listen_sockets_pollfd) */
 
-			/* Do not block here. Blocking here has led to
-			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
+		/* Hand the packets over to the dispatch threads. Do not block
+		 * here: Blocking here has led to insufficient performance in
+		 * the past. Lists whose queue is busy are retried after the
+		 * next packet or, if none arrives, after a short timeout. Once
+		 * that timeout expired or a list has grown long, wait for the
+		 * lock so that no packet is held back indefinitely. */
+		poll_timeout = -1;
+		for (q = 0; q < receive_queues_num; q++)
+		{
+			if (private_lists[q].head == NULL)
+				continue;
+
+			if (timed_out || (private_lists[q].length
+						>= RECEIVE_LIST_BLOCK_LENGTH))
+				pthread_mutex_lock (&receive_queues[q].lock);
+			else if (pthread_mutex_trylock (&receive_queues[q].lock) != 0)
 			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
-				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
-
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
-
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
+				poll_timeout = RECEIVE_LIST_BLOCK_TIMEOUT;
+				continue;
 			}
-		} /* for (listen_sockets_pollfd) */
+
+			receive_queue_append (receive_queues + q,
+					private_lists[q].head,
+					private_lists[q].tail,
+					private_lists[q].length);
+			pthread_mutex_unlock (&receive_queues[q].lock);
+
+			private_lists[q].head = NULL;
+			private_lists[q].tail = NULL;
+			private_lists[q].length = 0;
+		}
 	} /* while (listen_loop == 0) */
 
 	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
+	for (q = 0; q < receive_queues_num; q++)
 	{
-		pthread_mutex_lock (&receive_list_lock);
-
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
-
-		private_list_head = NULL;
-		private_list_tail = NULL;
-		private_list_length = 0;
+		if (private_lists[q].head == NULL)
+			continue;
 
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
+		pthread_mutex_lock (&receive_queues[q].lock);
+		receive_queue_append (receive_queues + q,
+				private_lists[q].head,
+				private_lists[q].tail,
+				private_lists[q].length);
+		pthread_mutex_unlock (&receive_queues[q].lock);
 	}
 
+	sfree (private_lists);
+
 	return (0);
 } /* }}} int network_receive */
 
@@ -2452,6 +2725,161 @@ static void *receive_thread (void __attribute__((unused)) *arg)
 	return (network_receive () ? (void *) 1 : (void *) 0);
 } /* void *receive_thread */
 
+/* Feeds the packets of one capture file through `parse_packet', either as fast
+ * as possible or, if `Speed' has been set, paced like the original traffic,
+ * and logs the throughput and the time spent in each stage. */
+static int network_replay (sockent_t *se) /* {{{ */
+{
+	network_replay_t *r = se->data.server.replay;
+	c_pcap_t *pcap;
+	char *buffer = NULL;
+	size_t buffer_size = 0;
+	double first_time = -1.0;
+	cdtime_t start;
+	cdtime_t fed;
+	cdtime_t drained;
+	int status = 0;
+
+	pcap = c_pcap_open_read (r->file);
+	if (pcap == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Opening the capture file \"%s\" failed: %s",
+				r->file, sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	r->packets = 0;
+	r->values = 0;
+	r->parse_time = 0;
+	r->dispatch_time = 0;
+	memset (r->latency, 0, sizeof (r->latency));
+
+	INFO ("network plugin: Replaying \"%s\".", r->file);
+
+	start = cdtime ();
+	while (listen_loop == 0)
+	{
+		const void *payload;
+		size_t payload_size;
+		double time;
+		cdtime_t packet_start;
+		cdtime_t packet_time;
+
+		status = c_pcap_read_udp (pcap, &time, &payload, &payload_size);
+		if (status != 0)
+			break;
+
+		if (r->speed > 0.0)
+		{
+			cdtime_t target;
+
+			if (first_time < 0.0)
+				first_time = time;
+			target = start + DOUBLE_TO_CDTIME_T ((time - first_time) / r->speed);
+
+			while ((listen_loop == 0) && (cdtime () < target))
+			{
+				cdtime_t wait = target - cdtime ();
+				struct timespec ts;
+
+				/* Wake up regularly to notice a shutdown. */
+				if (wait > TIME_T_TO_CDTIME_T (1))
+					wait = TIME_T_TO_CDTIME_T (1);
+				CDTIME_T_TO_TIMESPEC (wait, &ts);
+				nanosleep (&ts, /* remaining = */ NULL);
+			}
+		}
+
+		/* Decryption works in place, so the payload has to be copied. */
+		if (payload_size > buffer_size)
+		{
+			char *tmp = realloc (buffer, payload_size);
+			if (tmp == NULL)
+			{
+				ERROR ("network plugin: realloc failed.");
+				status = ENOMEM;
+				break;
+			}
+			buffer = tmp;
+			buffer_size = payload_size;
+		}
+		memcpy (buffer, payload, payload_size);
+
+		r->packet_dispatch_time = 0;
+		packet_start = cdtime ();
+		parse_packet (se, buffer, payload_size, /* flags = */ 0,
+				/* username = */ NULL);
+		packet_time = cdtime () - packet_start;
+
+		r->packets++;
+		r->dispatch_time += r->packet_dispatch_time;
+		if (packet_time > r->packet_dispatch_time)
+			r->parse_time += packet_time - r->packet_dispatch_time;
+
+		r->latency[latency_bucket (packet_time)]++;
+	}
+	fed = cdtime ();
+
+	sfree (buffer);
+	c_pcap_close (pcap);
+
+	if ((status != 0) && (status != ENOENT))
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Reading the capture file \"%s\" failed: %s",
+				r->file, sstrerror (status, errbuf, sizeof (errbuf)));
+	}
+
+	/* Wait for the write threads, so that the end-to-end rate includes the
+	 * value cache and the write plugins. */
+	while ((listen_loop == 0) && (plugin_get_write_queue_length () > 0))
+	{
+		struct timespec ts = { 0, 1000000 };
+		nanosleep (&ts, /* remaining = */ NULL);
+	}
+	drained = cdtime ();
+
+	if (r->packets == 0)
+	{
+		WARNING ("network plugin: \"%s\" does not contain any UDP packets.",
+				r->file);
+		return (-1);
+	}
+
+	INFO ("network plugin: Replayed %"PRIu64" packets with %"PRIu64" values "
+			"from \"%s\" in %.3f seconds (%.0f values/s); "
+			"end-to-end including the write threads: %.3f seconds "
+			"(%.0f values/s).",
+			r->packets, r->values, r->file,
+			CDTIME_T_TO_DOUBLE (fed - start),
+			((double) r->values) / CDTIME_T_TO_DOUBLE (fed - start + 1),
+			CDTIME_T_TO_DOUBLE (drained - start),
+			((double) r->values) / CDTIME_T_TO_DOUBLE (drained - start + 1));
+	INFO ("network plugin: Replay stages: parse %.2f us/packet, "
+			"dispatch %.2f us/value; per-packet latency: "
+			"p50 < %"PRIu64" us, p99 < %"PRIu64" us, p99.9 < %"PRIu64" us.",
+			1000000.0 * CDTIME_T_TO_DOUBLE (r->parse_time) / ((double) r->packets),
+			(r->values > 0)
+			? 1000000.0 * CDTIME_T_TO_DOUBLE (r->dispatch_time) / ((double) r->values)
+			: 0.0,
+			latency_percentile (r->latency, r->packets, 50.0),
+			latency_percentile (r->latency, r->packets, 99.0),
+			latency_percentile (r->latency, r->packets, 99.9));
+
+	return (0);
+} /* }}} int network_replay */
+
+static void *replay_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	sockent_t *se;
+
+	for (se = replay_sockets; (se != NULL) && (listen_loop == 0); se = se->next)
+		network_replay (se);
+
+	return (NULL);
+} /* }}} void *replay_thread */
+
 static void network_init_buffer (void)
 {
 	memset (send_buffer, 0, network_config_packet_size);
@@ -2501,28 +2929,12 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   size_t buffer_offset;
   size_t username_len;
 
-  gcry_md_hd_t hd;
-  gcry_error_t err;
+  network_crypto_t *crypto;
   unsigned char *hash;
 
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC object failed: %s",
-        gcry_strerror (err));
+  crypto = network_crypto_get (se, /* username = */ NULL);
+  if (crypto == NULL)
     return;
-  }
-
-  err = gcry_md_setkey (hd, se->data.client.password,
-      strlen (se->data.client.password));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s",
-        gcry_strerror (err));
-    gcry_md_close (hd);
-    return;
-  }
 
   username_len = strlen (se->data.client.username);
   if (username_len > (BUFF_SIG_SIZE - PART_SIGNATURE_SHA256_SIZE))
@@ -2543,13 +2955,13 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   ps.head.length = htons (PART_SIGNATURE_SHA256_SIZE + username_len);
 
   /* Calculate the hash value. */
-  gcry_md_write (hd, buffer + PART_SIGNATURE_SHA256_SIZE,
+  gcry_md_reset (crypto->hmac);
+  gcry_md_write (crypto->hmac, buffer + PART_SIGNATURE_SHA256_SIZE,
       username_len + in_buffer_size);
-  hash = gcry_md_read (hd, GCRY_MD_SHA256);
+  hash = gcry_md_read (crypto->hmac, GCRY_MD_SHA256);
   if (hash == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
     return;
   }
   memcpy (ps.hash, hash, sizeof (ps.hash));
@@ -2563,9 +2975,6 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
 
   assert (buffer_offset == PART_SIGNATURE_SHA256_SIZE);
 
-  gcry_md_close (hd);
-  hd = NULL;
-
   buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
   networt_send_buffer_plain (se, buffer, buffer_offset);
 } /* }}} void networt_send_buffer_signed */
@@ -2630,7 +3039,7 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   assert (buffer_offset == buffer_size);
 
   cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
-      se->data.client.password);
+      se->data.client.username);
   if (cypher == NULL)
     return;
 
@@ -2671,76 +3080,6 @@ static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
   } /* for (sending_sockets) */
 } /* }}} void network_send_buffer */
 
-static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
-		value_list_t *vl_def,
-		const data_set_t *ds, const value_list_t *vl)
-{
-	char *buffer_orig = buffer;
-
-	if (strcmp (vl_def->host, vl->host) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_HOST,
-					vl->host, strlen (vl->host)) != 0)
-			return (-1);
-		sstrncpy (vl_def->host, vl->host, sizeof (vl_def->host));
-	}
-
-	if (vl_def->time != vl->time)
-	{
-		if (write_part_number (&buffer, &buffer_size, TYPE_TIME_HR,
-					(uint64_t) vl->time))
-			return (-1);
-		vl_def->time = vl->time;
-	}
-
-	if (vl_def->interval != vl->interval)
-	{
-		if (write_part_number (&buffer, &buffer_size, TYPE_INTERVAL_HR,
-					(uint64_t) vl->interval))
-			return (-1);
-		vl_def->interval = vl->interval;
-	}
-
-	if (strcmp (vl_def->plugin, vl->plugin) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN,
-					vl->plugin, strlen (vl->plugin)) != 0)
-			return (-1);
-		sstrncpy (vl_def->plugin, vl->plugin, sizeof (vl_def->plugin));
-	}
-
-	if (strcmp (vl_def->plugin_instance, vl->plugin_instance) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN_INSTANCE,
-					vl->plugin_instance,
-					strlen (vl->plugin_instance)) != 0)
-			return (-1);
-		sstrncpy (vl_def->plugin_instance, vl->plugin_instance, sizeof (vl_def->plugin_instance));
-	}
-
-	if (strcmp (vl_def->type, vl->type) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE,
-					vl->type, strlen (vl->type)) != 0)
-			return (-1);
-		sstrncpy (vl_def->type, ds->type, sizeof (vl_def->type));
-	}
-
-	if (strcmp (vl_def->type_instance, vl->type_instance) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE_INSTANCE,
-					vl->type_instance,
-					strlen (vl->type_instance)) != 0)
-			return (-1);
-		sstrncpy (vl_def->type_instance, vl->type_instance, sizeof (vl_def->type_instance));
-	}
-
-	if (write_part_values (&buffer, &buffer_size, ds, vl) != 0)
-		return (-1);
-
-	return (buffer - buffer_orig);
-} /* }}} int add_to_buffer */
-
 static void flush_buffer (void)
 {
 	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %i",
@@ -2748,8 +3087,8 @@ static void flush_buffer (void)
 
 	network_send_buffer (send_buffer, (size_t) send_buffer_fill);
 
-	stats_octets_tx += ((uint64_t) send_buffer_fill);
-	stats_packets_tx++;
+	stats_send.octets_tx += (derive_t) send_buffer_fill;
+	stats_send.packets_tx++;
 
 	network_init_buffer ();
 }
@@ -2768,11 +3107,8 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	  DEBUG ("network plugin: network_write: "
 	      "NOT sending %s.", name);
 #endif
-	  /* Counter is not protected by another lock and may be reached by
-	   * multiple threads */
-	  pthread_mutex_lock (&stats_lock);
-	  stats_values_not_sent++;
-	  pthread_mutex_unlock (&stats_lock);
+	  /* May be reached by multiple threads at once. */
+	  STATS_INC (stats_send.values_not_sent);
 	  return (0);
 	}
 
@@ -2781,7 +3117,7 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 
 	pthread_mutex_lock (&send_buffer_lock);
 
-	status = add_to_buffer (send_buffer_ptr,
+	status = format_network_value_list (send_buffer_ptr,
 			network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
 			&send_buffer_vl,
 			ds, vl);
@@ -2791,13 +3127,13 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 		send_buffer_fill += status;
 		send_buffer_ptr  += status;
 
-		stats_values_sent++;
+		stats_send.values_sent++;
 	}
 	else
 	{
 		flush_buffer ();
 
-		status = add_to_buffer (send_buffer_ptr,
+		status = format_network_value_list (send_buffer_ptr,
 				network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
 				&send_buffer_vl,
 				ds, vl);
@@ -2807,7 +3143,7 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 			send_buffer_fill += status;
 			send_buffer_ptr  += status;
 
-			stats_values_sent++;
+			stats_send.values_sent++;
 		}
 	}
 
@@ -2883,6 +3219,25 @@ static int network_config_set_ttl (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_set_ttl */
 
+static int network_config_set_dispatch_threads (/* {{{ */
+    const oconfig_item_t *ci)
+{
+  int tmp = 0;
+
+  if (cf_util_get_int (ci, &tmp) != 0)
+    return (-1);
+
+  if (tmp < 1)
+  {
+    WARNING ("network plugin: The `DispatchThreads' config option must be "
+        "positive.");
+    return (-1);
+  }
+
+  network_config_dispatch_threads = tmp;
+  return (0);
+} /* }}} int network_config_set_dispatch_threads */
+
 static int network_config_set_interface (const oconfig_item_t *ci, /* {{{ */
     int *interface)
 {
@@ -3137,6 +3492,83 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_add_server */
 
+static int network_config_add_replay (const oconfig_item_t *ci) /* {{{ */
+{
+  sockent_t *se;
+  network_replay_t *r;
+  int i;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    ERROR ("network plugin: The `%s' config option needs exactly one "
+        "string argument.", ci->key);
+    return (-1);
+  }
+
+  se = malloc (sizeof (*se));
+  r = malloc (sizeof (*r));
+  if ((se == NULL) || (r == NULL))
+  {
+    ERROR ("network plugin: malloc failed.");
+    sfree (se);
+    sfree (r);
+    return (-1);
+  }
+  sockent_init (se, SOCKENT_TYPE_SERVER);
+  memset (r, 0, sizeof (*r));
+  se->data.server.replay = r;
+
+  r->file = strdup (ci->values[0].value.string);
+  if (r->file == NULL)
+  {
+    ERROR ("network plugin: strdup failed.");
+    sockent_destroy (se);
+    return (-1);
+  }
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+#if HAVE_LIBGCRYPT
+    if (strcasecmp ("AuthFile", child->key) == 0)
+      network_config_set_string (child, &se->data.server.auth_file);
+    else if (strcasecmp ("SecurityLevel", child->key) == 0)
+      network_config_set_security_level (child,
+          &se->data.server.security_level);
+    else
+#endif /* HAVE_LIBGCRYPT */
+    if (strcasecmp ("Speed", child->key) == 0)
+      cf_util_get_double (child, &r->speed);
+    else
+    {
+      WARNING ("network plugin: Option `%s' is not allowed here.",
+          child->key);
+    }
+  }
+
+  if (sockent_init_crypto (se) != 0)
+  {
+    ERROR ("network plugin: network_config_add_replay: "
+        "sockent_init_crypto failed.");
+    sockent_destroy (se);
+    return (-1);
+  }
+
+  /* Keep the order of the config file. */
+  if (replay_sockets == NULL)
+    replay_sockets = se;
+  else
+  {
+    sockent_t *last = replay_sockets;
+    while (last->next != NULL)
+      last = last->next;
+    last->next = se;
+  }
+
+  return (0);
+} /* }}} int network_config_add_replay */
+
 static int network_config (oconfig_item_t *ci) /* {{{ */
 {
   int i;
@@ -3153,10 +3585,18 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
       network_config_set_ttl (child);
     else if (strcasecmp ("MaxPacketSize", child->key) == 0)
       network_config_set_buffer_size (child);
+    else if (strcasecmp ("DispatchThreads", child->key) == 0)
+      network_config_set_dispatch_threads (child);
     else if (strcasecmp ("Forward", child->key) == 0)
       network_config_set_boolean (child, &network_config_forward);
     else if (strcasecmp ("ReportStats", child->key) == 0)
       network_config_set_boolean (child, &network_config_stats);
+    else if (strcasecmp ("CaptureFile", child->key) == 0)
+      cf_util_get_string (child, &network_config_capture_file);
+    else if (strcasecmp ("CaptureLimit", child->key) == 0)
+      cf_util_get_int (child, &network_config_capture_limit);
+    else if (strcasecmp ("Replay", child->key) == 0)
+      network_config_add_replay (child);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3180,19 +3620,19 @@ static int network_notification (const notification_t *n,
 
   memset (buffer, 0, sizeof (buffer));
 
-  status = write_part_number (&buffer_ptr, &buffer_free, TYPE_TIME_HR,
+  status = format_network_part_number (&buffer_ptr, &buffer_free, TYPE_TIME_HR,
       (uint64_t) n->time);
   if (status != 0)
     return (-1);
 
-  status = write_part_number (&buffer_ptr, &buffer_free, TYPE_SEVERITY,
+  status = format_network_part_number (&buffer_ptr, &buffer_free, TYPE_SEVERITY,
       (uint64_t) n->severity);
   if (status != 0)
     return (-1);
 
   if (strlen (n->host) > 0)
   {
-    status = write_part_string (&buffer_ptr, &buffer_free, TYPE_HOST,
+    status = format_network_part_string (&buffer_ptr, &buffer_free, TYPE_HOST,
         n->host, strlen (n->host));
     if (status != 0)
       return (-1);
@@ -3200,7 +3640,7 @@ static int network_notification (const notification_t *n,
 
   if (strlen (n->plugin) > 0)
   {
-    status = write_part_string (&buffer_ptr, &buffer_free, TYPE_PLUGIN,
+    status = format_network_part_string (&buffer_ptr, &buffer_free, TYPE_PLUGIN,
         n->plugin, strlen (n->plugin));
     if (status != 0)
       return (-1);
@@ -3208,7 +3648,7 @@ static int network_notification (const notification_t *n,
 
   if (strlen (n->plugin_instance) > 0)
   {
-    status = write_part_string (&buffer_ptr, &buffer_free,
+    status = format_network_part_string (&buffer_ptr, &buffer_free,
         TYPE_PLUGIN_INSTANCE,
         n->plugin_instance, strlen (n->plugin_instance));
     if (status != 0)
@@ -3217,7 +3657,7 @@ static int network_notification (const notification_t *n,
 
   if (strlen (n->type) > 0)
   {
-    status = write_part_string (&buffer_ptr, &buffer_free, TYPE_TYPE,
+    status = format_network_part_string (&buffer_ptr, &buffer_free, TYPE_TYPE,
         n->type, strlen (n->type));
     if (status != 0)
       return (-1);
@@ -3225,13 +3665,13 @@ static int network_notification (const notification_t *n,
 
   if (strlen (n->type_instance) > 0)
   {
-    status = write_part_string (&buffer_ptr, &buffer_free, TYPE_TYPE_INSTANCE,
+    status = format_network_part_string (&buffer_ptr, &buffer_free, TYPE_TYPE_INSTANCE,
         n->type_instance, strlen (n->type_instance));
     if (status != 0)
       return (-1);
   }
 
-  status = write_part_string (&buffer_ptr, &buffer_free, TYPE_MESSAGE,
+  status = format_network_part_string (&buffer_ptr, &buffer_free, TYPE_MESSAGE,
       n->message, strlen (n->message));
   if (status != 0)
     return (-1);
@@ -3255,18 +3695,49 @@ static int network_shutdown (void)
 		receive_thread_running = 0;
 	}
 
-	/* Shutdown the dispatching thread */
-	if (dispatch_thread_running != 0)
+	network_capture_close ();
+	sfree (capture_local);
+	sfree (network_config_capture_file);
+
+	if (replay_thread_running != 0)
+	{
+		INFO ("network plugin: Stopping replay thread.");
+		pthread_join (replay_thread_id, /* ret = */ NULL);
+		replay_thread_running = 0;
+	}
+
+	/* Shutdown the dispatching threads */
+	if (receive_queues != NULL)
 	{
-		INFO ("network plugin: Stopping dispatch thread.");
-		pthread_mutex_lock (&receive_list_lock);
-		pthread_cond_broadcast (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-		pthread_join (dispatch_thread_id, /* ret = */ NULL);
-		dispatch_thread_running = 0;
+		size_t i;
+
+		INFO ("network plugin: Stopping dispatch threads.");
+		for (i = 0; i < receive_queues_num; i++)
+		{
+			receive_queue_t *q = receive_queues + i;
+
+			if (!q->thread_running)
+				continue;
+
+			pthread_mutex_lock (&q->lock);
+			pthread_cond_broadcast (&q->cond);
+			pthread_mutex_unlock (&q->lock);
+			pthread_join (q->thread_id, /* ret = */ NULL);
+			q->thread_running = 0;
+		}
+
+		for (i = 0; i < receive_queues_num; i++)
+		{
+			pthread_mutex_destroy (&receive_queues[i].lock);
+			pthread_cond_destroy (&receive_queues[i].cond);
+		}
+		sfree (receive_queues);
+		receive_queues_num = 0;
 	}
 
 	sockent_destroy (listen_sockets);
+	sockent_destroy (replay_sockets);
+	replay_sockets = NULL;
 
 	if (send_buffer_fill > 0)
 		flush_buffer ();
@@ -3283,6 +3754,54 @@ static int network_shutdown (void)
 	return (0);
 } /* int network_shutdown */
 
+static void network_stats_read_socket (value_list_t *vl, /* {{{ */
+		sockent_t *se)
+{
+	snprintf (vl->type_instance, sizeof (vl->type_instance), "%s_%s",
+			(se->node != NULL) ? se->node : "any",
+			(se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+	escape_slashes (vl->type_instance, sizeof (vl->type_instance));
+
+	vl->values[0].derive = STATS_GET (se->data.server.stats_octets_rx);
+	sstrncpy (vl->type, "if_rx_octets", sizeof (vl->type));
+	plugin_dispatch_values (vl);
+
+	vl->values[0].derive = STATS_GET (se->data.server.stats_packets_rx);
+	sstrncpy (vl->type, "if_rx_packets", sizeof (vl->type));
+	plugin_dispatch_values (vl);
+} /* }}} void network_stats_read_socket */
+
+static void network_stats_read_latency (value_list_t *vl) /* {{{ */
+{
+	uint64_t histogram[LATENCY_BUCKETS];
+	uint64_t total = 0;
+	double percents[] = { 50.0, 95.0, 99.0 };
+	size_t i;
+
+	/* Only look at the packets received since the last read. */
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		derive_t tmp = STATS_GET (stats_dispatch.queue_latency[i]);
+
+		histogram[i] = (uint64_t) (tmp - stats_queue_latency_last[i]);
+		stats_queue_latency_last[i] = tmp;
+		total += histogram[i];
+	}
+
+	if (total == 0)
+		return;
+
+	sstrncpy (vl->type, "delay", sizeof (vl->type));
+	for (i = 0; i < STATIC_ARRAY_SIZE (percents); i++)
+	{
+		snprintf (vl->type_instance, sizeof (vl->type_instance),
+				"dispatch_queue-p%.0f", percents[i]);
+		vl->values[0].gauge = ((gauge_t) latency_percentile (histogram,
+					total, percents[i])) / 1000000.0;
+		plugin_dispatch_values (vl);
+	}
+} /* }}} void network_stats_read_latency */
+
 static int network_stats_read (void) /* {{{ */
 {
 	derive_t copy_octets_rx;
@@ -3296,16 +3815,21 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_receive_list_length;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
-
-	copy_octets_rx = stats_octets_rx;
-	copy_octets_tx = stats_octets_tx;
-	copy_packets_rx = stats_packets_rx;
-	copy_packets_tx = stats_packets_tx;
-	copy_values_dispatched = stats_values_dispatched;
-	copy_values_not_dispatched = stats_values_not_dispatched;
-	copy_values_sent = stats_values_sent;
-	copy_values_not_sent = stats_values_not_sent;
-	copy_receive_list_length = receive_list_length;
+	sockent_t *se;
+	size_t i;
+
+	copy_octets_rx = STATS_GET (stats_receive.octets_rx);
+	copy_octets_tx = STATS_GET (stats_send.octets_tx);
+	copy_packets_rx = STATS_GET (stats_receive.packets_rx);
+	copy_packets_tx = STATS_GET (stats_send.packets_tx);
+	copy_values_dispatched = STATS_GET (stats_dispatch.values_dispatched);
+	copy_values_not_dispatched =
+		STATS_GET (stats_dispatch.values_not_dispatched);
+	copy_values_sent = STATS_GET (stats_send.values_sent);
+	copy_values_not_sent = STATS_GET (stats_send.values_not_sent);
+	copy_receive_list_length = 0;
+	for (i = 0; i < receive_queues_num; i++)
+		copy_receive_list_length += (derive_t) receive_queues[i].length;
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3350,6 +3874,28 @@ static int network_stats_read (void) /* {{{ */
 			sizeof (vl.type_instance));
 	plugin_dispatch_values (&vl);
 
+	/* Packets which could not be parsed, decrypted or verified */
+	sstrncpy (vl.type, "if_rx_errors", sizeof (vl.type));
+
+	vl.values[0].derive = STATS_GET (stats_dispatch.parse_errors);
+	sstrncpy (vl.type_instance, "parse", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = STATS_GET (stats_dispatch.decrypt_errors);
+	sstrncpy (vl.type_instance, "decrypt", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = STATS_GET (stats_dispatch.signature_errors);
+	sstrncpy (vl.type_instance, "signature", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Octets and packets received per socket */
+	for (se = listen_sockets; se != NULL; se = se->next)
+		network_stats_read_socket (&vl, se);
+
+	/* Time spent in the receive queue */
+	network_stats_read_latency (&vl);
+
 	/* Receive queue length */
 	vl.values[0].gauge = (gauge_t) copy_receive_list_length;
 	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
@@ -3405,18 +3951,12 @@ static int network_init (void)
 				/* user_data = */ NULL);
 	}
 
-	/* If no threads need to be started, return here. */
-	if ((listen_sockets_num == 0)
-			|| ((dispatch_thread_running != 0)
-				&& (receive_thread_running != 0)))
-		return (0);
-
-	if (dispatch_thread_running == 0)
+	if ((replay_sockets != NULL) && (replay_thread_running == 0))
 	{
 		int status;
-		status = plugin_thread_create (&dispatch_thread_id,
+		status = plugin_thread_create (&replay_thread_id,
 				NULL /* no attributes */,
-				dispatch_thread,
+				replay_thread,
 				NULL /* no argument */);
 		if (status != 0)
 		{
@@ -3427,10 +3967,79 @@ static int network_init (void)
 		}
 		else
 		{
-			dispatch_thread_running = 1;
+			replay_thread_running = 1;
 		}
 	}
 
+	/* If no threads need to be started, return here. */
+	if ((listen_sockets_num == 0)
+			|| ((receive_queues != NULL)
+				&& (receive_thread_running != 0)))
+		return (0);
+
+	if (receive_queues == NULL)
+	{
+		int i;
+
+		receive_queues = calloc ((size_t) network_config_dispatch_threads,
+				sizeof (*receive_queues));
+		if (receive_queues == NULL)
+		{
+			ERROR ("network plugin: calloc failed.");
+			return (-1);
+		}
+
+		/* Packets are only assigned to queues with a running thread,
+		 * so queues whose thread could not be started are not kept. */
+		receive_queues_num = 0;
+		for (i = 0; i < network_config_dispatch_threads; i++)
+		{
+			receive_queue_t *q = receive_queues + receive_queues_num;
+			int status;
+
+			pthread_mutex_init (&q->lock, /* attr = */ NULL);
+			pthread_cond_init (&q->cond, /* attr = */ NULL);
+
+			status = plugin_thread_create (&q->thread_id,
+					NULL /* no attributes */,
+					dispatch_thread,
+					q /* argument */);
+			if (status != 0)
+			{
+				char errbuf[1024];
+				ERROR ("network: pthread_create failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				pthread_mutex_destroy (&q->lock);
+				pthread_cond_destroy (&q->cond);
+				memset (q, 0, sizeof (*q));
+				continue;
+			}
+
+			q->thread_running = 1;
+			receive_queues_num++;
+		}
+
+		if (receive_queues_num == 0)
+		{
+			ERROR ("network plugin: Unable to start any dispatch "
+					"thread.");
+			sfree (receive_queues);
+			return (-1);
+		}
+		else if (receive_queues_num
+				< (size_t) network_config_dispatch_threads)
+		{
+			WARNING ("network plugin: Only %zu of %i dispatch "
+					"threads could be started.",
+					receive_queues_num,
+					network_config_dispatch_threads);
+		}
+	}
+
+	if ((network_config_capture_file != NULL) && (capture == NULL))
+		network_capture_open ();
+
 	if (receive_thread_running == 0)
 	{
 		int status;
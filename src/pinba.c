@@ -23,6 +23,8 @@
  *   Florian Forster <octo at verplant.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
@@ -54,6 +56,32 @@
 # define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Number of packets received with a single system call. */
+#ifndef PINBA_RECV_BATCH
+# if HAVE_RECVMMSG
+#  define PINBA_RECV_BATCH 16
+# else
+#  define PINBA_RECV_BATCH 1
+# endif
+#endif
+
+/* Fields a view matches on. Views using the same combination of fields are
+ * kept in the same hash table, see service_statnode_index(). */
+#define PINBA_MATCH_HOST   0x01
+#define PINBA_MATCH_SERVER 0x02
+#define PINBA_MATCH_SCRIPT 0x04
+#define PINBA_MATCH_COMBINATIONS 8
+
+/* The request time histogram splits each power of two (in microseconds) into
+ * 2^PINBA_HIST_SUB_BITS linear sub-buckets, so the relative error of a
+ * percentile is below 1/2^PINBA_HIST_SUB_BITS. Request times of 2^32 us
+ * (about 71 minutes) and above are counted in the last bucket. */
+#define PINBA_HIST_SUB_BITS 4
+#define PINBA_HIST_SUB (1 << PINBA_HIST_SUB_BITS)
+#define PINBA_HIST_MAX_BITS 32
+#define PINBA_HIST_BUCKETS \
+  ((PINBA_HIST_MAX_BITS - PINBA_HIST_SUB_BITS + 1) * PINBA_HIST_SUB)
+
 /*
  * Private data structures
  */
@@ -73,6 +101,15 @@ struct float_counter_s
 };
 typedef struct float_counter_s float_counter_t;
 
+/* Histograms are plain counters, so two histograms are merged by adding up
+ * their buckets. */
+struct pinba_histogram_s
+{
+  uint64_t count;
+  uint64_t bucket[PINBA_HIST_BUCKETS];
+};
+typedef struct pinba_histogram_s pinba_histogram_t;
+
 struct pinba_statnode_s
 {
   /* collector name, used as plugin instance */
@@ -83,6 +120,13 @@ struct pinba_statnode_s
   char *server;
   char *script;
 
+  /* PINBA_MATCH_* flags of the fields set above */
+  int match;
+  /* hash of the fields set above, see pinba_hash_fields() */
+  uint64_t hash;
+  /* next node in the same index bucket plus one, zero at the end */
+  unsigned int index_next;
+
   derive_t req_count;
 
   float_counter_t req_time;
@@ -91,8 +135,33 @@ struct pinba_statnode_s
 
   derive_t doc_size;
   gauge_t mem_peak;
+
+  /* request times of the current interval */
+  pinba_histogram_t req_hist;
 };
 typedef struct pinba_statnode_s pinba_statnode_t;
+
+/* Hash table of the views using one combination of PINBA_MATCH_* fields. */
+struct pinba_index_s
+{
+  /* index of the first node in each bucket plus one, zero if empty */
+  unsigned int *buckets;
+  uint64_t buckets_mask;
+};
+typedef struct pinba_index_s pinba_index_t;
+
+/* Values of a request which do not depend on the views, see
+ * service_request_key(). */
+struct pinba_request_key_s
+{
+  uint64_t hash[PINBA_MATCH_COMBINATIONS];
+  int hist_bucket;
+
+  float_counter_t req_time;
+  float_counter_t ru_utime;
+  float_counter_t ru_stime;
+};
+typedef struct pinba_request_key_s pinba_request_key_t;
 /* }}} */
 
 /*
@@ -102,6 +171,7 @@ typedef struct pinba_statnode_s pinba_statnode_t;
 static pinba_statnode_t *stat_nodes = NULL;
 static unsigned int stat_nodes_num = 0;
 static pthread_mutex_t stat_nodes_lock;
+static pinba_index_t stat_index[PINBA_MATCH_COMBINATIONS];
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
@@ -135,6 +205,20 @@ static void float_counter_add (float_counter_t *fc, float val) /* {{{ */
   }
 } /* }}} void float_counter_add */
 
+static void float_counter_merge (float_counter_t *fc, /* {{{ */
+    const float_counter_t *other)
+{
+  fc->i += other->i;
+  fc->n += other->n;
+
+  if (fc->n >= 1000000000)
+  {
+    fc->i += 1;
+    fc->n -= 1000000000;
+    assert (fc->n < 1000000000);
+  }
+} /* }}} void float_counter_merge */
+
 static derive_t float_counter_get (const float_counter_t *fc, /* {{{ */
     uint64_t factor)
 {
@@ -161,6 +245,126 @@ static void strset (char **str, const char *new) /* {{{ */
   *str = tmp;
 } /* }}} void strset */
 
+static int histogram_bucket (float seconds) /* {{{ */
+{
+  uint64_t us;
+  int bits;
+
+  if (!(seconds >= 0.0))
+    return (-1);
+
+  if (seconds >= (float) (((uint64_t) 1) << PINBA_HIST_MAX_BITS) / 1000000.0)
+    return (PINBA_HIST_BUCKETS - 1);
+
+  us = (uint64_t) (seconds * 1000000.0);
+  if (us < PINBA_HIST_SUB)
+    return ((int) us);
+
+  /* Number of significant bits */
+  for (bits = PINBA_HIST_SUB_BITS + 1; (us >> bits) != 0; bits++)
+    /* do nothing */;
+
+  return (((bits - PINBA_HIST_SUB_BITS) * PINBA_HIST_SUB)
+      + ((int) (us >> (bits - PINBA_HIST_SUB_BITS - 1))) - PINBA_HIST_SUB);
+} /* }}} int histogram_bucket */
+
+static void histogram_add (pinba_histogram_t *h, int bucket) /* {{{ */
+{
+  if ((bucket < 0) || (bucket >= PINBA_HIST_BUCKETS))
+    return;
+
+  h->bucket[bucket]++;
+  h->count++;
+} /* }}} void histogram_add */
+
+/* Returns the given percentile of the request time in seconds, using the
+ * middle of the bucket it falls into, or NAN if the histogram is empty. */
+static gauge_t histogram_percentile (const pinba_histogram_t *h, /* {{{ */
+    double percent)
+{
+  uint64_t sum = 0;
+  uint64_t rank;
+  uint64_t lower;
+  uint64_t width;
+  int group;
+  int i;
+
+  if (h->count == 0)
+    return (NAN);
+
+  rank = (uint64_t) ceil ((((double) h->count) * percent) / 100.0);
+  if (rank < 1)
+    rank = 1;
+
+  for (i = 0; i < PINBA_HIST_BUCKETS - 1; i++)
+  {
+    sum += h->bucket[i];
+    if (sum >= rank)
+      break;
+  }
+
+  group = i / PINBA_HIST_SUB;
+  if (group == 0)
+  {
+    lower = (uint64_t) i;
+    width = 1;
+  }
+  else
+  {
+    width = ((uint64_t) 1) << (group - 1);
+    lower = ((uint64_t) (PINBA_HIST_SUB + (i % PINBA_HIST_SUB))) * width;
+  }
+
+  return ((((gauge_t) lower) + (((gauge_t) width) / 2.0)) / 1000000.0);
+} /* }}} gauge_t histogram_percentile */
+
+static uint64_t pinba_hash_string (const char *str) /* {{{ */
+{
+  /* FNV-1a */
+  uint64_t h = 14695981039346656037ULL;
+  const unsigned char *c;
+
+  if (str == NULL)
+    return (0);
+
+  for (c = (const unsigned char *) str; *c != 0; c++)
+  {
+    h ^= (uint64_t) *c;
+    h *= 1099511628211ULL;
+  }
+
+  return (h);
+} /* }}} uint64_t pinba_hash_string */
+
+static uint64_t pinba_hash_mix (uint64_t h) /* {{{ */
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return (h);
+} /* }}} uint64_t pinba_hash_mix */
+
+/* Combines the hashes of the fields selected by "match". Nodes and requests
+ * use the same function, so a node can only match requests with the same
+ * hash. */
+static uint64_t pinba_hash_fields (int match, /* {{{ */
+    uint64_t host, uint64_t server, uint64_t script)
+{
+  uint64_t h = pinba_hash_mix ((uint64_t) match);
+
+  if (match & PINBA_MATCH_HOST)
+    h = pinba_hash_mix (h ^ host);
+  if (match & PINBA_MATCH_SERVER)
+    h = pinba_hash_mix (h ^ server);
+  if (match & PINBA_MATCH_SCRIPT)
+    h = pinba_hash_mix (h ^ script);
+
+  return (h);
+} /* }}} uint64_t pinba_hash_fields */
+
 static void service_statnode_add(const char *name, /* {{{ */
     const char *host,
     const char *server,
@@ -193,11 +397,86 @@ static void service_statnode_add(const char *name, /* {{{ */
   strset (&node->host, host);
   strset (&node->server, server);
   strset (&node->script, script);
+
+  node->match = 0;
+  if (node->host != NULL)
+    node->match |= PINBA_MATCH_HOST;
+  if (node->server != NULL)
+    node->match |= PINBA_MATCH_SERVER;
+  if (node->script != NULL)
+    node->match |= PINBA_MATCH_SCRIPT;
+  node->hash = pinba_hash_fields (node->match,
+      pinba_hash_string (node->host),
+      pinba_hash_string (node->server),
+      pinba_hash_string (node->script));
   
   /* increment counter */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
+static void service_statnode_index_free (void) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < PINBA_MATCH_COMBINATIONS; i++)
+  {
+    sfree (stat_index[i].buckets);
+    stat_index[i].buckets_mask = 0;
+  }
+} /* }}} void service_statnode_index_free */
+
+/* (Re-)builds the hash tables used by service_process_requests(). Must be
+ * called with "stat_nodes_lock" held after nodes have been added. */
+static int service_statnode_index (void) /* {{{ */
+{
+  unsigned int count[PINBA_MATCH_COMBINATIONS];
+  unsigned int i;
+  int m;
+
+  service_statnode_index_free ();
+
+  memset (count, 0, sizeof (count));
+  for (i = 0; i < stat_nodes_num; i++)
+    count[stat_nodes[i].match]++;
+
+  for (m = 0; m < PINBA_MATCH_COMBINATIONS; m++)
+  {
+    pinba_index_t *idx = stat_index + m;
+    uint64_t buckets_num;
+
+    if (count[m] == 0)
+      continue;
+
+    /* Keep the load factor below 0.5. */
+    buckets_num = 2;
+    while (buckets_num < (2 * ((uint64_t) count[m])))
+      buckets_num *= 2;
+
+    idx->buckets = calloc ((size_t) buckets_num, sizeof (*idx->buckets));
+    if (idx->buckets == NULL)
+    {
+      ERROR ("pinba plugin: calloc failed.");
+      service_statnode_index_free ();
+      return (-1);
+    }
+    idx->buckets_mask = buckets_num - 1;
+  }
+
+  /* Insert in reverse order so that each bucket lists its nodes in the
+   * configured order. */
+  for (i = stat_nodes_num; i > 0; i--)
+  {
+    pinba_statnode_t *node = stat_nodes + (i - 1);
+    pinba_index_t *idx = stat_index + node->match;
+    uint64_t b = node->hash & idx->buckets_mask;
+
+    node->index_next = idx->buckets[b];
+    idx->buckets[b] = i;
+  }
+
+  return (0);
+} /* }}} int service_statnode_index */
+
 /* Copy the data from the global "stat_nodes" list into the buffer pointed to
  * by "res", doing the derivation in the process. Returns the next index or
  * zero if the end of the list has been reached. */
@@ -225,18 +504,20 @@ static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
 
   /* reset node */
   node->mem_peak = NAN;
+  memset (&node->req_hist, 0, sizeof (node->req_hist));
   
   return (index + 1);
 } /* }}} unsigned int service_statnode_collect */
 
 static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
-    Pinba__Request* request)
+    Pinba__Request* request, const pinba_request_key_t *key)
 {
   node->req_count++;
 
-  float_counter_add (&node->req_time, request->request_time);
-  float_counter_add (&node->ru_utime, request->ru_utime);
-  float_counter_add (&node->ru_stime, request->ru_stime);
+  float_counter_merge (&node->req_time, &key->req_time);
+  float_counter_merge (&node->ru_utime, &key->ru_utime);
+  float_counter_merge (&node->ru_stime, &key->ru_stime);
+  histogram_add (&node->req_hist, key->hist_bucket);
 
   node->doc_size += request->document_size;
 
@@ -246,31 +527,87 @@ static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
 
 } /* }}} void service_statnode_process */
 
-static void service_process_request (Pinba__Request *request) /* {{{ */
+/* Computes everything needed to account a request which does not depend on
+ * the views, so this can be done without holding "stat_nodes_lock". */
+static void service_request_key (pinba_request_key_t *key, /* {{{ */
+    const Pinba__Request *request)
 {
-  unsigned int i;
+  uint64_t host = pinba_hash_string (request->hostname);
+  uint64_t server = pinba_hash_string (request->server_name);
+  uint64_t script = pinba_hash_string (request->script_name);
+  int m;
+
+  for (m = 0; m < PINBA_MATCH_COMBINATIONS; m++)
+    key->hash[m] = pinba_hash_fields (m, host, server, script);
+
+  key->hist_bucket = histogram_bucket (request->request_time);
+
+  /* Convert the times once instead of for every matching view. */
+  memset (&key->req_time, 0, sizeof (key->req_time));
+  memset (&key->ru_utime, 0, sizeof (key->ru_utime));
+  memset (&key->ru_stime, 0, sizeof (key->ru_stime));
+  float_counter_add (&key->req_time, request->request_time);
+  float_counter_add (&key->ru_utime, request->ru_utime);
+  float_counter_add (&key->ru_stime, request->ru_stime);
+} /* }}} void service_request_key */
+
+static _Bool service_statnode_match (const pinba_statnode_t *node, /* {{{ */
+    const Pinba__Request *request)
+{
+  if ((node->host != NULL)
+      && (strcmp (request->hostname, node->host) != 0))
+    return (0);
+
+  if ((node->server != NULL)
+      && (strcmp (request->server_name, node->server) != 0))
+    return (0);
+
+  if ((node->script != NULL)
+      && (strcmp (request->script_name, node->script) != 0))
+    return (0);
+
+  return (1);
+} /* }}} _Bool service_statnode_match */
+
+static void service_process_requests (Pinba__Request **requests, /* {{{ */
+    const pinba_request_key_t *keys, size_t requests_num)
+{
+  size_t i;
 
   pthread_mutex_lock (&stat_nodes_lock);
-  
-  for (i = 0; i < stat_nodes_num; i++)
+
+  for (i = 0; i < requests_num; i++)
   {
-    if ((stat_nodes[i].host != NULL)
-        && (strcmp (request->hostname, stat_nodes[i].host) != 0))
-      continue;
+    int m;
 
-    if ((stat_nodes[i].server != NULL)
-      && (strcmp (request->server_name, stat_nodes[i].server) != 0))
-      continue;
+    /* Only views with exactly the fields of the request can match, so
+     * every combination of fields in use is looked up once. */
+    for (m = 0; m < PINBA_MATCH_COMBINATIONS; m++)
+    {
+      const pinba_index_t *idx = stat_index + m;
+      uint64_t hash = keys[i].hash[m];
+      unsigned int n;
 
-    if ((stat_nodes[i].script != NULL)
-      && (strcmp (request->script_name, stat_nodes[i].script) != 0))
-      continue;
+      if (idx->buckets == NULL)
+        continue;
+
+      for (n = idx->buckets[hash & idx->buckets_mask];
+          n != 0;
+          n = stat_nodes[n - 1].index_next)
+      {
+        pinba_statnode_t *node = stat_nodes + (n - 1);
 
-    service_statnode_process(&stat_nodes[i], request);
+        if ((node->hash != hash)
+            || !service_statnode_match (node, requests[i]))
+          continue;
+
+        service_statnode_process (node, requests[i], keys + i);
+      }
+    }
   }
-  
+
   pthread_mutex_unlock(&stat_nodes_lock);
-} /* }}} void service_process_request */
+} /* }}} void service_process_requests */
 
 static int pb_del_socket (pinba_socket_t *s, /* {{{ */
     nfds_t index)
@@ -422,32 +759,123 @@ static void pinba_socket_free (pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
-    size_t buffer_size)
+/* Parses and accounts "packets_num" packets. The packets are stored in
+ * "buffer" with a stride of PINBA_UDP_BUFFER_SIZE bytes. */
+static int pinba_process_stats_packets (const uint8_t *buffer, /* {{{ */
+    const size_t *sizes, size_t packets_num)
 {
-  Pinba__Request *request;  
-  
-  request = pinba__request__unpack (NULL, buffer_size, buffer);
-  
-  if (!request)
-    return (-1);
+  Pinba__Request *requests[PINBA_RECV_BATCH];
+  pinba_request_key_t keys[PINBA_RECV_BATCH];
+  size_t requests_num = 0;
+  size_t i;
 
-  service_process_request(request);
-  pinba__request__free_unpacked (request, NULL);
-    
-  return (0);
-} /* }}} int pinba_process_stats_packet */
+  assert (packets_num <= PINBA_RECV_BATCH);
+
+  for (i = 0; i < packets_num; i++)
+  {
+    Pinba__Request *request;
+
+    request = pinba__request__unpack (NULL, sizes[i],
+        buffer + (i * PINBA_UDP_BUFFER_SIZE));
+    if (request == NULL)
+    {
+      DEBUG ("pinba plugin: Parsing packet failed.");
+      continue;
+    }
+
+    service_request_key (keys + requests_num, request);
+    requests[requests_num] = request;
+    requests_num++;
+  }
+
+  if (requests_num > 0)
+    service_process_requests (requests, keys, requests_num);
+
+  for (i = 0; i < requests_num; i++)
+    pinba__request__free_unpacked (requests[i], NULL);
+
+  return ((requests_num > 0) ? 0 : -1);
+} /* }}} int pinba_process_stats_packets */
+
+/* Receives up to PINBA_RECV_BATCH packets into "buffer", which must hold
+ * PINBA_RECV_BATCH * PINBA_UDP_BUFFER_SIZE bytes, and stores their sizes in
+ * "sizes". Returns the number of packets or less than zero on error. */
+#if HAVE_RECVMMSG
+static int pinba_udp_receive (int sock, /* {{{ */
+    uint8_t *buffer, size_t *sizes)
+{
+  struct mmsghdr msgs[PINBA_RECV_BATCH];
+  struct iovec iovs[PINBA_RECV_BATCH];
+  int packets_num = 0;
+  int status;
+  int i;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < PINBA_RECV_BATCH; i++)
+  {
+    iovs[i].iov_base = buffer + (i * PINBA_UDP_BUFFER_SIZE);
+    iovs[i].iov_len = PINBA_UDP_BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (42)
+  {
+    status = recvmmsg (sock, msgs, PINBA_RECV_BATCH, MSG_DONTWAIT,
+        /* timeout = */ NULL);
+    if (status < 0)
+    {
+      char errbuf[1024];
 
-static int pinba_udp_read_callback_fn (int sock) /* {{{ */
+      if ((errno == EINTR)
+#ifdef EWOULDBLOCK
+          || (errno == EWOULDBLOCK)
+#endif
+          || (errno == EAGAIN))
+      {
+        continue;
+      }
+
+      WARNING("pinba plugin: recvmmsg(2) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      DEBUG ("pinba plugin: recvmmsg(2) returned unexpected status zero.");
+      return (-1);
+    }
+
+    break;
+  } /* while (42) */
+
+  for (i = 0; i < status; i++)
+  {
+    if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || (msgs[i].msg_len == 0))
+    {
+      DEBUG ("pinba plugin: Ignoring truncated or empty packet.");
+      continue;
+    }
+
+    /* Move the packet to the next free slot if a packet was skipped. */
+    if (packets_num != i)
+      memmove (buffer + (packets_num * PINBA_UDP_BUFFER_SIZE),
+          buffer + (i * PINBA_UDP_BUFFER_SIZE), msgs[i].msg_len);
+    sizes[packets_num] = (size_t) msgs[i].msg_len;
+    packets_num++;
+  }
+
+  return (packets_num);
+} /* }}} int pinba_udp_receive */
+#else /* if !HAVE_RECVMMSG */
+static int pinba_udp_receive (int sock, /* {{{ */
+    uint8_t *buffer, size_t *sizes)
 {
-  uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
-  size_t buffer_size;
   int status;
 
   while (42)
   {
-    buffer_size = sizeof (buffer);
-    status = recvfrom (sock, buffer, buffer_size - 1, MSG_DONTWAIT, /* from = */ NULL, /* from len = */ 0);
+    status = recvfrom (sock, buffer, PINBA_UDP_BUFFER_SIZE - 1, MSG_DONTWAIT, /* from = */ NULL, /* from len = */ 0);
     if (status < 0)
     {
       char errbuf[1024];
@@ -472,30 +900,47 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
     }
     else /* if (status > 0) */
     {
-      assert (((size_t) status) < buffer_size);
-      buffer_size = (size_t) status;
-      buffer[buffer_size] = 0;
-
-      status = pinba_process_stats_packet (buffer, buffer_size);
-      if (status != 0)
-        DEBUG("pinba plugin: Parsing packet failed.");
-      return (status);
+      assert (status < PINBA_UDP_BUFFER_SIZE);
+      sizes[0] = (size_t) status;
+      return (1);
     }
   } /* while (42) */
 
   /* not reached */
   assert (23 == 42);
   return (-1);
-} /* }}} void pinba_udp_read_callback_fn */
+} /* }}} int pinba_udp_receive */
+#endif /* !HAVE_RECVMMSG */
+
+static int pinba_udp_read_callback_fn (int sock, uint8_t *buffer) /* {{{ */
+{
+  size_t sizes[PINBA_RECV_BATCH];
+  int status;
+
+  status = pinba_udp_receive (sock, buffer, sizes);
+  if (status <= 0)
+    return (-1);
+
+  return (pinba_process_stats_packets (buffer, sizes, (size_t) status));
+} /* }}} int pinba_udp_read_callback_fn */
 
 static int receive_loop (void) /* {{{ */
 {
   pinba_socket_t *s;
+  uint8_t *buffer;
+
+  buffer = malloc (PINBA_RECV_BATCH * PINBA_UDP_BUFFER_SIZE);
+  if (buffer == NULL)
+  {
+    ERROR ("pinba plugin: malloc failed.");
+    return (-1);
+  }
 
   s = pinba_socket_open (conf_node, conf_service);
   if (s == NULL)
   {
     ERROR ("pinba plugin: Collector thread is exiting prematurely.");
+    sfree (buffer);
     return (-1);
   }
 
@@ -522,6 +967,7 @@ static int receive_loop (void) /* {{{ */
       ERROR ("pinba plugin: poll(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
       pinba_socket_free (s);
+      sfree (buffer);
       return (-1);
     }
 
@@ -534,13 +980,14 @@ static int receive_loop (void) /* {{{ */
       }
       else if (s->fd[i].revents & (POLLIN | POLLPRI))
       {
-        pinba_udp_read_callback_fn (s->fd[i].fd);
+        pinba_udp_read_callback_fn (s->fd[i].fd, buffer);
       }
     } /* for (s->fd) */
   } /* while (!collector_thread_do_shutdown) */
 
   pinba_socket_free (s);
   s = NULL;
+  sfree (buffer);
 
   return (0);
 } /* }}} int receive_loop */
@@ -642,6 +1089,12 @@ static int plugin_init (void) /* {{{ */
         /* script = */ NULL);
   }
 
+  pthread_mutex_lock (&stat_nodes_lock);
+  status = service_statnode_index ();
+  pthread_mutex_unlock (&stat_nodes_lock);
+  if (status != 0)
+    return (-1);
+
   if (collector_thread_running)
     return (0);
 
@@ -682,13 +1135,19 @@ static int plugin_shutdown (void) /* {{{ */
     collector_thread_do_shutdown = 0;
   } /* if (collector_thread_running) */
 
+  pthread_mutex_lock (&stat_nodes_lock);
+  service_statnode_index_free ();
+  pthread_mutex_unlock (&stat_nodes_lock);
+
   return (0);
 } /* }}} int plugin_shutdown */
 
 static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
 {
+  double percents[] = { 50.0, 90.0, 99.0 };
   value_t value;
   value_list_t vl = VALUE_LIST_INIT;
+  size_t i;
   
   vl.values = &value;
   vl.values_len = 1;
@@ -723,6 +1182,15 @@ static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
   sstrncpy (vl.type_instance, "peak", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
 
+  sstrncpy (vl.type, "response_time", sizeof (vl.type));
+  for (i = 0; i < STATIC_ARRAY_SIZE (percents); i++)
+  {
+    value.gauge = histogram_percentile (&res->req_hist, percents[i]);
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+        "p%.0f", percents[i]);
+    plugin_dispatch_values (&vl);
+  }
+
   return (0);
 } /* }}} int plugin_submit */
 
@@ -28,6 +28,7 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_ds_table.h"
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_time.h"
@@ -74,10 +75,24 @@ typedef struct write_queue_s write_queue_t;
 struct write_queue_s
 {
 	value_list_t *vl;
+	/* Resolved when enqueueing, NULL if the type was unknown then. */
+	const data_set_t *ds;
 	plugin_ctx_t ctx;
 	write_queue_t *next;
 };
 
+/* Replaced data sets and lookup tables. Value lists may still refer to the
+ * data sets, so they are only freed on shutdown. Lookup tables are freed as
+ * soon as no lookup is in progress, see plugin_ds_tables_free(). */
+struct ds_retired_s;
+typedef struct ds_retired_s ds_retired_t;
+struct ds_retired_s
+{
+	data_set_t *ds;
+	ds_table_t *table;
+	ds_retired_t *next;
+};
+
 /*
  * Private variables
  */
@@ -93,6 +108,16 @@ static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
 
 static c_avl_tree_t *data_sets;
+/* Perfect hash table built from `data_sets'. It is read without locking and
+ * replaced, never modified, when data sets are (un)registered. NULL if it has
+ * to be (re)built. */
+static ds_table_t *data_sets_table = NULL;
+static _Bool data_sets_table_failed = 0;
+static ds_retired_t *data_sets_retired = NULL;
+/* Number of lookups which may be using `data_sets_table'. */
+static long data_sets_table_readers = 0;
+/* Protects `data_sets', `data_sets_retired' and updating `data_sets_table'. */
+static pthread_mutex_t data_sets_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static char *plugindir = NULL;
 
@@ -106,6 +131,9 @@ static int             read_threads_num = 0;
 
 static write_queue_t  *write_queue_head;
 static write_queue_t  *write_queue_tail;
+/* Value lists which have been enqueued but not yet been handled by all write
+ * plugins. Only modified with atomic operations. */
+static long            write_queue_length = 0;
 static _Bool           write_loop = 1;
 static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  write_cond = PTHREAD_COND_INITIALIZER;
@@ -118,7 +146,8 @@ static _Bool           plugin_ctx_key_initialized = 0;
 /*
  * Static functions
  */
-static int plugin_dispatch_values_internal (value_list_t *vl);
+static int plugin_dispatch_values_internal (value_list_t *vl,
+		const data_set_t *ds);
 
 static const char *plugin_get_dir (void)
 {
@@ -584,6 +613,155 @@ static void plugin_value_list_free (value_list_t *vl) /* {{{ */
 	sfree (vl);
 } /* }}} void plugin_value_list_free */
 
+/* Must be called with `data_sets_lock' held. */
+static void plugin_ds_retire (data_set_t *ds, ds_table_t *table) /* {{{ */
+{
+	ds_retired_t *r;
+
+	if ((ds == NULL) && (table == NULL))
+		return;
+
+	r = malloc (sizeof (*r));
+	if (r == NULL)
+	{
+		/* Leaking is better than freeing memory which may be in use. */
+		ERROR ("plugin_ds_retire: malloc failed.");
+		return;
+	}
+
+	r->ds = ds;
+	r->table = table;
+	r->next = data_sets_retired;
+	data_sets_retired = r;
+} /* }}} void plugin_ds_retire */
+
+/* Frees the retired lookup tables unless a lookup is in progress. Lookups
+ * increment `data_sets_table_readers' before loading `data_sets_table', so
+ * if the counter is zero after the table has been replaced, later lookups
+ * can't get hold of a retired table anymore. `readers_own' is the number of
+ * lookups the caller itself is counted for. Must be called with
+ * `data_sets_lock' held. */
+static void plugin_ds_tables_free (long readers_own) /* {{{ */
+{
+	ds_retired_t **r_ptr = &data_sets_retired;
+
+	__sync_synchronize ();
+	if (__sync_add_and_fetch (&data_sets_table_readers, 0) > readers_own)
+		return;
+
+	while (*r_ptr != NULL)
+	{
+		ds_retired_t *r = *r_ptr;
+
+		ds_table_destroy (r->table);
+		r->table = NULL;
+
+		if (r->ds == NULL)
+		{
+			*r_ptr = r->next;
+			sfree (r);
+		}
+		else
+		{
+			r_ptr = &r->next;
+		}
+	}
+} /* }}} void plugin_ds_tables_free */
+
+/* Must be called with `data_sets_lock' held. */
+static void plugin_ds_table_invalidate (void) /* {{{ */
+{
+	ds_table_t *table = data_sets_table;
+
+	data_sets_table = NULL;
+	data_sets_table_failed = 0;
+	plugin_ds_retire (/* ds = */ NULL, table);
+	plugin_ds_tables_free (/* readers_own = */ 0);
+} /* }}} void plugin_ds_table_invalidate */
+
+/* Builds the lookup table from `data_sets' unless another thread did so
+ * already. Returns NULL if there are no data sets or building failed.
+ * `readers_own' is passed on to plugin_ds_tables_free(). */
+static ds_table_t *plugin_ds_table_update (long readers_own) /* {{{ */
+{
+	ds_table_t *table;
+
+	pthread_mutex_lock (&data_sets_lock);
+
+	table = data_sets_table;
+	if ((table == NULL) && !data_sets_table_failed && (data_sets != NULL))
+	{
+		c_avl_iterator_t *iter;
+		const data_set_t **ds_array;
+		size_t ds_num = 0;
+		char *type;
+		data_set_t *ds;
+
+		ds_array = calloc ((size_t) c_avl_size (data_sets) + 1,
+				sizeof (*ds_array));
+		iter = c_avl_get_iterator (data_sets);
+		if ((ds_array != NULL) && (iter != NULL))
+		{
+			while (c_avl_iterator_next (iter, (void *) &type,
+						(void *) &ds) == 0)
+				ds_array[ds_num++] = ds;
+
+			table = ds_table_create (ds_array, ds_num);
+		}
+		c_avl_iterator_destroy (iter);
+		sfree (ds_array);
+
+		if (table != NULL)
+		{
+			/* Make sure the table is complete before other
+			 * threads can see it. */
+			__sync_synchronize ();
+			data_sets_table = table;
+		}
+		else
+		{
+			ERROR ("plugin_ds_table_update: Building the data set "
+					"lookup table failed. Lookups will be slow.");
+			data_sets_table_failed = 1;
+		}
+	}
+
+	/* Catch tables which were in use when they were retired. */
+	plugin_ds_tables_free (readers_own);
+
+	pthread_mutex_unlock (&data_sets_lock);
+	return (table);
+} /* }}} ds_table_t *plugin_ds_table_update */
+
+static const data_set_t *plugin_lookup_ds (const char *type) /* {{{ */
+{
+	ds_table_t *table;
+	data_set_t *ds = NULL;
+
+	/* Keeps the table from being freed while it is being used. */
+	__sync_add_and_fetch (&data_sets_table_readers, 1);
+
+	table = data_sets_table;
+	if (table == NULL)
+		table = plugin_ds_table_update (/* readers_own = */ 1);
+	if (table != NULL)
+	{
+		const data_set_t *ds_const = ds_table_get (table, type);
+
+		__sync_sub_and_fetch (&data_sets_table_readers, 1);
+		return (ds_const);
+	}
+
+	__sync_sub_and_fetch (&data_sets_table_readers, 1);
+
+	pthread_mutex_lock (&data_sets_lock);
+	if (data_sets != NULL)
+		c_avl_get (data_sets, type, (void *) &ds);
+	pthread_mutex_unlock (&data_sets_lock);
+
+	return (ds);
+} /* }}} const data_set_t *plugin_lookup_ds */
+
 static value_list_t *plugin_value_list_clone (value_list_t const *vl_orig) /* {{{ */
 {
 	value_list_t *vl;
@@ -656,11 +834,19 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 		return (ENOMEM);
 	}
 
+	/* Resolve the data set on the calling thread, so the write thread
+	 * doesn't have to. */
+	q->ds = plugin_lookup_ds (q->vl->type);
+
 	/* Store context of caller (read plugin); otherwise, it would not be
 	 * available to the write plugins when actually dispatching the
 	 * value-list later on. */
 	q->ctx = plugin_get_ctx ();
 
+	/* Count before the value list becomes visible to the write threads, so
+	 * the length never drops below zero. */
+	__sync_add_and_fetch (&write_queue_length, 1);
+
 	pthread_mutex_lock (&write_lock);
 
 	if (write_queue_tail == NULL)
@@ -680,7 +866,75 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 	return (0);
 } /* }}} int plugin_write_enqueue */
 
-static value_list_t *plugin_write_dequeue (void) /* {{{ */
+static int plugin_write_enqueue_batch (value_list_t const *vl, /* {{{ */
+		size_t vl_num)
+{
+	write_queue_t *head = NULL;
+	write_queue_t *tail = NULL;
+	plugin_ctx_t ctx;
+	size_t i;
+
+	if (vl_num == 0)
+		return (0);
+
+	ctx = plugin_get_ctx ();
+
+	/* Copy everything before taking the lock. */
+	for (i = 0; i < vl_num; i++)
+	{
+		write_queue_t *q;
+
+		q = malloc (sizeof (*q));
+		if (q != NULL)
+		{
+			q->next = NULL;
+			q->ctx = ctx;
+			q->vl = plugin_value_list_clone (&vl[i]);
+			if (q->vl == NULL)
+				sfree (q);
+			else
+				q->ds = plugin_lookup_ds (q->vl->type);
+		}
+
+		if (q == NULL)
+		{
+			while (head != NULL)
+			{
+				q = head->next;
+				plugin_value_list_free (head->vl);
+				sfree (head);
+				head = q;
+			}
+			return (ENOMEM);
+		}
+
+		if (tail == NULL)
+			head = q;
+		else
+			tail->next = q;
+		tail = q;
+	}
+
+	__sync_add_and_fetch (&write_queue_length, (long) vl_num);
+
+	pthread_mutex_lock (&write_lock);
+
+	if (write_queue_tail == NULL)
+		write_queue_head = head;
+	else
+		write_queue_tail->next = head;
+	write_queue_tail = tail;
+
+	if (vl_num > 1)
+		pthread_cond_broadcast (&write_cond);
+	else
+		pthread_cond_signal (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	return (0);
+} /* }}} int plugin_write_enqueue_batch */
+
+static value_list_t *plugin_write_dequeue (const data_set_t **ret_ds) /* {{{ */
 {
 	write_queue_t *q;
 	value_list_t *vl;
@@ -706,6 +960,7 @@ static value_list_t *plugin_write_dequeue (void) /* {{{ */
 	(void) plugin_set_ctx (q->ctx);
 
 	vl = q->vl;
+	*ret_ds = q->ds;
 	sfree (q);
 	return (vl);
 } /* }}} value_list_t *plugin_write_dequeue */
@@ -714,13 +969,15 @@ static void *plugin_write_thread (void __attribute__((unused)) *args) /* {{{ */
 {
 	while (write_loop)
 	{
-		value_list_t *vl = plugin_write_dequeue ();
+		const data_set_t *ds = NULL;
+		value_list_t *vl = plugin_write_dequeue (&ds);
 		if (vl == NULL)
 			continue;
 
-		plugin_dispatch_values_internal (vl);
+		plugin_dispatch_values_internal (vl, ds);
 
 		plugin_value_list_free (vl);
+		__sync_sub_and_fetch (&write_queue_length, 1);
 	}
 
 	pthread_exit (NULL);
@@ -802,6 +1059,7 @@ static void stop_write_threads (void) /* {{{ */
 	}
 	write_queue_head = NULL;
 	write_queue_tail = NULL;
+	write_queue_length = 0;
 	pthread_mutex_unlock (&write_lock);
 
 	if (i > 0)
@@ -1138,21 +1396,10 @@ int plugin_register_shutdown (const char *name,
 int plugin_register_data_set (const data_set_t *ds)
 {
 	data_set_t *ds_copy;
+	data_set_t *ds_old = NULL;
+	int status;
 	int i;
 
-	if ((data_sets != NULL)
-			&& (c_avl_get (data_sets, ds->type, NULL) == 0))
-	{
-		NOTICE ("Replacing DS `%s' with another version.", ds->type);
-		plugin_unregister_data_set (ds->type);
-	}
-	else if (data_sets == NULL)
-	{
-		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
-		if (data_sets == NULL)
-			return (-1);
-	}
-
 	ds_copy = (data_set_t *) malloc (sizeof (data_set_t));
 	if (ds_copy == NULL)
 		return (-1);
@@ -1169,7 +1416,37 @@ int plugin_register_data_set (const data_set_t *ds)
 	for (i = 0; i < ds->ds_num; i++)
 		memcpy (ds_copy->ds + i, ds->ds + i, sizeof (data_source_t));
 
-	return (c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
+	pthread_mutex_lock (&data_sets_lock);
+
+	if (data_sets == NULL)
+	{
+		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		if (data_sets == NULL)
+		{
+			pthread_mutex_unlock (&data_sets_lock);
+			sfree (ds_copy->ds);
+			sfree (ds_copy);
+			return (-1);
+		}
+	}
+	else if (c_avl_remove (data_sets, ds->type, NULL, (void *) &ds_old) == 0)
+	{
+		NOTICE ("Replacing DS `%s' with another version.", ds->type);
+		plugin_ds_retire (ds_old, /* table = */ NULL);
+	}
+
+	status = c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy);
+	plugin_ds_table_invalidate ();
+
+	pthread_mutex_unlock (&data_sets_lock);
+
+	if (status != 0)
+	{
+		sfree (ds_copy->ds);
+		sfree (ds_copy);
+	}
+
+	return (status);
 } /* int plugin_register_data_set */
 
 int plugin_register_log (const char *name,
@@ -1328,14 +1605,20 @@ int plugin_unregister_data_set (const char *name)
 {
 	data_set_t *ds;
 
-	if (data_sets == NULL)
-		return (-1);
+	pthread_mutex_lock (&data_sets_lock);
 
-	if (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0)
+	if ((data_sets == NULL)
+			|| (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0))
+	{
+		pthread_mutex_unlock (&data_sets_lock);
 		return (-1);
+	}
+
+	/* Value lists in the write queue may still refer to the data set. */
+	plugin_ds_retire (ds, /* table = */ NULL);
+	plugin_ds_table_invalidate ();
 
-	sfree (ds->ds);
-	sfree (ds);
+	pthread_mutex_unlock (&data_sets_lock);
 
 	return (0);
 } /* int plugin_unregister_data_set */
@@ -1356,9 +1639,18 @@ void plugin_init_all (void)
 	llentry_t *le;
 	int status;
 
+	/* Build the data set lookup table now that all TypesDB files have been
+	 * read. Data sets registered later, e.g. by the Perl or Python plugin,
+	 * cause the table to be rebuilt. */
+	plugin_ds_table_update (/* readers_own = */ 0);
+
 	/* Init the value cache */
 	uc_init ();
 
+	/* Restore the cache before any values are dispatched. */
+	if (global_option_get ("CacheFile") != NULL)
+		uc_checkpoint_read (global_option_get ("CacheFile"));
+
 	chain_name = global_option_get ("PreCacheChain");
 	pre_cache_chain = fc_chain_get_by_name (chain_name);
 
@@ -1425,8 +1717,26 @@ void plugin_init_all (void)
 /* TODO: Rename this function. */
 void plugin_read_all (void)
 {
+	static cdtime_t checkpoint_next = 0;
+	const char *cache_file;
+
 	uc_check_timeout ();
 
+	cache_file = global_option_get ("CacheFile");
+	if (cache_file != NULL)
+	{
+		double interval = atof (global_option_get ("CacheCheckpointInterval"));
+		cdtime_t now = cdtime ();
+
+		if ((interval > 0.0) && (checkpoint_next == 0))
+			checkpoint_next = now + DOUBLE_TO_CDTIME_T (interval);
+		else if ((interval > 0.0) && (now >= checkpoint_next))
+		{
+			uc_checkpoint_write (cache_file);
+			checkpoint_next = now + DOUBLE_TO_CDTIME_T (interval);
+		}
+	}
+
 	return;
 } /* void plugin_read_all */
 
@@ -1645,6 +1955,10 @@ void plugin_shutdown_all (void)
 
 	stop_write_threads ();
 
+	/* All values have been dispatched, so the cache is complete now. */
+	if (global_option_get ("CacheFile") != NULL)
+		uc_checkpoint_write (global_option_get ("CacheFile"));
+
 	/* Write plugins which use the `user_data' pointer usually need the
 	 * same data available to the flush callback. If this is the case, set
 	 * the free_function to NULL when registering the flush callback and to
@@ -1657,6 +1971,20 @@ void plugin_shutdown_all (void)
 	destroy_all_callbacks (&list_notification);
 	destroy_all_callbacks (&list_shutdown);
 	destroy_all_callbacks (&list_log);
+
+	pthread_mutex_lock (&data_sets_lock);
+	while (data_sets_retired != NULL)
+	{
+		ds_retired_t *r = data_sets_retired;
+
+		data_sets_retired = r->next;
+		if (r->ds != NULL)
+			sfree (r->ds->ds);
+		sfree (r->ds);
+		ds_table_destroy (r->table);
+		sfree (r);
+	}
+	pthread_mutex_unlock (&data_sets_lock);
 } /* void plugin_shutdown_all */
 
 int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
@@ -1700,7 +2028,8 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-static int plugin_dispatch_values_internal (value_list_t *vl)
+static int plugin_dispatch_values_internal (value_list_t *vl,
+		const data_set_t *ds)
 {
 	int status;
 	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
@@ -1708,8 +2037,6 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	value_t *saved_values;
 	int      saved_values_len;
 
-	data_set_t *ds;
-
 	int free_meta_data = 0;
 
 	if ((vl == NULL) || (vl->type[0] == 0)
@@ -1740,7 +2067,12 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 		return (-1);
 	}
 
-	if (c_avl_get (data_sets, vl->type, (void *) &ds) != 0)
+	/* Usually resolved when enqueueing; the type may have been registered
+	 * since, though. */
+	if (ds == NULL)
+		ds = plugin_lookup_ds (vl->type);
+
+	if (ds == NULL)
 	{
 		char ident[6 * DATA_MAX_NAME_LEN];
 
@@ -1894,6 +2226,28 @@ int plugin_dispatch_values (value_list_t const *vl)
 	return (0);
 }
 
+long plugin_get_write_queue_length (void) /* {{{ */
+{
+	return (__sync_add_and_fetch (&write_queue_length, 0));
+} /* }}} long plugin_get_write_queue_length */
+
+int plugin_dispatch_values_batch (value_list_t const *vl, size_t vl_num)
+{
+	int status;
+
+	status = plugin_write_enqueue_batch (vl, vl_num);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("plugin_dispatch_values_batch: plugin_write_enqueue_batch "
+				"failed with status %i (%s).", status,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (status);
+	}
+
+	return (0);
+}
+
 int plugin_dispatch_notification (const notification_t *notif)
 {
 	llentry_t *le;
@@ -2014,9 +2368,10 @@ int parse_notif_severity (const char *severity)
 
 const data_set_t *plugin_get_ds (const char *name)
 {
-	data_set_t *ds;
+	const data_set_t *ds;
 
-	if (c_avl_get (data_sets, name, (void *) &ds) != 0)
+	ds = plugin_lookup_ds (name);
+	if (ds == NULL)
 	{
 		DEBUG ("No such dataset registered: %s", name);
 		return (NULL);
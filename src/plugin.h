@@ -327,6 +327,32 @@ int plugin_unregister_notification (const char *name);
  *              function.
  */
 int plugin_dispatch_values (value_list_t const *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Same as `plugin_dispatch_values' for a number of value lists. The value
+ *  lists are added to the write queue in one go, so the queue's lock is only
+ *  taken once. If copying one of the value lists fails, none of them is
+ *  dispatched.
+ *
+ * ARGUMENTS
+ *  `vl'        Array of value lists.
+ *  `vl_num'    Number of elements in `vl'.
+ */
+int plugin_dispatch_values_batch (value_list_t const *vl, size_t vl_num);
+
+/*
+ * NAME
+ *  plugin_get_write_queue_length
+ *
+ * DESCRIPTION
+ *  Returns the number of value lists which have been dispatched but have not
+ *  yet been handled by the write threads.
+ */
+long plugin_get_write_queue_length (void);
 int plugin_dispatch_missing (const value_list_t *vl);
 
 int plugin_dispatch_notification (const notification_t *notif);
@@ -92,6 +92,8 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include <pthread.h>
+#  include "utils_btree.h"
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -208,6 +210,66 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* The `Process' and `ProcessMatch' entries a pid matches. Since matching
+ * requires the name and possibly the command line, the result is kept until
+ * the process exits or executes another program, i.e. until the start time or
+ * the name of the pid changes. */
+typedef struct ps_pid_s
+{
+	int pid;
+	unsigned long long starttime;
+	char name[64];
+	unsigned long cycle;
+
+	procstat_t **matches;
+	size_t matches_num;
+} ps_pid_t;
+
+typedef struct ps_result_s
+{
+	procstat_entry_t pse;
+	ps_pid_t *pid;
+} ps_result_t;
+
+/* Pids are distributed over the scanners by "pid % ps_scanners_num", so that
+ * each scanner, and each thread, owns its part of the pid cache. */
+typedef struct ps_scanner_s
+{
+	int *pids;
+	size_t pids_num;
+	size_t pids_size;
+
+	c_btree_t *cache;
+
+	/* The fields of /proc/<pid>/stat point into `stat'. */
+	char stat[1024];
+	char *fields[64];
+	int fields_num;
+	char buffer[4096];
+	char cmdline[ARG_MAX];
+
+	int running;
+	int sleeping;
+	int zombies;
+	int stopped;
+	int paging;
+	int blocked;
+
+	ps_result_t *results;
+	size_t results_num;
+	size_t results_size;
+} ps_scanner_t;
+
+static DIR *ps_proc_dir = NULL;
+static int ps_proc_fd = -1;
+
+static ps_scanner_t *ps_scanners = NULL;
+static size_t ps_scanners_num = 1;
+static unsigned long ps_cycle = 0;
+
+static _Bool ps_have_regex = 0;
+static _Bool ps_cache_matches = 1;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -263,6 +325,9 @@ static void ps_list_register (const char *name, const char *regexp)
 			sfree(new->re);
 			return;
 		}
+#if KERNEL_LINUX
+		ps_have_regex = 1;
+#endif
 	}
 #else
 	if (regexp != NULL)
@@ -331,143 +396,152 @@ static int ps_list_match (const char *name, const char *cmdline, procstat_t *ps)
 	return (0);
 } /* int ps_list_match */
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to the 'instances' of 'ps' (or refresh it) */
+static void ps_list_add_one (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
 
-	if (entry->id == 0)
-		return;
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		procstat_entry_t *new;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
+		if (new == NULL)
+			return;
+		memset (new, 0, sizeof (procstat_entry_t));
+		new->id = entry->id;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
+		pse = new;
+	}
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	if ((entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0))
+	{
+		pse->vmem_minflt_counter += entry->vmem_minflt;
+		pse->vmem_minflt = entry->vmem_minflt;
 
-			pse = new;
+		pse->vmem_majflt_counter += entry->vmem_majflt;
+		pse->vmem_majflt = entry->vmem_majflt;
+	}
+	else
+	{
+		if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
+		{
+			pse->vmem_minflt = entry->vmem_minflt_counter
+				+ (ULONG_MAX - pse->vmem_minflt_counter);
 		}
-
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
+		else
 		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+			pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
+		}
+		pse->vmem_minflt_counter = entry->vmem_minflt_counter;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
+		if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
+		{
+			pse->vmem_majflt = entry->vmem_majflt_counter
+				+ (ULONG_MAX - pse->vmem_majflt_counter);
 		}
 		else
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
-			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+			pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
 		}
+		pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+	}
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
+	ps->vmem_minflt_counter += pse->vmem_minflt;
+	ps->vmem_majflt_counter += pse->vmem_majflt;
 
-		if ((entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0))
-		{
-			pse->cpu_user_counter += entry->cpu_user;
-			pse->cpu_user = entry->cpu_user;
+	if ((entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0))
+	{
+		pse->cpu_user_counter += entry->cpu_user;
+		pse->cpu_user = entry->cpu_user;
 
-			pse->cpu_system_counter += entry->cpu_system;
-			pse->cpu_system = entry->cpu_system;
+		pse->cpu_system_counter += entry->cpu_system;
+		pse->cpu_system = entry->cpu_system;
+	}
+	else
+	{
+		if (entry->cpu_user_counter < pse->cpu_user_counter)
+		{
+			pse->cpu_user = entry->cpu_user_counter
+				+ (ULONG_MAX - pse->cpu_user_counter);
 		}
 		else
 		{
-			if (entry->cpu_user_counter < pse->cpu_user_counter)
-			{
-				pse->cpu_user = entry->cpu_user_counter
-					+ (ULONG_MAX - pse->cpu_user_counter);
-			}
-			else
-			{
-				pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
-			}
-			pse->cpu_user_counter = entry->cpu_user_counter;
+			pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
+		}
+		pse->cpu_user_counter = entry->cpu_user_counter;
 
-			if (entry->cpu_system_counter < pse->cpu_system_counter)
-			{
-				pse->cpu_system = entry->cpu_system_counter
-					+ (ULONG_MAX - pse->cpu_system_counter);
-			}
-			else
-			{
-				pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
-			}
-			pse->cpu_system_counter = entry->cpu_system_counter;
+		if (entry->cpu_system_counter < pse->cpu_system_counter)
+		{
+			pse->cpu_system = entry->cpu_system_counter
+				+ (ULONG_MAX - pse->cpu_system_counter);
 		}
+		else
+		{
+			pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
+		}
+		pse->cpu_system_counter = entry->cpu_system_counter;
+	}
+
+	ps->cpu_user_counter   += pse->cpu_user;
+	ps->cpu_system_counter += pse->cpu_system;
+} /* void ps_list_add_one */
 
-		ps->cpu_user_counter   += pse->cpu_user;
-		ps->cpu_system_counter += pse->cpu_system;
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
+
+	if (entry->id == 0)
+		return;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
+
+		ps_list_add_one (ps, entry);
 	}
 }
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -573,6 +647,22 @@ static int ps_config (oconfig_item_t *ci)
 			ps_list_register (c->values[0].value.string,
 					c->values[1].value.string);
 		}
+#if KERNEL_LINUX
+		else if (strcasecmp (c->key, "ScanThreads") == 0)
+		{
+			int tmp = 0;
+
+			if ((cf_util_get_int (c, &tmp) != 0) || (tmp < 1))
+			{
+				ERROR ("processes plugin: `ScanThreads' expects a "
+						"positive integer.");
+				continue;
+			}
+			ps_scanners_num = (size_t) tmp;
+		}
+		else if (strcasecmp (c->key, "CacheMatches") == 0)
+			cf_util_get_boolean (c, &ps_cache_matches);
+#endif
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -759,18 +849,61 @@ static void ps_submit_fork_rate (derive_t value)
 
 /* ------- additional functions for KERNEL_LINUX/HAVE_THREAD_INFO ------- */
 #if KERNEL_LINUX
+/* Reads the file `path', relative to /proc, into `buffer' and terminates it
+ * with a null byte. Returns the number of bytes read or -1 on failure. */
+static ssize_t ps_read_proc_file (const char *path,
+		char *buffer, size_t buffer_size)
+{
+	size_t len = 0;
+	int fd;
+
+	fd = openat (ps_proc_fd, path, O_RDONLY);
+	if (fd < 0)
+		return (-1);
+
+	while (len < (buffer_size - 1))
+	{
+		ssize_t status;
+
+		status = read (fd, buffer + len, buffer_size - 1 - len);
+		if (status < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EINTR))
+				continue;
+			close (fd);
+			return (-1);
+		}
+		else if (status == 0)
+			break;
+
+		len += (size_t) status;
+	}
+
+	close (fd);
+	buffer[len] = 0;
+	return ((ssize_t) len);
+} /* ssize_t ps_read_proc_file */
+
 static int ps_read_tasks (int pid)
 {
 	char           dirname[64];
 	DIR           *dh;
 	struct dirent *ent;
+	int fd;
 	int count = 0;
 
-	ssnprintf (dirname, sizeof (dirname), "/proc/%i/task", pid);
+	ssnprintf (dirname, sizeof (dirname), "%i/task", pid);
 
-	if ((dh = opendir (dirname)) == NULL)
+	fd = openat (ps_proc_fd, dirname, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
 	{
-		DEBUG ("Failed to open directory `%s'", dirname);
+		DEBUG ("Failed to open directory `/proc/%s'", dirname);
+		return (-1);
+	}
+
+	if ((dh = fdopendir (fd)) == NULL)
+	{
+		close (fd);
 		return (-1);
 	}
 
@@ -787,30 +920,32 @@ static int ps_read_tasks (int pid)
 } /* int *ps_read_tasks */
 
 /* Read advanced virtual memory data from /proc/pid/status */
-static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
+static procstat_t *ps_read_vmem (ps_scanner_t *sc, int pid, procstat_t *ps)
 {
-	FILE *fh;
-	char buffer[1024];
 	char filename[64];
 	unsigned long long lib = 0;
 	unsigned long long exe = 0;
 	unsigned long long data = 0;
 	char *fields[8];
 	int numfields;
+	char *line;
+	char *saveptr = NULL;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	ssnprintf (filename, sizeof (filename), "%i/status", pid);
+	if (ps_read_proc_file (filename, sc->buffer, sizeof (sc->buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof(buffer), fh) != NULL)
+	for (line = strtok_r (sc->buffer, "\n", &saveptr);
+			line != NULL;
+			line = strtok_r (NULL, "\n", &saveptr))
 	{
 		long long tmp;
 		char *endptr;
 
-		if (strncmp (buffer, "Vm", 2) != 0)
+		if (strncmp (line, "Vm", 2) != 0)
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -821,27 +956,20 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 		tmp = strtoll (fields[1], &endptr, /* base = */ 10);
 		if ((errno == 0) && (endptr != fields[1]))
 		{
-			if (strncmp (buffer, "VmData", 6) == 0)
+			if (strncmp (line, "VmData", 6) == 0)
 			{
 				data = tmp;
 			}
-			else if (strncmp (buffer, "VmLib", 5) == 0)
+			else if (strncmp (line, "VmLib", 5) == 0)
 			{
 				lib = tmp;
 			}
-			else if  (strncmp(buffer, "VmExe", 5) == 0)
+			else if  (strncmp(line, "VmExe", 5) == 0)
 			{
 				exe = tmp;
 			}
 		}
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* for (line) */
 
 	ps->vmem_data = data * 1024;
 	ps->vmem_code = (exe + lib) * 1024;
@@ -849,37 +977,39 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_vmem */
 
-static procstat_t *ps_read_io (int pid, procstat_t *ps)
+static procstat_t *ps_read_io (ps_scanner_t *sc, int pid, procstat_t *ps)
 {
-	FILE *fh;
-	char buffer[1024];
 	char filename[64];
 
 	char *fields[8];
 	int numfields;
+	char *line;
+	char *saveptr = NULL;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/io", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	ssnprintf (filename, sizeof (filename), "%i/io", pid);
+	if (ps_read_proc_file (filename, sc->buffer, sizeof (sc->buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	for (line = strtok_r (sc->buffer, "\n", &saveptr);
+			line != NULL;
+			line = strtok_r (NULL, "\n", &saveptr))
 	{
 		derive_t *val = NULL;
 		long long tmp;
 		char *endptr;
 
-		if (strncasecmp (buffer, "rchar:", 6) == 0)
+		if (strncasecmp (line, "rchar:", 6) == 0)
 			val = &(ps->io_rchar);
-		else if (strncasecmp (buffer, "wchar:", 6) == 0)
+		else if (strncasecmp (line, "wchar:", 6) == 0)
 			val = &(ps->io_wchar);
-		else if (strncasecmp (buffer, "syscr:", 6) == 0)
+		else if (strncasecmp (line, "syscr:", 6) == 0)
 			val = &(ps->io_syscr);
-		else if (strncasecmp (buffer, "syscw:", 6) == 0)
+		else if (strncasecmp (line, "syscw:", 6) == 0)
 			val = &(ps->io_syscw);
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -892,26 +1022,17 @@ static procstat_t *ps_read_io (int pid, procstat_t *ps)
 			*val = -1;
 		else
 			*val = (derive_t) tmp;
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* for (line) */
 
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-int ps_read_process (int pid, procstat_t *ps, char *state)
+/* Reads /proc/<pid>/stat. Only the name and the state are parsed; the other
+ * fields are kept in the scanner for ps_read_process(). */
+static int ps_read_stat (ps_scanner_t *sc, int pid, procstat_t *ps,
+		char *state, unsigned long long *starttime)
 {
 	char  filename[64];
-	char  buffer[1024];
-
-	char *fields[64];
-	char  fields_len;
-
 	int   buffer_len;
 
 	char *buffer_ptr;
@@ -919,21 +1040,12 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	size_t name_end_pos;
 	size_t name_len;
 
-	derive_t cpu_user_counter;
-	derive_t cpu_system_counter;
-	long long unsigned vmem_size;
-	long long unsigned vmem_rss;
-	long long unsigned stack_size;
-
-	memset (ps, 0, sizeof (procstat_t));
+	ssnprintf (filename, sizeof (filename), "%i/stat", pid);
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", pid);
-
-	buffer_len = read_file_contents (filename,
-			buffer, sizeof(buffer) - 1);
+	buffer_len = (int) ps_read_proc_file (filename,
+			sc->stat, sizeof (sc->stat));
 	if (buffer_len <= 0)
 		return (-1);
-	buffer[buffer_len] = 0;
 
 	/* The name of the process is enclosed in parens. Since the name can
 	 * contain parens itself, spaces, numbers and pretty much everything
@@ -941,12 +1053,12 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	 * strchr(3) and strrchr(3) to avoid pointer arithmetic which would
 	 * otherwise be required to determine name_len. */
 	name_start_pos = 0;
-	while ((buffer[name_start_pos] != '(')
+	while ((sc->stat[name_start_pos] != '(')
 			&& (name_start_pos < buffer_len))
 		name_start_pos++;
 
 	name_end_pos = buffer_len;
-	while ((buffer[name_end_pos] != ')')
+	while ((sc->stat[name_end_pos] != ')')
 			&& (name_end_pos > 0))
 		name_end_pos--;
 
@@ -963,24 +1075,41 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	if (name_len >= sizeof (ps->name))
 		name_len = sizeof (ps->name) - 1;
 
-	sstrncpy (ps->name, &buffer[name_start_pos + 1], name_len + 1);
+	sstrncpy (ps->name, &sc->stat[name_start_pos + 1], name_len + 1);
 
 	if ((buffer_len - name_end_pos) < 2)
 		return (-1);
-	buffer_ptr = &buffer[name_end_pos + 2];
+	buffer_ptr = &sc->stat[name_end_pos + 2];
 
-	fields_len = strsplit (buffer_ptr, fields, STATIC_ARRAY_SIZE (fields));
-	if (fields_len < 22)
+	sc->fields_num = strsplit (buffer_ptr, sc->fields,
+			STATIC_ARRAY_SIZE (sc->fields));
+	if (sc->fields_num < 22)
 	{
-		DEBUG ("processes plugin: ps_read_process (pid = %i):"
-				" `%s' has only %i fields..",
-				(int) pid, filename, fields_len);
+		DEBUG ("processes plugin: ps_read_stat (pid = %i):"
+				" `/proc/%s' has only %i fields..",
+				(int) pid, filename, sc->fields_num);
 		return (-1);
 	}
 
-	*state = fields[0][0];
+	*state = sc->fields[0][0];
+	*starttime = strtoull (sc->fields[19], NULL, /* base = */ 10);
+
+	return (0);
+} /* int ps_read_stat */
+
+/* Reads the details of a process after ps_read_stat() succeeded. */
+static int ps_read_process (ps_scanner_t *sc, int pid, procstat_t *ps,
+		char state)
+{
+	char **fields = sc->fields;
 
-	if (*state == 'Z')
+	derive_t cpu_user_counter;
+	derive_t cpu_system_counter;
+	long long unsigned vmem_size;
+	long long unsigned vmem_rss;
+	long long unsigned stack_size;
+
+	if (state == 'Z')
 	{
 		ps->num_lwp  = 0;
 		ps->num_proc = 0;
@@ -1010,6 +1139,7 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	ps->vmem_minflt_counter = atol (fields[7]);
 	ps->vmem_majflt_counter = atol (fields[9]);
 
+	if (sc->fields_num > 26)
 	{
 		unsigned long long stack_start = atoll (fields[25]);
 		unsigned long long stack_ptr   = atoll (fields[26]);
@@ -1018,13 +1148,15 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 			? stack_start - stack_ptr
 			: stack_ptr - stack_start;
 	}
+	else
+		stack_size = 0;
 
 	/* Convert jiffies to useconds */
 	cpu_user_counter   = cpu_user_counter   * 1000000 / CONFIG_HZ;
 	cpu_system_counter = cpu_system_counter * 1000000 / CONFIG_HZ;
 	vmem_rss = vmem_rss * pagesize_g;
 
-	if ( (ps_read_vmem(pid, ps)) == NULL)
+	if ( (ps_read_vmem (sc, pid, ps)) == NULL)
 	{
 		/* No VMem data */
 		ps->vmem_data = -1;
@@ -1038,7 +1170,7 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	ps->vmem_rss = (unsigned long) vmem_rss;
 	ps->stack_size = (unsigned long) stack_size;
 
-	if ( (ps_read_io (pid, ps)) == NULL)
+	if ( (ps_read_io (sc, pid, ps)) == NULL)
 	{
 		/* no io data */
 		ps->io_rchar = -1;
@@ -1055,67 +1187,28 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 {
-	char  *buf_ptr;
-	size_t len;
-
-	char file[PATH_MAX];
-	int  fd;
-
+	char file[64];
+	ssize_t status;
 	size_t n;
 
 	if ((pid < 1) || (NULL == buf) || (buf_len < 2))
 		return NULL;
 
-	ssnprintf (file, sizeof (file), "/proc/%u/cmdline",
-		       	(unsigned int) pid);
+	ssnprintf (file, sizeof (file), "%u/cmdline", (unsigned int) pid);
 
 	errno = 0;
-	fd = open (file, O_RDONLY);
-	if (fd < 0) {
-		char errbuf[4096];
-		/* ENOENT means the process exited while we were handling it.
-		 * Don't complain about this, it only fills the logs. */
-		if (errno != ENOENT)
-			WARNING ("processes plugin: Failed to open `%s': %s.", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
+	status = ps_read_proc_file (file, buf, buf_len);
+	if (status < 0) {
+		char errbuf[1024];
+		/* ENOENT and ESRCH mean the process exited while we were
+		 * handling it. Don't complain about this, it only fills the
+		 * logs. */
+		if ((errno != ENOENT) && (errno != ESRCH))
+			WARNING ("processes plugin: Failed to read `/proc/%s': %s.",
+					file, sstrerror (errno, errbuf, sizeof (errbuf)));
 		return NULL;
 	}
-
-	buf_ptr = buf;
-	len     = buf_len;
-
-	n = 0;
-
-	while (42) {
-		ssize_t status;
-
-		status = read (fd, (void *)buf_ptr, len);
-
-		if (status < 0) {
-			char errbuf[1024];
-
-			if ((EAGAIN == errno) || (EINTR == errno))
-				continue;
-
-			WARNING ("processes plugin: Failed to read from `%s': %s.", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (fd);
-			return NULL;
-		}
-
-		n += status;
-
-		if (status == 0)
-			break;
-
-		buf_ptr += status;
-		len     -= status;
-
-		if (len <= 0)
-			break;
-	}
-
-	close (fd);
+	n = (size_t) status;
 
 	if (0 == n) {
 		/* cmdline not available; e.g. kernel thread, zombie */
@@ -1126,11 +1219,7 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 		return buf;
 	}
 
-	assert (n <= buf_len);
-
-	if (n == buf_len)
-		--n;
-	buf[n] = '\0';
+	assert (n < buf_len);
 
 	--n;
 	/* remove trailing whitespace */
@@ -1148,6 +1237,258 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 	return buf;
 } /* char *ps_get_cmdline (...) */
 
+static int ps_pid_compare (const void *a, const void *b)
+{
+	int pid_a = *((const int *) a);
+	int pid_b = *((const int *) b);
+
+	if (pid_a < pid_b)
+		return (-1);
+	else if (pid_a > pid_b)
+		return (1);
+	return (0);
+} /* int ps_pid_compare */
+
+static void ps_pid_free (ps_pid_t *p)
+{
+	if (p == NULL)
+		return;
+
+	sfree (p->matches);
+	sfree (p);
+} /* void ps_pid_free */
+
+/* Returns the cache entry of the process `pid', determining the `Process' and
+ * `ProcessMatch' entries it matches if required. */
+static ps_pid_t *ps_pid_classify (ps_scanner_t *sc, int pid,
+		const char *name, unsigned long long starttime)
+{
+	ps_pid_t *p = NULL;
+	const char *cmdline = NULL;
+	procstat_t *ps;
+
+	if (c_btree_get (sc->cache, &pid, (void *) &p) == 0)
+	{
+		if (ps_cache_matches && (p->starttime == starttime)
+				&& (strncmp (p->name, name, sizeof (p->name) - 1) == 0))
+		{
+			p->cycle = ps_cycle;
+			return (p);
+		}
+
+		/* The pid was reused or the process executed another program. */
+		sfree (p->matches);
+		p->matches_num = 0;
+	}
+	else
+	{
+		p = calloc (1, sizeof (*p));
+		if (p == NULL)
+			return (NULL);
+		p->pid = pid;
+
+		if (c_btree_insert (sc->cache, &p->pid, p) != 0)
+		{
+			sfree (p);
+			return (NULL);
+		}
+	}
+
+	p->starttime = starttime;
+	sstrncpy (p->name, name, sizeof (p->name));
+	p->cycle = ps_cycle;
+
+	/* The command line is only needed for regular expressions. */
+	if (ps_have_regex)
+		cmdline = ps_get_cmdline (pid, (char *) name,
+				sc->cmdline, sizeof (sc->cmdline));
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+		if (ps_list_match (name, cmdline, ps) == 0)
+			continue;
+
+		tmp = realloc (p->matches, (p->matches_num + 1) * sizeof (*tmp));
+		if (tmp == NULL)
+			break;
+		p->matches = tmp;
+		p->matches[p->matches_num] = ps;
+		p->matches_num++;
+	}
+
+	return (p);
+} /* ps_pid_t *ps_pid_classify */
+
+/* Removes the cache entries of processes which have exited. */
+static void ps_pid_cache_expire (ps_scanner_t *sc)
+{
+	c_btree_iterator_t *iter;
+	int *pid;
+	ps_pid_t *p;
+
+	iter = c_btree_get_iterator (sc->cache);
+	while (c_btree_iterator_next (iter, (void *) &pid, (void *) &p) == 0)
+	{
+		int key;
+
+		if (p->cycle == ps_cycle)
+			continue;
+
+		/* Continue after the removed entry, see utils_btree.h. */
+		key = p->pid;
+		c_btree_remove (sc->cache, &key, NULL, NULL);
+		ps_pid_free (p);
+		c_btree_iterator_seek (iter, &key);
+	}
+	c_btree_iterator_destroy (iter);
+} /* void ps_pid_cache_expire */
+
+static int ps_scanner_add_result (ps_scanner_t *sc, ps_pid_t *p,
+		int pid, procstat_t *ps)
+{
+	procstat_entry_t *pse;
+
+	if (sc->results_num >= sc->results_size)
+	{
+		size_t size = (sc->results_size == 0) ? 64 : 2 * sc->results_size;
+		ps_result_t *tmp;
+
+		tmp = realloc (sc->results, size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (ENOMEM);
+		sc->results = tmp;
+		sc->results_size = size;
+	}
+
+	sc->results[sc->results_num].pid = p;
+	pse = &sc->results[sc->results_num].pse;
+	memset (pse, 0, sizeof (*pse));
+
+	pse->id       = pid;
+	pse->age      = 0;
+
+	pse->num_proc   = ps->num_proc;
+	pse->num_lwp    = ps->num_lwp;
+	pse->vmem_size  = ps->vmem_size;
+	pse->vmem_rss   = ps->vmem_rss;
+	pse->vmem_data  = ps->vmem_data;
+	pse->vmem_code  = ps->vmem_code;
+	pse->stack_size = ps->stack_size;
+
+	pse->vmem_minflt = 0;
+	pse->vmem_minflt_counter = ps->vmem_minflt_counter;
+	pse->vmem_majflt = 0;
+	pse->vmem_majflt_counter = ps->vmem_majflt_counter;
+
+	pse->cpu_user = 0;
+	pse->cpu_user_counter = ps->cpu_user_counter;
+	pse->cpu_system = 0;
+	pse->cpu_system_counter = ps->cpu_system_counter;
+
+	pse->io_rchar = ps->io_rchar;
+	pse->io_wchar = ps->io_wchar;
+	pse->io_syscr = ps->io_syscr;
+	pse->io_syscw = ps->io_syscw;
+
+	sc->results_num++;
+	return (0);
+} /* int ps_scanner_add_result */
+
+/* Reads the state of all pids assigned to the scanner and the details of
+ * those matching a `Process' or `ProcessMatch' entry. Only touches the
+ * scanner, so scanners can run concurrently. */
+static void *ps_scanner_run (void *arg)
+{
+	ps_scanner_t *sc = arg;
+	size_t i;
+
+	for (i = 0; i < sc->pids_num; i++)
+	{
+		int pid = sc->pids[i];
+		unsigned long long starttime;
+		procstat_t ps;
+		ps_pid_t *p;
+		char state;
+
+		memset (&ps, 0, sizeof (ps));
+		if (ps_read_stat (sc, pid, &ps, &state, &starttime) != 0)
+			continue;
+
+		switch (state)
+		{
+			case 'R': sc->running++;  break;
+			case 'S': sc->sleeping++; break;
+			case 'D': sc->blocked++;  break;
+			case 'Z': sc->zombies++;  break;
+			case 'T': sc->stopped++;  break;
+			case 'W': sc->paging++;   break;
+		}
+
+		p = ps_pid_classify (sc, pid, ps.name, starttime);
+		if ((p == NULL) || (p->matches_num == 0))
+			continue;
+
+		if (ps_read_process (sc, pid, &ps, state) != 0)
+		{
+			DEBUG ("ps_read_process failed for pid %i", pid);
+			continue;
+		}
+
+		ps_scanner_add_result (sc, p, pid, &ps);
+	}
+
+	ps_pid_cache_expire (sc);
+	return (NULL);
+} /* void *ps_scanner_run */
+
+static int ps_scanners_init (void)
+{
+	size_t i;
+
+	if (ps_scanners != NULL)
+		return (0);
+
+	ps_scanners = calloc (ps_scanners_num, sizeof (*ps_scanners));
+	if (ps_scanners == NULL)
+	{
+		ERROR ("processes plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < ps_scanners_num; i++)
+	{
+		ps_scanners[i].cache = c_btree_create (ps_pid_compare);
+		if (ps_scanners[i].cache == NULL)
+		{
+			ERROR ("processes plugin: c_btree_create failed.");
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* int ps_scanners_init */
+
+static int ps_scanner_add_pid (ps_scanner_t *sc, int pid)
+{
+	if (sc->pids_num >= sc->pids_size)
+	{
+		size_t size = (sc->pids_size == 0) ? 256 : 2 * sc->pids_size;
+		int *tmp;
+
+		tmp = realloc (sc->pids, size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (ENOMEM);
+		sc->pids = tmp;
+		sc->pids_size = size;
+	}
+
+	sc->pids[sc->pids_num] = pid;
+	sc->pids_num++;
+	return (0);
+} /* int ps_scanner_add_pid */
+
 static int read_fork_rate ()
 {
 	FILE *proc_stat;
@@ -1683,30 +2024,48 @@ static int ps_read (void)
 	int blocked  = 0;
 
 	struct dirent *ent;
-	DIR           *proc;
 	int            pid;
 
-	char cmdline[ARG_MAX];
-
-	int        status;
-	procstat_t ps;
-	procstat_entry_t pse;
-	char       state;
+	pthread_t *threads;
+	size_t     threads_num = 0;
+	size_t     i;
+	size_t     j;
 
 	procstat_t *ps_ptr;
 
-	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
+	ps_cycle++;
 
-	if ((proc = opendir ("/proc")) == NULL)
-	{
-		char errbuf[1024];
-		ERROR ("Cannot open `/proc': %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+	if (ps_scanners_init () != 0)
 		return (-1);
+
+	/* Keep /proc open, so the files of the processes can be opened
+	 * relative to it. */
+	if (ps_proc_dir == NULL)
+	{
+		if ((ps_proc_dir = opendir ("/proc")) == NULL)
+		{
+			char errbuf[1024];
+			ERROR ("Cannot open `/proc': %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+		ps_proc_fd = dirfd (ps_proc_dir);
 	}
+	else
+		rewinddir (ps_proc_dir);
 
-	while ((ent = readdir (proc)) != NULL)
+	for (i = 0; i < ps_scanners_num; i++)
+	{
+		ps_scanner_t *sc = ps_scanners + i;
+
+		sc->pids_num = 0;
+		sc->results_num = 0;
+		sc->running = sc->sleeping = sc->zombies = 0;
+		sc->stopped = sc->paging = sc->blocked = 0;
+	}
+
+	while ((ent = readdir (ps_proc_dir)) != NULL)
 	{
 		if (!isdigit (ent->d_name[0]))
 			continue;
@@ -1714,56 +2073,47 @@ static int ps_read (void)
 		if ((pid = atoi (ent->d_name)) < 1)
 			continue;
 
-		status = ps_read_process (pid, &ps, &state);
-		if (status != 0)
-		{
-			DEBUG ("ps_read_process failed: %i", status);
-			continue;
-		}
-
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
+		ps_scanner_add_pid (ps_scanners + (pid % ps_scanners_num), pid);
+	}
 
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
+	/* The first scanner runs in this thread. */
+	threads = calloc (ps_scanners_num, sizeof (*threads));
+	for (i = 1; (threads != NULL) && (i < ps_scanners_num); i++)
+	{
+		if (pthread_create (threads + threads_num, /* attr = */ NULL,
+					ps_scanner_run, ps_scanners + i) != 0)
+			break;
+		threads_num++;
+	}
+	/* Scan whatever could not be handed to a thread in this one. */
+	for (j = 1 + threads_num; j < ps_scanners_num; j++)
+		ps_scanner_run (ps_scanners + j);
+	ps_scanner_run (ps_scanners);
+	for (i = 0; i < threads_num; i++)
+		pthread_join (threads[i], /* retval = */ NULL);
+	sfree (threads);
+
+	for (i = 0; i < ps_scanners_num; i++)
+	{
+		ps_scanner_t *sc = ps_scanners + i;
 
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
+		running  += sc->running;
+		sleeping += sc->sleeping;
+		zombies  += sc->zombies;
+		stopped  += sc->stopped;
+		paging   += sc->paging;
+		blocked  += sc->blocked;
 
-		switch (state)
+		for (j = 0; j < sc->results_num; j++)
 		{
-			case 'R': running++;  break;
-			case 'S': sleeping++; break;
-			case 'D': blocked++;  break;
-			case 'Z': zombies++;  break;
-			case 'T': stopped++;  break;
-			case 'W': paging++;   break;
-		}
+			ps_result_t *r = sc->results + j;
+			size_t k;
 
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
+			for (k = 0; k < r->pid->matches_num; k++)
+				ps_list_add_one (r->pid->matches[k], &r->pse);
+		}
 	}
 
-	closedir (proc);
-
 	ps_submit_state ("running",  running);
 	ps_submit_state ("sleeping", sleeping);
 	ps_submit_state ("zombies",  zombies);
@@ -2169,9 +2519,43 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+#if KERNEL_LINUX
+static int ps_shutdown (void)
+{
+	size_t i;
+
+	for (i = 0; (ps_scanners != NULL) && (i < ps_scanners_num); i++)
+	{
+		ps_scanner_t *sc = ps_scanners + i;
+		int *pid;
+		ps_pid_t *p;
+
+		while (c_btree_pick (sc->cache, (void *) &pid, (void *) &p) == 0)
+			ps_pid_free (p);
+		c_btree_destroy (sc->cache);
+
+		sfree (sc->pids);
+		sfree (sc->results);
+	}
+	sfree (ps_scanners);
+
+	if (ps_proc_dir != NULL)
+	{
+		closedir (ps_proc_dir);
+		ps_proc_dir = NULL;
+		ps_proc_fd = -1;
+	}
+
+	return (0);
+} /* int ps_shutdown */
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("processes", ps_shutdown);
+#endif
 } /* void module_register */
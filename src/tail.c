@@ -24,6 +24,13 @@
 #include "plugin.h"
 #include "utils_tail_match.h"
 
+#if HAVE_SYS_INOTIFY_H
+# include "utils_avltree.h"
+# include <sys/inotify.h>
+# include <poll.h>
+# include <pthread.h>
+#endif
+
 /*
  *  <Plugin tail>
  *    <File "/var/log/exim4/mainlog">
@@ -35,7 +42,9 @@
  *	  Type "ipt_bytes"
  *	  Instance "total"
  *	</Match>
+ *	ReportStats false
  *    </File>
+ *    UseInotify false
  *  </Plugin>
  */
 
@@ -52,6 +61,525 @@ typedef struct ctail_config_match_s ctail_config_match_t;
 cu_tail_match_t **tail_match_list = NULL;
 size_t tail_match_list_num = 0;
 
+#if HAVE_SYS_INOTIFY_H
+/*
+ * With "UseInotify", a thread waits for changes to the files using a single
+ * inotify(7) descriptor and reads new lines as soon as they have been
+ * written. The read callback only dispatches the values then. Each file is
+ * watched itself, to notice writes, and its directory is watched to notice a
+ * new file being created in its place. Until then, the old file is followed.
+ */
+#define CTAIL_FILE_EVENTS (IN_MODIFY | IN_DELETE_SELF)
+#define CTAIL_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+struct ctail_watch_s
+{
+  cu_tail_match_t *tm;
+  char *file;
+  /* Points into `file' */
+  char *name;
+
+  /* Watch descriptors of the file and its directory, -1 if none. While
+   * the file isn't watched, it is polled by the read callback. */
+  int wd;
+  int dir_wd;
+
+  /* Used by the inotify thread only. */
+  _Bool dirty;
+  _Bool check;
+  struct ctail_watch_s *dirty_next;
+};
+typedef struct ctail_watch_s ctail_watch_t;
+
+/* All files using a watch descriptor: Each file has its own, but all files
+ * in a directory share the directory's. */
+struct ctail_wd_s
+{
+  int wd;
+  ctail_watch_t **watches;
+  size_t watches_num;
+};
+typedef struct ctail_wd_s ctail_wd_t;
+
+static _Bool ctail_use_inotify = 0;
+
+/* Same order as `tail_match_list'. */
+static ctail_watch_t *ctail_watches = NULL;
+static size_t ctail_watches_num = 0;
+
+static int ctail_inotify_fd = -1;
+static c_avl_tree_t *ctail_wds = NULL;
+/* Protects the watch descriptors in `ctail_watches' and `ctail_wds'. */
+static pthread_mutex_t ctail_watches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t ctail_thread_id;
+static _Bool ctail_thread_running = 0;
+static _Bool ctail_thread_do_shutdown = 0;
+/* True while the thread watches the files. */
+static _Bool ctail_inotify_active = 0;
+
+static int ctail_watch_add (cu_tail_match_t *tm, const char *file) /* {{{ */
+{
+  ctail_watch_t *temp;
+  ctail_watch_t *w;
+
+  temp = realloc (ctail_watches,
+      sizeof (*ctail_watches) * (ctail_watches_num + 1));
+  if (temp == NULL)
+    return (-1);
+  ctail_watches = temp;
+
+  w = ctail_watches + ctail_watches_num;
+  memset (w, 0, sizeof (*w));
+  w->tm = tm;
+  w->wd = -1;
+  w->dir_wd = -1;
+
+  w->file = strdup (file);
+  if (w->file == NULL)
+    return (-1);
+  w->name = strrchr (w->file, '/');
+  w->name = (w->name == NULL) ? w->file : w->name + 1;
+
+  ctail_watches_num++;
+  return (0);
+} /* }}} int ctail_watch_add */
+
+static int ctail_wd_compare (const void *a, const void *b) /* {{{ */
+{
+  int wd_a = *((const int *) a);
+  int wd_b = *((const int *) b);
+
+  if (wd_a < wd_b)
+    return (-1);
+  else if (wd_a > wd_b)
+    return (1);
+  return (0);
+} /* }}} int ctail_wd_compare */
+
+static void ctail_wd_free (ctail_wd_t *entry) /* {{{ */
+{
+  if (entry == NULL)
+    return;
+
+  sfree (entry->watches);
+  sfree (entry);
+} /* }}} void ctail_wd_free */
+
+/* Adds `w' to the files using `wd'. */
+static int ctail_wd_link (int wd, ctail_watch_t *w) /* {{{ */
+{
+  ctail_wd_t *entry = NULL;
+  ctail_watch_t **temp;
+  size_t i;
+
+  if (c_avl_get (ctail_wds, &wd, (void *) &entry) != 0)
+  {
+    entry = calloc (1, sizeof (*entry));
+    if (entry == NULL)
+      return (-1);
+    entry->wd = wd;
+
+    if (c_avl_insert (ctail_wds, &entry->wd, entry) != 0)
+    {
+      sfree (entry);
+      return (-1);
+    }
+  }
+
+  for (i = 0; i < entry->watches_num; i++)
+    if (entry->watches[i] == w)
+      return (0);
+
+  temp = realloc (entry->watches,
+      sizeof (*entry->watches) * (entry->watches_num + 1));
+  if (temp == NULL)
+    return (-1);
+  entry->watches = temp;
+  entry->watches[entry->watches_num] = w;
+  entry->watches_num++;
+
+  return (0);
+} /* }}} int ctail_wd_link */
+
+/* Removes `w' from the files using `wd'. The watch descriptor is removed
+ * once it isn't used anymore. */
+static void ctail_wd_unlink (int wd, ctail_watch_t *w) /* {{{ */
+{
+  ctail_wd_t *entry = NULL;
+  size_t i;
+
+  if (c_avl_get (ctail_wds, &wd, (void *) &entry) != 0)
+    return;
+
+  for (i = 0; i < entry->watches_num; i++)
+  {
+    if (entry->watches[i] != w)
+      continue;
+
+    entry->watches_num--;
+    memmove (entry->watches + i, entry->watches + i + 1,
+	sizeof (*entry->watches) * (entry->watches_num - i));
+    break;
+  }
+
+  if (entry->watches_num == 0)
+  {
+    c_avl_remove (ctail_wds, &wd, /* key = */ NULL, /* value = */ NULL);
+    /* Fails if the kernel has already removed the watch. */
+    inotify_rm_watch (ctail_inotify_fd, wd);
+    ctail_wd_free (entry);
+  }
+} /* }}} void ctail_wd_unlink */
+
+/* (Re-)Adds the watch for the file, which may be a different file than the
+ * one watched so far. Must be called with `ctail_watches_lock' held. */
+static void ctail_watch_file (ctail_watch_t *w) /* {{{ */
+{
+  int wd;
+
+  wd = inotify_add_watch (ctail_inotify_fd, w->file, CTAIL_FILE_EVENTS);
+  if (wd < 0)
+  {
+    /* Keep watching the old file, if any. Once the file appears, the
+     * directory's watch will tell us. */
+    if (w->wd < 0)
+    {
+      char errbuf[1024];
+      INFO ("tail plugin: inotify_add_watch (%s) failed: %s. "
+	  "Polling the file instead.",
+	  w->file, sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+    return;
+  }
+
+  if (wd == w->wd)
+    return;
+
+  if (ctail_wd_link (wd, w) != 0)
+  {
+    ERROR ("tail plugin: Allocating memory for watch of `%s' failed.",
+	w->file);
+    return;
+  }
+
+  if (w->wd >= 0)
+    ctail_wd_unlink (w->wd, w);
+  w->wd = wd;
+} /* }}} void ctail_watch_file */
+
+static void ctail_watch_dir (ctail_watch_t *w) /* {{{ */
+{
+  char dir[PATH_MAX];
+  int wd;
+
+  if (w->name == w->file)
+    sstrncpy (dir, ".", sizeof (dir));
+  else if (w->name == w->file + 1)
+    sstrncpy (dir, "/", sizeof (dir));
+  else
+  {
+    size_t len = (size_t) (w->name - w->file);
+
+    if (len > sizeof (dir))
+      len = sizeof (dir);
+    /* Copy without the trailing slash. */
+    sstrncpy (dir, w->file, len);
+  }
+
+  wd = inotify_add_watch (ctail_inotify_fd, dir, CTAIL_DIR_EVENTS);
+  if (wd < 0)
+  {
+    char errbuf[1024];
+    WARNING ("tail plugin: inotify_add_watch (%s) failed: %s. "
+	"New files replacing `%s' will only be noticed while it is "
+	"being polled.", dir, sstrerror (errno, errbuf, sizeof (errbuf)),
+	w->file);
+    return;
+  }
+
+  if (ctail_wd_link (wd, w) != 0)
+  {
+    ERROR ("tail plugin: Allocating memory for watch of `%s' failed.",
+	dir);
+    return;
+  }
+  w->dir_wd = wd;
+} /* }}} void ctail_watch_dir */
+
+static void ctail_mark_dirty (ctail_watch_t *w, _Bool check, /* {{{ */
+    ctail_watch_t **dirty)
+{
+  if (check)
+    w->check = 1;
+
+  if (w->dirty)
+    return;
+
+  w->dirty = 1;
+  w->dirty_next = *dirty;
+  *dirty = w;
+} /* }}} void ctail_mark_dirty */
+
+static void ctail_handle_event (const struct inotify_event *ev, /* {{{ */
+    ctail_watch_t **dirty)
+{
+  ctail_wd_t *entry = NULL;
+  size_t i;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+  {
+    WARNING ("tail plugin: The inotify event queue overflowed. "
+	"Checking all files.");
+    for (i = 0; i < ctail_watches_num; i++)
+      ctail_mark_dirty (ctail_watches + i, /* check = */ 1, dirty);
+    return;
+  }
+
+  if (c_avl_get (ctail_wds, &ev->wd, (void *) &entry) != 0)
+    return;
+
+  if (ev->mask & IN_IGNORED)
+  {
+    /* The file or directory has been removed, and so has the watch. */
+    c_avl_remove (ctail_wds, &ev->wd, /* key = */ NULL, /* value = */ NULL);
+    for (i = 0; i < entry->watches_num; i++)
+    {
+      ctail_watch_t *w = entry->watches[i];
+
+      if (w->wd == ev->wd)
+      {
+	w->wd = -1;
+	ctail_mark_dirty (w, /* check = */ 1, dirty);
+      }
+      if (w->dir_wd == ev->wd)
+	w->dir_wd = -1;
+    }
+    ctail_wd_free (entry);
+    return;
+  }
+
+  for (i = 0; i < entry->watches_num; i++)
+  {
+    ctail_watch_t *w = entry->watches[i];
+
+    if (w->wd == ev->wd)
+      ctail_mark_dirty (w, /* check = */ 0, dirty);
+    else if ((w->dir_wd == ev->wd) && (ev->len > 0)
+	&& (strcmp (ev->name, w->name) == 0))
+      ctail_mark_dirty (w, /* check = */ 1, dirty);
+  }
+} /* }}} void ctail_handle_event */
+
+/* Reads all queued events and returns the files that need to be read. */
+static ctail_watch_t *ctail_read_events (void) /* {{{ */
+{
+  char buffer[64 * (sizeof (struct inotify_event) + NAME_MAX + 1)]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  ctail_watch_t *dirty = NULL;
+
+  while (42)
+  {
+    ssize_t len;
+    char *ptr;
+
+    len = read (ctail_inotify_fd, buffer, sizeof (buffer));
+    if (len < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      if (errno != EAGAIN)
+      {
+	char errbuf[1024];
+	ERROR ("tail plugin: Reading inotify events failed: %s",
+	    sstrerror (errno, errbuf, sizeof (errbuf)));
+      }
+      break;
+    }
+    else if (len == 0)
+      break;
+
+    for (ptr = buffer; ptr < buffer + len; )
+    {
+      const struct inotify_event *ev = (const struct inotify_event *) ptr;
+
+      ctail_handle_event (ev, &dirty);
+      ptr += sizeof (*ev) + ev->len;
+    }
+  }
+
+  return (dirty);
+} /* }}} ctail_watch_t *ctail_read_events */
+
+static void *ctail_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  size_t i;
+
+  while (!ctail_thread_do_shutdown)
+  {
+    struct pollfd pfd;
+    ctail_watch_t *dirty;
+    int status;
+
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = ctail_inotify_fd;
+    pfd.events = POLLIN;
+
+    status = poll (&pfd, 1, /* timeout = */ 1000);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+	continue;
+
+      ERROR ("tail plugin: poll(2) failed: %s. Falling back to polling "
+	  "the files.", sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+    else if (status == 0)
+      continue;
+
+    /* All events queued so far are handled at once, so a burst of writes
+     * results in a single read per file. */
+    pthread_mutex_lock (&ctail_watches_lock);
+    dirty = ctail_read_events ();
+    pthread_mutex_unlock (&ctail_watches_lock);
+
+    while (dirty != NULL)
+    {
+      ctail_watch_t *w = dirty;
+      _Bool check = w->check;
+
+      dirty = w->dirty_next;
+      w->dirty = 0;
+      w->check = 0;
+      w->dirty_next = NULL;
+
+      if (check)
+	tail_match_check (w->tm);
+      tail_match_update (w->tm);
+
+      if (check)
+      {
+	pthread_mutex_lock (&ctail_watches_lock);
+	ctail_watch_file (w);
+	tail_match_watched (w->tm, w->wd >= 0);
+	pthread_mutex_unlock (&ctail_watches_lock);
+      }
+    }
+  } /* while (!ctail_thread_do_shutdown) */
+
+  /* Let the read callback poll all files. */
+  pthread_mutex_lock (&ctail_watches_lock);
+  ctail_inotify_active = 0;
+  for (i = 0; i < ctail_watches_num; i++)
+    tail_match_watched (ctail_watches[i].tm, /* watched = */ 0);
+  pthread_mutex_unlock (&ctail_watches_lock);
+
+  return ((void *) 0);
+} /* }}} void *ctail_thread */
+
+static int ctail_inotify_init (void) /* {{{ */
+{
+  size_t i;
+  int status;
+
+  ctail_inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (ctail_inotify_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tail plugin: inotify_init1 failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  ctail_wds = c_avl_create (ctail_wd_compare);
+  if (ctail_wds == NULL)
+  {
+    close (ctail_inotify_fd);
+    ctail_inotify_fd = -1;
+    return (-1);
+  }
+
+  pthread_mutex_lock (&ctail_watches_lock);
+  for (i = 0; i < ctail_watches_num; i++)
+  {
+    ctail_watch_t *w = ctail_watches + i;
+
+    ctail_watch_dir (w);
+    ctail_watch_file (w);
+
+    /* Open the file now, so that everything written from now on is
+     * read. */
+    tail_match_watched (w->tm, w->wd >= 0);
+    tail_match_update (w->tm);
+  }
+
+  status = plugin_thread_create (&ctail_thread_id, /* attr = */ NULL,
+      ctail_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("tail plugin: pthread_create(3) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    for (i = 0; i < ctail_watches_num; i++)
+      tail_match_watched (ctail_watches[i].tm, /* watched = */ 0);
+    pthread_mutex_unlock (&ctail_watches_lock);
+    return (-1);
+  }
+  ctail_thread_running = 1;
+  ctail_inotify_active = 1;
+  pthread_mutex_unlock (&ctail_watches_lock);
+
+  return (0);
+} /* }}} int ctail_inotify_init */
+
+static void ctail_inotify_shutdown (void) /* {{{ */
+{
+  ctail_wd_t *entry;
+  void *key;
+  size_t i;
+
+  if (ctail_thread_running)
+  {
+    int status;
+
+    ctail_thread_do_shutdown = 1;
+
+    status = pthread_join (ctail_thread_id, /* retval = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("tail plugin: pthread_join(3) failed: %s",
+	  sstrerror (status, errbuf, sizeof (errbuf)));
+    }
+
+    ctail_thread_running = 0;
+    ctail_thread_do_shutdown = 0;
+  }
+
+  if (ctail_wds != NULL)
+  {
+    while (c_avl_pick (ctail_wds, &key, (void *) &entry) == 0)
+      ctail_wd_free (entry);
+    c_avl_destroy (ctail_wds);
+    ctail_wds = NULL;
+  }
+
+  if (ctail_inotify_fd >= 0)
+  {
+    close (ctail_inotify_fd);
+    ctail_inotify_fd = -1;
+  }
+
+  for (i = 0; i < ctail_watches_num; i++)
+    sfree (ctail_watches[i].file);
+  sfree (ctail_watches);
+  ctail_watches_num = 0;
+} /* }}} void ctail_inotify_shutdown */
+#endif /* HAVE_SYS_INOTIFY_H */
+
 static int ctail_config_add_string (const char *name, char **dest, oconfig_item_t *ci)
 {
   if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
@@ -260,6 +788,14 @@ static int ctail_config_add_file (oconfig_item_t *ci)
     }
     else if (strcasecmp ("Instance", option->key) == 0)
       status = ctail_config_add_string ("Instance", &plugin_instance, option);
+    else if (strcasecmp ("ReportStats", option->key) == 0)
+    {
+      _Bool report_stats = 0;
+
+      status = cf_util_get_boolean (option, &report_stats);
+      if ((status == 0) && report_stats)
+	status = tail_match_report_stats (tm, "tail", plugin_instance);
+    }
     else
     {
       WARNING ("tail plugin: Option `%s' not allowed here.", option->key);
@@ -291,6 +827,16 @@ static int ctail_config_add_file (oconfig_item_t *ci)
     }
 
     tail_match_list = temp;
+
+#if HAVE_SYS_INOTIFY_H
+    if (ctail_watch_add (tm, ci->values[0].value.string) != 0)
+    {
+      ERROR ("tail plugin: ctail_watch_add failed.");
+      tail_match_destroy (tm);
+      return (-1);
+    }
+#endif
+
     tail_match_list[tail_match_list_num] = tm;
     tail_match_list_num++;
   }
@@ -308,6 +854,15 @@ static int ctail_config (oconfig_item_t *ci)
 
     if (strcasecmp ("File", option->key) == 0)
       ctail_config_add_file (option);
+    else if (strcasecmp ("UseInotify", option->key) == 0)
+    {
+#if HAVE_SYS_INOTIFY_H
+      cf_util_get_boolean (option, &ctail_use_inotify);
+#else
+      WARNING ("tail plugin: The `UseInotify' option is not supported "
+	  "on this system.");
+#endif
+    }
     else
     {
       WARNING ("tail plugin: Option `%s' not allowed here.", option->key);
@@ -325,6 +880,15 @@ static int ctail_init (void)
     return (-1);
   }
 
+#if HAVE_SYS_INOTIFY_H
+  if (ctail_use_inotify && (ctail_inotify_fd < 0))
+  {
+    if (ctail_inotify_init () != 0)
+      WARNING ("tail plugin: Using inotify failed. Polling the files "
+	  "instead.");
+  }
+#endif
+
   return (0);
 } /* int ctail_init */
 
@@ -337,6 +901,18 @@ static int ctail_read (void)
   {
     int status;
 
+#if HAVE_SYS_INOTIFY_H
+    /* Files watched by the inotify thread are already up to date. */
+    _Bool watched;
+
+    pthread_mutex_lock (&ctail_watches_lock);
+    watched = ctail_inotify_active && (ctail_watches[i].wd >= 0);
+    pthread_mutex_unlock (&ctail_watches_lock);
+
+    if (watched)
+      status = tail_match_submit (tail_match_list[i]);
+    else
+#endif
     status = tail_match_read (tail_match_list[i]);
     if (status != 0)
     {
@@ -357,6 +933,10 @@ static int ctail_shutdown (void)
 {
   size_t i;
 
+#if HAVE_SYS_INOTIFY_H
+  ctail_inotify_shutdown ();
+#endif
+
   for (i = 0; i < tail_match_list_num; i++)
   {
     tail_match_destroy (tail_match_list[i]);
@@ -74,6 +74,9 @@
 /* sys/socket.h is necessary to compile when using netlink on older systems. */
 # include <sys/socket.h>
 # include <linux/netlink.h>
+# if HAVE_LINUX_SOCK_DIAG_H
+#  include <linux/sock_diag.h>
+# endif
 # include <linux/inet_diag.h>
 # include <sys/socket.h>
 # include <arpa/inet.h>
@@ -142,6 +145,31 @@ struct nlreq {
   struct inet_diag_req r;
 };
 
+#ifdef SOCK_DIAG_BY_FAMILY
+# define TCPCONNS_HAVE_SOCK_DIAG 1
+
+/* Maximum number of port ranges in the filter passed to the kernel. The
+ * kernel runs the filter for every socket, so checking more ranges costs more
+ * than returning a few unwanted sockets. Each range takes five operations,
+ * see conn_filter_add_range(). */
+# define CONN_FILTER_RANGES_MAX 64
+# define CONN_FILTER_OPS_MAX (5 * CONN_FILTER_RANGES_MAX + 1)
+
+/* Request for the "sock_diag" interface. The filter built by
+ * conn_build_filter() is passed as INET_DIAG_REQ_BYTECODE attribute. */
+struct conn_sock_diag_req_s {
+  struct nlmsghdr nlh;
+  struct inet_diag_req_v2 r;
+  struct nlattr nla;
+  struct inet_diag_bc_op bc[CONN_FILTER_OPS_MAX];
+};
+
+static struct conn_sock_diag_req_s sock_diag_req;
+static size_t sock_diag_ops_num = 0;
+#else
+# define TCPCONNS_HAVE_SOCK_DIAG 0
+#endif
+
 static const char *tcp_state[] =
 {
   "", /* 0 */
@@ -261,7 +289,6 @@ typedef struct port_entry_s
   uint16_t flags;
   uint32_t count_local[TCP_STATE_MAX + 1];
   uint32_t count_remote[TCP_STATE_MAX + 1];
-  struct port_entry_s *next;
 } port_entry_t;
 
 static const char *config_keys[] =
@@ -273,7 +300,11 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int port_collect_listening = 0;
-static port_entry_t *port_list_head = NULL;
+
+/* Port entries are indexed by port number, so that handling a connection costs
+ * two array lookups, no matter how many ports are collected. */
+static port_entry_t *port_table[65536];
+static size_t port_entries_num = 0;
 
 #if KERNEL_LINUX
 static uint32_t sequence_number = 0;
@@ -281,6 +312,7 @@ static uint32_t sequence_number = 0;
 enum
 {
   SRC_DUNNO,
+  SRC_SOCK_DIAG,
   SRC_NETLINK,
   SRC_PROC
 } linux_source = SRC_DUNNO;
@@ -332,23 +364,18 @@ static void conn_submit_port_entry (port_entry_t *pe)
 
 static void conn_submit_all (void)
 {
-  port_entry_t *pe;
+  size_t i;
 
-  for (pe = port_list_head; pe != NULL; pe = pe->next)
-    conn_submit_port_entry (pe);
+  for (i = 0; i < STATIC_ARRAY_SIZE (port_table); i++)
+    if (port_table[i] != NULL)
+      conn_submit_port_entry (port_table[i]);
 } /* void conn_submit_all */
 
 static port_entry_t *conn_get_port_entry (uint16_t port, int create)
 {
   port_entry_t *ret;
 
-  ret = port_list_head;
-  while (ret != NULL)
-  {
-    if (ret->port == port)
-      break;
-    ret = ret->next;
-  }
+  ret = port_table[port];
 
   if ((ret == NULL) && (create != 0))
   {
@@ -358,8 +385,8 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
     memset (ret, '\0', sizeof (port_entry_t));
 
     ret->port = port;
-    ret->next = port_list_head;
-    port_list_head = ret;
+    port_table[port] = ret;
+    port_entries_num++;
   }
 
   return (ret);
@@ -369,29 +396,27 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
  * setting but which are no longer listening. */
 static void conn_reset_port_entry (void)
 {
-  port_entry_t *prev = NULL;
-  port_entry_t *pe = port_list_head;
+  size_t i;
 
-  while (pe != NULL)
+  for (i = 0; i < STATIC_ARRAY_SIZE (port_table); i++)
   {
+    port_entry_t *pe = port_table[i];
+
+    if (pe == NULL)
+      continue;
+
     /* If this entry was created while reading the files (ant not when handling
      * the configuration) remove it now. */
     if ((pe->flags & (PORT_COLLECT_LOCAL
 	    | PORT_COLLECT_REMOTE
 	    | PORT_IS_LISTENING)) == 0)
     {
-      port_entry_t *next = pe->next;
-
       DEBUG ("tcpconns plugin: Removing temporary entry "
 	  "for listening port %"PRIu16, pe->port);
 
-      if (prev == NULL)
-	port_list_head = next;
-      else
-	prev->next = next;
-
+      port_table[i] = NULL;
+      port_entries_num--;
       sfree (pe);
-      pe = next;
 
       continue;
     }
@@ -399,8 +424,6 @@ static void conn_reset_port_entry (void)
     memset (pe->count_local, '\0', sizeof (pe->count_local));
     memset (pe->count_remote, '\0', sizeof (pe->count_remote));
     pe->flags &= ~PORT_IS_LISTENING;
-
-    pe = pe->next;
   }
 } /* void conn_reset_port_entry */
 
@@ -430,11 +453,11 @@ static int conn_handle_ports (uint16_t port_local, uint16_t port_remote, uint8_t
   DEBUG ("tcpconns plugin: Connection %"PRIu16" <-> %"PRIu16" (%s)",
       port_local, port_remote, tcp_state[state]);
 
-  pe = conn_get_port_entry (port_local, 0 /* no create */);
+  pe = port_table[port_local];
   if (pe != NULL)
     pe->count_local[state]++;
 
-  pe = conn_get_port_entry (port_remote, 0 /* no create */);
+  pe = port_table[port_remote];
   if (pe != NULL)
     pe->count_remote[state]++;
 
@@ -442,51 +465,30 @@ static int conn_handle_ports (uint16_t port_local, uint16_t port_remote, uint8_t
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
-/* Returns zero on success, less than zero on socket error and greater than
- * zero on other errors. */
-static int conn_read_netlink (void)
+/* Sends the request `req' to the netlink socket `fd' and handles all sockets
+ * returned by the kernel. Returns zero on success, less than zero on socket
+ * error and greater than zero on other errors. */
+static int conn_netlink_dump (int fd, struct nlmsghdr *req)
 {
-  int fd;
   struct sockaddr_nl nladdr;
-  struct nlreq req;
   struct msghdr msg;
   struct iovec iov;
   struct inet_diag_msg *r;
-  char buf[8192];
-
-  /* If this fails, it's likely a permission problem. We'll fall back to
-   * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0)
-  {
-    ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
-	"NETLINK_INET_DIAG) failed: %s",
-	sstrerror (errno, buf, sizeof (buf)));
-    return (-1);
-  }
+  /* Large enough for the biggest replies the kernel sends, so one recvmsg(2)
+   * call returns several hundred sockets. */
+  char buf[32768];
 
   memset(&nladdr, 0, sizeof(nladdr));
   nladdr.nl_family = AF_NETLINK;
 
-  memset(&req, 0, sizeof(req));
-  req.nlh.nlmsg_len = sizeof(req);
-  req.nlh.nlmsg_type = TCPDIAG_GETSOCK;
-  /* NLM_F_ROOT: return the complete table instead of a single entry.
-   * NLM_F_MATCH: return all entries matching criteria (not implemented)
-   * NLM_F_REQUEST: must be set on all request messages */
-  req.nlh.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
-  req.nlh.nlmsg_pid = 0;
   /* The sequence_number is used to track our messages. Since netlink is not
    * reliable, we don't want to end up with a corrupt or incomplete old
    * message in case the system is/was out of memory. */
-  req.nlh.nlmsg_seq = ++sequence_number;
-  req.r.idiag_family = AF_INET;
-  req.r.idiag_states = 0xfff;
-  req.r.idiag_ext = 0;
+  req->nlmsg_seq = ++sequence_number;
 
   memset(&iov, 0, sizeof(iov));
-  iov.iov_base = &req;
-  iov.iov_len = sizeof(req);
+  iov.iov_base = req;
+  iov.iov_len = req->nlmsg_len;
 
   memset(&msg, 0, sizeof(msg));
   msg.msg_name = (void*)&nladdr;
@@ -496,9 +498,8 @@ static int conn_read_netlink (void)
 
   if (sendmsg (fd, &msg, 0) < 0)
   {
-    ERROR ("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
+    ERROR ("tcpconns plugin: conn_netlink_dump: sendmsg(2) failed: %s",
 	sstrerror (errno, buf, sizeof (buf)));
-    close (fd);
     return (-1);
   }
 
@@ -522,15 +523,13 @@ static int conn_read_netlink (void)
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
-      ERROR ("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
+      ERROR ("tcpconns plugin: conn_netlink_dump: recvmsg(2) failed: %s",
 	  sstrerror (errno, buf, sizeof (buf)));
-      close (fd);
       return (-1);
     }
     else if (status == 0)
     {
-      close (fd);
-      DEBUG ("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
+      DEBUG ("tcpconns plugin: conn_netlink_dump: Unexpected zero-sized "
 	  "reply from netlink socket.");
       return (0);
     }
@@ -546,7 +545,6 @@ static int conn_read_netlink (void)
 
       if (h->nlmsg_type == NLMSG_DONE)
       {
-	close (fd);
 	return (0);
       }
       else if (h->nlmsg_type == NLMSG_ERROR)
@@ -554,10 +552,9 @@ static int conn_read_netlink (void)
 	struct nlmsgerr *msg_error;
 
 	msg_error = NLMSG_DATA(h);
-	WARNING ("tcpconns plugin: conn_read_netlink: Received error %i.",
+	WARNING ("tcpconns plugin: conn_netlink_dump: Received error %i.",
 	    msg_error->error);
 
-	close (fd);
 	return (1);
       }
 
@@ -574,72 +571,337 @@ static int conn_read_netlink (void)
 
   /* Not reached because the while() loop above handles the exit condition. */
   return (0);
+} /* int conn_netlink_dump */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink (void)
+{
+  int fd;
+  struct nlreq req;
+  int status;
+
+  /* If this fails, it's likely a permission problem. We'll fall back to
+   * reading this information from files below. */
+  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
+	"NETLINK_INET_DIAG) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len = sizeof(req);
+  req.nlh.nlmsg_type = TCPDIAG_GETSOCK;
+  /* NLM_F_ROOT: return the complete table instead of a single entry.
+   * NLM_F_MATCH: return all entries matching criteria (not implemented)
+   * NLM_F_REQUEST: must be set on all request messages */
+  req.nlh.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
+  req.nlh.nlmsg_pid = 0;
+  req.r.idiag_family = AF_INET;
+  req.r.idiag_states = 0xfff;
+  req.r.idiag_ext = 0;
+
+  status = conn_netlink_dump (fd, &req.nlh);
+
+  close (fd);
+  return (status);
 } /* int conn_read_netlink */
 
-static int conn_handle_line (char *buffer)
+#if TCPCONNS_HAVE_SOCK_DIAG
+static _Bool conn_port_is_wanted (uint16_t port, int remote)
 {
-  char *fields[32];
-  int   fields_len;
+  port_entry_t *pe = port_table[port];
 
-  char *endptr;
+  if (pe == NULL)
+    return (0);
+  else if (remote)
+    return ((pe->flags & PORT_COLLECT_REMOTE) != 0);
+  else
+    return (((pe->flags & PORT_COLLECT_LOCAL) != 0)
+	|| ((port_collect_listening != 0)
+	  && ((pe->flags & PORT_IS_LISTENING) != 0)));
+} /* _Bool conn_port_is_wanted */
+
+/* Appends a check for "first <= port <= last" to the filter. If the port is in
+ * the range, the socket is accepted, otherwise the next check is run. */
+static void conn_filter_add_range (uint8_t code_ge, uint8_t code_le,
+    uint16_t first, uint16_t last)
+{
+  struct inet_diag_bc_op *op;
+
+  /* Jump distances are in bytes, relative to the current operation.
+   * Comparisons are followed by an operation holding the port in `no'. */
+  op = sock_diag_req.bc + sock_diag_ops_num;
+  memset (op, 0, 5 * sizeof (*op));
+
+  op[0].code = code_ge;
+  op[0].yes = 2 * sizeof (*op);
+  op[0].no = 5 * sizeof (*op); /* next check */
+  op[1].no = first;
+
+  op[2].code = code_le;
+  op[2].yes = 2 * sizeof (*op);
+  op[2].no = 3 * sizeof (*op); /* next check */
+  op[3].no = last;
+
+  /* The kernel accepts a socket if the filter ends exactly at its end. The
+   * distance is set by conn_build_filter() once the length is known. */
+  op[4].code = INET_DIAG_BC_JMP;
+  op[4].yes = sizeof (*op);
+
+  sock_diag_ops_num += 5;
+} /* void conn_filter_add_range */
+
+/* Appends checks for the local or remote ports we are interested in, using at
+ * most `ranges_max' ranges. Consecutive ports are merged into one range. If
+ * there are too many ranges, ports less than `gap' apart are merged, too. The
+ * kernel then returns some unwanted sockets, which conn_handle_ports()
+ * ignores. */
+static void conn_filter_add_ports (int remote, size_t ranges_max)
+{
+  uint8_t code_ge = remote ? INET_DIAG_BC_D_GE : INET_DIAG_BC_S_GE;
+  uint8_t code_le = remote ? INET_DIAG_BC_D_LE : INET_DIAG_BC_S_LE;
+  size_t ops_start = sock_diag_ops_num;
+  uint32_t gap;
 
-  char *port_local_str;
-  char *port_remote_str;
-  uint16_t port_local;
-  uint16_t port_remote;
+  for (gap = 1; ; gap *= 2)
+  {
+    size_t ranges_num = 0;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t port;
 
-  uint8_t state;
+    sock_diag_ops_num = ops_start;
 
-  int buffer_len = strlen (buffer);
+    for (port = 1; port < STATIC_ARRAY_SIZE (port_table); port++)
+    {
+      if (!conn_port_is_wanted ((uint16_t) port, remote))
+	continue;
 
-  while ((buffer_len > 0) && (buffer[buffer_len - 1] < 32))
-    buffer[--buffer_len] = '\0';
-  if (buffer_len <= 0)
-    return (-1);
+      if ((first != 0) && ((port - last) <= gap))
+      {
+	last = port;
+	continue;
+      }
+
+      if (first != 0)
+      {
+	if (ranges_num >= ranges_max)
+	  break;
+	conn_filter_add_range (code_ge, code_le,
+	    (uint16_t) first, (uint16_t) last);
+	ranges_num++;
+      }
+      first = port;
+      last = port;
+    }
+
+    if (port < STATIC_ARRAY_SIZE (port_table))
+      continue;
+
+    if (first != 0)
+    {
+      if (ranges_num >= ranges_max)
+	continue;
+      conn_filter_add_range (code_ge, code_le,
+	  (uint16_t) first, (uint16_t) last);
+    }
+    break;
+  }
+} /* void conn_filter_add_ports */
+
+/* Builds a filter program for the kernel which only lets through sockets with
+ * a local or remote port we are interested in. Returns the number of
+ * operations or zero if no socket can match. */
+static size_t conn_build_filter (void)
+{
+  struct inet_diag_bc_op *last;
+  size_t i;
 
-  fields_len = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
-  if (fields_len < 12)
+  sock_diag_ops_num = 0;
+  conn_filter_add_ports (/* remote = */ 0, CONN_FILTER_RANGES_MAX / 2);
+  conn_filter_add_ports (/* remote = */ 1, CONN_FILTER_RANGES_MAX / 2);
+
+  if (sock_diag_ops_num == 0)
+    return (0);
+
+  /* Accepting jumps go to the end of the filter, behind the final operation.
+   * That one jumps beyond the end, which rejects the socket. */
+  for (i = 4; i < sock_diag_ops_num; i += 5)
+    sock_diag_req.bc[i].no = (sock_diag_ops_num + 1 - i)
+      * sizeof (sock_diag_req.bc[i]);
+
+  last = sock_diag_req.bc + sock_diag_ops_num;
+  memset (last, 0, sizeof (*last));
+  last->code = INET_DIAG_BC_JMP;
+  last->yes = sizeof (*last);
+  last->no = 2 * sizeof (*last);
+  sock_diag_ops_num++;
+
+  return (sock_diag_ops_num);
+} /* size_t conn_build_filter */
+
+/* Dumps all TCP sockets of `family' with one of `states'. Unless
+ * `use_filter' is false, the filter in sock_diag_req is attached. */
+static int conn_sock_diag_dump (int fd, uint8_t family, uint32_t states,
+    _Bool use_filter)
+{
+  size_t len = offsetof (struct conn_sock_diag_req_s, nla);
+
+  memset (&sock_diag_req, 0, len);
+  sock_diag_req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  sock_diag_req.nlh.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
+  sock_diag_req.r.sdiag_family = family;
+  sock_diag_req.r.sdiag_protocol = IPPROTO_TCP;
+  sock_diag_req.r.idiag_states = states;
+
+  if (use_filter)
   {
-    DEBUG ("tcpconns plugin: Got %i fields, expected at least 12.", fields_len);
-    return (-1);
+    size_t bc_len = sock_diag_ops_num * sizeof (sock_diag_req.bc[0]);
+
+    sock_diag_req.nla.nla_type = INET_DIAG_REQ_BYTECODE;
+    sock_diag_req.nla.nla_len = (uint16_t) (sizeof (sock_diag_req.nla)
+	+ bc_len);
+    len += sizeof (sock_diag_req.nla) + bc_len;
   }
 
-  port_local_str  = strchr (fields[1], ':');
-  port_remote_str = strchr (fields[2], ':');
+  sock_diag_req.nlh.nlmsg_len = (uint32_t) len;
+
+  return (conn_netlink_dump (fd, &sock_diag_req.nlh));
+} /* int conn_sock_diag_dump */
 
-  if ((port_local_str == NULL) || (port_remote_str == NULL))
+/* Like conn_read_netlink(), but uses the "sock_diag" interface of Linux 3.3
+ * and later. Listening sockets are requested first, because they may add
+ * ports. Then the kernel is told to only return sockets using one of the
+ * ports we collect. Returns zero on success, less than zero on socket error
+ * and greater than zero on other errors. */
+static int conn_read_sock_diag (void)
+{
+  static const uint8_t families[] = { AF_INET, AF_INET6 };
+  uint32_t states = 0xfff;
+  size_t filter_ops;
+  int status = 0;
+  size_t i;
+  int fd;
+
+  fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tcpconns plugin: conn_read_sock_diag: socket(AF_NETLINK, "
+	"SOCK_RAW, NETLINK_INET_DIAG) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
-  port_local_str++;
-  port_remote_str++;
-  if ((*port_local_str == '\0') || (*port_remote_str == '\0'))
+  }
+
+  if (port_collect_listening != 0)
+  {
+    for (i = 0; (i < STATIC_ARRAY_SIZE (families)) && (status == 0); i++)
+      status = conn_sock_diag_dump (fd, families[i],
+	  1 << TCP_STATE_LISTEN, /* use_filter = */ 0);
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  filter_ops = conn_build_filter ();
+  for (i = 0; (i < STATIC_ARRAY_SIZE (families)) && (status == 0)
+      && (filter_ops != 0); i++)
+    status = conn_sock_diag_dump (fd, families[i], states,
+	/* use_filter = */ 1);
+
+  close (fd);
+  return (status);
+} /* int conn_read_sock_diag */
+#endif /* TCPCONNS_HAVE_SOCK_DIAG */
+
+/* Parses the hexadecimal number at `*ptr' and moves `*ptr' behind it. Returns
+ * the number of digits read. Only the lower 32 bits of the value are kept. */
+static int conn_parse_hex (char **ptr, uint32_t *ret_value)
+{
+  uint32_t value = 0;
+  int digits = 0;
+  char *c;
+
+  for (c = *ptr; ; c++, digits++)
+  {
+    if ((*c >= '0') && (*c <= '9'))
+      value = (value << 4) | (uint32_t) (*c - '0');
+    else if ((*c >= 'A') && (*c <= 'F'))
+      value = (value << 4) | (uint32_t) (*c - 'A' + 10);
+    else if ((*c >= 'a') && (*c <= 'f'))
+      value = (value << 4) | (uint32_t) (*c - 'a' + 10);
+    else
+      break;
+  }
+
+  *ptr = c;
+  *ret_value = value;
+  return (digits);
+} /* int conn_parse_hex */
+
+/* Handles one line of /proc/net/tcp or /proc/net/tcp6, for example:
+ *   "   0: 0100007F:0019 00000000:0000 0A 00000000:00000000 ..."
+ * Only the ports and the state are used, so the line is not split into all
+ * of its fields. */
+static int conn_handle_line (char *buffer)
+{
+  char *ptr = buffer;
+  uint32_t port_local;
+  uint32_t port_remote;
+  uint32_t state;
+  uint32_t dummy;
+
+  while (*ptr == ' ')
+    ptr++;
+
+  /* Slot number, "sl". This also skips the header line. */
+  if ((conn_parse_hex (&ptr, &dummy) == 0) || (*ptr != ':'))
     return (-1);
+  ptr++;
 
-  endptr = NULL;
-  port_local = (uint16_t) strtol (port_local_str, &endptr, 16);
-  if ((endptr == NULL) || (*endptr != '\0'))
+  while (*ptr == ' ')
+    ptr++;
+  if ((conn_parse_hex (&ptr, &dummy) == 0) || (*ptr != ':'))
+    return (-1);
+  ptr++;
+  if ((conn_parse_hex (&ptr, &port_local) == 0) || (port_local > 0xffff)
+      || (*ptr != ' '))
     return (-1);
 
-  endptr = NULL;
-  port_remote = (uint16_t) strtol (port_remote_str, &endptr, 16);
-  if ((endptr == NULL) || (*endptr != '\0'))
+  while (*ptr == ' ')
+    ptr++;
+  if ((conn_parse_hex (&ptr, &dummy) == 0) || (*ptr != ':'))
+    return (-1);
+  ptr++;
+  if ((conn_parse_hex (&ptr, &port_remote) == 0) || (port_remote > 0xffff)
+      || (*ptr != ' '))
     return (-1);
 
-  endptr = NULL;
-  state = (uint8_t) strtol (fields[3], &endptr, 16);
-  if ((endptr == NULL) || (*endptr != '\0'))
+  while (*ptr == ' ')
+    ptr++;
+  if ((conn_parse_hex (&ptr, &state) == 0) || (state > 0xff)
+      || (*ptr != ' '))
     return (-1);
 
-  return (conn_handle_ports (port_local, port_remote, state));
+  return (conn_handle_ports ((uint16_t) port_local, (uint16_t) port_remote,
+	(uint8_t) state));
 } /* int conn_handle_line */
 
 static int conn_read_file (const char *file)
 {
   FILE *fh;
   char buffer[1024];
+  /* The kernel formats the table in chunks of the size of the read(2)
+   * request, so a large buffer saves many system calls. */
+  static char fh_buffer[65536];
 
   fh = fopen (file, "r");
   if (fh == NULL)
     return (-1);
+  setvbuf (fh, fh_buffer, _IOFBF, sizeof (fh_buffer));
 
   while (fgets (buffer, sizeof (buffer), fh) != NULL)
   {
@@ -702,7 +964,7 @@ static int conn_config (const char *key, const char *value)
 #if KERNEL_LINUX
 static int conn_init (void)
 {
-  if (port_list_head == NULL)
+  if (port_entries_num == 0)
     port_collect_listening = 1;
 
   return (0);
@@ -714,6 +976,13 @@ static int conn_read (void)
 
   conn_reset_port_entry ();
 
+#if TCPCONNS_HAVE_SOCK_DIAG
+  if (linux_source == SRC_SOCK_DIAG)
+  {
+    status = conn_read_sock_diag ();
+  }
+  else
+#endif
   if (linux_source == SRC_NETLINK)
   {
     status = conn_read_netlink ();
@@ -734,6 +1003,23 @@ static int conn_read (void)
   }
   else /* if (linux_source == SRC_DUNNO) */
   {
+#if TCPCONNS_HAVE_SOCK_DIAG
+    /* The sock_diag interface lets the kernel filter the sockets, so only
+     * connections using one of the collected ports are copied to us. */
+    status = conn_read_sock_diag ();
+    if (status == 0)
+    {
+      INFO ("tcpconns plugin: Reading from sock_diag succeeded. "
+	  "Will use the sock_diag method from now on.");
+      linux_source = SRC_SOCK_DIAG;
+      conn_submit_all ();
+      return (0);
+    }
+
+    /* Throw away what has been counted before the error. */
+    conn_reset_port_entry ();
+#endif
+
     /* Try to use netlink for getting this data, it is _much_ faster on systems
      * with a large amount of connections. */
     status = conn_read_netlink ();
@@ -30,6 +30,7 @@
 #include "utils_cache.h"
 
 #include <assert.h>
+#include <math.h>
 #include <pthread.h>
 
 /*
@@ -40,6 +41,21 @@
 #define UT_FLAG_PERCENTAGE 0x04
 #define UT_FLAG_INTERESTING 0x08
 #define UT_FLAG_PERSIST_OK 0x10
+
+/* What is compared against the minimum and maximum values. Everything but
+ * UT_FUNCTION_VALUE is calculated over the last `window' values of a series. */
+#define UT_FUNCTION_VALUE          0
+#define UT_FUNCTION_MEAN           1
+#define UT_FUNCTION_PERCENTILE     2
+#define UT_FUNCTION_RATE_OF_CHANGE 3
+#define UT_FUNCTION_DEVIATION      4
+
+#define UT_WINDOW_DEFAULT 10
+#define UT_WINDOW_MAX     86400
+
+/* FailureMin/Max, WarningMin/Max and the same shifted by the hysteresis. */
+#define UT_BOUNDS_MAX 8
+
 typedef struct threshold_s
 {
   char host[DATA_MAX_NAME_LEN];
@@ -55,14 +71,64 @@ typedef struct threshold_s
   gauge_t hysteresis;
   unsigned int flags;
   int hits;
+  int function;
+  int window;
+  double percentile;
+  /* Values the percentile is compared against, see ut_threshold_bounds. */
+  gauge_t bounds[UT_BOUNDS_MAX];
+  int bounds_num;
   struct threshold_s *next;
 } threshold_t;
+
+/* Sliding window of the last `th->window' values of one data source. All
+ * statistics are updated incrementally, so an update is O(1) regardless of the
+ * size of the window. */
+typedef struct ut_window_s
+{
+  gauge_t *values;   /* ring buffer, NULL if the threshold has no window */
+  cdtime_t *times;   /* only allocated for UT_FUNCTION_RATE_OF_CHANGE */
+  int index;         /* slot the next value is written to */
+  int num;           /* number of slots in use */
+  int valid;         /* number of values in the window which are not NaN */
+  int updates;       /* updates since `mean' and `m2' have been recalculated */
+  double mean;
+  double m2;         /* sum of the squared differences from `mean' */
+  gauge_t current;   /* result of the last update, unused for percentiles */
+  /* Number of values less than (less than or equal to) th->bounds[i]. */
+  int lt[UT_BOUNDS_MAX];
+  int le[UT_BOUNDS_MAX];
+} ut_window_t;
+
+/* Per-series state. The matching threshold(s) are resolved once per series and
+ * remembered in `th'; entries with `th == NULL' record that no threshold
+ * applies to the series. The raw values of the last update are kept so that
+ * rates can be calculated without going through the global value cache. */
+typedef struct ut_series_s
+{
+  threshold_t *th;
+  /* Protects the members below. */
+  pthread_mutex_t lock;
+  int state;
+  int hits;
+  cdtime_t last_time;
+  int values_num;
+  value_t *values_raw;
+  /* `values_num' windows for each threshold in the `th' list, or NULL if none
+   * of the thresholds uses a window. */
+  ut_window_t *windows;
+  int windows_num;
+} ut_series_t;
 /* }}} */
 
 /*
  * Private (static) variables
  * {{{ */
 static c_avl_tree_t   *threshold_tree = NULL;
+/* Maps FORMAT_VL names to ut_series_t. */
+static c_avl_tree_t   *series_tree = NULL;
+/* Protects both, `threshold_tree' and `series_tree'. A series' own lock is
+ * acquired while holding `threshold_lock', so that the series cannot be freed
+ * in between; the check itself only holds the series' lock. */
 static pthread_mutex_t threshold_lock = PTHREAD_MUTEX_INITIALIZER;
 /* }}} */
 
@@ -223,6 +289,547 @@ static threshold_t *threshold_search (const value_list_t *vl)
   return (NULL);
 } /* }}} threshold_t *threshold_search */
 
+/*
+ * Sliding windows
+ * ===============
+ * The functions below maintain the windows used by the "Mean", "Percentile",
+ * "RateOfChange" and "Deviation" functions.
+ * {{{ */
+/* Returns true if the threshold checks the data source `ds_index'. */
+static _Bool ut_threshold_applies (const threshold_t *th,
+    const data_set_t *ds, int ds_index)
+{
+  if (th->data_source[0] == 0)
+    return (1);
+  return (strcmp (ds->ds[ds_index].name, th->data_source) == 0);
+} /* _Bool ut_threshold_applies */
+
+/*
+ * void ut_threshold_bounds
+ *
+ * Collects the values a percentile may be compared against in
+ * ut_check_one_data_source. For each of them, the windows count the values
+ * below it, so that comparing the percentile against it does not require
+ * sorting the window.
+ */
+static void ut_threshold_bounds (threshold_t *th)
+{
+  gauge_t bounds[UT_BOUNDS_MAX];
+  int i;
+
+  bounds[0] = th->failure_min;
+  bounds[1] = th->failure_max;
+  bounds[2] = th->warning_min;
+  bounds[3] = th->warning_max;
+  bounds[4] = th->failure_min + th->hysteresis;
+  bounds[5] = th->failure_max - th->hysteresis;
+  bounds[6] = th->warning_min + th->hysteresis;
+  bounds[7] = th->warning_max - th->hysteresis;
+
+  th->bounds_num = 0;
+  for (i = 0; i < UT_BOUNDS_MAX; i++)
+  {
+    if (isnan (bounds[i]))
+      continue;
+    th->bounds[th->bounds_num] = bounds[i];
+    th->bounds_num++;
+  }
+} /* void ut_threshold_bounds */
+
+static int ut_window_init (const threshold_t *th, ut_window_t *w)
+{
+  memset (w, 0, sizeof (*w));
+  w->current = NAN;
+
+  w->values = calloc ((size_t) th->window, sizeof (*w->values));
+  if (w->values == NULL)
+    return (-1);
+
+  if (th->function == UT_FUNCTION_RATE_OF_CHANGE)
+  {
+    w->times = calloc ((size_t) th->window, sizeof (*w->times));
+    if (w->times == NULL)
+    {
+      sfree (w->values);
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* int ut_window_init */
+
+static void ut_window_destroy (ut_window_t *w)
+{
+  sfree (w->values);
+  sfree (w->times);
+} /* void ut_window_destroy */
+
+/* Adds (sign > 0) or removes (sign < 0) `value' from the statistics. */
+static void ut_window_account (const threshold_t *th, ut_window_t *w,
+    gauge_t value, int sign)
+{
+  double delta;
+  int i;
+
+  if (isnan (value))
+    return;
+
+  if (sign > 0)
+  {
+    w->valid++;
+    delta = value - w->mean;
+    w->mean += delta / ((double) w->valid);
+    w->m2 += delta * (value - w->mean);
+  }
+  else if (w->valid <= 1)
+  {
+    w->valid = 0;
+    w->mean = 0.0;
+    w->m2 = 0.0;
+  }
+  else
+  {
+    double mean_old = w->mean;
+
+    w->valid--;
+    w->mean = ((mean_old * ((double) (w->valid + 1))) - value)
+      / ((double) w->valid);
+    w->m2 -= (value - mean_old) * (value - w->mean);
+    if (w->m2 < 0.0)
+      w->m2 = 0.0;
+  }
+
+  if (th->function != UT_FUNCTION_PERCENTILE)
+    return;
+
+  for (i = 0; i < th->bounds_num; i++)
+  {
+    if (value < th->bounds[i])
+      w->lt[i] += sign;
+    if (value <= th->bounds[i])
+      w->le[i] += sign;
+  }
+} /* void ut_window_account */
+
+/* Recalculates `mean' and `m2' from the ring buffer, so that rounding errors
+ * of the incremental updates don't accumulate. */
+static void ut_window_recalculate (ut_window_t *w)
+{
+  double sum = 0.0;
+  int i;
+
+  w->valid = 0;
+  for (i = 0; i < w->num; i++)
+  {
+    if (isnan (w->values[i]))
+      continue;
+    sum += w->values[i];
+    w->valid++;
+  }
+
+  w->mean = (w->valid > 0) ? (sum / ((double) w->valid)) : 0.0;
+  w->m2 = 0.0;
+  for (i = 0; i < w->num; i++)
+  {
+    if (isnan (w->values[i]))
+      continue;
+    w->m2 += (w->values[i] - w->mean) * (w->values[i] - w->mean);
+  }
+} /* void ut_window_recalculate */
+
+/*
+ * void ut_window_update
+ *
+ * Adds `value' to the window, replacing the oldest value if the window is
+ * full, and stores the result of the threshold's function in `w->current'.
+ */
+static void ut_window_update (const threshold_t *th, ut_window_t *w,
+    gauge_t value, cdtime_t t)
+{
+  int oldest;
+  int newest;
+
+  /* The deviation is relative to the values seen before this one. */
+  if (th->function == UT_FUNCTION_DEVIATION)
+  {
+    double stddev = (w->valid > 1)
+      ? sqrt (w->m2 / ((double) w->valid)) : 0.0;
+
+    if ((stddev > 0.0) && !isnan (value))
+      w->current = (value - w->mean) / stddev;
+    else
+      w->current = NAN;
+  }
+
+  if (w->num >= th->window)
+    ut_window_account (th, w, w->values[w->index], /* sign = */ -1);
+  else
+    w->num++;
+
+  w->values[w->index] = value;
+  if (w->times != NULL)
+    w->times[w->index] = t;
+  ut_window_account (th, w, value, /* sign = */ 1);
+
+  newest = w->index;
+  w->index = (w->index + 1) % th->window;
+  oldest = (w->num < th->window) ? 0 : w->index;
+
+  w->updates++;
+  if (w->updates >= th->window)
+  {
+    ut_window_recalculate (w);
+    w->updates = 0;
+  }
+
+  if (th->function == UT_FUNCTION_MEAN)
+  {
+    w->current = (w->valid > 0) ? w->mean : NAN;
+  }
+  else if (th->function == UT_FUNCTION_RATE_OF_CHANGE)
+  {
+    w->current = NAN;
+    if ((w->num > 1) && (w->times[newest] > w->times[oldest]))
+      w->current = (w->values[newest] - w->values[oldest])
+        / CDTIME_T_TO_DOUBLE (w->times[newest] - w->times[oldest]);
+  }
+} /* void ut_window_update */
+
+/* Rank of the percentile in a sorted window, counting from one. */
+static int ut_window_rank (const threshold_t *th, const ut_window_t *w)
+{
+  int rank = (int) ceil (th->percentile * ((double) w->valid) / 100.0);
+
+  if (rank < 1)
+    rank = 1;
+  return (rank);
+} /* int ut_window_rank */
+
+static int ut_compare_gauge (const void *a, const void *b)
+{
+  gauge_t ga = *((const gauge_t *) a);
+  gauge_t gb = *((const gauge_t *) b);
+
+  if (ga < gb)
+    return (-1);
+  else if (ga > gb)
+    return (1);
+  return (0);
+} /* int ut_compare_gauge */
+
+/*
+ * gauge_t ut_window_value
+ *
+ * Returns the result of the threshold's function for reporting it. For
+ * percentiles, this sorts a copy of the window and is therefore only used when
+ * a notification is created.
+ */
+static gauge_t ut_window_value (const threshold_t *th, const ut_window_t *w)
+{
+  gauge_t *sorted;
+  gauge_t ret;
+  int num = 0;
+  int i;
+
+  if (th->function != UT_FUNCTION_PERCENTILE)
+    return (w->current);
+
+  if (w->valid == 0)
+    return (NAN);
+
+  sorted = malloc (w->valid * sizeof (*sorted));
+  if (sorted == NULL)
+    return (NAN);
+
+  for (i = 0; i < w->num; i++)
+    if (!isnan (w->values[i]) && (num < w->valid))
+      sorted[num++] = w->values[i];
+
+  qsort (sorted, (size_t) num, sizeof (*sorted), ut_compare_gauge);
+  ret = sorted[ut_window_rank (th, w) - 1];
+
+  sfree (sorted);
+  return (ret);
+} /* gauge_t ut_window_value */
+
+/* Returns true if the checked value is less than `bound'. `w' is NULL for
+ * thresholds without a window. */
+static _Bool ut_is_below (const threshold_t *th, const ut_window_t *w,
+    gauge_t value, gauge_t bound)
+{
+  int i;
+
+  if ((w == NULL) || (th->function != UT_FUNCTION_PERCENTILE))
+    return (value < bound);
+
+  if (w->valid == 0)
+    return (0);
+
+  /* The percentile is less than `bound' if at least `rank' values are. */
+  for (i = 0; i < th->bounds_num; i++)
+    if (th->bounds[i] == bound)
+      return (w->lt[i] >= ut_window_rank (th, w));
+
+  return (0);
+} /* _Bool ut_is_below */
+
+/* Returns true if the checked value is greater than `bound'. */
+static _Bool ut_is_above (const threshold_t *th, const ut_window_t *w,
+    gauge_t value, gauge_t bound)
+{
+  int i;
+
+  if ((w == NULL) || (th->function != UT_FUNCTION_PERCENTILE))
+    return (value > bound);
+
+  if (w->valid == 0)
+    return (0);
+
+  /* The percentile is greater than `bound' if less than `rank' values are
+   * less than or equal to it. */
+  for (i = 0; i < th->bounds_num; i++)
+    if (th->bounds[i] == bound)
+      return (w->le[i] < ut_window_rank (th, w));
+
+  return (0);
+} /* _Bool ut_is_above */
+/* }}} */
+
+/*
+ * Series cache
+ * ============
+ * The functions below manage `series_tree'. ut_series_free, ut_series_clear
+ * and ut_series_get must be called with `threshold_lock' held, the functions
+ * working on a single series with the series' lock held.
+ * {{{ */
+static void ut_series_free (ut_series_t *series)
+{
+  int i;
+
+  if (series == NULL)
+    return;
+
+  /* Wait for a check of this series which is still in progress. */
+  pthread_mutex_lock (&series->lock);
+  pthread_mutex_unlock (&series->lock);
+  pthread_mutex_destroy (&series->lock);
+
+  for (i = 0; i < series->windows_num; i++)
+    ut_window_destroy (series->windows + i);
+  sfree (series->windows);
+  sfree (series->values_raw);
+  sfree (series);
+} /* void ut_series_free */
+
+/*
+ * int ut_series_init_windows
+ *
+ * Allocates the windows of all thresholds in the `series->th' list which use
+ * one. Data sources the threshold does not apply to don't get a ring buffer.
+ */
+static int ut_series_init_windows (const data_set_t *ds, ut_series_t *series)
+{
+  threshold_t *th;
+  int th_num = 0;
+  _Bool need_windows = 0;
+  int i;
+  int j;
+
+  for (th = series->th; th != NULL; th = th->next)
+  {
+    th_num++;
+    if (th->function != UT_FUNCTION_VALUE)
+      need_windows = 1;
+  }
+
+  if (!need_windows)
+    return (0);
+
+  series->windows = calloc ((size_t) (th_num * ds->ds_num),
+      sizeof (*series->windows));
+  if (series->windows == NULL)
+    return (-1);
+  series->windows_num = th_num * ds->ds_num;
+
+  for (th = series->th, i = 0; th != NULL; th = th->next, i++)
+  {
+    if (th->function == UT_FUNCTION_VALUE)
+      continue;
+
+    for (j = 0; j < ds->ds_num; j++)
+    {
+      if (!ut_threshold_applies (th, ds, j))
+        continue;
+      if (ut_window_init (th, series->windows + (i * ds->ds_num) + j) != 0)
+        return (-1);
+    }
+  }
+
+  return (0);
+} /* int ut_series_init_windows */
+
+static void ut_series_clear (void)
+{
+  char *name;
+  ut_series_t *series;
+
+  if (series_tree == NULL)
+    return;
+
+  while (c_avl_pick (series_tree, (void *) &name, (void *) &series) == 0)
+  {
+    sfree (name);
+    ut_series_free (series);
+  }
+} /* void ut_series_clear */
+
+/*
+ * ut_series_t *ut_series_get
+ *
+ * Returns the cache entry for the series `name', resolving the matching
+ * threshold and creating the entry if necessary. Returns NULL on failure.
+ */
+static ut_series_t *ut_series_get (const data_set_t *ds,
+    const value_list_t *vl, const char *name)
+{
+  ut_series_t *series = NULL;
+  char *name_copy;
+
+  if (c_avl_get (series_tree, name, (void *) &series) == 0)
+    return (series);
+
+  series = calloc (1, sizeof (*series));
+  name_copy = strdup (name);
+  if ((series == NULL) || (name_copy == NULL))
+  {
+    ERROR ("ut_series_get: Out of memory.");
+    sfree (series);
+    sfree (name_copy);
+    return (NULL);
+  }
+
+  pthread_mutex_init (&series->lock, /* attr = */ NULL);
+  series->th = threshold_search (vl);
+  series->state = STATE_OKAY;
+  if (series->th != NULL)
+  {
+    series->values_num = ds->ds_num;
+    series->values_raw = calloc ((size_t) ds->ds_num,
+        sizeof (*series->values_raw));
+    if ((series->values_raw == NULL)
+        || (ut_series_init_windows (ds, series) != 0))
+    {
+      ERROR ("ut_series_get: calloc failed.");
+      ut_series_free (series);
+      sfree (name_copy);
+      return (NULL);
+    }
+
+    /* Pick up the state restored from a cache file, if any. */
+    series->state = uc_get_state (ds, vl);
+  }
+
+  if (c_avl_insert (series_tree, name_copy, series) != 0)
+  {
+    ERROR ("ut_series_get: c_avl_insert (%s) failed.", name);
+    ut_series_free (series);
+    sfree (name_copy);
+    return (NULL);
+  }
+
+  return (series);
+} /* ut_series_t *ut_series_get */
+
+/*
+ * int ut_series_rates
+ *
+ * Calculates the rates of `vl' into `ret_rates', which must have room for
+ * `ds->ds_num' values, and remembers the raw values for the next update. The
+ * first update of a series is answered from the global value cache, later ones
+ * are calculated with the value cache's functions. Returns non-zero if `vl' is
+ * not newer than the previous update.
+ */
+static int ut_series_rates (const data_set_t *ds, const value_list_t *vl,
+    ut_series_t *series, gauge_t *ret_rates)
+{
+  if (series->values_num != ds->ds_num)
+    return (-1);
+
+  if (series->last_time == 0)
+  {
+    gauge_t *rates = uc_get_rate (ds, vl);
+
+    if (rates == NULL)
+      return (-1);
+    memcpy (ret_rates, rates, ds->ds_num * sizeof (*ret_rates));
+    sfree (rates);
+
+    memcpy (series->values_raw, vl->values,
+        ds->ds_num * sizeof (*series->values_raw));
+    series->last_time = vl->time;
+    return (0);
+  }
+
+  if (series->last_time >= vl->time)
+    return (-1);
+
+  if (uc_calculate_rates (ds, vl, series->values_raw, series->last_time,
+        ret_rates) != 0)
+    return (-1);
+  uc_check_range (ds, ret_rates);
+
+  series->last_time = vl->time;
+
+  return (0);
+} /* int ut_series_rates */
+
+/*
+ * int ut_series_update_state
+ *
+ * Updates the hit counter and state of `series'. Returns non-zero if a
+ * notification should be sent; the previous state is stored in
+ * `ret_state_old' in that case.
+ */
+static int ut_series_update_state (ut_series_t *series,
+    const threshold_t *th, int state, int *ret_state_old)
+{
+  /* Check if hits matched */
+  if (th->hits != 0)
+  {
+    /* STATE_OKAY resets hits unless PERSIST_OK flag is set. Hits resets if
+     * threshold is hit. */
+    if (((state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0))
+        || (series->hits > th->hits))
+    {
+      DEBUG ("ut_series_update_state: reset hits = 0");
+      series->hits = 0; /* reset hit counter and notify */
+    }
+    else
+    {
+      DEBUG ("ut_series_update_state: th->hits = %d, hits = %d",
+          th->hits, series->hits);
+      series->hits++; /* increase hit counter */
+      return (0);
+    }
+  } /* end check hits */
+
+  *ret_state_old = series->state;
+
+  /* If the state didn't change, report if `persistent' is specified. If the
+   * state is `okay', then only report if `persist_ok` flag is set. */
+  if (state == series->state)
+  {
+    if ((th->flags & UT_FLAG_PERSIST) == 0)
+      return (0);
+    else if ((state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0))
+      return (0);
+  }
+
+  series->state = state;
+  return (1);
+} /* int ut_series_update_state */
+/* }}} */
+
 /*
  * Configuration
  * =============
@@ -327,6 +934,75 @@ static int ut_config_type_hysteresis (threshold_t *th, oconfig_item_t *ci)
   return (0);
 } /* int ut_config_type_hysteresis */
 
+static int ut_config_type_function (threshold_t *th, oconfig_item_t *ci)
+{
+  const char *value;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("threshold values: The `Function' option needs exactly one "
+	"string argument.");
+    return (-1);
+  }
+
+  value = ci->values[0].value.string;
+  if (strcasecmp ("Value", value) == 0)
+    th->function = UT_FUNCTION_VALUE;
+  else if ((strcasecmp ("Mean", value) == 0)
+      || (strcasecmp ("Average", value) == 0))
+    th->function = UT_FUNCTION_MEAN;
+  else if (strcasecmp ("Percentile", value) == 0)
+    th->function = UT_FUNCTION_PERCENTILE;
+  else if (strcasecmp ("RateOfChange", value) == 0)
+    th->function = UT_FUNCTION_RATE_OF_CHANGE;
+  else if (strcasecmp ("Deviation", value) == 0)
+    th->function = UT_FUNCTION_DEVIATION;
+  else
+  {
+    WARNING ("threshold values: Unknown function `%s'. Valid functions are "
+	"`Value', `Mean', `Percentile', `RateOfChange' and `Deviation'.",
+	value);
+    return (-1);
+  }
+
+  return (0);
+} /* int ut_config_type_function */
+
+static int ut_config_type_window (threshold_t *th, oconfig_item_t *ci)
+{
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER)
+      || (ci->values[0].value.number < 2)
+      || (ci->values[0].value.number > UT_WINDOW_MAX))
+  {
+    WARNING ("threshold values: The `Window' option needs exactly one "
+	"number argument between 2 and %i.", UT_WINDOW_MAX);
+    return (-1);
+  }
+
+  th->window = (int) ci->values[0].value.number;
+
+  return (0);
+} /* int ut_config_type_window */
+
+static int ut_config_type_percentile (threshold_t *th, oconfig_item_t *ci)
+{
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER)
+      || (ci->values[0].value.number <= 0.0)
+      || (ci->values[0].value.number > 100.0))
+  {
+    WARNING ("threshold values: The `Percentile' option needs exactly one "
+	"number argument greater than 0 and less than or equal to 100.");
+    return (-1);
+  }
+
+  th->percentile = ci->values[0].value.number;
+
+  return (0);
+} /* int ut_config_type_percentile */
+
 static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
 {
   int i;
@@ -357,6 +1033,9 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
   th.hits = 0;
   th.hysteresis = 0;
   th.flags = UT_FLAG_INTERESTING; /* interesting by default */
+  th.function = UT_FUNCTION_VALUE;
+  th.window = UT_WINDOW_DEFAULT;
+  th.percentile = 50.0;
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -387,6 +1066,12 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
       status = ut_config_type_hits (&th, option);
     else if (strcasecmp ("Hysteresis", option->key) == 0)
       status = ut_config_type_hysteresis (&th, option);
+    else if (strcasecmp ("Function", option->key) == 0)
+      status = ut_config_type_function (&th, option);
+    else if (strcasecmp ("Window", option->key) == 0)
+      status = ut_config_type_window (&th, option);
+    else if (strcasecmp ("Percentile", option->key) == 0)
+      status = ut_config_type_percentile (&th, option);
     else
     {
       WARNING ("threshold values: Option `%s' not allowed inside a `Type' "
@@ -400,6 +1085,7 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
 
   if (status == 0)
   {
+    ut_threshold_bounds (&th);
     status = ut_threshold_add (&th);
   }
 
@@ -520,57 +1206,49 @@ static int ut_config_host (const threshold_t *th_orig, oconfig_item_t *ci)
  */
 /* }}} */
 
+/* Describes the function of a threshold with a window for notifications. */
+static void ut_function_describe (const threshold_t *th,
+    char *buffer, size_t buffer_size)
+{
+  if (th->function == UT_FUNCTION_MEAN)
+    sstrncpy (buffer, "mean", buffer_size);
+  else if (th->function == UT_FUNCTION_PERCENTILE)
+    ssnprintf (buffer, buffer_size, "%g%% percentile", th->percentile);
+  else if (th->function == UT_FUNCTION_RATE_OF_CHANGE)
+    sstrncpy (buffer, "rate of change (per second)", buffer_size);
+  else if (th->function == UT_FUNCTION_DEVIATION)
+    sstrncpy (buffer, "deviation (in standard deviations)", buffer_size);
+  else
+    sstrncpy (buffer, "value", buffer_size);
+} /* void ut_function_describe */
+
 /*
  * int ut_report_state
  *
- * Checks if the `state' differs from the old state and creates a notification
- * if appropriate.
+ * Creates a notification for the transition from `state_old' to `state'. The
+ * decision whether to notify at all is made by ut_series_update_state above.
+ * `window_value' is the result of the threshold's function if it uses a
+ * window and ignored otherwise.
  * Does not fail.
  */
 static int ut_report_state (const data_set_t *ds,
     const value_list_t *vl,
     const threshold_t *th,
     const gauge_t *values,
+    gauge_t window_value,
     int ds_index,
-    int state)
+    int state,
+    int state_old)
 { /* {{{ */
-  int state_old;
   notification_t n;
+  gauge_t current = (th->function == UT_FUNCTION_VALUE)
+    ? values[ds_index] : window_value;
 
   char *buf;
   size_t bufsize;
 
   int status;
 
-  /* Check if hits matched */
-  if ( (th->hits != 0) )
-  {
-    int hits = uc_get_hits(ds,vl);
-    /* STATE_OKAY resets hits unless PERSIST_OK flag is set. Hits resets if
-     * threshold is hit. */
-    if ( ( (state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0) ) || (hits > th->hits) )
-    {
-        DEBUG("ut_report_state: reset uc_get_hits = 0");
-        uc_set_hits(ds,vl,0); /* reset hit counter and notify */
-    } else {
-      DEBUG("ut_report_state: th->hits = %d, uc_get_hits = %d",th->hits,uc_get_hits(ds,vl));
-      (void) uc_inc_hits(ds,vl,1); /* increase hit counter */
-      return (0);
-    }
-  } /* end check hits */
-
-  state_old = uc_get_state (ds, vl);
-
-  /* If the state didn't change, report if `persistent' is specified. If the
-   * state is `okay', then only report if `persist_ok` flag is set. */
-  if (state == state_old)
-  {
-    if ((th->flags & UT_FLAG_PERSIST) == 0)
-      return (0);
-    else if ( (state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0) )
-      return (0);
-  }
-
   if (state != state_old)
     uc_set_state (ds, vl, state);
 
@@ -615,11 +1293,19 @@ static int ut_report_state (const data_set_t *ds,
 
   plugin_notification_meta_add_string (&n, "DataSource",
       ds->ds[ds_index].name);
-  plugin_notification_meta_add_double (&n, "CurrentValue", values[ds_index]);
+  plugin_notification_meta_add_double (&n, "CurrentValue", current);
   plugin_notification_meta_add_double (&n, "WarningMin", th->warning_min);
   plugin_notification_meta_add_double (&n, "WarningMax", th->warning_max);
   plugin_notification_meta_add_double (&n, "FailureMin", th->failure_min);
   plugin_notification_meta_add_double (&n, "FailureMax", th->failure_max);
+  if (th->function != UT_FUNCTION_VALUE)
+  {
+    char function[64];
+
+    ut_function_describe (th, function, sizeof (function));
+    plugin_notification_meta_add_string (&n, "Function", function);
+    plugin_notification_meta_add_double (&n, "Window", (double) th->window);
+  }
 
   /* Send an okay notification */
   if (state == STATE_OKAY)
@@ -647,7 +1333,7 @@ static int ut_report_state (const data_set_t *ds,
       {
         status = ssnprintf (buf, bufsize, ": Data source \"%s\" is currently "
             "%f. That is within the %s region of %f%s and %f%s.",
-            ds->ds[ds_index].name, values[ds_index],
+            ds->ds[ds_index].name, current,
             (state == STATE_ERROR) ? "failure" : "warning",
             min, ((th->flags & UT_FLAG_PERCENTAGE) != 0) ? "%" : "",
             max, ((th->flags & UT_FLAG_PERCENTAGE) != 0) ? "%" : "");
@@ -656,13 +1342,27 @@ static int ut_report_state (const data_set_t *ds,
       {
 	status = ssnprintf (buf, bufsize, ": Data source \"%s\" is currently "
 	    "%f. That is %s the %s threshold of %f%s.",
-	    ds->ds[ds_index].name, values[ds_index],
+	    ds->ds[ds_index].name, current,
 	    isnan (min) ? "below" : "above",
 	    (state == STATE_ERROR) ? "failure" : "warning",
 	    isnan (min) ? max : min,
 	    ((th->flags & UT_FLAG_PERCENTAGE) != 0) ? "%" : "");
       }
     }
+    else if (th->function != UT_FUNCTION_VALUE)
+    {
+      char function[64];
+
+      ut_function_describe (th, function, sizeof (function));
+      status = ssnprintf (buf, bufsize, ": The %s of data source \"%s\" "
+          "over the last %i values is currently %f. That is %s the %s "
+          "threshold of %f%s.",
+          function, ds->ds[ds_index].name, th->window, current,
+          (current < min) ? "below" : "above",
+          (state == STATE_ERROR) ? "failure" : "warning",
+          (current < min) ? min : max,
+          ((th->flags & UT_FLAG_PERCENTAGE) != 0) ? "%" : "");
+    }
     else if (th->flags & UT_FLAG_PERCENTAGE)
     {
       gauge_t value;
@@ -694,10 +1394,10 @@ static int ut_report_state (const data_set_t *ds,
     {
       status = ssnprintf (buf, bufsize, ": Data source \"%s\" is currently "
 	  "%f. That is %s the %s threshold of %f.",
-	  ds->ds[ds_index].name, values[ds_index],
-	  (values[ds_index] < min) ? "below" : "above",
+	  ds->ds[ds_index].name, current,
+	  (current < min) ? "below" : "above",
 	  (state == STATE_ERROR) ? "failure" : "warning",
-	  (values[ds_index] < min) ? min : max);
+	  (current < min) ? min : max);
     }
     buf += status;
     bufsize -= status;
@@ -720,24 +1420,19 @@ static int ut_report_state (const data_set_t *ds,
  * Does not fail.
  */
 static int ut_check_one_data_source (const data_set_t *ds,
-    const value_list_t __attribute__((unused)) *vl,
     const threshold_t *th,
+    const ut_window_t *w,
     const gauge_t *values,
-    int ds_index)
+    int ds_index,
+    int prev_state)
 { /* {{{ */
-  const char *ds_name;
+  gauge_t value = values[ds_index];
   int is_warning = 0;
   int is_failure = 0;
-  int prev_state = STATE_OKAY;
 
   /* check if this threshold applies to this data source */
-  if (ds != NULL)
-  {
-    ds_name = ds->ds[ds_index].name;
-    if ((th->data_source[0] != 0)
-	&& (strcmp (ds_name, th->data_source) != 0))
-      return (STATE_OKAY);
-  }
+  if ((ds != NULL) && !ut_threshold_applies (th, ds, ds_index))
+    return (STATE_OKAY);
 
   if ((th->flags & UT_FLAG_INVERT) != 0)
   {
@@ -747,31 +1442,31 @@ static int ut_check_one_data_source (const data_set_t *ds,
 
   /* XXX: This is an experimental code, not optimized, not fast, not reliable,
    * and probably, do not work as you expect. Enjoy! :D */
-  if ( (th->hysteresis > 0) && ((prev_state = uc_get_state(ds,vl)) != STATE_OKAY) )
+  if ( (th->hysteresis > 0) && (prev_state != STATE_OKAY) )
   {
     switch(prev_state)
     {
       case STATE_ERROR:
-	if ( (!isnan (th->failure_min) && ((th->failure_min + th->hysteresis) < values[ds_index])) ||
-	     (!isnan (th->failure_max) && ((th->failure_max - th->hysteresis) > values[ds_index])) )
+	if ( (!isnan (th->failure_min) && ut_is_above (th, w, value, th->failure_min + th->hysteresis)) ||
+	     (!isnan (th->failure_max) && ut_is_below (th, w, value, th->failure_max - th->hysteresis)) )
 	  return (STATE_OKAY);
 	else
 	  is_failure++;
       case STATE_WARNING:
-	if ( (!isnan (th->warning_min) && ((th->warning_min + th->hysteresis) < values[ds_index])) ||
-	     (!isnan (th->warning_max) && ((th->warning_max - th->hysteresis) > values[ds_index])) )
+	if ( (!isnan (th->warning_min) && ut_is_above (th, w, value, th->warning_min + th->hysteresis)) ||
+	     (!isnan (th->warning_max) && ut_is_below (th, w, value, th->warning_max - th->hysteresis)) )
 	  return (STATE_OKAY);
 	else
 	  is_warning++;
      }
   }
   else { /* no hysteresis */
-    if ((!isnan (th->failure_min) && (th->failure_min > values[ds_index]))
-	|| (!isnan (th->failure_max) && (th->failure_max < values[ds_index])))
+    if ((!isnan (th->failure_min) && ut_is_below (th, w, value, th->failure_min))
+	|| (!isnan (th->failure_max) && ut_is_above (th, w, value, th->failure_max)))
       is_failure++;
 
-    if ((!isnan (th->warning_min) && (th->warning_min > values[ds_index]))
-	|| (!isnan (th->warning_max) && (th->warning_max < values[ds_index])))
+    if ((!isnan (th->warning_min) && ut_is_below (th, w, value, th->warning_min))
+	|| (!isnan (th->warning_max) && ut_is_above (th, w, value, th->warning_max)))
       is_warning++;
  }
 
@@ -789,13 +1484,18 @@ static int ut_check_one_data_source (const data_set_t *ds,
  *
  * Checks all data sources of a value list against the given threshold, using
  * the ut_check_one_data_source function above. Returns the worst status,
- * which is `okay' if nothing has failed.
+ * which is `okay' if nothing has failed. `prev_state' is the state of the
+ * series after the previous check and used for the hysteresis. If the
+ * threshold uses a window, `windows' points to one window per data source,
+ * which are updated with the values first.
  * Returns less than zero if the data set doesn't have any data sources.
  */
 static int ut_check_one_threshold (const data_set_t *ds,
     const value_list_t *vl,
     const threshold_t *th,
+    ut_window_t *windows,
     const gauge_t *values,
+    int prev_state,
     int *ret_ds_index)
 { /* {{{ */
   int ret = -1;
@@ -841,9 +1541,18 @@ static int ut_check_one_threshold (const data_set_t *ds,
 
   for (i = 0; i < ds->ds_num; i++)
   {
+    ut_window_t *w = NULL;
     int status;
 
-    status = ut_check_one_data_source (ds, vl, th, values_copy, i);
+    if ((windows != NULL) && (windows[i].values != NULL))
+    {
+      w = windows + i;
+      ut_window_update (th, w, values_copy[i], vl->time);
+      values_copy[i] = w->current;
+    }
+
+    status = ut_check_one_data_source (ds, th, w, values_copy, i,
+        prev_state);
     if (ret < status)
     {
       ret = status;
@@ -862,47 +1571,70 @@ static int ut_check_one_threshold (const data_set_t *ds,
  *
  * Gets a list of matching thresholds and searches for the worst status by one
  * of the thresholds. Then reports that status using the ut_report_state
- * function above. 
+ * function above. The thresholds, rates and state of the series are all
+ * taken from the series cache, so this is a single lookup per value.
  * Returns zero on success and if no threshold has been configured. Returns
  * less than zero on failure.
  */
 static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     __attribute__((unused)) user_data_t *ud)
 { /* {{{ */
+  char name[6 * DATA_MAX_NAME_LEN];
+  ut_series_t *series;
   threshold_t *th;
-  gauge_t *values;
+  gauge_t values[ds->ds_num];
   int status;
 
   int worst_state = -1;
   threshold_t *worst_th = NULL;
+  ut_window_t *worst_windows = NULL;
   int worst_ds_index = -1;
+  gauge_t worst_value = NAN;
+  int state_old = STATE_OKAY;
+  int notify;
+  int i;
 
   if (threshold_tree == NULL)
     return (0);
 
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("ut_check_threshold: FORMAT_VL failed.");
+    return (-1);
+  }
+
   pthread_mutex_lock (&threshold_lock);
-  th = threshold_search (vl);
+  series = ut_series_get (ds, vl, name);
+  if ((series == NULL) || (series->th == NULL))
+  {
+    pthread_mutex_unlock (&threshold_lock);
+    return (0);
+  }
+  pthread_mutex_lock (&series->lock);
   pthread_mutex_unlock (&threshold_lock);
-  if (th == NULL)
+
+  if (ut_series_rates (ds, vl, series, values) != 0)
+  {
+    pthread_mutex_unlock (&series->lock);
     return (0);
+  }
 
   DEBUG ("ut_check_threshold: Found matching threshold(s)");
 
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
-    return (0);
-
-  while (th != NULL)
+  for (th = series->th, i = 0; th != NULL; th = th->next, i++)
   {
+    ut_window_t *windows = NULL;
     int ds_index = -1;
 
-    status = ut_check_one_threshold (ds, vl, th, values, &ds_index);
+    if ((series->windows != NULL) && (th->function != UT_FUNCTION_VALUE))
+      windows = series->windows + (i * ds->ds_num);
+
+    status = ut_check_one_threshold (ds, vl, th, windows, values,
+        series->state, &ds_index);
     if (status < 0)
     {
+      pthread_mutex_unlock (&series->lock);
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
       return (-1);
     }
 
@@ -910,35 +1642,46 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     {
       worst_state = status;
       worst_th = th;
+      worst_windows = windows;
       worst_ds_index = ds_index;
     }
+  } /* for (th) */
 
-    th = th->next;
-  } /* while (th) */
+  notify = ut_series_update_state (series, worst_th, worst_state, &state_old);
+  if (notify && (worst_windows != NULL))
+    worst_value = ut_window_value (worst_th, worst_windows + worst_ds_index);
 
-  status = ut_report_state (ds, vl, worst_th, values,
-      worst_ds_index, worst_state);
+  pthread_mutex_unlock (&series->lock);
+
+  /* Thresholds are never removed, so `worst_th' stays valid without the lock.
+   * Notifications are dispatched without holding it. */
+  if (!notify)
+    return (0);
+
+  status = ut_report_state (ds, vl, worst_th, values, worst_value,
+      worst_ds_index, worst_state, state_old);
   if (status != 0)
   {
     ERROR ("ut_check_threshold: ut_report_state failed.");
-    sfree (values);
     return (-1);
   }
 
-  sfree (values);
-
   return (0);
 } /* }}} int ut_check_threshold */
 
 /*
  * int ut_missing
  *
- * This function is called whenever a value goes "missing".
+ * This function is called whenever a value goes "missing". The value is
+ * removed from the global value cache afterwards, so its entry is dropped from
+ * the series cache, too.
  */
 static int ut_missing (const value_list_t *vl,
     __attribute__((unused)) user_data_t *ud)
 { /* {{{ */
   threshold_t *th;
+  ut_series_t *series = NULL;
+  char *key = NULL;
   cdtime_t missing_time;
   char identifier[6 * DATA_MAX_NAME_LEN];
   notification_t n;
@@ -947,12 +1690,30 @@ static int ut_missing (const value_list_t *vl,
   if (threshold_tree == NULL)
     return (0);
 
-  th = threshold_search (vl);
+  if (FORMAT_VL (identifier, sizeof (identifier), vl) != 0)
+  {
+    ERROR ("ut_missing: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  pthread_mutex_lock (&threshold_lock);
+  if (c_avl_remove (series_tree, identifier,
+        (void *) &key, (void *) &series) == 0)
+  {
+    th = series->th;
+    sfree (key);
+    ut_series_free (series);
+  }
+  else
+  {
+    th = threshold_search (vl);
+  }
+  pthread_mutex_unlock (&threshold_lock);
+
   if (th == NULL)
     return (0);
 
   missing_time = cdtime () - vl->time;
-  FORMAT_VL (identifier, sizeof (identifier), vl);
 
   NOTIFICATION_INIT_VL (&n, vl);
   ssnprintf (n.message, sizeof (n.message),
@@ -981,6 +1742,16 @@ int ut_config (oconfig_item_t *ci)
     }
   }
 
+  if (series_tree == NULL)
+  {
+    series_tree = c_avl_create ((void *) strcmp);
+    if (series_tree == NULL)
+    {
+      ERROR ("ut_config: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
   memset (&th, '\0', sizeof (th));
   th.warning_min = NAN;
   th.warning_max = NAN;
@@ -1012,6 +1783,11 @@ int ut_config (oconfig_item_t *ci)
       break;
   }
 
+  /* Series resolved so far may match one of the new thresholds. */
+  pthread_mutex_lock (&threshold_lock);
+  ut_series_clear ();
+  pthread_mutex_unlock (&threshold_lock);
+
   if (c_avl_size (threshold_tree) > 0) {
     plugin_register_missing ("threshold", ut_missing,
         /* user data = */ NULL);
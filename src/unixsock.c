@@ -23,11 +23,13 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_complain.h"
 
 #include "utils_cmd_flush.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putval.h"
+#include "utils_cmd_putvals.h"
 #include "utils_cmd_putnotif.h"
 
 /* Folks without pthread will need to disable this plugin. */
@@ -37,7 +39,9 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
 
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
@@ -45,6 +49,43 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+/* Maximum length of a single line sent by a client. */
+#define US_READ_BUFFER_SIZE 16384
+
+#ifdef MSG_NOSIGNAL
+# define US_SEND_FLAGS MSG_NOSIGNAL
+#else
+# define US_SEND_FLAGS 0
+#endif
+
+/*
+ * Private data types
+ */
+struct us_client_s;
+typedef struct us_client_s us_client_t;
+struct us_client_s
+{
+	int fd;
+
+	char  *rbuf;
+	size_t rbuf_fill;
+
+	char  *wbuf;
+	size_t wbuf_fill;
+	size_t wbuf_size;
+
+	/* Open PUTVALS block, if any. */
+	cmd_putvals_t *putvals;
+
+	/* Set while the client is queued or handled by a worker thread. */
+	_Bool busy;
+	_Bool eof;
+	_Bool error;
+
+	us_client_t *next;
+	us_client_t *queue_next;
+};
+
 /*
  * Private variables
  */
@@ -54,7 +95,9 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"MaxClients",
+	"WorkerThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -68,6 +111,22 @@ static int   sock_perms = S_IRWXU | S_IRWXG;
 static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
+static int wakeup_pipe[2] = { -1, -1 };
+
+/* Only used by the I/O thread. */
+static us_client_t *clients = NULL;
+static int clients_num = 0;
+static int max_clients = 128;
+
+static int workers_num = 4;
+static int workers_running = 0;
+static pthread_t *workers = NULL;
+
+/* Clients waiting for a worker thread. */
+static us_client_t *queue_head = NULL;
+static us_client_t *queue_tail = NULL;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
 
 /*
  * Functions
@@ -124,7 +183,7 @@ static int us_open_socket (void)
 
 	chmod (sa.sun_path, sock_perms);
 
-	status = listen (sock_fd, 8);
+	status = listen (sock_fd, SOMAXCONN);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -135,6 +194,18 @@ static int us_open_socket (void)
 		return (-1);
 	}
 
+	/* The socket is polled, so accept must never block. */
+	status = fcntl (sock_fd, F_GETFL);
+	if ((status < 0) || (fcntl (sock_fd, F_SETFL, status | O_NONBLOCK) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: fcntl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (sock_fd);
+		sock_fd = -1;
+		return (-1);
+	}
+
 	do
 	{
 		char *grpname;
@@ -174,167 +245,573 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+/*
+ * Client handling
+ *
+ * A single I/O thread polls the listening socket and all idle client
+ * sockets. When a client has sent one or more complete lines, it is handed
+ * to one of the worker threads, which executes all of these commands in one
+ * go and collects their output in the client's write buffer. While a worker
+ * owns a client, the I/O thread does not touch the client's buffers.
+ */
+static int us_handle_command (FILE *fhout, char *buffer) /* {{{ */
 {
-	int fdin;
-	int fdout;
-	FILE *fhin, *fhout;
+	char buffer_copy[1024];
+	char *fields[128];
+	int   fields_num;
 
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
+	sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
 
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
-
-	fdout = dup (fdin);
-	if (fdout < 0)
+	fields_num = strsplit (buffer_copy, fields,
+			sizeof (fields) / sizeof (fields[0]));
+	if (fields_num < 1)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: dup failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
+		fprintf (fhout, "-1 Internal error\n");
+		return (-1);
 	}
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+	if (strcasecmp (fields[0], "getval") == 0)
+		handle_getval (fhout, buffer);
+	else if (strcasecmp (fields[0], "putval") == 0)
+		handle_putval (fhout, buffer);
+	else if (strcasecmp (fields[0], "listval") == 0)
+		handle_listval (fhout, buffer);
+	else if (strcasecmp (fields[0], "putnotif") == 0)
+		handle_putnotif (fhout, buffer);
+	else if (strcasecmp (fields[0], "flush") == 0)
+		handle_flush (fhout, buffer);
+	else
+		fprintf (fhout, "-1 Unknown command: %s\n", fields[0]);
+
+	return (0);
+} /* }}} int us_handle_command */
+
+static void us_client_free (us_client_t *c) /* {{{ */
+{
+	if (c == NULL)
+		return;
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", c->fd);
+
+	if (c->fd >= 0)
+		close (c->fd);
+	cmd_putvals_destroy (c->putvals);
+	sfree (c->rbuf);
+	sfree (c->wbuf);
+	sfree (c);
+} /* }}} void us_client_free */
+
+static int us_client_append_output (us_client_t *c, /* {{{ */
+		const char *data, size_t data_size)
+{
+	if (data_size == 0)
+		return (0);
+
+	if ((c->wbuf_fill + data_size) > c->wbuf_size)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		size_t new_size = (c->wbuf_size > 0) ? c->wbuf_size : 4096;
+		char *tmp;
+
+		while (new_size < (c->wbuf_fill + data_size))
+			new_size *= 2;
+
+		tmp = realloc (c->wbuf, new_size);
+		if (tmp == NULL)
+		{
+			ERROR ("unixsock plugin: realloc failed.");
+			return (-1);
+		}
+		c->wbuf = tmp;
+		c->wbuf_size = new_size;
 	}
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	memcpy (c->wbuf + c->wbuf_fill, data, data_size);
+	c->wbuf_fill += data_size;
+
+	return (0);
+} /* }}} int us_client_append_output */
+
+/* Writes as much of the write buffer as the socket accepts without
+ * blocking. */
+static int us_client_write (us_client_t *c) /* {{{ */
+{
+	size_t offset = 0;
+
+	while (offset < c->wbuf_fill)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		ssize_t status;
+
+		status = send (c->fd, c->wbuf + offset, c->wbuf_fill - offset,
+				US_SEND_FLAGS);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			c->error = 1;
+			return (-1);
+		}
+
+		offset += (size_t) status;
 	}
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	if (offset > 0)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: setvbuf failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
-		return ((void *) 0);
+		memmove (c->wbuf, c->wbuf + offset, c->wbuf_fill - offset);
+		c->wbuf_fill -= offset;
 	}
 
-	while (42)
+	return (0);
+} /* }}} int us_client_write */
+
+/* Reads everything available from the socket into the read buffer.
+ * Returns the number of bytes read. */
+static ssize_t us_client_read (us_client_t *c) /* {{{ */
+{
+	ssize_t total = 0;
+
+	while (c->rbuf_fill < US_READ_BUFFER_SIZE)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+		ssize_t status;
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
+		status = read (c->fd, c->rbuf + c->rbuf_fill,
+				US_READ_BUFFER_SIZE - c->rbuf_fill);
+		if (status < 0)
 		{
-			if ((errno == EINTR) || (errno == EAGAIN))
+			char errbuf[1024];
+
+			if (errno == EINTR)
 				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
 
-			if (errno != 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			c->error = 1;
+			break;
+		}
+		else if (status == 0)
+		{
+			c->eof = 1;
 			break;
 		}
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+		c->rbuf_fill += (size_t) status;
+		total += status;
+	}
 
-		if (len == 0)
-			continue;
+	return (total);
+} /* }}} ssize_t us_client_read */
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+/* Executes all complete lines in the read buffer. At the end of the input,
+ * an incomplete last line is executed, too. Called by the worker threads. */
+static void us_client_process (us_client_t *c) /* {{{ */
+{
+	FILE *fhout;
+	char *output = NULL;
+	size_t output_size = 0;
+	size_t offset = 0;
 
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
-		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
-		}
+	fhout = open_memstream (&output, &output_size);
+	if (fhout == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: open_memstream failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		c->error = 1;
+		return;
+	}
+
+	while ((offset < c->rbuf_fill) && !c->error)
+	{
+		char *line = c->rbuf + offset;
+		char *end;
+		size_t len;
 
-		if (strcasecmp (fields[0], "getval") == 0)
+		end = memchr (line, '\n', c->rbuf_fill - offset);
+		if (end == NULL)
 		{
-			handle_getval (fhout, buffer);
+			if (!c->eof)
+				break;
+			/* The read buffer has room for a terminating null byte. */
+			end = c->rbuf + c->rbuf_fill;
 		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+		*end = 0;
+		offset = (size_t) (end - c->rbuf) + 1;
+
+		len = strlen (line);
+		while ((len > 0) && (line[len - 1] == '\r'))
+			line[--len] = 0;
+
+		/* Inside a PUTVALS block, an empty line ends the block. */
+		if (c->putvals != NULL)
 		{
-			handle_putval (fhout, buffer);
+			if (len > 0)
+			{
+				cmd_putvals_add (c->putvals, line);
+				continue;
+			}
+
+			cmd_putvals_finish (c->putvals, fhout);
+			cmd_putvals_destroy (c->putvals);
+			c->putvals = NULL;
+			continue;
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+
+		if (len == 0)
+			continue;
+
+		if ((strncasecmp ("PUTVALS", line, strlen ("PUTVALS")) == 0)
+				&& ((line[strlen ("PUTVALS")] == 0)
+					|| isspace ((int) line[strlen ("PUTVALS")])))
 		{
-			handle_listval (fhout, buffer);
+			c->putvals = cmd_putvals_create (fhout, line);
+			continue;
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+
+		if (us_handle_command (fhout, line) != 0)
+			c->error = 1;
+	}
+
+	/* The client may close the connection without ending the block. */
+	if (c->eof && (c->putvals != NULL) && (offset >= c->rbuf_fill))
+	{
+		cmd_putvals_finish (c->putvals, fhout);
+		cmd_putvals_destroy (c->putvals);
+		c->putvals = NULL;
+	}
+
+	if (offset >= c->rbuf_fill)
+		c->rbuf_fill = 0;
+	else if (offset > 0)
+	{
+		memmove (c->rbuf, c->rbuf + offset, c->rbuf_fill - offset);
+		c->rbuf_fill -= offset;
+	}
+
+	fclose (fhout);
+	if (us_client_append_output (c, output, output_size) != 0)
+		c->error = 1;
+	free (output);
+
+	us_client_write (c);
+} /* }}} void us_client_process */
+
+static void us_wakeup (void) /* {{{ */
+{
+	char c = 0;
+
+	if (write (wakeup_pipe[1], &c, sizeof (c)) < 0)
+	{
+		/* The pipe is full, so the I/O thread will wake up anyway. */
+	}
+} /* }}} void us_wakeup */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&queue_lock);
+	while (42)
+	{
+		us_client_t *c;
+
+		while ((loop != 0) && (queue_head == NULL))
+			pthread_cond_wait (&queue_cond, &queue_lock);
+
+		if (queue_head == NULL)
+			break;
+
+		c = queue_head;
+		queue_head = c->queue_next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		c->queue_next = NULL;
+		pthread_mutex_unlock (&queue_lock);
+
+		us_client_process (c);
+
+		pthread_mutex_lock (&queue_lock);
+		c->busy = 0;
+		us_wakeup ();
+	}
+	pthread_mutex_unlock (&queue_lock);
+
+	return ((void *) 0);
+} /* }}} void *us_worker_thread */
+
+/* XXX: You must hold "queue_lock" when calling this function! */
+static void us_client_enqueue (us_client_t *c) /* {{{ */
+{
+	c->busy = 1;
+	c->queue_next = NULL;
+	if (queue_tail == NULL)
+		queue_head = c;
+	else
+		queue_tail->queue_next = c;
+	queue_tail = c;
+
+	pthread_cond_signal (&queue_cond);
+} /* }}} void us_client_enqueue */
+
+static void us_accept_client (void) /* {{{ */
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+	us_client_t *c;
+	int fd;
+	int flags;
+
+	fd = accept (sock_fd, NULL, NULL);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+			return;
+
+		ERROR ("unixsock plugin: accept failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	if (clients_num >= max_clients)
+	{
+		static const char msg[] = "-1 Too many clients\n";
+
+		c_complain (LOG_WARNING, &complaint, "unixsock plugin: "
+				"Rejecting connection: MaxClients (%i) reached.",
+				max_clients);
+		if (send (fd, msg, sizeof (msg) - 1, US_SEND_FLAGS) < 0)
 		{
-			handle_putnotif (fhout, buffer);
+			/* Nothing we can do about it. */
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+		close (fd);
+		return;
+	}
+	c_release (LOG_INFO, &complaint, "unixsock plugin: "
+			"Accepting connections again.");
+
+	flags = fcntl (fd, F_GETFL);
+	if ((flags < 0) || (fcntl (fd, F_SETFL, flags | O_NONBLOCK) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: fcntl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return;
+	}
+
+	c = malloc (sizeof (*c));
+	if (c == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		close (fd);
+		return;
+	}
+	memset (c, 0, sizeof (*c));
+	c->fd = fd;
+
+	/* One extra byte for terminating an incomplete last line. */
+	c->rbuf = malloc (US_READ_BUFFER_SIZE + 1);
+	if (c->rbuf == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		us_client_free (c);
+		return;
+	}
+
+	DEBUG ("unixsock plugin: Accepted connection on fd #%i", fd);
+
+	c->next = clients;
+	clients = c;
+	clients_num++;
+} /* }}} void us_accept_client */
+
+/* Called by the I/O thread for clients which are not owned by a worker.
+ * Returns non-zero if the connection should be closed. */
+static int us_client_handle_events (us_client_t *c, short revents) /* {{{ */
+{
+	if (revents & POLLOUT)
+		us_client_write (c);
+
+	if (revents & (POLLIN | POLLHUP | POLLERR))
+	{
+		us_client_read (c);
+
+		if (!c->error && (c->rbuf_fill >= US_READ_BUFFER_SIZE)
+				&& (memchr (c->rbuf, '\n', c->rbuf_fill) == NULL))
 		{
-			handle_flush (fhout, buffer);
+			static const char msg[] = "-1 Line too long\n";
+
+			WARNING ("unixsock plugin: Client on socket #%i sent a line "
+					"longer than %i bytes. Closing connection.",
+					c->fd, US_READ_BUFFER_SIZE);
+			us_client_append_output (c, msg, sizeof (msg) - 1);
+			us_client_write (c);
+			return (-1);
 		}
-		else
+	}
+
+	if (c->error)
+		return (-1);
+
+	if (((c->rbuf_fill > 0)
+				&& (c->eof || (memchr (c->rbuf, '\n', c->rbuf_fill) != NULL)))
+			|| (c->eof && (c->putvals != NULL)))
+	{
+		pthread_mutex_lock (&queue_lock);
+		us_client_enqueue (c);
+		pthread_mutex_unlock (&queue_lock);
+		return (0);
+	}
+
+	if (c->eof && (c->wbuf_fill == 0) && (c->putvals == NULL))
+		return (-1);
+
+	return (0);
+} /* }}} int us_client_handle_events */
+
+static int us_start_workers (void) /* {{{ */
+{
+	int i;
+
+	workers = calloc ((size_t) workers_num, sizeof (*workers));
+	if (workers == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < workers_num; i++)
+	{
+		int status;
+
+		status = plugin_thread_create (&workers[i], NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
-			}
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
 		}
-	} /* while (fgets) */
+		workers_running++;
+	}
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+	if (workers_running == 0)
+	{
+		sfree (workers);
+		return (-1);
+	}
 
-	pthread_exit ((void *) 0);
-	return ((void *) 0);
-} /* void *us_handle_client */
+	return (0);
+} /* }}} int us_start_workers */
 
-static void *us_server_thread (void __attribute__((unused)) *arg)
+static void us_stop_workers (void) /* {{{ */
 {
-	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
+	int i;
 
-	pthread_attr_init (&th_attr);
-	pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+	pthread_mutex_lock (&queue_lock);
+	pthread_cond_broadcast (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
+
+	for (i = 0; i < workers_running; i++)
+		pthread_join (workers[i], NULL);
+
+	workers_running = 0;
+	sfree (workers);
+} /* }}} void us_stop_workers */
+
+static void *us_server_thread (void __attribute__((unused)) *arg)
+{
+	struct pollfd *fds;
+	us_client_t **fds_clients;
+	int status;
 
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
+	/* Wake-up pipe, listening socket and one entry per client. */
+	fds = calloc ((size_t) max_clients + 2, sizeof (*fds));
+	fds_clients = calloc ((size_t) max_clients + 2, sizeof (*fds_clients));
+	if ((fds == NULL) || (fds_clients == NULL)
+			|| (us_start_workers () != 0))
+	{
+		ERROR ("unixsock plugin: Initializing the server failed.");
+		sfree (fds);
+		sfree (fds_clients);
+		close (sock_fd);
+		sock_fd = -1;
+		pthread_exit ((void *) 1);
+	}
+
 	while (loop != 0)
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
+		us_client_t *c;
+		us_client_t **prev;
+		int fds_num = 0;
+		int i;
+
+		fds[fds_num].fd = wakeup_pipe[0];
+		fds[fds_num].events = POLLIN;
+		fds[fds_num].revents = 0;
+		fds_clients[fds_num] = NULL;
+		fds_num++;
+
+		fds[fds_num].fd = sock_fd;
+		fds[fds_num].events = POLLIN;
+		fds[fds_num].revents = 0;
+		fds_clients[fds_num] = NULL;
+		fds_num++;
+
+		/* Close finished connections and poll all clients which are not
+		 * owned by a worker. Clients with pending output are not read from
+		 * until the output has been sent. */
+		pthread_mutex_lock (&queue_lock);
+		prev = &clients;
+		while ((c = *prev) != NULL)
+		{
+			if (c->busy)
+			{
+				prev = &c->next;
+				continue;
+			}
+
+			if (c->error
+					|| (c->eof && (c->rbuf_fill == 0) && (c->wbuf_fill == 0)
+						&& (c->putvals == NULL)))
+			{
+				*prev = c->next;
+				clients_num--;
+				us_client_free (c);
+				continue;
+			}
+
+			/* A worker may have left an incomplete last line or an open
+			 * PUTVALS block behind. */
+			if (c->eof && (c->wbuf_fill == 0)
+					&& ((c->rbuf_fill > 0) || (c->putvals != NULL)))
+			{
+				us_client_enqueue (c);
+				prev = &c->next;
+				continue;
+			}
+
+			fds[fds_num].fd = c->fd;
+			fds[fds_num].events = (c->wbuf_fill > 0) ? POLLOUT : POLLIN;
+			fds[fds_num].revents = 0;
+			fds_clients[fds_num] = c;
+			fds_num++;
+
+			prev = &c->next;
+		}
+		pthread_mutex_unlock (&queue_lock);
+
+		status = poll (fds, (nfds_t) fds_num, /* timeout = */ -1);
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -342,43 +819,47 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 			if (errno == EINTR)
 				continue;
 
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (sock_fd);
-			sock_fd = -1;
-			pthread_attr_destroy (&th_attr);
-			pthread_exit ((void *) 1);
+			break;
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		if (fds[0].revents & POLLIN)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
+			char buffer[64];
+			while (read (wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+				/* drain the pipe */;
 		}
-		*remote_fd = status;
-
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
 
-		status = plugin_thread_create (&th, &th_attr,
-				us_handle_client, (void *) remote_fd);
-		if (status != 0)
+		for (i = 2; i < fds_num; i++)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			c = fds_clients[i];
+			if (fds[i].revents == 0)
+				continue;
+
+			if (us_client_handle_events (c, fds[i].revents) != 0)
+				c->error = 1;
 		}
+
+		if (fds[1].revents & POLLIN)
+			us_accept_client ();
 	} /* while (loop) */
 
+	us_stop_workers ();
+
+	while (clients != NULL)
+	{
+		us_client_t *next = clients->next;
+		us_client_free (clients);
+		clients = next;
+	}
+	clients_num = 0;
+
+	sfree (fds);
+	sfree (fds_clients);
+
 	close (sock_fd);
 	sock_fd = -1;
-	pthread_attr_destroy (&th_attr);
 
 	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
@@ -423,6 +904,26 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "MaxClients") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: MaxClients must be positive.");
+			return (1);
+		}
+		max_clients = tmp;
+	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: WorkerThreads must be positive.");
+			return (1);
+		}
+		workers_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -444,6 +945,19 @@ static int us_init (void)
 
 	loop = 1;
 
+	status = pipe (wakeup_pipe);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wakeup_pipe[0], F_SETFL,
+			fcntl (wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wakeup_pipe[1], F_SETFL,
+			fcntl (wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -465,11 +979,18 @@ static int us_shutdown (void)
 
 	if (listen_thread != (pthread_t) 0)
 	{
-		pthread_kill (listen_thread, SIGTERM);
+		us_wakeup ();
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	if (wakeup_pipe[0] >= 0)
+	{
+		close (wakeup_pipe[0]);
+		close (wakeup_pipe[1]);
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+	}
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
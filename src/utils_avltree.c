@@ -713,6 +713,39 @@ int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value)
 	return (0);
 } /* int c_avl_iterator_prev */
 
+int c_avl_iterator_seek (c_avl_iterator_t *iter, const void *key)
+{
+	c_avl_node_t *n;
+	c_avl_node_t *prev;
+	int cmp;
+
+	if ((iter == NULL) || (key == NULL))
+		return (-1);
+
+	/* Find the biggest node which is strictly smaller than `key'. The next
+	 * call to `c_avl_iterator_next' will then return its successor. If there
+	 * is no such node, `iter->node' is NULL and the iteration (re)starts at
+	 * the smallest node. */
+	prev = NULL;
+	n = iter->tree->root;
+	while (n != NULL)
+	{
+		cmp = iter->tree->compare (key, n->key);
+		if (cmp > 0)
+		{
+			prev = n;
+			n = n->right;
+		}
+		else
+		{
+			n = n->left;
+		}
+	}
+
+	iter->node = prev;
+	return (0);
+} /* int c_avl_iterator_seek */
+
 void c_avl_iterator_destroy (c_avl_iterator_t *iter)
 {
 	free (iter);
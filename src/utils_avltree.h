@@ -148,6 +148,25 @@ int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy (c_avl_iterator_t *iter);
 
+/*
+ * NAME
+ *   c_avl_iterator_seek
+ *
+ * DESCRIPTION
+ *   Positions the iterator so that the next call to `c_avl_iterator_next'
+ *   returns the smallest key which is greater than or equal to `key'. This
+ *   allows to resume an iteration after the tree has been modified, e.g. when
+ *   a lock protecting the tree was released in between.
+ *
+ * PARAMETERS
+ *   `iter'     Iterator to reposition.
+ *   `key'      Key to seek to. The key doesn't need to exist in the tree.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero if `iter' or `key' is NULL.
+ */
+int c_avl_iterator_seek (c_avl_iterator_t *iter, const void *key);
+
 /*
  * NAME
  *   c_avl_size
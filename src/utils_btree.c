@@ -0,0 +1,887 @@
+/**
+ * collectd - src/utils_btree.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "utils_btree.h"
+
+/* Minimum number of keys in all nodes but the root. */
+#define MIN_KEYS (C_BTREE_ORDER / 2)
+
+/* Number of nodes allocated at once. */
+#define POOL_CHUNK_SIZE 64
+
+#define CHILD(n,i) ((c_btree_node_t *) (n)->ptrs[i])
+
+/*
+ * private data types
+ */
+/* Leaves store up to C_BTREE_ORDER keys with their values in `ptrs'. Inner
+ * nodes store up to C_BTREE_ORDER keys and one child more than keys in `ptrs';
+ * keys[i] is the smallest key in the subtree ptrs[i+1]. Both have room for one
+ * additional element, so that an element can be inserted before splitting a
+ * node. */
+struct c_btree_node_s
+{
+	int num;
+	_Bool leaf;
+	void *keys[C_BTREE_ORDER + 1];
+	void *ptrs[C_BTREE_ORDER + 2];
+
+	/* Leaves are linked for iterating. `next' also links the free list of
+	 * the pool. */
+	struct c_btree_node_s *next;
+	struct c_btree_node_s *prev;
+};
+typedef struct c_btree_node_s c_btree_node_t;
+
+struct c_btree_chunk_s
+{
+	struct c_btree_chunk_s *next;
+	c_btree_node_t nodes[POOL_CHUNK_SIZE];
+};
+typedef struct c_btree_chunk_s c_btree_chunk_t;
+
+struct c_btree_s
+{
+	c_btree_node_t *root;
+	int (*compare) (const void *, const void *);
+	_Bool compare_is_strcmp;
+	int size;
+	int height;
+
+	c_btree_chunk_t *chunks;
+	c_btree_node_t *free_nodes;
+	int free_nodes_num;
+};
+
+struct c_btree_iterator_s
+{
+	c_btree_t *tree;
+	/* Leaf and index of the element returned last. `leaf' is NULL before
+	 * the first element has been returned. */
+	c_btree_node_t *leaf;
+	int index;
+
+	char *prefix;
+	size_t prefix_len;
+};
+
+/*
+ * private functions
+ */
+static int compare_keys (const c_btree_t *t, const void *a, const void *b)
+{
+	if (t->compare_is_strcmp)
+		return (strcmp (a, b));
+	return (t->compare (a, b));
+} /* int compare_keys */
+
+static int pool_reserve (c_btree_t *t, int num)
+{
+	while (t->free_nodes_num < num)
+	{
+		c_btree_chunk_t *chunk;
+		int i;
+
+		chunk = malloc (sizeof (*chunk));
+		if (chunk == NULL)
+			return (-1);
+
+		chunk->next = t->chunks;
+		t->chunks = chunk;
+
+		for (i = 0; i < POOL_CHUNK_SIZE; i++)
+		{
+			chunk->nodes[i].next = t->free_nodes;
+			t->free_nodes = chunk->nodes + i;
+		}
+		t->free_nodes_num += POOL_CHUNK_SIZE;
+	}
+
+	return (0);
+} /* int pool_reserve */
+
+/* Frees all nodes, i.e. empties the tree. */
+static void pool_destroy (c_btree_t *t)
+{
+	while (t->chunks != NULL)
+	{
+		c_btree_chunk_t *next = t->chunks->next;
+		free (t->chunks);
+		t->chunks = next;
+	}
+
+	t->free_nodes = NULL;
+	t->free_nodes_num = 0;
+	t->root = NULL;
+	t->size = 0;
+	t->height = 0;
+} /* void pool_destroy */
+
+static c_btree_node_t *node_alloc (c_btree_t *t, _Bool leaf)
+{
+	c_btree_node_t *n;
+
+	if (pool_reserve (t, 1) != 0)
+		return (NULL);
+
+	n = t->free_nodes;
+	t->free_nodes = n->next;
+	t->free_nodes_num--;
+
+	n->num = 0;
+	n->leaf = leaf;
+	n->next = NULL;
+	n->prev = NULL;
+
+	return (n);
+} /* c_btree_node_t *node_alloc */
+
+static void node_free (c_btree_t *t, c_btree_node_t *n)
+{
+	n->next = t->free_nodes;
+	t->free_nodes = n;
+	t->free_nodes_num++;
+} /* void node_free */
+
+/* Returns the index of the first key in `n' which is greater than or equal to
+ * `key'. `*found' is set if the key at that index is equal to `key'. */
+static int node_lower_bound (const c_btree_t *t, const c_btree_node_t *n,
+		const void *key, _Bool *found)
+{
+	int lo = 0;
+	int hi = n->num;
+
+	*found = 0;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		int cmp = compare_keys (t, key, n->keys[mid]);
+
+		if (cmp == 0)
+		{
+			*found = 1;
+			return (mid);
+		}
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return (lo);
+} /* int node_lower_bound */
+
+/* Returns the index of the child of the inner node `n' which may contain
+ * `key'. */
+static int node_child_index (const c_btree_t *t, const c_btree_node_t *n,
+		const void *key)
+{
+	_Bool found;
+	int i;
+
+	i = node_lower_bound (t, n, key, &found);
+	return (found ? (i + 1) : i);
+} /* int node_child_index */
+
+static c_btree_node_t *search_leaf (const c_btree_t *t, const void *key)
+{
+	c_btree_node_t *n = t->root;
+
+	while ((n != NULL) && !n->leaf)
+		n = CHILD (n, node_child_index (t, n, key));
+
+	return (n);
+} /* c_btree_node_t *search_leaf */
+
+static void *subtree_min (c_btree_node_t *n)
+{
+	while (!n->leaf)
+		n = CHILD (n, 0);
+	return (n->keys[0]);
+} /* void *subtree_min */
+
+/* Splits a node holding C_BTREE_ORDER + 1 keys. The new right sibling is
+ * returned, the smallest key in it is stored in `ret_key'. The pool must hold
+ * a free node. */
+static c_btree_node_t *node_split (c_btree_t *t, c_btree_node_t *n,
+		void **ret_key)
+{
+	c_btree_node_t *r;
+	int mid = n->num / 2;
+
+	r = node_alloc (t, n->leaf);
+	assert (r != NULL);
+
+	if (n->leaf)
+	{
+		r->num = n->num - mid;
+		memcpy (r->keys, n->keys + mid, r->num * sizeof (void *));
+		memcpy (r->ptrs, n->ptrs + mid, r->num * sizeof (void *));
+		n->num = mid;
+
+		r->next = n->next;
+		r->prev = n;
+		if (n->next != NULL)
+			n->next->prev = r;
+		n->next = r;
+
+		*ret_key = r->keys[0];
+	}
+	else
+	{
+		/* keys[mid] moves up into the parent. */
+		r->num = n->num - mid - 1;
+		memcpy (r->keys, n->keys + mid + 1, r->num * sizeof (void *));
+		memcpy (r->ptrs, n->ptrs + mid + 1, (r->num + 1) * sizeof (void *));
+		*ret_key = n->keys[mid];
+		n->num = mid;
+	}
+
+	return (r);
+} /* c_btree_node_t *node_split */
+
+/* Returns less than zero on failure, greater than zero if the key exists and
+ * zero on success. If `n' had to be split, the new right sibling and its
+ * smallest key are returned in `ret_split' and `ret_key'. */
+static int insert_rec (c_btree_t *t, c_btree_node_t *n, void *key,
+		void *value, c_btree_node_t **ret_split, void **ret_key)
+{
+	int i;
+
+	*ret_split = NULL;
+
+	if (n->leaf)
+	{
+		_Bool found;
+
+		i = node_lower_bound (t, n, key, &found);
+		if (found)
+			return (1);
+
+		memmove (n->keys + i + 1, n->keys + i, (n->num - i) * sizeof (void *));
+		memmove (n->ptrs + i + 1, n->ptrs + i, (n->num - i) * sizeof (void *));
+		n->keys[i] = key;
+		n->ptrs[i] = value;
+		n->num++;
+	}
+	else
+	{
+		c_btree_node_t *split;
+		void *split_key;
+		int status;
+
+		i = node_child_index (t, n, key);
+		status = insert_rec (t, CHILD (n, i), key, value, &split, &split_key);
+		if ((status != 0) || (split == NULL))
+			return (status);
+
+		memmove (n->keys + i + 1, n->keys + i, (n->num - i) * sizeof (void *));
+		memmove (n->ptrs + i + 2, n->ptrs + i + 1,
+				(n->num - i) * sizeof (void *));
+		n->keys[i] = split_key;
+		n->ptrs[i + 1] = split;
+		n->num++;
+	}
+
+	if (n->num > C_BTREE_ORDER)
+		*ret_split = node_split (t, n, ret_key);
+
+	return (0);
+} /* int insert_rec */
+
+/* Moves elements between the children `i' and `i + 1' of `p' or merges them,
+ * after one of them dropped below MIN_KEYS keys. */
+static void merge_children (c_btree_t *t, c_btree_node_t *p, int i)
+{
+	c_btree_node_t *l = CHILD (p, i);
+	c_btree_node_t *r = CHILD (p, i + 1);
+
+	if (l->leaf)
+	{
+		memcpy (l->keys + l->num, r->keys, r->num * sizeof (void *));
+		memcpy (l->ptrs + l->num, r->ptrs, r->num * sizeof (void *));
+		l->num += r->num;
+
+		l->next = r->next;
+		if (r->next != NULL)
+			r->next->prev = l;
+	}
+	else
+	{
+		l->keys[l->num] = p->keys[i];
+		memcpy (l->keys + l->num + 1, r->keys, r->num * sizeof (void *));
+		memcpy (l->ptrs + l->num + 1, r->ptrs, (r->num + 1) * sizeof (void *));
+		l->num += r->num + 1;
+	}
+
+	memmove (p->keys + i, p->keys + i + 1, (p->num - i - 1) * sizeof (void *));
+	memmove (p->ptrs + i + 1, p->ptrs + i + 2,
+			(p->num - i - 1) * sizeof (void *));
+	p->num--;
+
+	node_free (t, r);
+} /* void merge_children */
+
+static void borrow_from_left (c_btree_node_t *p, int i)
+{
+	c_btree_node_t *l = CHILD (p, i - 1);
+	c_btree_node_t *c = CHILD (p, i);
+
+	if (c->leaf)
+	{
+		memmove (c->keys + 1, c->keys, c->num * sizeof (void *));
+		memmove (c->ptrs + 1, c->ptrs, c->num * sizeof (void *));
+		c->keys[0] = l->keys[l->num - 1];
+		c->ptrs[0] = l->ptrs[l->num - 1];
+		c->num++;
+		l->num--;
+		p->keys[i - 1] = c->keys[0];
+	}
+	else
+	{
+		memmove (c->keys + 1, c->keys, c->num * sizeof (void *));
+		memmove (c->ptrs + 1, c->ptrs, (c->num + 1) * sizeof (void *));
+		c->keys[0] = p->keys[i - 1];
+		c->ptrs[0] = l->ptrs[l->num];
+		c->num++;
+		p->keys[i - 1] = l->keys[l->num - 1];
+		l->num--;
+	}
+} /* void borrow_from_left */
+
+static void borrow_from_right (c_btree_node_t *p, int i)
+{
+	c_btree_node_t *c = CHILD (p, i);
+	c_btree_node_t *r = CHILD (p, i + 1);
+
+	if (c->leaf)
+	{
+		c->keys[c->num] = r->keys[0];
+		c->ptrs[c->num] = r->ptrs[0];
+		c->num++;
+		r->num--;
+		memmove (r->keys, r->keys + 1, r->num * sizeof (void *));
+		memmove (r->ptrs, r->ptrs + 1, r->num * sizeof (void *));
+		p->keys[i] = r->keys[0];
+	}
+	else
+	{
+		c->keys[c->num] = p->keys[i];
+		c->ptrs[c->num + 1] = r->ptrs[0];
+		c->num++;
+		p->keys[i] = r->keys[0];
+		r->num--;
+		memmove (r->keys, r->keys + 1, r->num * sizeof (void *));
+		memmove (r->ptrs, r->ptrs + 1, (r->num + 1) * sizeof (void *));
+	}
+} /* void borrow_from_right */
+
+static void rebalance_child (c_btree_t *t, c_btree_node_t *p, int i)
+{
+	if ((i > 0) && (CHILD (p, i - 1)->num > MIN_KEYS))
+		borrow_from_left (p, i);
+	else if ((i < p->num) && (CHILD (p, i + 1)->num > MIN_KEYS))
+		borrow_from_right (p, i);
+	else if (i > 0)
+		merge_children (t, p, i - 1);
+	else
+		merge_children (t, p, i);
+} /* void rebalance_child */
+
+/* Removes `key' from the subtree `n'. The removed key and value are stored in
+ * `rkey' and `rvalue'. Returns zero upon success. */
+static int remove_rec (c_btree_t *t, c_btree_node_t *n, const void *key,
+		void **rkey, void **rvalue)
+{
+	c_btree_node_t *c;
+	int status;
+	int i;
+
+	if (n->leaf)
+	{
+		_Bool found;
+
+		i = node_lower_bound (t, n, key, &found);
+		if (!found)
+			return (-1);
+
+		*rkey = n->keys[i];
+		*rvalue = n->ptrs[i];
+
+		n->num--;
+		memmove (n->keys + i, n->keys + i + 1, (n->num - i) * sizeof (void *));
+		memmove (n->ptrs + i, n->ptrs + i + 1, (n->num - i) * sizeof (void *));
+		return (0);
+	}
+
+	i = node_child_index (t, n, key);
+	c = CHILD (n, i);
+
+	status = remove_rec (t, c, key, rkey, rvalue);
+	if (status != 0)
+		return (status);
+
+	/* The caller may free the removed key, so it must not be used as a
+	 * separator any longer. */
+	if ((i > 0) && (n->keys[i - 1] == *rkey))
+		n->keys[i - 1] = subtree_min (c);
+
+	if (c->num < MIN_KEYS)
+		rebalance_child (t, n, i);
+
+	return (0);
+} /* int remove_rec */
+
+static c_btree_node_t *leftmost_leaf (const c_btree_t *t)
+{
+	c_btree_node_t *n = t->root;
+
+	while ((n != NULL) && !n->leaf)
+		n = CHILD (n, 0);
+	return (n);
+} /* c_btree_node_t *leftmost_leaf */
+
+static c_btree_node_t *rightmost_leaf (const c_btree_t *t)
+{
+	c_btree_node_t *n = t->root;
+
+	while ((n != NULL) && !n->leaf)
+		n = CHILD (n, n->num);
+	return (n);
+} /* c_btree_node_t *rightmost_leaf */
+
+/*
+ * public functions
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *))
+{
+	c_btree_t *t;
+
+	if (compare == NULL)
+		return (NULL);
+
+	t = malloc (sizeof (*t));
+	if (t == NULL)
+		return (NULL);
+	memset (t, 0, sizeof (*t));
+
+	t->compare = compare;
+	t->compare_is_strcmp = (compare == (void *) strcmp);
+
+	return (t);
+} /* c_btree_t *c_btree_create */
+
+void c_btree_destroy (c_btree_t *t)
+{
+	if (t == NULL)
+		return;
+
+	pool_destroy (t);
+	free (t);
+} /* void c_btree_destroy */
+
+int c_btree_insert (c_btree_t *t, void *key, void *value)
+{
+	c_btree_node_t *split;
+	void *split_key;
+	int status;
+
+	assert (t != NULL);
+
+	/* Make sure that splitting nodes on the way up cannot fail: Each level
+	 * and a new root need at most one new node. */
+	if (pool_reserve (t, t->height + 2) != 0)
+		return (-1);
+
+	if (t->root == NULL)
+	{
+		t->root = node_alloc (t, /* leaf = */ 1);
+		t->height = 1;
+	}
+
+	status = insert_rec (t, t->root, key, value, &split, &split_key);
+	if (status != 0)
+		return (status);
+
+	if (split != NULL)
+	{
+		c_btree_node_t *root = node_alloc (t, /* leaf = */ 0);
+
+		root->num = 1;
+		root->keys[0] = split_key;
+		root->ptrs[0] = t->root;
+		root->ptrs[1] = split;
+		t->root = root;
+		t->height++;
+	}
+
+	t->size++;
+	return (0);
+} /* int c_btree_insert */
+
+int c_btree_build (c_btree_t *t, void **keys, void **values, size_t num)
+{
+	c_btree_node_t **level;
+	void **mins;
+	size_t level_num;
+	size_t i;
+
+	assert (t != NULL);
+
+	if (t->size != 0)
+		return (EEXIST);
+	if (num == 0)
+		return (0);
+	if (num > (size_t) INT_MAX)
+		return (EINVAL);
+
+	for (i = 1; i < num; i++)
+		if (compare_keys (t, keys[i - 1], keys[i]) >= 0)
+			return (EINVAL);
+
+	/* Throw away the nodes of an emptied tree. */
+	pool_destroy (t);
+
+	level_num = (num + C_BTREE_ORDER - 1) / C_BTREE_ORDER;
+	level = calloc (level_num, sizeof (*level));
+	mins = calloc (level_num, sizeof (*mins));
+	if ((level == NULL) || (mins == NULL)
+			|| (pool_reserve (t, (int) (2 * level_num + 1)) != 0))
+	{
+		free (level);
+		free (mins);
+		pool_destroy (t);
+		return (ENOMEM);
+	}
+
+	/* Distribute the elements evenly over the leaves, so that each leaf
+	 * holds at least MIN_KEYS elements. */
+	for (i = 0; i < level_num; i++)
+	{
+		size_t first = (num * i) / level_num;
+		size_t last = (num * (i + 1)) / level_num;
+		c_btree_node_t *n = node_alloc (t, /* leaf = */ 1);
+
+		n->num = (int) (last - first);
+		memcpy (n->keys, keys + first, n->num * sizeof (void *));
+		memcpy (n->ptrs, values + first, n->num * sizeof (void *));
+		if (i > 0)
+		{
+			n->prev = level[i - 1];
+			level[i - 1]->next = n;
+		}
+
+		level[i] = n;
+		mins[i] = n->keys[0];
+	}
+	t->height = 1;
+
+	/* Build the inner nodes bottom up, reusing the arrays. */
+	while (level_num > 1)
+	{
+		size_t parents_num = (level_num + C_BTREE_ORDER)
+			/ (C_BTREE_ORDER + 1);
+
+		for (i = 0; i < parents_num; i++)
+		{
+			size_t first = (level_num * i) / parents_num;
+			size_t last = (level_num * (i + 1)) / parents_num;
+			c_btree_node_t *n = node_alloc (t, /* leaf = */ 0);
+			size_t j;
+
+			n->num = (int) (last - first - 1);
+			for (j = first; j < last; j++)
+			{
+				n->ptrs[j - first] = level[j];
+				if (j > first)
+					n->keys[j - first - 1] = mins[j];
+			}
+
+			/* i <= first, so this doesn't overwrite unused entries. */
+			mins[i] = mins[first];
+			level[i] = n;
+		}
+
+		level_num = parents_num;
+		t->height++;
+	}
+
+	t->root = level[0];
+	t->size = (int) num;
+
+	free (level);
+	free (mins);
+	return (0);
+} /* int c_btree_build */
+
+int c_btree_remove (c_btree_t *t, const void *key, void **rkey, void **rvalue)
+{
+	void *tmp_key;
+	void *tmp_value;
+	int status;
+
+	assert (t != NULL);
+
+	if (t->root == NULL)
+		return (-1);
+
+	status = remove_rec (t, t->root, key, &tmp_key, &tmp_value);
+	if (status != 0)
+		return (status);
+
+	if (!t->root->leaf && (t->root->num == 0))
+	{
+		c_btree_node_t *old_root = t->root;
+
+		t->root = CHILD (old_root, 0);
+		t->height--;
+		node_free (t, old_root);
+	}
+	else if (t->root->leaf && (t->root->num == 0))
+	{
+		node_free (t, t->root);
+		t->root = NULL;
+		t->height = 0;
+	}
+
+	if (rkey != NULL)
+		*rkey = tmp_key;
+	if (rvalue != NULL)
+		*rvalue = tmp_value;
+
+	t->size--;
+	return (0);
+} /* int c_btree_remove */
+
+int c_btree_get (c_btree_t *t, const void *key, void **value)
+{
+	c_btree_node_t *n;
+	_Bool found;
+	int i;
+
+	assert (t != NULL);
+
+	n = search_leaf (t, key);
+	if (n == NULL)
+		return (-1);
+
+	i = node_lower_bound (t, n, key, &found);
+	if (!found)
+		return (-1);
+
+	if (value != NULL)
+		*value = n->ptrs[i];
+
+	return (0);
+} /* int c_btree_get */
+
+int c_btree_pick (c_btree_t *t, void **key, void **value)
+{
+	c_btree_node_t *n;
+
+	if ((t == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	/* Removing the biggest element never requires updating separators. */
+	n = rightmost_leaf (t);
+	if (n == NULL)
+		return (-1);
+
+	return (c_btree_remove (t, n->keys[n->num - 1], key, value));
+} /* int c_btree_pick */
+
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t)
+{
+	c_btree_iterator_t *iter;
+
+	if (t == NULL)
+		return (NULL);
+
+	iter = malloc (sizeof (*iter));
+	if (iter == NULL)
+		return (NULL);
+	memset (iter, 0, sizeof (*iter));
+	iter->tree = t;
+
+	return (iter);
+} /* c_btree_iterator_t *c_btree_get_iterator */
+
+c_btree_iterator_t *c_btree_get_prefix_iterator (c_btree_t *t,
+		const char *prefix)
+{
+	c_btree_iterator_t *iter;
+
+	if (prefix == NULL)
+		return (NULL);
+
+	iter = c_btree_get_iterator (t);
+	if (iter == NULL)
+		return (NULL);
+
+	iter->prefix = strdup (prefix);
+	if (iter->prefix == NULL)
+	{
+		free (iter);
+		return (NULL);
+	}
+	iter->prefix_len = strlen (prefix);
+
+	c_btree_iterator_seek (iter, prefix);
+	return (iter);
+} /* c_btree_iterator_t *c_btree_get_prefix_iterator */
+
+int c_btree_iterator_next (c_btree_iterator_t *iter, void **key, void **value)
+{
+	c_btree_node_t *n;
+	int i;
+
+	if ((iter == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	if (iter->leaf == NULL)
+	{
+		n = leftmost_leaf (iter->tree);
+		i = 0;
+	}
+	else
+	{
+		n = iter->leaf;
+		i = iter->index + 1;
+	}
+
+	while ((n != NULL) && (i >= n->num))
+	{
+		n = n->next;
+		i = 0;
+	}
+
+	if (n == NULL)
+		return (-1);
+
+	if ((iter->prefix != NULL)
+			&& (strncmp (n->keys[i], iter->prefix, iter->prefix_len) != 0))
+		return (-1);
+
+	iter->leaf = n;
+	iter->index = i;
+	*key = n->keys[i];
+	*value = n->ptrs[i];
+
+	return (0);
+} /* int c_btree_iterator_next */
+
+int c_btree_iterator_prev (c_btree_iterator_t *iter, void **key, void **value)
+{
+	c_btree_node_t *n;
+	int i;
+
+	if ((iter == NULL) || (key == NULL) || (value == NULL)
+			|| (iter->prefix != NULL))
+		return (-1);
+
+	if (iter->leaf == NULL)
+	{
+		n = rightmost_leaf (iter->tree);
+		i = (n == NULL) ? 0 : n->num - 1;
+	}
+	else
+	{
+		n = iter->leaf;
+		i = iter->index - 1;
+	}
+
+	while ((n != NULL) && (i < 0))
+	{
+		n = n->prev;
+		i = (n == NULL) ? 0 : n->num - 1;
+	}
+
+	if (n == NULL)
+		return (-1);
+
+	iter->leaf = n;
+	iter->index = i;
+	*key = n->keys[i];
+	*value = n->ptrs[i];
+
+	return (0);
+} /* int c_btree_iterator_prev */
+
+int c_btree_iterator_seek (c_btree_iterator_t *iter, const void *key)
+{
+	c_btree_node_t *n;
+	_Bool found;
+	int i;
+
+	if ((iter == NULL) || (key == NULL))
+		return (-1);
+
+	/* Position the iterator on the biggest element which is strictly
+	 * smaller than `key', so that `c_btree_iterator_next' returns its
+	 * successor. If there is no such element, the iteration (re)starts at
+	 * the smallest element. */
+	iter->leaf = NULL;
+	iter->index = 0;
+
+	n = search_leaf (iter->tree, key);
+	if (n == NULL)
+		return (0);
+
+	i = node_lower_bound (iter->tree, n, key, &found);
+	if (i > 0)
+	{
+		iter->leaf = n;
+		iter->index = i - 1;
+	}
+	else if (n->prev != NULL)
+	{
+		iter->leaf = n->prev;
+		iter->index = n->prev->num - 1;
+	}
+
+	return (0);
+} /* int c_btree_iterator_seek */
+
+void c_btree_iterator_destroy (c_btree_iterator_t *iter)
+{
+	if (iter == NULL)
+		return;
+
+	free (iter->prefix);
+	free (iter);
+} /* void c_btree_iterator_destroy */
+
+int c_btree_size (c_btree_t *t)
+{
+	if (t == NULL)
+		return (0);
+	return (t->size);
+} /* int c_btree_size */
@@ -0,0 +1,201 @@
+/**
+ * collectd - src/utils_btree.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_BTREE_H
+#define UTILS_BTREE_H 1
+
+#include <stddef.h>
+
+/*
+ * Ordered map implemented as a B+-tree. It has the same interface and
+ * semantics as the AVL-tree in "utils_avltree.h", so that users can be
+ * migrated by renaming the functions, but stores up to C_BTREE_ORDER keys per
+ * node. This reduces the depth of the tree to a handful of levels and keeps
+ * the keys that are compared during a lookup next to each other in memory.
+ * Nodes are allocated from a per-tree pool, leaves are linked to allow cheap
+ * iteration.
+ *
+ * Like the AVL-tree, the tree must not be modified while an iterator is in
+ * use. Use `c_btree_iterator_seek' to continue after the tree was modified.
+ */
+#define C_BTREE_ORDER 32
+
+struct c_btree_s;
+typedef struct c_btree_s c_btree_t;
+
+struct c_btree_iterator_s;
+typedef struct c_btree_iterator_s c_btree_iterator_t;
+
+/*
+ * NAME
+ *   c_btree_create
+ *
+ * DESCRIPTION
+ *   Allocates a new B+-tree.
+ *
+ * PARAMETERS
+ *   `compare'  The function-pointer `compare' is used to compare two keys. It
+ *              has to return less than zero if it's first argument is smaller
+ *              then the second argument, more than zero if the first argument
+ *              is bigger than the second argument and zero if they are equal.
+ *              If your keys are char-pointers, you can use the `strcmp'
+ *              function from the libc here; it is called directly instead of
+ *              through the function pointer in that case.
+ *
+ * RETURN VALUE
+ *   A c_btree_t-pointer upon success or NULL upon failure.
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *));
+
+/*
+ * NAME
+ *   c_btree_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a B+-tree. Stored value- and key-pointer are lost, but of
+ *   course not freed.
+ */
+void c_btree_destroy (c_btree_t *t);
+
+/*
+ * NAME
+ *   c_btree_insert
+ *
+ * DESCRIPTION
+ *   Stores the key-value-pair in the tree pointed to by `t'. The key pointer is
+ *   stored, not copied, see `c_avl_insert'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise. It's less than zero if an error
+ *   occurred or greater than zero if the key is already stored in the tree.
+ */
+int c_btree_insert (c_btree_t *t, void *key, void *value);
+
+/*
+ * NAME
+ *   c_btree_build
+ *
+ * DESCRIPTION
+ *   Fills an empty tree with `num' key-value-pairs at once. The keys must be
+ *   sorted in ascending order according to the compare function and must be
+ *   unique. This is considerably faster than inserting the pairs one by one
+ *   and results in completely filled nodes, which is ideal for maps that are
+ *   built once and then only read.
+ *
+ * PARAMETERS
+ *   `t'        Empty tree to fill.
+ *   `keys'     Array of `num' keys.
+ *   `values'   Array of `num' values.
+ *   `num'      Number of key-value-pairs.
+ *
+ * RETURN VALUE
+ *   Zero upon success, EEXIST if the tree is not empty, EINVAL if the keys
+ *   are not sorted or not unique and ENOMEM if allocating memory failed. The
+ *   tree is left empty upon failure.
+ */
+int c_btree_build (c_btree_t *t, void **keys, void **values, size_t num);
+
+/*
+ * NAME
+ *   c_btree_remove
+ *
+ * DESCRIPTION
+ *   Removes a key-value-pair from the tree t. The stored key and value may be
+ *   returned in `rkey' and `rvalue', see `c_avl_remove'.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the tree.
+ */
+int c_btree_remove (c_btree_t *t, const void *key, void **rkey, void **rvalue);
+
+/*
+ * NAME
+ *   c_btree_get
+ *
+ * DESCRIPTION
+ *   Retrieve the `value' belonging to `key'. `value' may be NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the tree.
+ */
+int c_btree_get (c_btree_t *t, const void *key, void **value);
+
+/*
+ * NAME
+ *   c_btree_pick
+ *
+ * DESCRIPTION
+ *   Remove an element from the tree and return it's `key' and `value'. This
+ *   function is intended for cache-flushes that don't care about the order but
+ *   simply want to remove all elements, one at a time.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the tree is empty or key or value is
+ *   NULL.
+ */
+int c_btree_pick (c_btree_t *t, void **key, void **value);
+
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t);
+int c_btree_iterator_next (c_btree_iterator_t *iter, void **key, void **value);
+int c_btree_iterator_prev (c_btree_iterator_t *iter, void **key, void **value);
+void c_btree_iterator_destroy (c_btree_iterator_t *iter);
+
+/*
+ * NAME
+ *   c_btree_iterator_seek
+ *
+ * DESCRIPTION
+ *   Positions the iterator so that the next call to `c_btree_iterator_next'
+ *   returns the smallest key which is greater than or equal to `key'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero if `iter' or `key' is NULL.
+ */
+int c_btree_iterator_seek (c_btree_iterator_t *iter, const void *key);
+
+/*
+ * NAME
+ *   c_btree_get_prefix_iterator
+ *
+ * DESCRIPTION
+ *   Returns an iterator over all keys which start with the string `prefix',
+ *   in ascending order. Only `c_btree_iterator_next' may be used with the
+ *   returned iterator. The keys of the tree must be strings and the tree must
+ *   have been created with `strcmp' or a compatible compare function.
+ *
+ * RETURN VALUE
+ *   A c_btree_iterator_t-pointer upon success or NULL upon failure.
+ */
+c_btree_iterator_t *c_btree_get_prefix_iterator (c_btree_t *t,
+		const char *prefix);
+
+/*
+ * NAME
+ *   c_btree_size
+ *
+ * DESCRIPTION
+ *   Return the number of key-value-pairs in the tree, 0 if the tree is empty
+ *   or NULL.
+ */
+int c_btree_size (c_btree_t *t);
+
+#endif /* UTILS_BTREE_H */
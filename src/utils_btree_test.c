@@ -0,0 +1,413 @@
+/**
+ * collectd - src/utils_btree_test.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Checks the B+-tree against the AVL-tree, which serves as reference. Run with
+ * "-b" to compare the speed of both trees instead, using keys that look like
+ * value list identifiers.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "utils_avltree.h"
+#include "utils_btree.h"
+
+static char **make_keys (int num, _Bool identifiers) /* {{{ */
+{
+  char **keys;
+  int i;
+
+  keys = calloc ((size_t) num, sizeof (*keys));
+  assert (keys != NULL);
+
+  for (i = 0; i < num; i++)
+  {
+    char buffer[256];
+
+    if (identifiers)
+      snprintf (buffer, sizeof (buffer), "host%04i.example.com/cpu-%i/cpu-%s",
+          i % 5000, i / 10000,
+          ((i / 5000) % 2) ? "system" : "user");
+    else
+      snprintf (buffer, sizeof (buffer), "%08i", i);
+
+    keys[i] = strdup (buffer);
+    assert (keys[i] != NULL);
+  }
+
+  /* Shuffle, so that keys are not inserted in order. */
+  for (i = num - 1; i > 0; i--)
+  {
+    int j = rand () % (i + 1);
+    char *tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+
+  return (keys);
+} /* }}} char **make_keys */
+
+static void free_keys (char **keys, int num) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < num; i++)
+    free (keys[i]);
+  free (keys);
+} /* }}} void free_keys */
+
+static int compare_string_ptr (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp (*(char * const *) a, *(char * const *) b));
+} /* }}} int compare_string_ptr */
+
+/* Compares the content of both trees. The B+-tree is walked backwards, too,
+ * and compared to the forward order. */
+static void check_equal (c_avl_tree_t *avl, c_btree_t *bt) /* {{{ */
+{
+  c_avl_iterator_t *ai;
+  c_btree_iterator_t *bi;
+  void *akey, *avalue, *bkey, *bvalue;
+  void **order;
+  int num = 0;
+
+  assert (c_avl_size (avl) == c_btree_size (bt));
+
+  order = calloc ((size_t) c_btree_size (bt) + 1, sizeof (*order));
+  assert (order != NULL);
+
+  ai = c_avl_get_iterator (avl);
+  bi = c_btree_get_iterator (bt);
+  while (c_avl_iterator_next (ai, &akey, &avalue) == 0)
+  {
+    assert (c_btree_iterator_next (bi, &bkey, &bvalue) == 0);
+    assert (akey == bkey);
+    assert (avalue == bvalue);
+    order[num] = bkey;
+    num++;
+  }
+  assert (c_btree_iterator_next (bi, &bkey, &bvalue) != 0);
+  assert (num == c_btree_size (bt));
+  c_avl_iterator_destroy (ai);
+  c_btree_iterator_destroy (bi);
+
+  bi = c_btree_get_iterator (bt);
+  while (c_btree_iterator_prev (bi, &bkey, &bvalue) == 0)
+  {
+    assert (num > 0);
+    num--;
+    assert (order[num] == bkey);
+  }
+  assert (num == 0);
+  c_btree_iterator_destroy (bi);
+
+  free (order);
+} /* }}} void check_equal */
+
+static void test_random (int num) /* {{{ */
+{
+  c_avl_tree_t *avl = c_avl_create ((void *) strcmp);
+  c_btree_t *bt = c_btree_create ((void *) strcmp);
+  char **keys = make_keys (num, /* identifiers = */ 0);
+  int round;
+  int i;
+
+  assert ((avl != NULL) && (bt != NULL));
+
+  for (round = 0; round < 4; round++)
+  {
+    for (i = 0; i < 4 * num; i++)
+    {
+      char *key = keys[rand () % num];
+      void *avalue, *bvalue, *rkey;
+      int astatus, bstatus;
+
+      switch (rand () % 3)
+      {
+        case 0:
+        case 1:
+          /* Insert more often than remove while growing. */
+          if ((round % 2) == 0)
+          {
+            astatus = c_avl_insert (avl, key, key + 1);
+            bstatus = c_btree_insert (bt, key, key + 1);
+            assert (astatus == bstatus);
+            break;
+          }
+          /* fall through */
+        case 2:
+          astatus = c_avl_remove (avl, key, NULL, &avalue);
+          bstatus = c_btree_remove (bt, key, &rkey, &bvalue);
+          assert ((astatus == 0) == (bstatus == 0));
+          if (bstatus == 0)
+          {
+            assert (rkey == key);
+            assert (bvalue == avalue);
+          }
+          break;
+      }
+
+      astatus = c_avl_get (avl, key, &avalue);
+      bstatus = c_btree_get (bt, key, &bvalue);
+      assert ((astatus == 0) == (bstatus == 0));
+      if (bstatus == 0)
+        assert (bvalue == avalue);
+    }
+
+    check_equal (avl, bt);
+  }
+
+  /* Empty both trees with pick and refill the B+-tree afterwards. */
+  while (c_btree_size (bt) > 0)
+  {
+    void *key, *value;
+
+    assert (c_btree_pick (bt, &key, &value) == 0);
+    assert (c_avl_remove (avl, key, NULL, NULL) == 0);
+    if ((c_btree_size (bt) % 997) == 0)
+      check_equal (avl, bt);
+  }
+  assert (c_avl_size (avl) == 0);
+
+  for (i = 0; i < num; i++)
+  {
+    assert (c_btree_insert (bt, keys[i], keys[i]) == 0);
+    assert (c_avl_insert (avl, keys[i], keys[i]) == 0);
+  }
+  check_equal (avl, bt);
+
+  c_avl_destroy (avl);
+  c_btree_destroy (bt);
+  free_keys (keys, num);
+} /* }}} void test_random */
+
+static void test_build (int num) /* {{{ */
+{
+  c_btree_t *bt = c_btree_create ((void *) strcmp);
+  c_avl_tree_t *avl = c_avl_create ((void *) strcmp);
+  char **keys = make_keys (num, /* identifiers = */ 0);
+  int i;
+
+  assert ((avl != NULL) && (bt != NULL));
+
+  /* Unsorted input is refused and leaves the tree empty. */
+  if (num > 2)
+    assert (c_btree_build (bt, (void **) keys, (void **) keys,
+          (size_t) num) == EINVAL);
+  assert (c_btree_size (bt) == 0);
+
+  qsort (keys, (size_t) num, sizeof (*keys), compare_string_ptr);
+  assert (c_btree_build (bt, (void **) keys, (void **) keys,
+        (size_t) num) == 0);
+  assert (c_btree_build (bt, (void **) keys, (void **) keys,
+        (size_t) num) == ((num > 0) ? EEXIST : 0));
+
+  for (i = 0; i < num; i++)
+    assert (c_avl_insert (avl, keys[i], keys[i]) == 0);
+  check_equal (avl, bt);
+
+  /* The built tree must support modifications, too. */
+  for (i = 0; i < num; i += 2)
+  {
+    assert (c_btree_remove (bt, keys[i], NULL, NULL) == 0);
+    assert (c_avl_remove (avl, keys[i], NULL, NULL) == 0);
+  }
+  check_equal (avl, bt);
+
+  c_avl_destroy (avl);
+  c_btree_destroy (bt);
+  free_keys (keys, num);
+} /* }}} void test_build */
+
+static void test_seek (void) /* {{{ */
+{
+  c_btree_t *bt = c_btree_create ((void *) strcmp);
+  char **keys = make_keys (1000, /* identifiers = */ 0);
+  c_btree_iterator_t *iter;
+  void *key, *value;
+  int num;
+  int i;
+
+  /* Insert only even keys, so that odd keys can be sought. */
+  for (i = 0; i < 1000; i++)
+    if ((atoi (keys[i]) % 2) == 0)
+      assert (c_btree_insert (bt, keys[i], keys[i]) == 0);
+
+  iter = c_btree_get_iterator (bt);
+  assert (c_btree_iterator_seek (iter, "00000500") == 0);
+  assert (c_btree_iterator_next (iter, &key, &value) == 0);
+  assert (strcmp (key, "00000500") == 0);
+
+  assert (c_btree_iterator_seek (iter, "00000501") == 0);
+  assert (c_btree_iterator_next (iter, &key, &value) == 0);
+  assert (strcmp (key, "00000502") == 0);
+  assert (c_btree_iterator_prev (iter, &key, &value) == 0);
+  assert (strcmp (key, "00000500") == 0);
+
+  assert (c_btree_iterator_seek (iter, "") == 0);
+  assert (c_btree_iterator_next (iter, &key, &value) == 0);
+  assert (strcmp (key, "00000000") == 0);
+
+  assert (c_btree_iterator_seek (iter, "00000999") == 0);
+  assert (c_btree_iterator_next (iter, &key, &value) != 0);
+  c_btree_iterator_destroy (iter);
+
+  /* "000001" matches 00000100 to 00000198. */
+  iter = c_btree_get_prefix_iterator (bt, "000001");
+  assert (iter != NULL);
+  num = 0;
+  while (c_btree_iterator_next (iter, &key, &value) == 0)
+  {
+    assert (strncmp (key, "000001", 6) == 0);
+    num++;
+  }
+  assert (num == 50);
+  c_btree_iterator_destroy (iter);
+
+  iter = c_btree_get_prefix_iterator (bt, "1");
+  assert (c_btree_iterator_next (iter, &key, &value) != 0);
+  c_btree_iterator_destroy (iter);
+
+  c_btree_destroy (bt);
+  free_keys (keys, 1000);
+} /* }}} void test_seek */
+
+static double now (void) /* {{{ */
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, /* tz = */ NULL);
+  return (((double) tv.tv_sec) + (((double) tv.tv_usec) / 1000000.0));
+} /* }}} double now */
+
+#define BENCH_TREE(prefix, tree_t) \
+static void bench_##prefix (char **keys, int num, double *t) \
+{ \
+  tree_t *tree = prefix##_create ((void *) strcmp); \
+  prefix##_iterator_t *iter; \
+  void *key, *value; \
+  double start; \
+  int i; \
+  \
+  start = now (); \
+  for (i = 0; i < num; i++) \
+    prefix##_insert (tree, keys[i], keys[i]); \
+  t[0] = now () - start; \
+  \
+  start = now (); \
+  for (i = 0; i < num; i++) \
+    prefix##_get (tree, keys[(int) ((i * 7919LL) % num)], &value); \
+  t[1] = now () - start; \
+  \
+  start = now (); \
+  iter = prefix##_get_iterator (tree); \
+  while (prefix##_iterator_next (iter, &key, &value) == 0) \
+    /* do nothing */; \
+  prefix##_iterator_destroy (iter); \
+  t[2] = now () - start; \
+  \
+  start = now (); \
+  for (i = 0; i < num; i++) \
+    prefix##_remove (tree, keys[i], NULL, NULL); \
+  t[3] = now () - start; \
+  \
+  prefix##_destroy (tree); \
+}
+
+BENCH_TREE (c_avl, c_avl_tree_t)
+BENCH_TREE (c_btree, c_btree_t)
+
+static void bench (int num) /* {{{ */
+{
+  static const char *ops[] = { "insert", "get", "iterate", "remove" };
+  char **keys = make_keys (num, /* identifiers = */ 1);
+  double t_avl[4];
+  double t_btree[4];
+  int i;
+
+  bench_c_avl (keys, num, t_avl);
+  bench_c_btree (keys, num, t_btree);
+
+  printf ("%i keys, ns per key\n", num);
+  printf ("%-8s %10s %10s\n", "", "avltree", "btree");
+  for (i = 0; i < 4; i++)
+    printf ("%-8s %10.1f %10.1f (%.2fx)\n", ops[i],
+        1e9 * t_avl[i] / num, 1e9 * t_btree[i] / num,
+        t_avl[i] / t_btree[i]);
+
+  free_keys (keys, num);
+} /* }}} void bench */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  _Bool benchmark = 0;
+  int num = 1000000;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "bn:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': benchmark = 1; break;
+      case 'n': num = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-b [-n <keys>]]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+  }
+
+  if (benchmark)
+  {
+    if (num < 1)
+      return (EXIT_FAILURE);
+    bench (num);
+    return (EXIT_SUCCESS);
+  }
+
+  srand (42);
+  test_random (1);
+  test_random (100);
+  test_random (20000);
+  test_build (0);
+  test_build (1);
+  test_build (C_BTREE_ORDER);
+  test_build (C_BTREE_ORDER + 1);
+  test_build (1000);
+  test_build (50000);
+  test_seek ();
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -28,6 +28,11 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sys/mman.h>
+
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
 
 typedef struct cache_entry_s
 {
@@ -66,6 +71,75 @@ typedef struct cache_entry_s
 static c_avl_tree_t   *cache_tree = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Checkpoint file format. The file starts with a uc_checkpoint_header_t,
+ * followed by one record per cache entry and a record with `name_len' set to
+ * zero, which marks the file as complete. Each record is a
+ * uc_checkpoint_entry_t followed by the name (including the terminating null
+ * byte), the raw values, the gauge values, the history and the meta data. The
+ * file is only meant to be read by the same build on the same host, so all
+ * numbers are stored in host byte order. */
+#define UC_CHECKPOINT_MAGIC   "CDCACHE"
+#define UC_CHECKPOINT_VERSION 1
+#define UC_CHECKPOINT_CHUNK   1024
+
+typedef struct
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t value_size;
+} uc_checkpoint_header_t;
+
+typedef struct
+{
+  uint32_t name_len;
+  uint32_t values_num;
+  uint32_t history_length;
+  uint32_t history_index;
+  uint32_t meta_size;
+  int32_t  state;
+  int32_t  hits;
+  uint32_t reserved;
+  uint64_t last_time;
+  uint64_t interval;
+} uc_checkpoint_entry_t;
+
+typedef struct
+{
+  char  *data;
+  size_t size;
+  size_t fill;
+} uc_buffer_t;
+
+/* Number of entries and bytes of names copied per chunk by the cache
+ * iterator, and the number of entries it looks at while holding the lock. */
+#define UC_ITER_CHUNK_SIZE   256
+#define UC_ITER_BUFFER_SIZE  32768
+#define UC_ITER_SCAN_MAX     4096
+
+struct uc_iter_s
+{
+	char *prefix;
+	size_t prefix_len;
+	char *pattern;
+
+	/* Key to resume the iteration at and whether it has been returned
+	 * already. */
+	char last[6 * DATA_MAX_NAME_LEN];
+	_Bool have_last;
+	_Bool done;
+
+	/* Current chunk. */
+	struct
+	{
+		size_t name_offset;
+		cdtime_t time;
+	} entries[UC_ITER_CHUNK_SIZE];
+	size_t entries_num;
+	size_t entries_pos;
+
+	char buffer[UC_ITER_BUFFER_SIZE];
+};
+
 static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
 {
   assert ((a != NULL) && (b != NULL));
@@ -119,21 +193,89 @@ static void cache_free (cache_entry_t *ce)
   sfree (ce);
 } /* void cache_free */
 
-static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
+void uc_check_range (const data_set_t *ds, gauge_t *rates)
 {
   int i;
 
   for (i = 0; i < ds->ds_num; i++)
   {
-    if (isnan (ce->values_gauge[i]))
+    if (isnan (rates[i]))
       continue;
-    else if (ce->values_gauge[i] < ds->ds[i].min)
-      ce->values_gauge[i] = NAN;
-    else if (ce->values_gauge[i] > ds->ds[i].max)
-      ce->values_gauge[i] = NAN;
+    else if (rates[i] < ds->ds[i].min)
+      rates[i] = NAN;
+    else if (rates[i] > ds->ds[i].max)
+      rates[i] = NAN;
   }
 } /* void uc_check_range */
 
+int uc_calculate_rates (const data_set_t *ds, const value_list_t *vl,
+    value_t *values_raw, cdtime_t last_time, gauge_t *ret_rates)
+{
+  int i;
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    switch (ds->ds[i].type)
+    {
+      case DS_TYPE_COUNTER:
+	{
+	  counter_t diff;
+
+	  /* check if the counter has wrapped around */
+	  if (vl->values[i].counter < values_raw[i].counter)
+	  {
+	    if (values_raw[i].counter <= 4294967295U)
+	      diff = (4294967295U - values_raw[i].counter)
+		+ vl->values[i].counter;
+	    else
+	      diff = (18446744073709551615ULL - values_raw[i].counter)
+		+ vl->values[i].counter;
+	  }
+	  else /* counter has NOT wrapped around */
+	  {
+	    diff = vl->values[i].counter - values_raw[i].counter;
+	  }
+
+	  ret_rates[i] = ((double) diff)
+	    / (CDTIME_T_TO_DOUBLE (vl->time - last_time));
+	  values_raw[i].counter = vl->values[i].counter;
+	}
+	break;
+
+      case DS_TYPE_GAUGE:
+	values_raw[i].gauge = vl->values[i].gauge;
+	ret_rates[i] = vl->values[i].gauge;
+	break;
+
+      case DS_TYPE_DERIVE:
+	{
+	  derive_t diff;
+
+	  diff = vl->values[i].derive - values_raw[i].derive;
+
+	  ret_rates[i] = ((double) diff)
+	    / (CDTIME_T_TO_DOUBLE (vl->time - last_time));
+	  values_raw[i].derive = vl->values[i].derive;
+	}
+	break;
+
+      case DS_TYPE_ABSOLUTE:
+	ret_rates[i] = ((double) vl->values[i].absolute)
+	  / (CDTIME_T_TO_DOUBLE (vl->time - last_time));
+	values_raw[i].absolute = vl->values[i].absolute;
+	break;
+
+      default:
+	/* This shouldn't happen. */
+	ERROR ("uc_calculate_rates: Don't know how to handle data source "
+	    "type %i.", ds->ds[i].type);
+	return (-1);
+    } /* switch (ds->ds[i].type) */
+  } /* for (i) */
+
+  return (0);
+} /* int uc_calculate_rates */
+
 static int uc_insert (const data_set_t *ds, const value_list_t *vl,
     const char *key)
 {
@@ -196,7 +338,7 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   } /* for (i) */
 
   /* Prune invalid gauge data */
-  uc_check_range (ds, ce);
+  uc_check_range (ds, ce->values_gauge);
 
   ce->last_time = vl->time;
   ce->last_update = cdtime ();
@@ -393,68 +535,13 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
     return (-1);
   }
 
-  for (i = 0; i < ds->ds_num; i++)
+  status = uc_calculate_rates (ds, vl, ce->values_raw, ce->last_time,
+      ce->values_gauge);
+  if (status != 0)
   {
-    switch (ds->ds[i].type)
-    {
-      case DS_TYPE_COUNTER:
-	{
-	  counter_t diff;
-
-	  /* check if the counter has wrapped around */
-	  if (vl->values[i].counter < ce->values_raw[i].counter)
-	  {
-	    if (ce->values_raw[i].counter <= 4294967295U)
-	      diff = (4294967295U - ce->values_raw[i].counter)
-		+ vl->values[i].counter;
-	    else
-	      diff = (18446744073709551615ULL - ce->values_raw[i].counter)
-		+ vl->values[i].counter;
-	  }
-	  else /* counter has NOT wrapped around */
-	  {
-	    diff = vl->values[i].counter - ce->values_raw[i].counter;
-	  }
-
-	  ce->values_gauge[i] = ((double) diff)
-	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	  ce->values_raw[i].counter = vl->values[i].counter;
-	}
-	break;
-
-      case DS_TYPE_GAUGE:
-	ce->values_raw[i].gauge = vl->values[i].gauge;
-	ce->values_gauge[i] = vl->values[i].gauge;
-	break;
-
-      case DS_TYPE_DERIVE:
-	{
-	  derive_t diff;
-
-	  diff = vl->values[i].derive - ce->values_raw[i].derive;
-
-	  ce->values_gauge[i] = ((double) diff)
-	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	  ce->values_raw[i].derive = vl->values[i].derive;
-	}
-	break;
-
-      case DS_TYPE_ABSOLUTE:
-	ce->values_gauge[i] = ((double) vl->values[i].absolute)
-	  / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	ce->values_raw[i].absolute = vl->values[i].absolute;
-	break;
-
-      default:
-	/* This shouldn't happen. */
-	pthread_mutex_unlock (&cache_lock);
-	ERROR ("uc_update: Don't know how to handle data source type %i.",
-	    ds->ds[i].type);
-	return (-1);
-    } /* switch (ds->ds[i].type) */
-
-    DEBUG ("uc_update: %s: ds[%i] = %lf", name, i, ce->values_gauge[i]);
-  } /* for (i) */
+    pthread_mutex_unlock (&cache_lock);
+    return (-1);
+  }
 
   /* Update the history if it exists. */
   if (ce->history != NULL)
@@ -471,7 +558,7 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   }
 
   /* Prune invalid gauge data */
-  uc_check_range (ds, ce);
+  uc_check_range (ds, ce->values_gauge);
 
   ce->last_time = vl->time;
   ce->last_update = cdtime ();
@@ -649,6 +736,781 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
   return (0);
 } /* int uc_get_names */
 
+uc_iter_t *uc_get_iterator (const char *prefix, const char *pattern)
+{
+  uc_iter_t *iter;
+
+#if !HAVE_FNMATCH_H
+  if (pattern != NULL)
+  {
+    ERROR ("uc_get_iterator: Cannot match against `%s': "
+        "fnmatch() not available.", pattern);
+    return (NULL);
+  }
+#endif
+
+  iter = malloc (sizeof (*iter));
+  if (iter == NULL)
+  {
+    ERROR ("uc_get_iterator: malloc failed.");
+    return (NULL);
+  }
+  memset (iter, 0, sizeof (*iter));
+
+  /* Without an explicit prefix, use the part of the pattern up to the first
+   * wildcard character. Since the cache is sorted by name, this lets us skip
+   * directly to the first candidate and stop after the last one. */
+  if ((prefix == NULL) && (pattern != NULL))
+  {
+    size_t len = strcspn (pattern, "*?[\\");
+    if (len > 0)
+    {
+      iter->prefix = malloc (len + 1);
+      if (iter->prefix != NULL)
+        sstrncpy (iter->prefix, pattern, len + 1);
+    }
+  }
+  else if ((prefix != NULL) && (prefix[0] != 0))
+  {
+    iter->prefix = strdup (prefix);
+  }
+
+  if (pattern != NULL)
+    iter->pattern = strdup (pattern);
+
+  if (((pattern != NULL) && (iter->pattern == NULL))
+      || ((prefix != NULL) && (prefix[0] != 0) && (iter->prefix == NULL)))
+  {
+    ERROR ("uc_get_iterator: strdup failed.");
+    uc_iterator_destroy (iter);
+    return (NULL);
+  }
+
+  if (iter->prefix != NULL)
+    iter->prefix_len = strlen (iter->prefix);
+
+  return (iter);
+} /* uc_iter_t *uc_get_iterator */
+
+/* Copies the next chunk of matching names into `iter->buffer'. The lock is
+ * held for at most UC_ITER_SCAN_MAX entries, so the chunk may be empty even
+ * though the iteration is not done yet. */
+static int uc_iterator_fill (uc_iter_t *iter) /* {{{ */
+{
+  c_avl_iterator_t *avl_iter;
+  char *key;
+  cache_entry_t *ce;
+  char *last_key = NULL;
+  size_t buffer_fill = 0;
+  size_t scanned = 0;
+  _Bool skip_last = iter->have_last;
+
+  iter->entries_num = 0;
+  iter->entries_pos = 0;
+
+  pthread_mutex_lock (&cache_lock);
+
+  avl_iter = c_avl_get_iterator (cache_tree);
+  if (avl_iter == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    iter->done = 1;
+    return (-1);
+  }
+
+  if (iter->have_last && ((iter->prefix == NULL)
+        || (strcmp (iter->last, iter->prefix) >= 0)))
+    c_avl_iterator_seek (avl_iter, iter->last);
+  else if (iter->prefix != NULL)
+    c_avl_iterator_seek (avl_iter, iter->prefix);
+
+  while (42)
+  {
+    size_t len;
+
+    if ((iter->entries_num >= UC_ITER_CHUNK_SIZE)
+        || (scanned >= UC_ITER_SCAN_MAX))
+      break;
+
+    if (c_avl_iterator_next (avl_iter, (void *) &key, (void *) &ce) != 0)
+    {
+      iter->done = 1;
+      break;
+    }
+
+    /* The previous chunk ended with this key. */
+    if (skip_last)
+    {
+      skip_last = 0;
+      if (strcmp (key, iter->last) == 0)
+        continue;
+    }
+
+    /* Keys are sorted, so the first key not starting with the prefix is
+     * past all the ones that do. */
+    if ((iter->prefix != NULL)
+        && (strncmp (key, iter->prefix, iter->prefix_len) != 0))
+    {
+      iter->done = 1;
+      break;
+    }
+
+    len = strlen (key) + 1;
+    if ((buffer_fill + len) > sizeof (iter->buffer))
+      break;
+
+    last_key = key;
+    scanned++;
+
+    /* remove missing values when list values */
+    if (ce->state == STATE_MISSING)
+      continue;
+
+#if HAVE_FNMATCH_H
+    if ((iter->pattern != NULL) && (fnmatch (iter->pattern, key, 0) != 0))
+      continue;
+#endif
+
+    memcpy (iter->buffer + buffer_fill, key, len);
+    iter->entries[iter->entries_num].name_offset = buffer_fill;
+    iter->entries[iter->entries_num].time = ce->last_time;
+    iter->entries_num++;
+    buffer_fill += len;
+  }
+
+  if (last_key != NULL)
+  {
+    sstrncpy (iter->last, last_key, sizeof (iter->last));
+    iter->have_last = 1;
+  }
+
+  c_avl_iterator_destroy (avl_iter);
+  pthread_mutex_unlock (&cache_lock);
+
+  return (0);
+} /* }}} int uc_iterator_fill */
+
+int uc_iterator_next (uc_iter_t *iter, char **ret_name, cdtime_t *ret_time)
+{
+  if ((iter == NULL) || (ret_name == NULL))
+    return (-1);
+
+  while (iter->entries_pos >= iter->entries_num)
+  {
+    if (iter->done)
+      return (-1);
+    uc_iterator_fill (iter);
+  }
+
+  *ret_name = iter->buffer + iter->entries[iter->entries_pos].name_offset;
+  if (ret_time != NULL)
+    *ret_time = iter->entries[iter->entries_pos].time;
+  iter->entries_pos++;
+
+  return (0);
+} /* int uc_iterator_next */
+
+int uc_iterator_seek (uc_iter_t *iter, const char *name)
+{
+  if ((iter == NULL) || (name == NULL))
+    return (-1);
+
+  /* Names up to and including `name' are skipped, just as if `name' had been
+   * the last name returned. */
+  sstrncpy (iter->last, name, sizeof (iter->last));
+  iter->have_last = 1;
+  iter->done = 0;
+  iter->entries_num = 0;
+  iter->entries_pos = 0;
+
+  return (0);
+} /* int uc_iterator_seek */
+
+void uc_iterator_destroy (uc_iter_t *iter)
+{
+  if (iter == NULL)
+    return;
+
+  sfree (iter->prefix);
+  sfree (iter->pattern);
+  sfree (iter);
+} /* void uc_iterator_destroy */
+
+/*
+ * Checkpoints
+ */
+static int uc_buffer_append (uc_buffer_t *buf, /* {{{ */
+    const void *data, size_t size)
+{
+  if ((buf->fill + size) > buf->size)
+  {
+    size_t new_size = (buf->size == 0) ? 65536 : buf->size;
+    char *tmp;
+
+    while ((buf->fill + size) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (buf->data, new_size);
+    if (tmp == NULL)
+      return (-1);
+    buf->data = tmp;
+    buf->size = new_size;
+  }
+
+  memcpy (buf->data + buf->fill, data, size);
+  buf->fill += size;
+  return (0);
+} /* }}} int uc_buffer_append */
+
+static int uc_checkpoint_add_meta (uc_buffer_t *buf, /* {{{ */
+    meta_data_t *meta, uint32_t *ret_size)
+{
+  char **toc = NULL;
+  size_t fill = buf->fill;
+  int toc_num;
+  int status = 0;
+  int i;
+
+  toc_num = meta_data_toc (meta, &toc);
+  if (toc_num < 0)
+    return (-1);
+
+  for (i = 0; i < toc_num; i++)
+  {
+    uint8_t type;
+    char *v_string = NULL;
+    int64_t v_signed = 0;
+    uint64_t v_unsigned = 0;
+    double v_double = 0.0;
+    _Bool v_bool = 0;
+
+    type = (uint8_t) meta_data_type (meta, toc[i]);
+
+    if (status == 0)
+      status = uc_buffer_append (buf, &type, sizeof (type));
+    if (status == 0)
+      status = uc_buffer_append (buf, toc[i], strlen (toc[i]) + 1);
+    if (status != 0)
+      break;
+
+    switch (type)
+    {
+      case MD_TYPE_STRING:
+        status = meta_data_get_string (meta, toc[i], &v_string);
+        if (status == 0)
+          status = uc_buffer_append (buf, v_string, strlen (v_string) + 1);
+        sfree (v_string);
+        break;
+      case MD_TYPE_SIGNED_INT:
+        status = meta_data_get_signed_int (meta, toc[i], &v_signed);
+        if (status == 0)
+          status = uc_buffer_append (buf, &v_signed, sizeof (v_signed));
+        break;
+      case MD_TYPE_UNSIGNED_INT:
+        status = meta_data_get_unsigned_int (meta, toc[i], &v_unsigned);
+        if (status == 0)
+          status = uc_buffer_append (buf, &v_unsigned, sizeof (v_unsigned));
+        break;
+      case MD_TYPE_DOUBLE:
+        status = meta_data_get_double (meta, toc[i], &v_double);
+        if (status == 0)
+          status = uc_buffer_append (buf, &v_double, sizeof (v_double));
+        break;
+      case MD_TYPE_BOOLEAN:
+        status = meta_data_get_boolean (meta, toc[i], &v_bool);
+        v_unsigned = v_bool ? 1 : 0;
+        if (status == 0)
+          status = uc_buffer_append (buf, &v_unsigned, sizeof (v_unsigned));
+        break;
+      default:
+        status = -1;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  for (i = 0; i < toc_num; i++)
+    sfree (toc[i]);
+  sfree (toc);
+
+  if (status != 0)
+  {
+    buf->fill = fill;
+    return (-1);
+  }
+
+  *ret_size = (uint32_t) (buf->fill - fill);
+  return (0);
+} /* }}} int uc_checkpoint_add_meta */
+
+static int uc_checkpoint_add_entry (uc_buffer_t *buf, /* {{{ */
+    cache_entry_t *ce)
+{
+  uc_checkpoint_entry_t entry;
+  size_t entry_pos = buf->fill;
+  size_t history_num;
+  int status;
+
+  memset (&entry, 0, sizeof (entry));
+  entry.name_len = (uint32_t) (strlen (ce->name) + 1);
+  entry.values_num = (uint32_t) ce->values_num;
+  entry.history_length = (uint32_t) ce->history_length;
+  entry.history_index = (uint32_t) ce->history_index;
+  entry.state = (int32_t) ce->state;
+  entry.hits = (int32_t) ce->hits;
+  entry.last_time = (uint64_t) ce->last_time;
+  entry.interval = (uint64_t) ce->interval;
+
+  history_num = ce->history_length * ((size_t) ce->values_num);
+
+  status = uc_buffer_append (buf, &entry, sizeof (entry));
+  if (status == 0)
+    status = uc_buffer_append (buf, ce->name, entry.name_len);
+  if (status == 0)
+    status = uc_buffer_append (buf, ce->values_raw,
+        ce->values_num * sizeof (*ce->values_raw));
+  if (status == 0)
+    status = uc_buffer_append (buf, ce->values_gauge,
+        ce->values_num * sizeof (*ce->values_gauge));
+  if ((status == 0) && (history_num > 0))
+    status = uc_buffer_append (buf, ce->history,
+        history_num * sizeof (*ce->history));
+  if ((status == 0) && (ce->meta != NULL))
+    status = uc_checkpoint_add_meta (buf, ce->meta, &entry.meta_size);
+
+  if (status != 0)
+  {
+    buf->fill = entry_pos;
+    return (-1);
+  }
+
+  /* Update `meta_size' in the already appended header. */
+  memcpy (buf->data + entry_pos, &entry, sizeof (entry));
+  return (0);
+} /* }}} int uc_checkpoint_add_entry */
+
+int uc_checkpoint_write (const char *file) /* {{{ */
+{
+  char tmpfile[PATH_MAX];
+  char errbuf[1024];
+  uc_checkpoint_header_t header;
+  uc_checkpoint_entry_t end;
+  uc_buffer_t buf;
+  char last[6 * DATA_MAX_NAME_LEN];
+  _Bool have_last = 0;
+  _Bool done = 0;
+  size_t entries_num = 0;
+  cdtime_t start;
+  FILE *fh;
+  int status = 0;
+
+  if (file == NULL)
+    return (EINVAL);
+
+  start = cdtime ();
+  memset (&buf, 0, sizeof (buf));
+
+  ssnprintf (tmpfile, sizeof (tmpfile), "%s.tmp", file);
+  fh = fopen (tmpfile, "w");
+  if (fh == NULL)
+  {
+    ERROR ("uc_checkpoint_write: fopen (%s) failed: %s", tmpfile,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  memset (&header, 0, sizeof (header));
+  sstrncpy (header.magic, UC_CHECKPOINT_MAGIC, sizeof (header.magic));
+  header.version = UC_CHECKPOINT_VERSION;
+  header.value_size = (uint32_t) sizeof (value_t);
+  if (fwrite (&header, sizeof (header), 1, fh) != 1)
+    status = -1;
+
+  /* Serialize the cache in chunks, releasing the lock in between, so that
+   * writers are not blocked while the file is being written. */
+  while ((status == 0) && !done)
+  {
+    c_avl_iterator_t *iter;
+    char *key;
+    cache_entry_t *ce;
+    size_t chunk_num = 0;
+
+    buf.fill = 0;
+
+    pthread_mutex_lock (&cache_lock);
+
+    iter = c_avl_get_iterator (cache_tree);
+    if (iter == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      status = -1;
+      break;
+    }
+
+    if (have_last)
+      c_avl_iterator_seek (iter, last);
+
+    while (chunk_num < UC_CHECKPOINT_CHUNK)
+    {
+      if (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) != 0)
+      {
+        done = 1;
+        break;
+      }
+
+      if (have_last && (strcmp (key, last) == 0))
+        continue;
+
+      status = uc_checkpoint_add_entry (&buf, ce);
+      if (status != 0)
+      {
+        ERROR ("uc_checkpoint_write: Serializing \"%s\" failed.", key);
+        break;
+      }
+
+      sstrncpy (last, key, sizeof (last));
+      have_last = 1;
+      chunk_num++;
+    }
+
+    c_avl_iterator_destroy (iter);
+    pthread_mutex_unlock (&cache_lock);
+
+    if ((status == 0) && (buf.fill > 0)
+        && (fwrite (buf.data, buf.fill, 1, fh) != 1))
+      status = -1;
+    entries_num += chunk_num;
+  }
+
+  memset (&end, 0, sizeof (end));
+  if ((status == 0) && (fwrite (&end, sizeof (end), 1, fh) != 1))
+    status = -1;
+
+  sfree (buf.data);
+
+  if (fclose (fh) != 0)
+    status = -1;
+
+  if (status != 0)
+  {
+    ERROR ("uc_checkpoint_write: Writing \"%s\" failed: %s", tmpfile,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmpfile);
+    return (-1);
+  }
+
+  if (rename (tmpfile, file) != 0)
+  {
+    ERROR ("uc_checkpoint_write: rename (%s, %s) failed: %s", tmpfile, file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmpfile);
+    return (-1);
+  }
+
+  INFO ("uc_checkpoint_write: Wrote %zu entries to \"%s\" in %.3f seconds.",
+      entries_num, file, CDTIME_T_TO_DOUBLE (cdtime () - start));
+  return (0);
+} /* }}} int uc_checkpoint_write */
+
+static meta_data_t *uc_checkpoint_read_meta (const char *data, /* {{{ */
+    size_t size)
+{
+  meta_data_t *meta;
+  size_t pos = 0;
+
+  meta = meta_data_create ();
+  if (meta == NULL)
+    return (NULL);
+
+  while (pos < size)
+  {
+    uint8_t type;
+    const char *key;
+    const char *end;
+    uint64_t tmp;
+    int status;
+
+    type = (uint8_t) data[pos];
+    pos++;
+
+    key = data + pos;
+    end = memchr (key, 0, size - pos);
+    if (end == NULL)
+      break;
+    pos += (size_t) (end - key) + 1;
+
+    if (type == MD_TYPE_STRING)
+    {
+      const char *value = data + pos;
+
+      end = memchr (value, 0, size - pos);
+      if (end == NULL)
+        break;
+      pos += (size_t) (end - value) + 1;
+
+      status = meta_data_add_string (meta, key, value);
+    }
+    else
+    {
+      if ((size - pos) < sizeof (tmp))
+        break;
+      memcpy (&tmp, data + pos, sizeof (tmp));
+      pos += sizeof (tmp);
+
+      if (type == MD_TYPE_SIGNED_INT)
+        status = meta_data_add_signed_int (meta, key, (int64_t) tmp);
+      else if (type == MD_TYPE_UNSIGNED_INT)
+        status = meta_data_add_unsigned_int (meta, key, tmp);
+      else if (type == MD_TYPE_DOUBLE)
+      {
+        double d;
+        memcpy (&d, &tmp, sizeof (d));
+        status = meta_data_add_double (meta, key, d);
+      }
+      else if (type == MD_TYPE_BOOLEAN)
+        status = meta_data_add_boolean (meta, key, (tmp != 0) ? 1 : 0);
+      else
+        break;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if (pos != size)
+  {
+    meta_data_destroy (meta);
+    return (NULL);
+  }
+
+  return (meta);
+} /* }}} meta_data_t *uc_checkpoint_read_meta */
+
+/* Creates a cache entry from the record at `data'. Returns the number of
+ * bytes consumed, zero for the end marker and -1 if the record is broken. */
+static ssize_t uc_checkpoint_read_entry (const char *data, /* {{{ */
+    size_t size, cdtime_t now, size_t *entries_num)
+{
+  uc_checkpoint_entry_t entry;
+  const data_set_t *ds;
+  cache_entry_t *ce;
+  const char *name;
+  char *key;
+  char type[DATA_MAX_NAME_LEN];
+  size_t history_num;
+  size_t record_size;
+  const char *ptr;
+
+  if (size < sizeof (entry))
+    return (-1);
+  memcpy (&entry, data, sizeof (entry));
+
+  if (entry.name_len == 0)
+    return (0);
+
+  history_num = ((size_t) entry.history_length) * entry.values_num;
+  record_size = sizeof (entry) + entry.name_len
+    + (entry.values_num * (sizeof (value_t) + sizeof (gauge_t)))
+    + (history_num * sizeof (gauge_t))
+    + entry.meta_size;
+  if ((record_size > size)
+      || (entry.name_len > sizeof (ce->name))
+      || (entry.values_num < 1)
+      || (entry.values_num > 0xffff)
+      || ((entry.history_length > 0)
+        && (entry.history_index >= entry.history_length)))
+    return (-1);
+
+  name = data + sizeof (entry);
+  if (name[entry.name_len - 1] != 0)
+    return (-1);
+
+  /* Skip entries whose data set has been changed or removed since the
+   * checkpoint was written. The type is the third part of the identifier. */
+  {
+    char buffer[6 * DATA_MAX_NAME_LEN];
+    char *host, *plugin, *plugin_instance, *type_ptr, *type_instance;
+
+    sstrncpy (buffer, name, sizeof (buffer));
+    if (parse_identifier (buffer, &host, &plugin, &plugin_instance,
+          &type_ptr, &type_instance) != 0)
+      return ((ssize_t) record_size);
+    sstrncpy (type, type_ptr, sizeof (type));
+  }
+
+  ds = plugin_get_ds (type);
+  if ((ds == NULL) || ((uint32_t) ds->ds_num != entry.values_num))
+  {
+    DEBUG ("uc_checkpoint_read: Skipping \"%s\": Data set has changed.",
+        name);
+    return ((ssize_t) record_size);
+  }
+
+  if (c_avl_get (cache_tree, name, NULL) == 0)
+    return ((ssize_t) record_size);
+
+  ce = cache_alloc ((int) entry.values_num);
+  if (ce == NULL)
+    return (-1);
+
+  ptr = name + entry.name_len;
+  sstrncpy (ce->name, name, sizeof (ce->name));
+  memcpy (ce->values_raw, ptr, entry.values_num * sizeof (value_t));
+  ptr += entry.values_num * sizeof (value_t);
+  memcpy (ce->values_gauge, ptr, entry.values_num * sizeof (gauge_t));
+  ptr += entry.values_num * sizeof (gauge_t);
+
+  if (history_num > 0)
+  {
+    ce->history = malloc (history_num * sizeof (*ce->history));
+    if (ce->history == NULL)
+    {
+      cache_free (ce);
+      return (-1);
+    }
+    memcpy (ce->history, ptr, history_num * sizeof (*ce->history));
+    ce->history_length = entry.history_length;
+    ce->history_index = entry.history_index;
+  }
+  ptr += history_num * sizeof (gauge_t);
+
+  if (entry.meta_size > 0)
+    ce->meta = uc_checkpoint_read_meta (ptr, entry.meta_size);
+
+  ce->last_time = (cdtime_t) entry.last_time;
+  ce->interval = (cdtime_t) entry.interval;
+  ce->state = (int) entry.state;
+  ce->hits = (int) entry.hits;
+  /* Give the value the usual time to show up again before it is considered
+   * missing. */
+  ce->last_update = now;
+
+  key = strdup (ce->name);
+  if ((key == NULL) || (c_avl_insert (cache_tree, key, ce) != 0))
+  {
+    sfree (key);
+    cache_free (ce);
+    return (-1);
+  }
+
+  (*entries_num)++;
+  return ((ssize_t) record_size);
+} /* }}} ssize_t uc_checkpoint_read_entry */
+
+int uc_checkpoint_read (const char *file) /* {{{ */
+{
+  uc_checkpoint_header_t header;
+  struct stat statbuf;
+  char errbuf[1024];
+  const char *map;
+  size_t map_size;
+  size_t pos;
+  size_t entries_num = 0;
+  cdtime_t start;
+  cdtime_t now;
+  int fd;
+  int status = -1;
+
+  if (file == NULL)
+    return (EINVAL);
+
+  start = cdtime ();
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+  {
+    if (errno == ENOENT)
+    {
+      INFO ("uc_checkpoint_read: \"%s\" does not exist. "
+          "Starting with an empty cache.", file);
+      return (0);
+    }
+    ERROR ("uc_checkpoint_read: open (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    ERROR ("uc_checkpoint_read: fstat (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+
+  map_size = (size_t) statbuf.st_size;
+  if (map_size < sizeof (header))
+  {
+    ERROR ("uc_checkpoint_read: \"%s\" is too small.", file);
+    close (fd);
+    return (-1);
+  }
+
+  map = mmap (/* addr = */ NULL, map_size, PROT_READ, MAP_PRIVATE,
+      fd, /* offset = */ 0);
+  if (map == MAP_FAILED)
+  {
+    ERROR ("uc_checkpoint_read: mmap (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+  close (fd);
+
+#if defined(MADV_SEQUENTIAL)
+  madvise ((void *) map, map_size, MADV_SEQUENTIAL);
+#endif
+
+  memcpy (&header, map, sizeof (header));
+  if ((memcmp (header.magic, UC_CHECKPOINT_MAGIC,
+          sizeof (UC_CHECKPOINT_MAGIC)) != 0)
+      || (header.version != UC_CHECKPOINT_VERSION)
+      || (header.value_size != sizeof (value_t)))
+  {
+    ERROR ("uc_checkpoint_read: \"%s\" is not a cache checkpoint written "
+        "by this version of collectd.", file);
+    munmap ((void *) map, map_size);
+    return (-1);
+  }
+
+  now = cdtime ();
+  pos = sizeof (header);
+
+  pthread_mutex_lock (&cache_lock);
+  while (pos < map_size)
+  {
+    ssize_t size;
+
+    size = uc_checkpoint_read_entry (map + pos, map_size - pos,
+        now, &entries_num);
+    if (size < 0)
+      break;
+    else if (size == 0)
+    {
+      status = 0;
+      break;
+    }
+    pos += (size_t) size;
+  }
+  pthread_mutex_unlock (&cache_lock);
+
+  munmap ((void *) map, map_size);
+
+  if (status != 0)
+  {
+    /* Keep what has been restored so far. */
+    WARNING ("uc_checkpoint_read: \"%s\" is truncated or corrupt. "
+        "Restored %zu entries.", file, entries_num);
+    return (-1);
+  }
+
+  INFO ("uc_checkpoint_read: Restored %zu entries from \"%s\" "
+      "in %.3f seconds.", entries_num, file,
+      CDTIME_T_TO_DOUBLE (cdtime () - start));
+  return (0);
+} /* }}} int uc_checkpoint_read */
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -35,8 +35,45 @@ int uc_update (const data_set_t *ds, const value_list_t *vl);
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
 
+/*
+ * The rate calculation used by `uc_update', for plugins which keep their own
+ * per-series state. `uc_calculate_rates' calculates the rates of `vl' from the
+ * raw values of the previous update, `values_raw' received at `last_time',
+ * into `ret_rates' and stores the raw values of `vl' in `values_raw'.
+ * `uc_check_range' sets rates outside of the data sources' range to NAN.
+ */
+int uc_calculate_rates (const data_set_t *ds, const value_list_t *vl,
+    value_t *values_raw, cdtime_t last_time, gauge_t *ret_rates);
+void uc_check_range (const data_set_t *ds, gauge_t *rates);
+
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * Cursor based iteration over the cache. Names are copied in chunks, and the
+ * cache lock is released between chunks, so that iterating over a large cache
+ * neither blocks writers for long nor requires a copy of all names. Only
+ * names starting with `prefix' and matching the shell wildcard `pattern' are
+ * returned; both may be NULL. The name returned by `uc_iterator_next' is valid
+ * until the next call to `uc_iterator_next' or `uc_iterator_destroy'.
+ * `uc_iterator_seek' continues the iteration after `name', which allows to
+ * resume a listing from the last name seen.
+ */
+struct uc_iter_s;
+typedef struct uc_iter_s uc_iter_t;
+
+uc_iter_t *uc_get_iterator (const char *prefix, const char *pattern);
+int uc_iterator_next (uc_iter_t *iter, char **ret_name, cdtime_t *ret_time);
+int uc_iterator_seek (uc_iter_t *iter, const char *name);
+void uc_iterator_destroy (uc_iter_t *iter);
+
+/*
+ * Writes the contents of the cache to `file' and restores them from it, so
+ * that rates, states and history survive a restart of the daemon. Reading a
+ * file which does not exist is not an error.
+ */
+int uc_checkpoint_write (const char *file);
+int uc_checkpoint_read (const char *file);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
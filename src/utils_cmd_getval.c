@@ -34,10 +34,13 @@
     return -1; \
   }
 
-int handle_getval (FILE *fh, char *buffer)
+/* Looks up `identifier' in the cache. Upon success, `*ret_ds' and `*ret_values'
+ * are set and zero is returned. Otherwise, an error message suitable for the
+ * status line is stored in `errbuf'. */
+static int getval_lookup (const char *identifier, /* {{{ */
+    const data_set_t **ret_ds, gauge_t **ret_values,
+    char *errbuf, size_t errbuf_size)
 {
-  char *command;
-  char *identifier;
   char *identifier_copy;
 
   char *hostname;
@@ -50,44 +53,7 @@ int handle_getval (FILE *fh, char *buffer)
 
   const data_set_t *ds;
 
-  int   status;
-  size_t i;
-
-  if ((fh == NULL) || (buffer == NULL))
-    return (-1);
-
-  DEBUG ("utils_cmd_getval: handle_getval (fh = %p, buffer = %s);",
-      (void *) fh, buffer);
-
-  command = NULL;
-  status = parse_string (&buffer, &command);
-  if (status != 0)
-  {
-    print_to_socket (fh, "-1 Cannot parse command.\n");
-    return (-1);
-  }
-  assert (command != NULL);
-
-  if (strcasecmp ("GETVAL", command) != 0)
-  {
-    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
-    return (-1);
-  }
-
-  identifier = NULL;
-  status = parse_string (&buffer, &identifier);
-  if (status != 0)
-  {
-    print_to_socket (fh, "-1 Cannot parse identifier.\n");
-    return (-1);
-  }
-  assert (identifier != NULL);
-
-  if (*buffer != 0)
-  {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    return (-1);
-  }
+  int status;
 
   /* parse_identifier() modifies its first argument,
    * returning pointers into it */
@@ -99,7 +65,8 @@ int handle_getval (FILE *fh, char *buffer)
   if (status != 0)
   {
     DEBUG ("handle_getval: Cannot parse identifier `%s'.", identifier);
-    print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n", identifier);
+    ssnprintf (errbuf, errbuf_size, "Cannot parse identifier `%s'.",
+        identifier);
     sfree (identifier_copy);
     return (-1);
   }
@@ -108,7 +75,7 @@ int handle_getval (FILE *fh, char *buffer)
   if (ds == NULL)
   {
     DEBUG ("handle_getval: plugin_get_ds (%s) == NULL;", type);
-    print_to_socket (fh, "-1 Type `%s' is unknown.\n", type);
+    ssnprintf (errbuf, errbuf_size, "Type `%s' is unknown.", type);
     sfree (identifier_copy);
     return (-1);
   }
@@ -118,7 +85,7 @@ int handle_getval (FILE *fh, char *buffer)
   status = uc_get_rate_by_name (identifier, &values, &values_num);
   if (status != 0)
   {
-    print_to_socket (fh, "-1 No such value\n");
+    sstrncpy (errbuf, "No such value", errbuf_size);
     sfree (identifier_copy);
     return (-1);
   }
@@ -128,31 +95,194 @@ int handle_getval (FILE *fh, char *buffer)
     ERROR ("ds[%s]->ds_num = %i, "
 	"but uc_get_rate_by_name returned %u values.",
 	ds->type, ds->ds_num, (unsigned int) values_num);
-    print_to_socket (fh, "-1 Error reading value from cache.\n");
+    sstrncpy (errbuf, "Error reading value from cache.", errbuf_size);
     sfree (values);
     sfree (identifier_copy);
     return (-1);
   }
 
-  print_to_socket (fh, "%u Value%s found\n", (unsigned int) values_num,
-      (values_num == 1) ? "" : "s");
-  for (i = 0; i < values_num; i++)
+  sfree (identifier_copy);
+
+  *ret_ds = ds;
+  *ret_values = values;
+  return (0);
+} /* }}} int getval_lookup */
+
+static int print_value (FILE *fh, const char *name, gauge_t value, /* {{{ */
+    const char *identifier)
+{
+  print_to_socket (fh, "%s=", name);
+  if (isnan (value))
+  {
+    print_to_socket (fh, "NaN");
+  }
+  else
+  {
+    print_to_socket (fh, "%12e", value);
+  }
+
+  if (identifier != NULL)
+  {
+    print_to_socket (fh, " %s\n", identifier);
+  }
+  else
+  {
+    print_to_socket (fh, "\n");
+  }
+
+  return (0);
+} /* }}} int print_value */
+
+/* GETVAL with more than one identifier: Values of all identifiers are
+ * returned in one response, each line followed by the identifier it belongs
+ * to. Identifiers which are not found are skipped. */
+static int handle_getval_multi (FILE *fh, /* {{{ */
+    char **identifiers, size_t identifiers_num)
+{
+  const data_set_t **ds;
+  gauge_t **values;
+  size_t values_num = 0;
+  size_t i;
+  int j;
+  int status = 0;
+
+  ds = calloc (identifiers_num, sizeof (*ds));
+  values = calloc (identifiers_num, sizeof (*values));
+  if ((ds == NULL) || (values == NULL))
+  {
+    sfree (ds);
+    sfree (values);
+    print_to_socket (fh, "-1 Out of memory.\n");
+    return (-1);
+  }
+
+  for (i = 0; i < identifiers_num; i++)
   {
-    print_to_socket (fh, "%s=", ds->ds[i].name);
-    if (isnan (values[i]))
+    char errbuf[1024];
+
+    if (getval_lookup (identifiers[i], &ds[i], &values[i],
+          errbuf, sizeof (errbuf)) != 0)
+    {
+      DEBUG ("handle_getval: Skipping `%s': %s", identifiers[i], errbuf);
+      ds[i] = NULL;
+      values[i] = NULL;
+      continue;
+    }
+    values_num += (size_t) ds[i]->ds_num;
+  }
+
+  if (fprintf (fh, "%u Value%s found\n", (unsigned int) values_num,
+        (values_num == 1) ? "" : "s") < 0)
+    status = -1;
+
+  for (i = 0; (i < identifiers_num) && (status == 0); i++)
+  {
+    if (values[i] == NULL)
+      continue;
+
+    for (j = 0; (j < ds[i]->ds_num) && (status == 0); j++)
+      status = print_value (fh, ds[i]->ds[j].name, values[i][j],
+          identifiers[i]);
+  }
+
+  for (i = 0; i < identifiers_num; i++)
+    sfree (values[i]);
+  sfree (values);
+  sfree (ds);
+
+  return (status);
+} /* }}} int handle_getval_multi */
+
+int handle_getval (FILE *fh, char *buffer)
+{
+  char *command;
+  char *identifier;
+  char **identifiers = NULL;
+  size_t identifiers_num = 0;
+  char errbuf[1024];
+
+  gauge_t *values;
+  const data_set_t *ds;
+
+  int   status;
+  int i;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  DEBUG ("utils_cmd_getval: handle_getval (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("GETVAL", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    return (-1);
+  }
+
+  do
+  {
+    char **tmp;
+
+    identifier = NULL;
+    status = parse_string (&buffer, &identifier);
+    if (status != 0)
     {
-      print_to_socket (fh, "NaN\n");
+      sfree (identifiers);
+      print_to_socket (fh, "-1 Cannot parse identifier.\n");
+      return (-1);
     }
-    else
+    assert (identifier != NULL);
+
+    tmp = realloc (identifiers, (identifiers_num + 1) * sizeof (*identifiers));
+    if (tmp == NULL)
     {
-      print_to_socket (fh, "%12e\n", values[i]);
+      sfree (identifiers);
+      print_to_socket (fh, "-1 Out of memory.\n");
+      return (-1);
     }
+    identifiers = tmp;
+    identifiers[identifiers_num] = identifier;
+    identifiers_num++;
+  } while (*buffer != 0);
+
+  if (identifiers_num > 1)
+  {
+    status = handle_getval_multi (fh, identifiers, identifiers_num);
+    sfree (identifiers);
+    return (status);
   }
 
+  identifier = identifiers[0];
+  sfree (identifiers);
+
+  ds = NULL;
+  values = NULL;
+  status = getval_lookup (identifier, &ds, &values, errbuf, sizeof (errbuf));
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 %s\n", errbuf);
+    return (-1);
+  }
+
+  if (fprintf (fh, "%u Value%s found\n", (unsigned int) ds->ds_num,
+        (ds->ds_num == 1) ? "" : "s") < 0)
+    status = -1;
+
+  for (i = 0; (i < ds->ds_num) && (status == 0); i++)
+    status = print_value (fh, ds->ds[i].name, values[i], /* identifier = */ NULL);
+
   sfree (values);
-  sfree (identifier_copy);
 
-  return (0);
+  return (status);
 } /* int handle_getval */
 
 /* vim: set sw=2 sts=2 ts=8 : */
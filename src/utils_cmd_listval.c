@@ -35,6 +35,7 @@
     } \
     sfree(names); \
     sfree(times); \
+    uc_iterator_destroy (iter); \
     return (status); \
   } while (0)
 
@@ -46,15 +47,56 @@
     free_everything_and_return (-1); \
   }
 
+static int add_to_list (char ***names, cdtime_t **times, size_t *number, /* {{{ */
+    size_t *size, const char *name, cdtime_t time)
+{
+  if (*number >= *size)
+  {
+    size_t new_size = (*size == 0) ? 64 : (2 * *size);
+    char **new_names;
+    cdtime_t *new_times;
+
+    new_names = realloc (*names, new_size * sizeof (*new_names));
+    if (new_names == NULL)
+      return (-1);
+    *names = new_names;
+
+    new_times = realloc (*times, new_size * sizeof (*new_times));
+    if (new_times == NULL)
+      return (-1);
+    *times = new_times;
+
+    *size = new_size;
+  }
+
+  (*names)[*number] = strdup (name);
+  if ((*names)[*number] == NULL)
+    return (-1);
+  (*times)[*number] = time;
+  (*number)++;
+
+  return (0);
+} /* }}} int add_to_list */
+
 int handle_listval (FILE *fh, char *buffer)
 {
   char *command;
   char **names = NULL;
   cdtime_t *times = NULL;
   size_t number = 0;
+  size_t size = 0;
   size_t i;
   int status;
 
+  uc_iter_t *iter = NULL;
+  char *prefix = NULL;
+  char *pattern = NULL;
+  char *after = NULL;
+  size_t limit = 0;
+
+  char *name;
+  cdtime_t time;
+
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
       (void *) fh, buffer);
 
@@ -73,20 +115,77 @@ int handle_listval (FILE *fh, char *buffer)
     free_everything_and_return (-1);
   }
 
-  if (*buffer != 0)
+  while (*buffer != 0)
   {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    free_everything_and_return (-1);
+    char *opt_key;
+    char *opt_value;
+
+    opt_key = NULL;
+    opt_value = NULL;
+    status = parse_option (&buffer, &opt_key, &opt_value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+      free_everything_and_return (-1);
+    }
+
+    if (strcasecmp ("prefix", opt_key) == 0)
+      prefix = opt_value;
+    else if (strcasecmp ("pattern", opt_key) == 0)
+      pattern = opt_value;
+    else if (strcasecmp ("after", opt_key) == 0)
+      after = opt_value;
+    else if (strcasecmp ("limit", opt_key) == 0)
+    {
+      char *endptr = NULL;
+      long tmp;
+
+      errno = 0;
+      tmp = strtol (opt_value, &endptr, 0);
+      if ((endptr == opt_value) || (*endptr != 0) || (errno != 0)
+          || (tmp < 0))
+      {
+        print_to_socket (fh, "-1 Invalid value for option `limit': %s\n",
+            opt_value);
+        free_everything_and_return (-1);
+      }
+      limit = (size_t) tmp;
+    }
+    else
+    {
+      print_to_socket (fh, "-1 Unknown option: %s\n", opt_key);
+      free_everything_and_return (-1);
+    }
   }
 
-  status = uc_get_names (&names, &times, &number);
-  if (status != 0)
+  iter = uc_get_iterator (prefix, pattern);
+  if (iter == NULL)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
+    DEBUG ("command listval: uc_get_iterator failed.");
+    print_to_socket (fh, "-1 uc_get_iterator failed.\n");
     free_everything_and_return (-1);
   }
 
+  if (after != NULL)
+    uc_iterator_seek (iter, after);
+
+  /* The status line announces the number of values, so the names have to be
+   * collected before printing anything. Clients can bound this by passing
+   * `limit' and page through the cache by passing the last identifier as
+   * `after'. A limit of zero, the default, returns all identifiers. */
+  while ((limit == 0) || (number < limit))
+  {
+    if (uc_iterator_next (iter, &name, &time) != 0)
+      break;
+
+    if (add_to_list (&names, &times, &number, &size, name, time) != 0)
+    {
+      ERROR ("handle_listval: add_to_list failed.");
+      print_to_socket (fh, "-1 Out of memory.\n");
+      free_everything_and_return (-1);
+    }
+  }
+
   print_to_socket (fh, "%i Value%s found\n",
       (int) number, (number == 1) ? "" : "s");
   for (i = 0; i < number; i++)
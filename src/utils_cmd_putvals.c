@@ -0,0 +1,559 @@
+/**
+ * collectd - src/utils_cmd_putvals.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_avltree.h"
+#include "utils_cmd_putvals.h"
+#include "utils_parse_option.h"
+
+/* Number of value lists passed to plugin_dispatch_values_batch at once. */
+#define PUTVALS_BATCH_SIZE 256
+
+/* Maximum number of identifiers remembered per block. */
+#define PUTVALS_CACHE_SIZE 4096
+
+#define print_to_socket(fh, ...) \
+	if (fprintf (fh, __VA_ARGS__) < 0) { \
+		char errbuf[1024]; \
+		WARNING ("cmd_putvals: failed to write to socket #%i: %s", \
+				fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+		return -1; \
+	}
+
+/* Time and interval of one value list of the line being parsed. */
+struct putvals_pending_s
+{
+	cdtime_t time;
+	cdtime_t interval;
+};
+typedef struct putvals_pending_s putvals_pending_t;
+
+/* A resolved identifier: the value list has all names filled in and points
+ * to no values. */
+struct putvals_ident_s
+{
+	char identifier[6 * DATA_MAX_NAME_LEN];
+	value_list_t vl;
+	const data_set_t *ds;
+};
+typedef struct putvals_ident_s putvals_ident_t;
+
+struct cmd_putvals_s
+{
+	/* Default interval of the block, zero if not set. */
+	cdtime_t interval;
+
+	c_avl_tree_t *cache;
+	int cache_num;
+	putvals_ident_t *last;
+	/* Used when the cache is full. */
+	putvals_ident_t scratch;
+
+	/* Value lists not yet dispatched. The values are stored in one array,
+	 * the value lists' pointers are set right before dispatching because
+	 * the array may be moved by realloc. */
+	value_list_t vl[PUTVALS_BATCH_SIZE];
+	size_t values_offset[PUTVALS_BATCH_SIZE];
+	size_t vl_num;
+	value_t *values;
+	size_t values_num;
+	size_t values_size;
+
+	/* Value lists of the line being parsed. They are only added to the
+	 * batch above once the whole line has been parsed, so a line is either
+	 * dispatched completely or not at all. */
+	putvals_pending_t *pending;
+	size_t pending_size;
+	value_t *pending_values;
+	size_t pending_values_size;
+
+	int lines_num;
+	int lines_failed;
+	int values_dispatched;
+	int values_failed;
+	int error_line;
+	char error[256];
+};
+
+static void putvals_error (cmd_putvals_t *b, /* {{{ */
+		const char *format, ...)
+{
+	va_list ap;
+
+	b->lines_failed++;
+	if (b->error_line > 0)
+		return;
+
+	b->error_line = b->lines_num;
+
+	va_start (ap, format);
+	vsnprintf (b->error, sizeof (b->error), format, ap);
+	b->error[sizeof (b->error) - 1] = 0;
+	va_end (ap);
+} /* }}} void putvals_error */
+
+static int putvals_parse_interval (const char *value, /* {{{ */
+		cdtime_t *ret_interval)
+{
+	double tmp;
+	char *endptr;
+
+	endptr = NULL;
+	errno = 0;
+	tmp = strtod (value, &endptr);
+
+	if ((errno != 0) || (endptr == NULL)
+			|| (endptr == value) || (tmp <= 0.0))
+		return (-1);
+
+	*ret_interval = DOUBLE_TO_CDTIME_T (tmp);
+	return (0);
+} /* }}} int putvals_parse_interval */
+
+/* Resolves "identifier" to host, plugin, ... and the data set. Only
+ * identifiers not seen before in this block are actually parsed. */
+static putvals_ident_t *putvals_lookup (cmd_putvals_t *b, /* {{{ */
+		const char *identifier)
+{
+	putvals_ident_t *id;
+	char *hostname;
+	char *plugin;
+	char *plugin_instance;
+	char *type;
+	char *type_instance;
+	char buffer[6 * DATA_MAX_NAME_LEN];
+	value_list_t vl = VALUE_LIST_INIT;
+	int status;
+
+	if ((b->last != NULL) && (strcmp (b->last->identifier, identifier) == 0))
+		return (b->last);
+
+	if (c_avl_get (b->cache, identifier, (void *) &id) == 0)
+	{
+		b->last = id;
+		return (id);
+	}
+
+	if (strlen (identifier) >= sizeof (buffer))
+	{
+		putvals_error (b, "Identifier too long.");
+		return (NULL);
+	}
+	sstrncpy (buffer, identifier, sizeof (buffer));
+
+	status = parse_identifier (buffer, &hostname,
+			&plugin, &plugin_instance,
+			&type, &type_instance);
+	if (status != 0)
+	{
+		putvals_error (b, "Cannot parse identifier `%s'.", identifier);
+		return (NULL);
+	}
+
+	if ((strlen (hostname) >= sizeof (vl.host))
+			|| (strlen (plugin) >= sizeof (vl.plugin))
+			|| (strlen (type) >= sizeof (vl.type))
+			|| ((plugin_instance != NULL)
+				&& (strlen (plugin_instance) >= sizeof (vl.plugin_instance)))
+			|| ((type_instance != NULL)
+				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
+	{
+		putvals_error (b, "Identifier too long.");
+		return (NULL);
+	}
+
+	sstrncpy (vl.host, hostname, sizeof (vl.host));
+	sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
+	sstrncpy (vl.type, type, sizeof (vl.type));
+	if (plugin_instance != NULL)
+		sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
+	if (type_instance != NULL)
+		sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+	if (b->cache_num < PUTVALS_CACHE_SIZE)
+	{
+		id = malloc (sizeof (*id));
+		if (id == NULL)
+		{
+			putvals_error (b, "malloc failed.");
+			return (NULL);
+		}
+	}
+	else
+	{
+		id = &b->scratch;
+	}
+
+	sstrncpy (id->identifier, identifier, sizeof (id->identifier));
+	memcpy (&id->vl, &vl, sizeof (id->vl));
+	id->vl.values = NULL;
+	id->vl.values_len = 0;
+	id->ds = plugin_get_ds (vl.type);
+
+	if (id != &b->scratch)
+	{
+		/* Identifiers with an unknown type are cached, too, so the type
+		 * is not looked up again. */
+		status = c_avl_insert (b->cache, id->identifier, id);
+		if (status != 0)
+		{
+			sfree (id);
+			putvals_error (b, "c_avl_insert failed.");
+			return (NULL);
+		}
+		b->cache_num++;
+	}
+
+	b->last = id;
+	return (id);
+} /* }}} putvals_ident_t *putvals_lookup */
+
+static int putvals_dispatch (cmd_putvals_t *b) /* {{{ */
+{
+	size_t i;
+	int status;
+
+	if (b->vl_num == 0)
+		return (0);
+
+	for (i = 0; i < b->vl_num; i++)
+		b->vl[i].values = b->values + b->values_offset[i];
+
+	status = plugin_dispatch_values_batch (b->vl, b->vl_num);
+	if (status == 0)
+	{
+		b->values_dispatched += (int) b->vl_num;
+	}
+	else
+	{
+		b->values_failed += (int) b->vl_num;
+		if (b->error_line == 0)
+		{
+			b->error_line = b->lines_num;
+			ssnprintf (b->error, sizeof (b->error),
+					"Dispatching %zu values failed.", b->vl_num);
+		}
+	}
+
+	b->vl_num = 0;
+	b->values_num = 0;
+
+	return (status);
+} /* }}} int putvals_dispatch */
+
+/* Makes sure "values_len" more values fit into the batch. */
+static int putvals_grow (cmd_putvals_t *b, size_t values_len) /* {{{ */
+{
+	size_t new_size;
+	value_t *tmp;
+
+	if ((b->values_num + values_len) <= b->values_size)
+		return (0);
+
+	new_size = (b->values_size > 0) ? b->values_size : 256;
+	while (new_size < (b->values_num + values_len))
+		new_size *= 2;
+
+	tmp = realloc (b->values, new_size * sizeof (*tmp));
+	if (tmp == NULL)
+		return (-1);
+	b->values = tmp;
+	b->values_size = new_size;
+
+	return (0);
+} /* }}} int putvals_grow */
+
+/* Reserves room for one more value list with "values_len" values. */
+static value_list_t *putvals_reserve (cmd_putvals_t *b, /* {{{ */
+		size_t values_len)
+{
+	value_list_t *vl;
+
+	/* Failures are recorded in "b" and reported by cmd_putvals_finish. */
+	if (b->vl_num >= PUTVALS_BATCH_SIZE)
+		putvals_dispatch (b);
+
+	if (putvals_grow (b, values_len) != 0)
+		return (NULL);
+
+	vl = &b->vl[b->vl_num];
+	vl->values = b->values + b->values_num;
+	vl->values_len = (int) values_len;
+
+	return (vl);
+} /* }}} value_list_t *putvals_reserve */
+
+/* Makes room for "num" value lists with "values_len" values each in the
+ * line being parsed. */
+static int putvals_pending_grow (cmd_putvals_t *b, /* {{{ */
+		size_t num, size_t values_len)
+{
+	if (num > b->pending_size)
+	{
+		size_t new_size = (b->pending_size > 0) ? (2 * b->pending_size) : 16;
+		putvals_pending_t *tmp;
+
+		while (new_size < num)
+			new_size *= 2;
+
+		tmp = realloc (b->pending, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (-1);
+		b->pending = tmp;
+		b->pending_size = new_size;
+	}
+
+	if ((num * values_len) > b->pending_values_size)
+	{
+		size_t new_size = (b->pending_values_size > 0)
+			? (2 * b->pending_values_size) : 256;
+		value_t *tmp;
+
+		while (new_size < (num * values_len))
+			new_size *= 2;
+
+		tmp = realloc (b->pending_values, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (-1);
+		b->pending_values = tmp;
+		b->pending_values_size = new_size;
+	}
+
+	return (0);
+} /* }}} int putvals_pending_grow */
+
+int cmd_putvals_add (cmd_putvals_t *b, char *buffer) /* {{{ */
+{
+	char *identifier = NULL;
+	putvals_ident_t *id;
+	cdtime_t interval;
+	value_list_t tmp_vl = VALUE_LIST_INIT;
+	size_t values_len;
+	size_t pending_num = 0;
+	size_t i;
+	int status;
+
+	b->lines_num++;
+
+	status = parse_string (&buffer, &identifier);
+	if (status != 0)
+	{
+		putvals_error (b, "Cannot parse identifier.");
+		return (-1);
+	}
+
+	/* Be lenient and accept complete PUTVAL commands, too. */
+	if (strcasecmp ("PUTVAL", identifier) == 0)
+	{
+		status = parse_string (&buffer, &identifier);
+		if (status != 0)
+		{
+			putvals_error (b, "Cannot parse identifier.");
+			return (-1);
+		}
+	}
+
+	id = putvals_lookup (b, identifier);
+	if (id == NULL)
+		return (-1);
+
+	if (id->ds == NULL)
+	{
+		putvals_error (b, "Type `%s' isn't defined.", id->vl.type);
+		return (-1);
+	}
+	values_len = (size_t) id->ds->ds_num;
+
+	interval = b->interval;
+
+	/* Parse the whole line before adding anything to the batch. */
+	while (*buffer != 0)
+	{
+		char *key = NULL;
+		char *value = NULL;
+
+		status = parse_option (&buffer, &key, &value);
+		if (status < 0)
+		{
+			putvals_error (b, "Misformatted option.");
+			return (-1);
+		}
+		else if (status == 0)
+		{
+			if (strcasecmp ("interval", key) == 0)
+				putvals_parse_interval (value, &interval);
+			continue;
+		}
+
+		status = parse_string (&buffer, &value);
+		if (status != 0)
+		{
+			putvals_error (b, "Misformatted value.");
+			return (-1);
+		}
+
+		if (putvals_pending_grow (b, pending_num + 1, values_len) != 0)
+		{
+			putvals_error (b, "realloc failed.");
+			return (-1);
+		}
+
+		tmp_vl.values = b->pending_values + (pending_num * values_len);
+		tmp_vl.values_len = (int) values_len;
+		tmp_vl.time = 0;
+
+		status = parse_values (value, &tmp_vl, id->ds);
+		if (status != 0)
+		{
+			putvals_error (b, "Parsing the values string failed.");
+			return (-1);
+		}
+
+		b->pending[pending_num].time = tmp_vl.time;
+		b->pending[pending_num].interval = interval;
+		pending_num++;
+	}
+
+	/* Dispatching only ever frees room, so once the values of the whole line
+	 * fit, putvals_reserve cannot fail below. */
+	if (putvals_grow (b, pending_num * values_len) != 0)
+	{
+		putvals_error (b, "realloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < pending_num; i++)
+	{
+		value_list_t *vl;
+
+		vl = putvals_reserve (b, values_len);
+		assert (vl != NULL);
+
+		memcpy (vl->values, b->pending_values + (i * values_len),
+				values_len * sizeof (*vl->values));
+		vl->time = b->pending[i].time;
+		vl->interval = b->pending[i].interval;
+		vl->meta = NULL;
+		sstrncpy (vl->host, id->vl.host, sizeof (vl->host));
+		sstrncpy (vl->plugin, id->vl.plugin, sizeof (vl->plugin));
+		sstrncpy (vl->plugin_instance, id->vl.plugin_instance,
+				sizeof (vl->plugin_instance));
+		sstrncpy (vl->type, id->vl.type, sizeof (vl->type));
+		sstrncpy (vl->type_instance, id->vl.type_instance,
+				sizeof (vl->type_instance));
+
+		b->values_offset[b->vl_num] = b->values_num;
+		b->values_num += values_len;
+		b->vl_num++;
+	}
+
+	return (0);
+} /* }}} int cmd_putvals_add */
+
+int cmd_putvals_finish (cmd_putvals_t *b, FILE *fh) /* {{{ */
+{
+	putvals_dispatch (b);
+
+	if ((b->lines_failed > 0) || (b->values_failed > 0))
+	{
+		print_to_socket (fh, "-1 %i of %i lines failed, %i values could "
+				"not be dispatched, first error in line %i: %s\n",
+				b->lines_failed, b->lines_num, b->values_failed,
+				b->error_line, b->error);
+		return (-1);
+	}
+
+	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+			b->values_dispatched,
+			(b->values_dispatched == 1) ? "value has" : "values have");
+
+	return (0);
+} /* }}} int cmd_putvals_finish */
+
+cmd_putvals_t *cmd_putvals_create (FILE *fh, char *buffer) /* {{{ */
+{
+	cmd_putvals_t *b;
+	char *command = NULL;
+	int status;
+
+	status = parse_string (&buffer, &command);
+	if ((status != 0) || (strcasecmp ("PUTVALS", command) != 0))
+	{
+		fprintf (fh, "-1 Cannot parse command.\n");
+		return (NULL);
+	}
+
+	b = malloc (sizeof (*b));
+	if (b == NULL)
+	{
+		fprintf (fh, "-1 malloc failed.\n");
+		return (NULL);
+	}
+	memset (b, 0, sizeof (*b));
+
+	while (*buffer != 0)
+	{
+		char *key = NULL;
+		char *value = NULL;
+
+		status = parse_option (&buffer, &key, &value);
+		if (status != 0)
+		{
+			fprintf (fh, "-1 Misformatted option.\n");
+			sfree (b);
+			return (NULL);
+		}
+
+		if (strcasecmp ("interval", key) == 0)
+			putvals_parse_interval (value, &b->interval);
+	}
+
+	b->cache = c_avl_create ((void *) strcmp);
+	if (b->cache == NULL)
+	{
+		fprintf (fh, "-1 c_avl_create failed.\n");
+		sfree (b);
+		return (NULL);
+	}
+
+	return (b);
+} /* }}} cmd_putvals_t *cmd_putvals_create */
+
+void cmd_putvals_destroy (cmd_putvals_t *b) /* {{{ */
+{
+	char *key;
+	putvals_ident_t *id;
+
+	if (b == NULL)
+		return;
+
+	while (c_avl_pick (b->cache, (void *) &key, (void *) &id) == 0)
+		sfree (id);
+	c_avl_destroy (b->cache);
+
+	sfree (b->values);
+	sfree (b->pending);
+	sfree (b->pending_values);
+	sfree (b);
+} /* }}} void cmd_putvals_destroy */
@@ -0,0 +1,58 @@
+/**
+ * collectd - src/utils_cmd_putvals.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_CMD_PUTVALS_H
+#define UTILS_CMD_PUTVALS_H 1
+
+#include <stdio.h>
+
+#include "plugin.h"
+
+/*
+ * The PUTVALS command starts a block of value lines, which is terminated by
+ * an empty line:
+ *
+ *   PUTVALS [interval=<seconds>]
+ *   <identifier> [interval=<seconds>] <values> [<values> ...]
+ *   ...
+ *   <empty line>
+ *
+ * The lines use the same syntax as the arguments of PUTVAL. Identifiers and
+ * data sets are resolved once per block and the value lists are dispatched
+ * in batches. A single status line is printed when the block ends.
+ */
+struct cmd_putvals_s;
+typedef struct cmd_putvals_s cmd_putvals_t;
+
+/* Parses the "PUTVALS" line. Prints an error to "fh" and returns NULL on
+ * failure. */
+cmd_putvals_t *cmd_putvals_create (FILE *fh, char *buffer);
+
+/* Parses one line of the block. Errors are remembered and reported by
+ * cmd_putvals_finish. Returns zero on success. */
+int cmd_putvals_add (cmd_putvals_t *b, char *buffer);
+
+/* Dispatches the remaining values and prints the status line to "fh". */
+int cmd_putvals_finish (cmd_putvals_t *b, FILE *fh);
+
+void cmd_putvals_destroy (cmd_putvals_t *b);
+
+#endif /* UTILS_CMD_PUTVALS_H */
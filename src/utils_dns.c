@@ -158,10 +158,6 @@ typedef int (printer)(const char *, ...);
 /*
  * Global variables
  */
-int qtype_counts[T_MAX];
-int opcode_counts[OP_MAX];
-int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 static pcap_t *pcap_obj = NULL;
 #endif
@@ -287,14 +283,15 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *))
 }
 
 #define RFC1035_MAXLABELSZ 63
+/* "loop_detect" is the recursion depth, so this can be called from several
+ * threads at once. */
 static int
-rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
-)
+rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns,
+	int loop_detect)
 {
     off_t no = 0;
     unsigned char c;
     size_t len;
-    static int loop_detect = 0;
     if (loop_detect > 2)
 	return 4;		/* compression loop */
     if (ns <= 0)
@@ -320,9 +317,8 @@ rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
 		return 2;	/* bad compression ptr */
 	    if (ptr < DNS_MSG_HDR_SZ)
 		return 2;	/* bad compression ptr */
-	    loop_detect++;
-	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no);
-	    loop_detect--;
+	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no,
+		    loop_detect + 1);
 	    return rc;
 	} else if (c > RFC1035_MAXLABELSZ) {
 	    /*
@@ -397,7 +393,8 @@ handle_dns(const char *buf, int len)
 
     offset = DNS_MSG_HDR_SZ;
     memset(qh.qname, '\0', MAX_QNAME_SZ);
-    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ);
+    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ,
+	    /* loop_detect = */ 0);
     if (status != 0)
     {
 	INFO ("utils_dns: handle_dns: rfc1035NameUnpack failed "
@@ -420,11 +417,6 @@ handle_dns(const char *buf, int len)
 
     qh.length = (uint16_t) len;
 
-    /* gather stats */
-    qtype_counts[qh.qtype]++;
-    qclass_counts[qh.qclass]++;
-    opcode_counts[qh.opcode]++;
-
     if (Callback != NULL)
 	    Callback (&qh);
 
@@ -721,6 +713,21 @@ void handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr, const u_char *pkt
     query_count_total++;
     last_ts = hdr->ts;
 }
+
+/* public function */
+int handle_ip_packet (const u_char *pkt, int len)
+{
+    char buf[PCAP_SNAPLEN];
+
+    if (len > PCAP_SNAPLEN)
+	len = PCAP_SNAPLEN;
+    if (len < (int) sizeof (struct ip))
+	return (0);
+
+    /* Copy the packet, so the header fields are properly aligned. */
+    memcpy (buf, pkt, len);
+    return (handle_ip ((struct ip *) buf, len));
+}
 #endif /* HAVE_PCAP_H */
 
 const char *qtype_str(int t)
@@ -46,6 +46,7 @@
 
 #define T_MAX 65536
 #define OP_MAX 16
+#define RC_MAX 16
 #define C_MAX 65536
 #define MAX_QNAME_SZ 512
 
@@ -72,10 +73,6 @@ struct rfc1035_header_s {
 };
 typedef struct rfc1035_header_s rfc1035_header_t;
 
-extern int qtype_counts[T_MAX];
-extern int opcode_counts[OP_MAX];
-extern int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 void dnstop_set_pcap_obj (pcap_t *po);
 #endif
@@ -84,6 +81,10 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *));
 void ignore_list_add_name (const char *name);
 #if HAVE_PCAP_H
 void handle_pcap (u_char * udata, const struct pcap_pkthdr *hdr, const u_char * pkt);
+/* Parses an IPv4 or IPv6 packet without link layer header, e.g. one received
+ * from a packet socket of type SOCK_DGRAM. Safe to call from several threads
+ * at once. */
+int handle_ip_packet (const u_char *pkt, int len);
 #endif
 
 const char *qtype_str(int t);
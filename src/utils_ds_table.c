@@ -0,0 +1,335 @@
+/**
+ * collectd - src/utils_ds_table.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_ds_table.h"
+
+/* Slots are addressed with 16 bits, see ds_table_slot(). */
+#define DS_TABLE_SLOTS_MAX 65536
+
+/* Number of hash seeds tried before the table is enlarged. */
+#define DS_TABLE_SEEDS 16
+
+/* Number of multipliers (d0, see below) tried for each bucket. */
+#define DS_TABLE_TRIES 64
+
+/*
+ * The perfect hash function: The 64 bit hash of a type name selects a bucket
+ * and provides two values, f1 and f2. Each bucket has a displacement (d0, d1)
+ * which was chosen so that (f1 + d0 * f2 + d1) maps all names in the bucket to
+ * distinct, unused slots. Buckets are placed in order of decreasing size, so
+ * the large buckets are placed while the table is still mostly empty.
+ */
+struct ds_table_s
+{
+	uint64_t seed;
+	uint32_t slots_mask;
+	uint32_t buckets_mask;
+	uint32_t *displacements;
+	data_set_t const **slots;
+};
+
+static uint64_t ds_table_hash (char const *type, uint64_t seed) /* {{{ */
+{
+	/* FNV-1a */
+	uint64_t h = 14695981039346656037ULL ^ seed;
+	unsigned char const *c;
+
+	for (c = (unsigned char const *) type; *c != 0; c++)
+	{
+		h ^= (uint64_t) *c;
+		h *= 1099511628211ULL;
+	}
+
+	/* Mix the bits, so that the bucket and slot depend on all bytes. */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (h);
+} /* }}} uint64_t ds_table_hash */
+
+static uint32_t ds_table_bucket (ds_table_t const *t, uint64_t h) /* {{{ */
+{
+	return (((uint32_t) (h >> 32)) & t->buckets_mask);
+} /* }}} uint32_t ds_table_bucket */
+
+static uint32_t ds_table_slot (ds_table_t const *t, uint64_t h, /* {{{ */
+		uint32_t displacement)
+{
+	uint32_t f1 = (uint32_t) h;
+	/* The bucket uses at most bits 32 to 47. */
+	uint32_t f2 = ((uint32_t) (h >> 48)) | 1;
+	uint32_t d0 = displacement >> 16;
+	uint32_t d1 = displacement & 0xffff;
+
+	return ((f1 + d0 * f2 + d1) & t->slots_mask);
+} /* }}} uint32_t ds_table_slot */
+
+static int ds_compare_type (void const *a, void const *b) /* {{{ */
+{
+	data_set_t const *ds_a = *((data_set_t const * const *) a);
+	data_set_t const *ds_b = *((data_set_t const * const *) b);
+
+	return (strcmp (ds_a->type, ds_b->type));
+} /* }}} int ds_compare_type */
+
+static _Bool ds_types_unique (data_set_t const **ds, size_t ds_num) /* {{{ */
+{
+	data_set_t const **sorted;
+	_Bool unique = 1;
+	size_t i;
+
+	if (ds_num < 2)
+		return (1);
+
+	sorted = malloc (ds_num * sizeof (*sorted));
+	if (sorted == NULL)
+		return (0);
+	memcpy (sorted, ds, ds_num * sizeof (*sorted));
+
+	qsort (sorted, ds_num, sizeof (*sorted), ds_compare_type);
+	for (i = 1; i < ds_num; i++)
+		if (strcmp (sorted[i - 1]->type, sorted[i]->type) == 0)
+			unique = 0;
+
+	free (sorted);
+	return (unique);
+} /* }}} _Bool ds_types_unique */
+
+/* Tries to find displacements for all buckets with the current seed and
+ * size. `hashes' and `order' must have room for `ds_num' elements, `start'
+ * for one more than the number of buckets. Returns zero upon success. */
+static int ds_table_place (ds_table_t *t, /* {{{ */
+		data_set_t const **ds, size_t ds_num,
+		uint64_t *hashes, size_t *order, size_t *start)
+{
+	size_t buckets_num = ((size_t) t->buckets_mask) + 1;
+	size_t slots_num = ((size_t) t->slots_mask) + 1;
+	size_t max_size = 0;
+	size_t size;
+	size_t b;
+	size_t i;
+
+	/* Group the data sets by bucket using a counting sort. */
+	memset (start, 0, (buckets_num + 1) * sizeof (*start));
+	for (i = 0; i < ds_num; i++)
+	{
+		hashes[i] = ds_table_hash (ds[i]->type, t->seed);
+		start[ds_table_bucket (t, hashes[i]) + 1]++;
+	}
+	for (b = 0; b < buckets_num; b++)
+	{
+		if (max_size < start[b + 1])
+			max_size = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	for (i = 0; i < ds_num; i++)
+	{
+		uint32_t bucket = ds_table_bucket (t, hashes[i]);
+		size_t pos;
+
+		/* Find the next unused position of this bucket. Positions are
+		 * filled in order, so the first one holding (size_t) -1 is
+		 * free. */
+		for (pos = start[bucket]; order[pos] != (size_t) -1; pos++)
+			/* do nothing */;
+		order[pos] = i;
+	}
+
+	memset (t->slots, 0, slots_num * sizeof (*t->slots));
+	memset (t->displacements, 0, buckets_num * sizeof (*t->displacements));
+
+	for (size = max_size; size > 0; size--)
+	{
+		for (b = 0; b < buckets_num; b++)
+		{
+			uint32_t tries;
+			_Bool placed = 0;
+
+			if ((start[b + 1] - start[b]) != size)
+				continue;
+
+			for (tries = 0; tries < DS_TABLE_TRIES * slots_num; tries++)
+			{
+				uint32_t displacement = ((tries / slots_num) << 16)
+					| (tries % slots_num);
+				size_t j;
+
+				for (j = start[b]; j < start[b + 1]; j++)
+				{
+					uint32_t slot = ds_table_slot (t, hashes[order[j]],
+							displacement);
+					if (t->slots[slot] != NULL)
+						break;
+					t->slots[slot] = ds[order[j]];
+				}
+
+				if (j == start[b + 1])
+				{
+					t->displacements[b] = displacement;
+					placed = 1;
+					break;
+				}
+
+				/* Undo the partial placement. */
+				while (j > start[b])
+				{
+					j--;
+					t->slots[ds_table_slot (t, hashes[order[j]],
+							displacement)] = NULL;
+				}
+			}
+
+			if (!placed)
+				return (-1);
+		}
+	}
+
+	return (0);
+} /* }}} int ds_table_place */
+
+ds_table_t *ds_table_create (data_set_t const **ds, size_t ds_num) /* {{{ */
+{
+	ds_table_t *t;
+	uint64_t *hashes;
+	size_t *order;
+	size_t *start;
+	size_t slots_num;
+	int status = -1;
+
+	if ((ds == NULL) && (ds_num != 0))
+		return (NULL);
+
+	if (!ds_types_unique (ds, ds_num))
+	{
+		ERROR ("ds_table_create: Type names are not unique.");
+		return (NULL);
+	}
+
+	/* Keep the load factor below 0.8. */
+	slots_num = 2;
+	while ((slots_num < DS_TABLE_SLOTS_MAX)
+			&& (slots_num < (ds_num + ds_num / 4)))
+		slots_num *= 2;
+	if (slots_num < (ds_num + ds_num / 4))
+	{
+		ERROR ("ds_table_create: Too many data sets (%zu).", ds_num);
+		return (NULL);
+	}
+
+	t = calloc (1, sizeof (*t));
+	hashes = calloc (ds_num + 1, sizeof (*hashes));
+	order = calloc (ds_num + 1, sizeof (*order));
+	start = calloc (DS_TABLE_SLOTS_MAX / 4 + 1, sizeof (*start));
+	if ((t == NULL) || (hashes == NULL) || (order == NULL) || (start == NULL))
+	{
+		sfree (t);
+		sfree (hashes);
+		sfree (order);
+		sfree (start);
+		return (NULL);
+	}
+
+	while (slots_num <= DS_TABLE_SLOTS_MAX)
+	{
+		size_t buckets_num = slots_num / 4;
+		int i;
+
+		if (buckets_num < 1)
+			buckets_num = 1;
+
+		t->slots_mask = (uint32_t) (slots_num - 1);
+		t->buckets_mask = (uint32_t) (buckets_num - 1);
+		t->slots = calloc (slots_num, sizeof (*t->slots));
+		t->displacements = calloc (buckets_num, sizeof (*t->displacements));
+		if ((t->slots == NULL) || (t->displacements == NULL))
+			break;
+
+		for (i = 0; i < DS_TABLE_SEEDS; i++)
+		{
+			t->seed = ((uint64_t) i) * 0x9e3779b97f4a7c15ULL;
+			memset (order, 0xff, (ds_num + 1) * sizeof (*order));
+
+			status = ds_table_place (t, ds, ds_num, hashes, order, start);
+			if (status == 0)
+				break;
+		}
+		if (status == 0)
+			break;
+
+		sfree (t->slots);
+		sfree (t->displacements);
+		slots_num *= 2;
+	}
+
+	sfree (hashes);
+	sfree (order);
+	sfree (start);
+
+	if (status != 0)
+	{
+		ERROR ("ds_table_create: Unable to find a perfect hash function "
+				"for %zu data sets.", ds_num);
+		ds_table_destroy (t);
+		return (NULL);
+	}
+
+	DEBUG ("ds_table_create: Placed %zu data sets in %zu slots.",
+			ds_num, slots_num);
+	return (t);
+} /* }}} ds_table_t *ds_table_create */
+
+void ds_table_destroy (ds_table_t *t) /* {{{ */
+{
+	if (t == NULL)
+		return;
+
+	sfree (t->slots);
+	sfree (t->displacements);
+	sfree (t);
+} /* }}} void ds_table_destroy */
+
+data_set_t const *ds_table_get (ds_table_t const *t, /* {{{ */
+		char const *type)
+{
+	data_set_t const *ds;
+	uint64_t h;
+
+	if ((t == NULL) || (type == NULL))
+		return (NULL);
+
+	h = ds_table_hash (type, t->seed);
+	ds = t->slots[ds_table_slot (t, h,
+			t->displacements[ds_table_bucket (t, h)])];
+
+	if ((ds == NULL) || (strcmp (ds->type, type) != 0))
+		return (NULL);
+
+	return (ds);
+} /* }}} data_set_t const *ds_table_get */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,63 @@
+/**
+ * collectd - src/utils_ds_table.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_DS_TABLE_H
+#define UTILS_DS_TABLE_H 1
+
+#include "plugin.h"
+
+/*
+ * Immutable lookup table mapping type names to data sets. A perfect hash
+ * function is computed when the table is created ("hash and displace"), so a
+ * lookup hashes the name once and compares it to exactly one entry. Since the
+ * table is never modified, it can be read by any number of threads without
+ * locking. To add data sets, create a new table.
+ */
+struct ds_table_s;
+typedef struct ds_table_s ds_table_t;
+
+/*
+ * NAME
+ *   ds_table_create
+ *
+ * DESCRIPTION
+ *   Builds a table for the `ds_num' data sets in `ds'. The data sets are not
+ *   copied and must stay valid as long as the table is used. The type names
+ *   must be unique.
+ *
+ * RETURN VALUE
+ *   The new table or NULL upon failure.
+ */
+ds_table_t *ds_table_create (data_set_t const **ds, size_t ds_num);
+
+void ds_table_destroy (ds_table_t *t);
+
+/*
+ * NAME
+ *   ds_table_get
+ *
+ * DESCRIPTION
+ *   Returns the data set for the type `type' or NULL if there is none.
+ */
+data_set_t const *ds_table_get (ds_table_t const *t, char const *type);
+
+#endif /* UTILS_DS_TABLE_H */
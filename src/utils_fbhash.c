@@ -31,6 +31,8 @@ struct fbhash_s
 {
   char *filename;
   time_t mtime;
+  /* Incremented whenever the file has been (re-)read. */
+  uint64_t generation;
 
   pthread_mutex_t lock;
   c_avl_tree_t *tree;
@@ -188,7 +190,10 @@ static int fbh_check_file (fbhash_t *h) /* {{{ */
 
   status = fbh_read_file (h);
   if (status == 0)
+  {
     h->mtime = statbuf.st_mtime;
+    h->generation++;
+  }
 
   return (status);
 } /* }}} int fbh_check_file */
@@ -268,4 +273,19 @@ char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
   return (value_copy);
 } /* }}} char *fbh_get */
 
+uint64_t fbh_generation (fbhash_t *h) /* {{{ */
+{
+  uint64_t generation;
+
+  if (h == NULL)
+    return (0);
+
+  pthread_mutex_lock (&h->lock);
+  fbh_check_file (h);
+  generation = h->generation;
+  pthread_mutex_unlock (&h->lock);
+
+  return (generation);
+} /* }}} uint64_t fbh_generation */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -42,6 +42,10 @@ void fbh_destroy (fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get (fbhash_t *h, const char *key);
 
+/* Returns a number which changes whenever the file is re-read, so callers can
+ * tell when values they have derived from the hash became stale. */
+uint64_t fbh_generation (fbhash_t *h);
+
 #endif /* UTILS_FBHASH_H */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -26,91 +26,292 @@
 #include "utils_cache.h"
 #include "utils_format_json.h"
 
-static int escape_string (char *buffer, size_t buffer_size, /* {{{ */
-    const char *string)
+#ifndef FORMAT_JSON_CHUNK_SIZE
+# define FORMAT_JSON_CHUNK_SIZE 16384
+#endif
+
+/*
+ * Buffer management
+ */
+struct json_chunk_s;
+typedef struct json_chunk_s json_chunk_t;
+struct json_chunk_s
 {
-  size_t src_pos;
-  size_t dst_pos;
+  char   *data;
+  size_t  size;
+  size_t  fill;
+  json_chunk_t *next;
+};
 
-  if ((buffer == NULL) || (string == NULL))
-    return (-EINVAL);
+struct format_json_buffer_s
+{
+  json_chunk_t *head;
+  json_chunk_t *tail;
+
+  size_t length;
+  size_t max_size;
+  size_t values_num;
+
+  /* Set for buffers wrapping a caller supplied array (see
+   * format_json_value_list). Such buffers never grow. */
+  _Bool fixed;
+  /* If set, every value list is prefixed with a comma, as expected by
+   * format_json_finalize. */
+  _Bool legacy_separator;
+  _Bool finalized;
+
+  /* Read position used by format_json_buffer_read. */
+  _Bool read_started;
+  json_chunk_t *read_chunk;
+  size_t read_offset;
+};
+
+/* Position to roll back to if a value list doesn't fit. */
+struct json_mark_s
+{
+  json_chunk_t *tail;
+  size_t tail_fill;
+  size_t length;
+};
+typedef struct json_mark_s json_mark_t;
+
+static void json_chunks_free (json_chunk_t *c) /* {{{ */
+{
+  while (c != NULL)
+  {
+    json_chunk_t *next = c->next;
+    sfree (c);
+    c = next;
+  }
+} /* }}} void json_chunks_free */
+
+/* Returns a pointer to at least `size' contiguous bytes at the end of the
+ * buffer (plus one byte for a terminating null byte). The bytes are only
+ * added to the buffer by `json_commit'. */
+static char *json_reserve (format_json_buffer_t *b, size_t size) /* {{{ */
+{
+  json_chunk_t *c;
+  size_t chunk_size;
+
+  if ((b->max_size > 0) && ((b->length + size) > b->max_size))
+    return (NULL);
+
+  if ((b->tail != NULL) && ((b->tail->size - b->tail->fill) > size))
+    return (b->tail->data + b->tail->fill);
+
+  if (b->fixed)
+    return (NULL);
 
-  if (buffer_size < 3)
+  chunk_size = FORMAT_JSON_CHUNK_SIZE;
+  if (chunk_size <= size)
+    chunk_size = size + 1;
+
+  /* The chunk header and its data are allocated in one go. */
+  c = malloc (sizeof (*c) + chunk_size);
+  if (c == NULL)
+    return (NULL);
+  c->data = (char *) (c + 1);
+  c->size = chunk_size;
+  c->fill = 0;
+  c->next = NULL;
+
+  if (b->tail == NULL)
+    b->head = c;
+  else
+    b->tail->next = c;
+  b->tail = c;
+
+  return (c->data);
+} /* }}} char *json_reserve */
+
+static void json_commit (format_json_buffer_t *b, size_t size) /* {{{ */
+{
+  b->tail->fill += size;
+  b->tail->data[b->tail->fill] = 0;
+  b->length += size;
+} /* }}} void json_commit */
+
+static int json_add (format_json_buffer_t *b, /* {{{ */
+    const char *data, size_t size)
+{
+  char *ptr;
+
+  ptr = json_reserve (b, size);
+  if (ptr == NULL)
     return (-ENOMEM);
 
-  dst_pos = 0;
+  memcpy (ptr, data, size);
+  json_commit (b, size);
+  return (0);
+} /* }}} int json_add */
 
-#define BUFFER_ADD(c) do { \
-  if (dst_pos >= (buffer_size - 1)) { \
-    buffer[buffer_size - 1] = 0; \
-    return (-ENOMEM); \
-  } \
-  buffer[dst_pos] = (c); \
-  dst_pos++; \
-} while (0)
+#define JSON_ADD_LITERAL(b, str) json_add ((b), (str), sizeof (str) - 1)
 
-  /* Escape special characters */
-  BUFFER_ADD ('"');
-  for (src_pos = 0; string[src_pos] != 0; src_pos++)
+static int json_printf (format_json_buffer_t *b, /* {{{ */
+    const char *format, ...)
+{
+  va_list ap;
+  size_t size = 64;
+  char *ptr;
+  int status;
+
+  /* Try the space left in the last chunk first, so that output which fits
+   * is never rejected by a fixed or size limited buffer. Only grow if
+   * vsnprintf reports that more space is needed. */
+  if (b->tail != NULL)
+    size = b->tail->size - b->tail->fill - 1;
+  if ((b->max_size > 0) && ((b->length + size) > b->max_size))
+    size = (b->length < b->max_size) ? (b->max_size - b->length) : 0;
+
+  while (42)
   {
-    if ((string[src_pos] == '"')
-        || (string[src_pos] == '\\'))
+    ptr = json_reserve (b, size);
+    if (ptr == NULL)
+      return (-ENOMEM);
+
+    va_start (ap, format);
+    status = vsnprintf (ptr, size + 1, format, ap);
+    va_end (ap);
+
+    if (status < 0)
     {
-      BUFFER_ADD ('\\');
-      BUFFER_ADD (string[src_pos]);
+      *ptr = 0;
+      return (-1);
     }
-    else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD ('?');
-    else
-      BUFFER_ADD (string[src_pos]);
-  } /* for */
-  BUFFER_ADD ('"');
-  buffer[dst_pos] = 0;
+    else if (((size_t) status) <= size)
+      break;
 
-#undef BUFFER_ADD
+    /* Restore the terminating null byte of the truncated attempt. */
+    *ptr = 0;
+    size = (size_t) status;
+  }
 
+  json_commit (b, (size_t) status);
   return (0);
-} /* }}} int escape_string */
+} /* }}} int json_printf */
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
+static void json_mark (format_json_buffer_t *b, json_mark_t *m) /* {{{ */
 {
-  size_t offset = 0;
-  int i;
-  gauge_t *rates = NULL;
+  m->tail = b->tail;
+  m->tail_fill = (b->tail != NULL) ? b->tail->fill : 0;
+  m->length = b->length;
+} /* }}} void json_mark */
+
+static void json_rollback (format_json_buffer_t *b, /* {{{ */
+    const json_mark_t *m)
+{
+  if (m->tail == NULL)
+  {
+    json_chunks_free (b->head);
+    b->head = NULL;
+    b->tail = NULL;
+  }
+  else
+  {
+    json_chunks_free (m->tail->next);
+    m->tail->next = NULL;
+    m->tail->fill = m->tail_fill;
+    m->tail->data[m->tail_fill] = 0;
+    b->tail = m->tail;
+  }
+  b->length = m->length;
+} /* }}} void json_rollback */
+
+/*
+ * Serialization
+ */
+/* Characters which need to be escaped in JSON strings. Zero means the
+ * character can be copied as-is, 'u' means the character is written as
+ * "\u00XX" and any other value is written as a backslash followed by that
+ * value. */
+static const char json_escape_table[256] =
+{
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', /* 0x00 - 0x07 */
+  'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', /* 0x08 - 0x0f */
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', /* 0x10 - 0x17 */
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', /* 0x18 - 0x1f */
+  0,   0,   '"', 0,   0,   0,   0,   0,   /* 0x20 - 0x27 */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x28 - 0x2f */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x30 - 0x37 */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x38 - 0x3f */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x40 - 0x47 */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x48 - 0x4f */
+  0,   0,   0,   0,   0,   0,   0,   0,   /* 0x50 - 0x57 */
+  0,   0,   0,   0,   '\\', 0,  0,   0,   /* 0x58 - 0x5f */
+  /* 0x60 - 0xff: all zero */
+};
+
+static int json_add_string (format_json_buffer_t *b, /* {{{ */
+    const char *string)
+{
+  const unsigned char *ptr = (const unsigned char *) string;
+  int status;
+
+  status = JSON_ADD_LITERAL (b, "\"");
+  if (status != 0)
+    return (status);
+
+  while (*ptr != 0)
+  {
+    const unsigned char *start = ptr;
+    char esc;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
+    /* Fast path: copy runs of characters which don't need escaping. */
+    while ((*ptr != 0) && (json_escape_table[*ptr] == 0))
+      ptr++;
+
+    if (ptr != start)
+    {
+      status = json_add (b, (const char *) start, (size_t) (ptr - start));
+      if (status != 0)
+        return (status);
+    }
+
+    if (*ptr == 0)
+      break;
+
+    esc = json_escape_table[*ptr];
+    if (esc == 'u')
+      status = json_printf (b, "\\u%04x", (unsigned int) *ptr);
+    else
+    {
+      char tmp[2] = { '\\', esc };
+      status = json_add (b, tmp, sizeof (tmp));
+    }
+    if (status != 0)
+      return (status);
+
+    ptr++;
+  }
+
+  return (JSON_ADD_LITERAL (b, "\""));
+} /* }}} int json_add_string */
+
+#define JSON_CHECK(expr) do { \
+  status = (expr); \
+  if (status != 0) \
+    goto out; \
 } while (0)
 
-  BUFFER_ADD ("[");
+static int json_add_values (format_json_buffer_t *b, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
+{
+  gauge_t *rates = NULL;
+  int status = 0;
+  int i;
+
+  JSON_CHECK (JSON_ADD_LITERAL (b, "["));
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
+      JSON_CHECK (JSON_ADD_LITERAL (b, ","));
 
     if (ds->ds[i].type == DS_TYPE_GAUGE)
     {
-      if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD ("%g", vl->values[i].gauge);
+      if (isfinite (vl->values[i].gauge))
+        JSON_CHECK (json_printf (b, "%g", vl->values[i].gauge));
       else
-        BUFFER_ADD ("null");
+        JSON_CHECK (JSON_ADD_LITERAL (b, "null"));
     }
     else if (store_rates)
     {
@@ -119,288 +320,400 @@ static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
       if (rates == NULL)
       {
         WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return (-1);
+        status = -1;
+        goto out;
       }
 
-      if(isfinite (rates[i]))
-        BUFFER_ADD ("%g", rates[i]);
+      if (isfinite (rates[i]))
+        JSON_CHECK (json_printf (b, "%g", rates[i]));
       else
-        BUFFER_ADD ("null");
+        JSON_CHECK (JSON_ADD_LITERAL (b, "null"));
     }
     else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
+      JSON_CHECK (json_printf (b, "%llu", vl->values[i].counter));
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
+      JSON_CHECK (json_printf (b, "%"PRIi64, vl->values[i].derive));
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
+      JSON_CHECK (json_printf (b, "%"PRIu64, vl->values[i].absolute));
     else
     {
       ERROR ("format_json: Unknown data source type: %i",
           ds->ds[i].type);
-      sfree (rates);
-      return (-1);
+      status = -1;
+      goto out;
     }
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+  JSON_CHECK (JSON_ADD_LITERAL (b, "]"));
 
-#undef BUFFER_ADD
+out:
+  sfree (rates);
+  return (status);
+} /* }}} int json_add_values */
 
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
-  return (0);
-} /* }}} int values_to_json */
-
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
+static int json_add_dstypes (format_json_buffer_t *b, /* {{{ */
+    const data_set_t *ds)
 {
-  size_t offset = 0;
+  int status = 0;
   int i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  JSON_CHECK (JSON_ADD_LITERAL (b, "["));
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
+      JSON_CHECK (JSON_ADD_LITERAL (b, ","));
+    JSON_CHECK (json_printf (b, "\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type)));
+  }
+  JSON_CHECK (JSON_ADD_LITERAL (b, "]"));
 
-  return (0);
-} /* }}} int dstypes_to_json */
+out:
+  return (status);
+} /* }}} int json_add_dstypes */
 
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
+static int json_add_dsnames (format_json_buffer_t *b, /* {{{ */
+    const data_set_t *ds)
 {
-  size_t offset = 0;
+  int status = 0;
   int i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  JSON_CHECK (JSON_ADD_LITERAL (b, "["));
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+      JSON_CHECK (JSON_ADD_LITERAL (b, ","));
+    JSON_CHECK (json_add_string (b, ds->ds[i].name));
+  }
+  JSON_CHECK (JSON_ADD_LITERAL (b, "]"));
 
-#undef BUFFER_ADD
+out:
+  return (status);
+} /* }}} int json_add_dsnames */
 
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dsnames_to_json */
-
-static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int json_add_meta_data (format_json_buffer_t *b, /* {{{ */
     meta_data_t *meta)
 {
-  size_t offset = 0;
   char **keys = NULL;
   int keys_num;
-  int status;
+  int status = 0;
   int i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   keys_num = meta_data_toc (meta, &keys);
+  if (keys_num <= 0)
+  {
+    sfree (keys);
+    return (0);
+  }
+
+  JSON_CHECK (JSON_ADD_LITERAL (b, ",\"meta\":{"));
   for (i = 0; i < keys_num; ++i)
   {
     int type;
     char *key = keys[i];
 
+    if (i > 0)
+      JSON_CHECK (JSON_ADD_LITERAL (b, ","));
+    JSON_CHECK (json_add_string (b, key));
+    JSON_CHECK (JSON_ADD_LITERAL (b, ":"));
+
     type = meta_data_type (meta, key);
     if (type == MD_TYPE_STRING)
     {
       char *value = NULL;
       if (meta_data_get_string (meta, key, &value) == 0)
       {
-        char temp[512] = "";
-        escape_string (temp, sizeof (temp), value);
+        status = json_add_string (b, value);
         sfree (value);
-        BUFFER_ADD (",\"%s\":%s", key, temp);
+        if (status != 0)
+          goto out;
       }
+      else
+        JSON_CHECK (JSON_ADD_LITERAL (b, "null"));
     }
     else if (type == MD_TYPE_SIGNED_INT)
     {
       int64_t value = 0;
-      if (meta_data_get_signed_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIi64, key, value);
+      meta_data_get_signed_int (meta, key, &value);
+      JSON_CHECK (json_printf (b, "%"PRIi64, value));
     }
     else if (type == MD_TYPE_UNSIGNED_INT)
     {
       uint64_t value = 0;
-      if (meta_data_get_unsigned_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIu64, key, value);
+      meta_data_get_unsigned_int (meta, key, &value);
+      JSON_CHECK (json_printf (b, "%"PRIu64, value));
     }
     else if (type == MD_TYPE_DOUBLE)
     {
       double value = 0.0;
-      if (meta_data_get_double (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%f", key, value);
+      meta_data_get_double (meta, key, &value);
+      if (isfinite (value))
+        JSON_CHECK (json_printf (b, "%f", value));
+      else
+        JSON_CHECK (JSON_ADD_LITERAL (b, "null"));
     }
     else if (type == MD_TYPE_BOOLEAN)
     {
       _Bool value = 0;
-      if (meta_data_get_boolean (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%s", key, value ? "true" : "false");
+      meta_data_get_boolean (meta, key, &value);
+      if (value)
+        JSON_CHECK (JSON_ADD_LITERAL (b, "true"));
+      else
+        JSON_CHECK (JSON_ADD_LITERAL (b, "false"));
     }
-
-    free (key);
+    else
+      JSON_CHECK (JSON_ADD_LITERAL (b, "null"));
   } /* for (keys) */
-  free (keys);
+  JSON_CHECK (JSON_ADD_LITERAL (b, "}"));
 
-  if (offset <= 0)
-    return (ENOENT);
+out:
+  for (i = 0; i < keys_num; ++i)
+    sfree (keys[i]);
+  sfree (keys);
 
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD ("}");
+  return (status);
+} /* }}} int json_add_meta_data */
 
-#undef BUFFER_ADD
+static int json_add_value_list (format_json_buffer_t *b, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
+{
+  json_mark_t mark;
+  int status = 0;
 
-  return (0);
-} /* int meta_data_to_json */
+  json_mark (b, &mark);
 
-static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
-{
-  char temp[512];
-  size_t offset = 0;
-  int status;
+  if (b->legacy_separator || (b->values_num > 0))
+    JSON_CHECK (JSON_ADD_LITERAL (b, ",{"));
+  else
+    JSON_CHECK (JSON_ADD_LITERAL (b, "[{"));
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
+  JSON_CHECK (JSON_ADD_LITERAL (b, "\"values\":"));
+  JSON_CHECK (json_add_values (b, ds, vl, store_rates));
+  JSON_CHECK (JSON_ADD_LITERAL (b, ",\"dstypes\":"));
+  JSON_CHECK (json_add_dstypes (b, ds));
+  JSON_CHECK (JSON_ADD_LITERAL (b, ",\"dsnames\":"));
+  JSON_CHECK (json_add_dsnames (b, ds));
+
+  JSON_CHECK (json_printf (b, ",\"time\":%.3f,\"interval\":%.3f",
+        CDTIME_T_TO_DOUBLE (vl->time), CDTIME_T_TO_DOUBLE (vl->interval)));
+
+#define JSON_ADD_KEYVAL(key, value) do { \
+  JSON_CHECK (JSON_ADD_LITERAL (b, ",\"" key "\":")); \
+  JSON_CHECK (json_add_string (b, (value))); \
 } while (0)
 
-  /* All value lists have a leading comma. The first one will be replaced with
-   * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
+  JSON_ADD_KEYVAL ("host", vl->host);
+  JSON_ADD_KEYVAL ("plugin", vl->plugin);
+  JSON_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
+  JSON_ADD_KEYVAL ("type", vl->type);
+  JSON_ADD_KEYVAL ("type_instance", vl->type_instance);
 
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
+#undef JSON_ADD_KEYVAL
 
-  status = dstypes_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
+  if (vl->meta != NULL)
+    JSON_CHECK (json_add_meta_data (b, vl->meta));
+
+  JSON_CHECK (JSON_ADD_LITERAL (b, "}"));
 
-  status = dsnames_to_json (temp, sizeof (temp), ds);
+out:
   if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
+    json_rollback (b, &mark);
+  else
+    b->values_num++;
 
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+  return (status);
+} /* }}} int json_add_value_list */
 
-#define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = escape_string (temp, sizeof (temp), (value)); \
-  if (status != 0) \
-    return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
-} while (0)
+#undef JSON_CHECK
 
-  BUFFER_ADD_KEYVAL ("host", vl->host);
-  BUFFER_ADD_KEYVAL ("plugin", vl->plugin);
-  BUFFER_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
-  BUFFER_ADD_KEYVAL ("type", vl->type);
-  BUFFER_ADD_KEYVAL ("type_instance", vl->type_instance);
+/*
+ * Public interface: growable buffer
+ */
+format_json_buffer_t *format_json_buffer_create (size_t max_size) /* {{{ */
+{
+  format_json_buffer_t *b;
 
-  if (vl->meta != NULL)
-  {
-    char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
-    status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
-    if (status != 0)
-      return (status);
+  b = malloc (sizeof (*b));
+  if (b == NULL)
+    return (NULL);
+  memset (b, 0, sizeof (*b));
 
-    BUFFER_ADD (",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
+  b->max_size = max_size;
 
-  BUFFER_ADD ("}");
+  return (b);
+} /* }}} format_json_buffer_t *format_json_buffer_create */
 
-#undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
+void format_json_buffer_destroy (format_json_buffer_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
 
-  DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
+  json_chunks_free (b->head);
+  sfree (b);
+} /* }}} void format_json_buffer_destroy */
 
-  return (0);
-} /* }}} int value_list_to_json */
+void format_json_buffer_reset (format_json_buffer_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
 
-static int format_json_value_list_nocheck (char *buffer, /* {{{ */
-    size_t *ret_buffer_fill, size_t *ret_buffer_free,
-    const data_set_t *ds, const value_list_t *vl,
-    int store_rates, size_t temp_size)
+  /* Keep the first chunk around to avoid reallocating it. */
+  if (b->head != NULL)
+  {
+    json_chunks_free (b->head->next);
+    b->head->next = NULL;
+    b->head->fill = 0;
+    b->head->data[0] = 0;
+    b->tail = b->head;
+  }
+
+  b->length = 0;
+  b->values_num = 0;
+  b->finalized = 0;
+  b->read_started = 0;
+  b->read_chunk = NULL;
+  b->read_offset = 0;
+} /* }}} void format_json_buffer_reset */
+
+int format_json_buffer_add (format_json_buffer_t *b, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[temp_size];
+  if ((b == NULL) || (ds == NULL) || (vl == NULL) || b->finalized)
+    return (-EINVAL);
+
+  return (json_add_value_list (b, ds, vl, store_rates));
+} /* }}} int format_json_buffer_add */
+
+int format_json_buffer_finalize (format_json_buffer_t *b) /* {{{ */
+{
+  size_t max_size;
   int status;
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  temp_size = strlen (temp);
+  if ((b == NULL) || b->finalized)
+    return (-EINVAL);
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  /* The size limit doesn't apply to the closing bracket. */
+  max_size = b->max_size;
+  b->max_size = 0;
 
-  return (0);
-} /* }}} int format_json_value_list_nocheck */
+  if (b->values_num == 0)
+    status = JSON_ADD_LITERAL (b, "[]");
+  else
+    status = JSON_ADD_LITERAL (b, "]");
+
+  b->max_size = max_size;
+
+  if (status == 0)
+    b->finalized = 1;
+
+  return (status);
+} /* }}} int format_json_buffer_finalize */
+
+size_t format_json_buffer_length (const format_json_buffer_t *b) /* {{{ */
+{
+  return ((b != NULL) ? b->length : 0);
+} /* }}} size_t format_json_buffer_length */
+
+size_t format_json_buffer_values_num (const format_json_buffer_t *b) /* {{{ */
+{
+  return ((b != NULL) ? b->values_num : 0);
+} /* }}} size_t format_json_buffer_values_num */
+
+const char *format_json_buffer_string (format_json_buffer_t *b) /* {{{ */
+{
+  json_chunk_t *c;
+  json_chunk_t *ptr;
+  size_t size;
+
+  if (b == NULL)
+    return (NULL);
+
+  if (b->head == NULL)
+    return ("");
+
+  if (b->head->next == NULL)
+    return (b->head->data);
+
+  /* Join all chunks into one. The joined chunk is kept by
+   * format_json_buffer_reset, so it is made large enough for a full buffer
+   * (plus the closing bracket and null byte). Later contents then fit into it
+   * and don't need to be joined again. */
+  size = b->length + 1;
+  if (size < (b->max_size + 2))
+    size = b->max_size + 2;
+
+  c = malloc (sizeof (*c) + size);
+  if (c == NULL)
+    return (NULL);
+  c->data = (char *) (c + 1);
+  c->size = size;
+  c->fill = 0;
+  c->next = NULL;
+
+  for (ptr = b->head; ptr != NULL; ptr = ptr->next)
+  {
+    memcpy (c->data + c->fill, ptr->data, ptr->fill);
+    c->fill += ptr->fill;
+  }
+  c->data[c->fill] = 0;
+
+  json_chunks_free (b->head);
+  b->head = c;
+  b->tail = c;
+  b->read_started = 0;
+  b->read_chunk = NULL;
+  b->read_offset = 0;
+
+  return (c->data);
+} /* }}} const char *format_json_buffer_string */
+
+size_t format_json_buffer_read (format_json_buffer_t *b, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  size_t copied = 0;
+
+  if ((b == NULL) || (buffer == NULL))
+    return (0);
+
+  if (!b->read_started)
+  {
+    b->read_started = 1;
+    b->read_chunk = b->head;
+    b->read_offset = 0;
+  }
+
+  while ((b->read_chunk != NULL) && (copied < buffer_size))
+  {
+    json_chunk_t *c = b->read_chunk;
+    size_t len = c->fill - b->read_offset;
+
+    if (len > (buffer_size - copied))
+      len = buffer_size - copied;
+
+    memcpy (buffer + copied, c->data + b->read_offset, len);
+    copied += len;
+    b->read_offset += len;
+
+    if (b->read_offset >= c->fill)
+    {
+      b->read_chunk = c->next;
+      b->read_offset = 0;
+    }
+  }
+
+  return (copied);
+} /* }}} size_t format_json_buffer_read */
+
+void format_json_buffer_rewind (format_json_buffer_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
+
+  b->read_started = 0;
+  b->read_chunk = NULL;
+  b->read_offset = 0;
+} /* }}} void format_json_buffer_rewind */
 
+/*
+ * Public interface: caller supplied buffers
+ */
 int format_json_initialize (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free)
 {
@@ -437,7 +750,7 @@ int format_json_finalize (char *buffer, /* {{{ */
   if (*ret_buffer_free < 2)
     return (-ENOMEM);
 
-  /* Replace the leading comma added in `value_list_to_json' with a square
+  /* Replace the leading comma added in `format_json_value_list' with a square
    * bracket. */
   if (buffer[0] != ',')
     return (-EINVAL);
@@ -457,6 +770,10 @@ int format_json_value_list (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free,
     const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
+  format_json_buffer_t b;
+  json_chunk_t c;
+  int status;
+
   if ((buffer == NULL)
       || (ret_buffer_fill == NULL) || (ret_buffer_free == NULL)
       || (ds == NULL) || (vl == NULL))
@@ -465,9 +782,30 @@ int format_json_value_list (char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return (-ENOMEM);
 
-  return (format_json_value_list_nocheck (buffer,
-        ret_buffer_fill, ret_buffer_free, ds, vl,
-        store_rates, (*ret_buffer_free) - 2));
+  /* Serialize directly into the caller's buffer, leaving room for the
+   * closing bracket added by format_json_finalize. */
+  memset (&c, 0, sizeof (c));
+  c.data = buffer + *ret_buffer_fill;
+  c.size = *ret_buffer_free - 1;
+  c.fill = 0;
+
+  memset (&b, 0, sizeof (b));
+  b.head = &c;
+  b.tail = &c;
+  b.fixed = 1;
+  b.legacy_separator = 1;
+
+  status = json_add_value_list (&b, ds, vl, store_rates);
+  if (status != 0)
+  {
+    c.data[0] = 0;
+    return (status);
+  }
+
+  (*ret_buffer_fill) += c.fill;
+  (*ret_buffer_free) -= c.fill;
+
+  return (0);
 } /* }}} int format_json_value_list */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
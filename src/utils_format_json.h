@@ -33,4 +33,39 @@ int format_json_value_list (char *buffer,
 int format_json_finalize (char *buffer,
     size_t *ret_buffer_fill, size_t *ret_buffer_free);
 
+/*
+ * Growable buffer holding a JSON array of value lists. Memory is allocated in
+ * chunks, so appending never copies data that has already been written. If
+ * `max_size' is non-zero, format_json_buffer_add fails with -ENOMEM when the
+ * value list would not fit; the buffer is left unchanged in that case.
+ */
+struct format_json_buffer_s;
+typedef struct format_json_buffer_s format_json_buffer_t;
+
+format_json_buffer_t *format_json_buffer_create (size_t max_size);
+void format_json_buffer_destroy (format_json_buffer_t *b);
+void format_json_buffer_reset (format_json_buffer_t *b);
+
+int format_json_buffer_add (format_json_buffer_t *b,
+    const data_set_t *ds, const value_list_t *vl, int store_rates);
+/* Closes the array. No more value lists can be added until the buffer is
+ * reset. */
+int format_json_buffer_finalize (format_json_buffer_t *b);
+
+size_t format_json_buffer_length (const format_json_buffer_t *b);
+size_t format_json_buffer_values_num (const format_json_buffer_t *b);
+
+/* Returns the buffer's content as a null-terminated string. If the data spans
+ * multiple chunks, they are joined first. The joined chunk has room for
+ * `max_size' bytes and is reused after a reset, so this copies at most once
+ * for buffers with a size limit. Use format_json_buffer_read to avoid the
+ * copy altogether. */
+const char *format_json_buffer_string (format_json_buffer_t *b);
+/* Copies up to `buffer_size' bytes, starting where the last call stopped, to
+ * `buffer' and returns the number of bytes copied. Suitable as a read
+ * callback, e.g. for libcurl. */
+size_t format_json_buffer_read (format_json_buffer_t *b,
+    char *buffer, size_t buffer_size);
+void format_json_buffer_rewind (format_json_buffer_t *b);
+
 #endif /* UTILS_FORMAT_JSON_H */
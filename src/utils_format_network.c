@@ -0,0 +1,273 @@
+/**
+ * collectd - src/utils_format_network.c
+ * Copyright (C) 2005-2010  Florian octo Forster
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; only version 2.1 of the License is
+ * applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Florian octo Forster <octo at verplant.org>
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+
+#include "network.h"
+#include "utils_format_network.h"
+
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+struct part_header_s
+{
+	uint16_t type;
+	uint16_t length;
+};
+typedef struct part_header_s part_header_t;
+
+int format_network_part_values (char **ret_buffer, int *ret_buffer_len,
+		const data_set_t *ds, const value_list_t *vl)
+{
+	char *packet_ptr;
+	int packet_len;
+	int num_values;
+
+	part_header_t pkg_ph;
+	uint16_t      pkg_num_values;
+
+	int offset;
+	int i;
+
+	num_values = vl->values_len;
+	packet_len = sizeof (part_header_t) + sizeof (uint16_t)
+		+ (num_values * sizeof (uint8_t))
+		+ (num_values * sizeof (value_t));
+
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	pkg_ph.type = htons (TYPE_VALUES);
+	pkg_ph.length = htons (packet_len);
+
+	pkg_num_values = htons ((uint16_t) vl->values_len);
+
+	/*
+	 * Use `memcpy' to write everything to the buffer, because the pointer
+	 * may be unaligned and some architectures, such as SPARC, can't handle
+	 * that. The types and values are written straight into the buffer:
+	 * "*ret_buffer" is only advanced once the whole part has been written,
+	 * so a failure leaves the caller's position untouched.
+	 */
+	packet_ptr = *ret_buffer;
+	offset = 0;
+	memcpy (packet_ptr + offset, &pkg_ph, sizeof (pkg_ph));
+	offset += sizeof (pkg_ph);
+	memcpy (packet_ptr + offset, &pkg_num_values, sizeof (pkg_num_values));
+	offset += sizeof (pkg_num_values);
+
+	for (i = 0; i < num_values; i++)
+	{
+		uint8_t type = (uint8_t) ds->ds[i].type;
+		memcpy (packet_ptr + offset + i, &type, sizeof (type));
+	}
+	offset += num_values * sizeof (uint8_t);
+
+	for (i = 0; i < num_values; i++)
+	{
+		value_t value;
+
+		switch (ds->ds[i].type)
+		{
+			case DS_TYPE_COUNTER:
+				value.counter = htonll (vl->values[i].counter);
+				break;
+
+			case DS_TYPE_GAUGE:
+				value.gauge = htond (vl->values[i].gauge);
+				break;
+
+			case DS_TYPE_DERIVE:
+				value.derive = htonll (vl->values[i].derive);
+				break;
+
+			case DS_TYPE_ABSOLUTE:
+				value.absolute = htonll (vl->values[i].absolute);
+				break;
+
+			default:
+				ERROR ("utils_format_network: "
+						"Unknown data source type: %i",
+						ds->ds[i].type);
+				return (-1);
+		} /* switch (ds->ds[i].type) */
+
+		memcpy (packet_ptr + offset, &value, sizeof (value));
+		offset += sizeof (value);
+	} /* for (num_values) */
+
+	assert (offset == packet_len);
+
+	*ret_buffer = packet_ptr + packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* int format_network_part_values */
+
+int format_network_part_number (char **ret_buffer, int *ret_buffer_len,
+		int type, uint64_t value)
+{
+	char *packet_ptr;
+	int packet_len;
+
+	part_header_t pkg_head;
+	uint64_t pkg_value;
+
+	int offset;
+
+	packet_len = sizeof (pkg_head) + sizeof (pkg_value);
+
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	pkg_head.type = htons (type);
+	pkg_head.length = htons (packet_len);
+	pkg_value = htonll (value);
+
+	packet_ptr = *ret_buffer;
+	offset = 0;
+	memcpy (packet_ptr + offset, &pkg_head, sizeof (pkg_head));
+	offset += sizeof (pkg_head);
+	memcpy (packet_ptr + offset, &pkg_value, sizeof (pkg_value));
+	offset += sizeof (pkg_value);
+
+	assert (offset == packet_len);
+
+	*ret_buffer = packet_ptr + packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* int format_network_part_number */
+
+int format_network_part_string (char **ret_buffer, int *ret_buffer_len,
+		int type, const char *str, int str_len)
+{
+	char *buffer;
+	int buffer_len;
+
+	uint16_t pkg_type;
+	uint16_t pkg_length;
+
+	int offset;
+
+	buffer_len = 2 * sizeof (uint16_t) + str_len + 1;
+	if (*ret_buffer_len < buffer_len)
+		return (-1);
+
+	pkg_type = htons (type);
+	pkg_length = htons (buffer_len);
+
+	buffer = *ret_buffer;
+	offset = 0;
+	memcpy (buffer + offset, (void *) &pkg_type, sizeof (pkg_type));
+	offset += sizeof (pkg_type);
+	memcpy (buffer + offset, (void *) &pkg_length, sizeof (pkg_length));
+	offset += sizeof (pkg_length);
+	memcpy (buffer + offset, str, str_len);
+	offset += str_len;
+	memset (buffer + offset, '\0', 1);
+	offset += 1;
+
+	assert (offset == buffer_len);
+
+	*ret_buffer = buffer + buffer_len;
+	*ret_buffer_len -= buffer_len;
+
+	return (0);
+} /* int format_network_part_string */
+
+int format_network_value_list (char *buffer, int buffer_size, /* {{{ */
+		value_list_t *vl_def,
+		const data_set_t *ds, const value_list_t *vl)
+{
+	char *buffer_orig = buffer;
+
+	if (strcmp (vl_def->host, vl->host) != 0)
+	{
+		if (format_network_part_string (&buffer, &buffer_size, TYPE_HOST,
+					vl->host, strlen (vl->host)) != 0)
+			return (-1);
+		sstrncpy (vl_def->host, vl->host, sizeof (vl_def->host));
+	}
+
+	if (vl_def->time != vl->time)
+	{
+		if (format_network_part_number (&buffer, &buffer_size, TYPE_TIME_HR,
+					(uint64_t) vl->time))
+			return (-1);
+		vl_def->time = vl->time;
+	}
+
+	if (vl_def->interval != vl->interval)
+	{
+		if (format_network_part_number (&buffer, &buffer_size,
+					TYPE_INTERVAL_HR, (uint64_t) vl->interval))
+			return (-1);
+		vl_def->interval = vl->interval;
+	}
+
+	if (strcmp (vl_def->plugin, vl->plugin) != 0)
+	{
+		if (format_network_part_string (&buffer, &buffer_size, TYPE_PLUGIN,
+					vl->plugin, strlen (vl->plugin)) != 0)
+			return (-1);
+		sstrncpy (vl_def->plugin, vl->plugin, sizeof (vl_def->plugin));
+	}
+
+	if (strcmp (vl_def->plugin_instance, vl->plugin_instance) != 0)
+	{
+		if (format_network_part_string (&buffer, &buffer_size,
+					TYPE_PLUGIN_INSTANCE,
+					vl->plugin_instance,
+					strlen (vl->plugin_instance)) != 0)
+			return (-1);
+		sstrncpy (vl_def->plugin_instance, vl->plugin_instance, sizeof (vl_def->plugin_instance));
+	}
+
+	if (strcmp (vl_def->type, vl->type) != 0)
+	{
+		if (format_network_part_string (&buffer, &buffer_size, TYPE_TYPE,
+					vl->type, strlen (vl->type)) != 0)
+			return (-1);
+		sstrncpy (vl_def->type, ds->type, sizeof (vl_def->type));
+	}
+
+	if (strcmp (vl_def->type_instance, vl->type_instance) != 0)
+	{
+		if (format_network_part_string (&buffer, &buffer_size,
+					TYPE_TYPE_INSTANCE,
+					vl->type_instance,
+					strlen (vl->type_instance)) != 0)
+			return (-1);
+		sstrncpy (vl_def->type_instance, vl->type_instance, sizeof (vl_def->type_instance));
+	}
+
+	if (format_network_part_values (&buffer, &buffer_size, ds, vl) != 0)
+		return (-1);
+
+	return (buffer - buffer_orig);
+} /* }}} int format_network_value_list */
@@ -0,0 +1,58 @@
+/**
+ * collectd - src/utils_format_network.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; only version 2.1 of the License is
+ * applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_FORMAT_NETWORK_H
+#define UTILS_FORMAT_NETWORK_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/* Encoder for the binary protocol used by the network plugin. See
+ * network.h for the part type definitions. */
+
+#define FORMAT_NETWORK_CONTENT_TYPE "application/octet-stream"
+
+/*
+ * Low level functions: Each appends one part to "*ret_buffer", advances the
+ * pointer and decrements "*ret_buffer_len" accordingly. Returns -1 if the
+ * part does not fit into the remaining space.
+ */
+int format_network_part_number (char **ret_buffer, int *ret_buffer_len,
+		int type, uint64_t value);
+int format_network_part_string (char **ret_buffer, int *ret_buffer_len,
+		int type, const char *str, int str_len);
+int format_network_part_values (char **ret_buffer, int *ret_buffer_len,
+		const data_set_t *ds, const value_list_t *vl);
+
+/*
+ * Appends a value list to "buffer". Only the fields which differ from
+ * "vl_def" are written, "vl_def" is then updated to reflect the state of the
+ * stream. Returns the number of bytes written or -1 if the value list does
+ * not fit into "buffer_size" bytes. In the latter case the buffer contents
+ * are unusable beyond the previous position and "vl_def" is out of sync:
+ * the caller should send what it has, clear "vl_def" using memset and retry.
+ */
+int format_network_value_list (char *buffer, int buffer_size,
+		value_list_t *vl_def,
+		const data_set_t *ds, const value_list_t *vl);
+
+#endif /* UTILS_FORMAT_NETWORK_H */
@@ -30,6 +30,8 @@
 
 #define UTILS_MATCH_FLAGS_FREE_USER_DATA 0x01
 #define UTILS_MATCH_FLAGS_EXCLUDE_REGEX 0x02
+#define UTILS_MATCH_FLAGS_LITERAL 0x04
+#define UTILS_MATCH_FLAGS_PREFIX 0x08
 
 struct cu_match_s
 {
@@ -37,14 +39,267 @@ struct cu_match_s
   regex_t excluderegex;
   int flags;
 
+  /* String every line matched by `regex' contains, see
+   * `match_required_literal'. NULL if no such string is known. If the regex
+   * consists of this string only, UTILS_MATCH_FLAGS_LITERAL is set, if it
+   * starts with it, UTILS_MATCH_FLAGS_PREFIX. */
+  char *literal;
+  size_t literal_len;
+
   int (*callback) (const char *str, char * const *matches, size_t matches_num,
       void *user_data);
   void *user_data;
 };
 
+/* States of the automaton used by `cu_match_set_t'. Transitions are stored as
+ * the offset of the destination state's row in the transition table, shifted
+ * by one bit; the lowest bit is set if the destination state completes one or
+ * more literals. */
+#define MATCH_SET_NONE ((uint32_t) -1)
+
+struct cu_match_set_s
+{
+  cu_match_t **matches;
+  size_t matches_num;
+
+  /* Maps each byte to its column in the transition table. All bytes that do
+   * not occur in any literal share column zero. */
+  unsigned char classes[256];
+  size_t classes_num;
+
+  uint32_t *delta;
+  size_t states_num;
+
+  /* Literals completed by each state: `out_head' is the first entry in the
+   * `out_match' / `out_next' lists, `dict' the next state (via the failure
+   * links) which completes a literal, too. */
+  uint32_t *out_head;
+  uint32_t *dict;
+  uint32_t *out_match;
+  uint32_t *out_next;
+
+  /* Generation in which a match's literal was last seen. */
+  uint32_t *seen;
+  uint32_t generation;
+};
+
 /*
  * Private functions
  */
+static void match_literal_commit (const char *run, size_t run_len,
+    char *best, size_t *best_len, size_t *first_len)
+{
+  if (*first_len == (size_t) -1)
+    *first_len = run_len;
+
+  if (run_len > *best_len)
+  {
+    memcpy (best, run, run_len);
+    *best_len = run_len;
+  }
+} /* void match_literal_commit */
+
+/* Returns the end of the bracket expression starting at `re', which must
+ * point to the opening bracket. */
+static const char *match_skip_bracket (const char *re)
+{
+  re++;
+  if (*re == '^')
+    re++;
+  if (*re == ']')
+    re++;
+
+  while ((*re != 0) && (*re != ']'))
+  {
+    if ((re[0] == '[')
+	&& ((re[1] == ':') || (re[1] == '.') || (re[1] == '=')))
+    {
+      char delim = re[1];
+
+      re += 2;
+      while ((re[0] != 0) && !((re[0] == delim) && (re[1] == ']')))
+	re++;
+      if (re[0] == 0)
+	break;
+      re += 2;
+      continue;
+    }
+    re++;
+  }
+
+  if (*re == ']')
+    re++;
+  return (re);
+} /* const char *match_skip_bracket */
+
+/* Returns the end of the subexpression starting at `re', which must point to
+ * the opening parenthesis. */
+static const char *match_skip_group (const char *re)
+{
+  int depth = 0;
+
+  while (*re != 0)
+  {
+    if (*re == '\\')
+    {
+      re++;
+      if (*re == 0)
+	break;
+      re++;
+    }
+    else if (*re == '[')
+      re = match_skip_bracket (re);
+    else if (*re == '(')
+    {
+      depth++;
+      re++;
+    }
+    else if (*re == ')')
+    {
+      depth--;
+      re++;
+      if (depth == 0)
+	break;
+    }
+    else
+      re++;
+  }
+
+  return (re);
+} /* const char *match_skip_group */
+
+/*
+ * Returns the longest string that is part of every string matched by the
+ * extended regular expression `regex', or NULL if no such string could be
+ * determined. This is a conservative approximation: Only runs of ordinary
+ * characters outside of subexpressions are considered and any alternation on
+ * the top level gives up. `ret_exact' is set to true if the regex matches
+ * exactly this string and nothing else, `ret_prefix' if every match starts
+ * with this string.
+ */
+static char *match_required_literal (const char *regex, size_t *ret_len,
+    _Bool *ret_exact, _Bool *ret_prefix)
+{
+  size_t regex_len = strlen (regex);
+  char *run;
+  size_t run_len = 0;
+  char *best;
+  size_t best_len = 0;
+  /* Length of the run at the beginning of the regex. */
+  size_t first_len = (size_t) -1;
+  const char *re = regex;
+  _Bool exact = 1;
+
+  run = malloc (regex_len + 1);
+  best = malloc (regex_len + 1);
+  if ((run == NULL) || (best == NULL))
+  {
+    sfree (run);
+    sfree (best);
+    return (NULL);
+  }
+
+  while (*re != 0)
+  {
+    char c;
+    const char *next;
+
+    if (*re != '\\')
+    {
+      if (strchr ("|([{.^$*+?)", *re) != NULL)
+	exact = 0;
+    }
+    else if ((re[1] == 0) || (strchr (".[]()*+?{}|^$\\/", re[1]) == NULL))
+      exact = 0;
+
+    if (*re == '|')
+    {
+      best_len = 0;
+      break;
+    }
+    else if ((*re == '(') || (*re == '['))
+    {
+      match_literal_commit (run, run_len, best, &best_len, &first_len);
+      run_len = 0;
+      re = (*re == '(') ? match_skip_group (re) : match_skip_bracket (re);
+      continue;
+    }
+    else if (*re == '{')
+    {
+      match_literal_commit (run, run_len, best, &best_len, &first_len);
+      run_len = 0;
+      while ((*re != 0) && (*re != '}'))
+	re++;
+      if (*re == '}')
+	re++;
+      continue;
+    }
+    else if ((*re == '.') || (*re == '^') || (*re == '$')
+	|| (*re == '*') || (*re == '+') || (*re == '?') || (*re == ')'))
+    {
+      match_literal_commit (run, run_len, best, &best_len, &first_len);
+      run_len = 0;
+      re++;
+      continue;
+    }
+    else if (*re == '\\')
+    {
+      if ((re[1] == 0) || (strchr (".[]()*+?{}|^$\\/", re[1]) == NULL))
+      {
+	/* Back-references and GNU extensions such as \< and \w. */
+	match_literal_commit (run, run_len, best, &best_len, &first_len);
+	run_len = 0;
+	re += (re[1] == 0) ? 1 : 2;
+	continue;
+      }
+      c = re[1];
+      next = re + 2;
+    }
+    else
+    {
+      c = *re;
+      next = re + 1;
+    }
+
+    /* A quantified character is optional or may be repeated, so the run
+     * ends here. */
+    if ((*next == '*') || (*next == '?') || (*next == '{'))
+    {
+      exact = 0;
+      match_literal_commit (run, run_len, best, &best_len, &first_len);
+      run_len = 0;
+    }
+    else if (*next == '+')
+    {
+      exact = 0;
+      run[run_len++] = c;
+      match_literal_commit (run, run_len, best, &best_len, &first_len);
+      run_len = 0;
+    }
+    else
+      run[run_len++] = c;
+
+    re = next;
+  } /* while (*re != 0) */
+
+  if (*re == 0)
+    match_literal_commit (run, run_len, best, &best_len, &first_len);
+  sfree (run);
+
+  if (best_len == 0)
+  {
+    sfree (best);
+    return (NULL);
+  }
+
+  best[best_len] = 0;
+  *ret_len = best_len;
+  *ret_exact = exact;
+  /* Ties are won by the earlier run, see `match_literal_commit'. */
+  *ret_prefix = (first_len == best_len);
+  return (best);
+} /* char *match_required_literal */
+
 static char *match_substr (const char *str, int begin, int end)
 {
   char *ret;
@@ -218,6 +473,8 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
 		void *user_data)
 {
   cu_match_t *obj;
+  _Bool literal_exact = 0;
+  _Bool literal_prefix = 0;
   int status;
 
   DEBUG ("utils_match: match_create_callback: regex = %s, excluderegex = %s",
@@ -237,17 +494,30 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
   }
 
   if (excluderegex && strcmp(excluderegex, "") != 0) {
-    status = regcomp (&obj->excluderegex, excluderegex, REG_EXTENDED);
+    /* Only used to decide whether a line matches, so don't bother
+     * computing the position of subexpressions. */
+    status = regcomp (&obj->excluderegex, excluderegex,
+	REG_EXTENDED | REG_NOSUB);
     if (status != 0)
     {
 	ERROR ("Compiling the excluding regular expression \"%s\" failed.",
 	       excluderegex);
+	regfree (&obj->regex);
 	sfree (obj);
 	return (NULL);
     }
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  obj->literal = match_required_literal (regex, &obj->literal_len,
+      &literal_exact, &literal_prefix);
+  if (obj->literal == NULL)
+    obj->literal_len = 0;
+  else if (literal_exact)
+    obj->flags |= UTILS_MATCH_FLAGS_LITERAL;
+  else if (literal_prefix)
+    obj->flags |= UTILS_MATCH_FLAGS_PREFIX;
+
   obj->callback = callback;
   obj->user_data = user_data;
 
@@ -289,6 +559,11 @@ void match_destroy (cu_match_t *obj)
     sfree (obj->user_data);
   }
 
+  regfree (&obj->regex);
+  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
+    regfree (&obj->excluderegex);
+
+  sfree (obj->literal);
   sfree (obj);
 } /* void match_destroy */
 
@@ -297,33 +572,84 @@ int match_apply (cu_match_t *obj, const char *str)
   int status;
   regmatch_t re_match[32];
   char *matches[32];
+  size_t matches_max;
   size_t matches_num;
   size_t i;
 
   if ((obj == NULL) || (str == NULL))
     return (-1);
 
+  /* Only ask for as many subexpressions as the regex has: regexec(3) is
+   * considerably slower if it has to track positions nobody uses. */
+  matches_max = obj->regex.re_nsub + 1;
+  if (matches_max > STATIC_ARRAY_SIZE (re_match))
+    matches_max = STATIC_ARRAY_SIZE (re_match);
+
+  if (obj->flags & UTILS_MATCH_FLAGS_LITERAL)
+  {
+    /* The regex is a plain string: strstr(3) is much faster than
+     * regexec(3) and finds the same, leftmost match. */
+    const char *pos = strstr (str, obj->literal);
+
+    if (pos == NULL)
+      return (0);
+
+    re_match[0].rm_so = (regoff_t) (pos - str);
+    re_match[0].rm_eo = (regoff_t) ((pos - str) + obj->literal_len);
+    matches_max = 1;
+    status = 0;
+  }
+  else if (obj->flags & UTILS_MATCH_FLAGS_PREFIX)
+  {
+    /* Every match starts with the literal, so the leftmost match can't
+     * start before its first occurrence. */
+    const char *pos = strstr (str, obj->literal);
+    regoff_t offset;
+
+    if (pos == NULL)
+      return (0);
+    offset = (regoff_t) (pos - str);
+
+    status = regexec (&obj->regex, pos, matches_max, re_match,
+	(offset != 0) ? REG_NOTBOL : 0);
+    if (status != 0)
+      return (0);
+
+    for (i = 0; i < matches_max; i++)
+    {
+      if ((re_match[i].rm_so < 0) || (re_match[i].rm_eo < 0))
+	continue;
+      re_match[i].rm_so += offset;
+      re_match[i].rm_eo += offset;
+    }
+  }
+  else
+  {
+    if ((obj->literal != NULL) && (strstr (str, obj->literal) == NULL))
+      return (0);
+
+    status = regexec (&obj->regex, str, matches_max, re_match,
+	/* eflags = */ 0);
+
+    /* Regex did not match */
+    if (status != 0)
+      return (0);
+  }
+
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
     status = regexec (&obj->excluderegex, str,
-		      STATIC_ARRAY_SIZE (re_match), re_match,
+		      /* nmatch = */ 0, /* pmatch = */ NULL,
 		      /* eflags = */ 0);
     /* Regex did match, so exclude this line */
     if (status == 0) {
       DEBUG("ExludeRegex matched, don't count that line\n");
       return (0);
     }
+    status = 0;
   }
 
-  status = regexec (&obj->regex, str,
-      STATIC_ARRAY_SIZE (re_match), re_match,
-      /* eflags = */ 0);
-
-  /* Regex did not match */
-  if (status != 0)
-    return (0);
-
   memset (matches, '\0', sizeof (matches));
-  for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE (matches); matches_num++)
+  for (matches_num = 0; matches_num < matches_max; matches_num++)
   {
     if ((re_match[matches_num].rm_so < 0)
 	|| (re_match[matches_num].rm_eo < 0))
@@ -366,4 +692,233 @@ void *match_get_user_data (cu_match_t *obj)
   return (obj->user_data);
 } /* void *match_get_user_data */
 
+cu_match_set_t *match_set_create (cu_match_t **matches, size_t matches_num)
+{
+  cu_match_set_t *set;
+  size_t states_max;
+  uint32_t *fail;
+  uint32_t *queue;
+  size_t queue_head;
+  size_t queue_tail;
+  size_t out_num;
+  size_t k;
+  size_t i;
+  size_t j;
+
+  if ((matches == NULL) && (matches_num != 0))
+    return (NULL);
+
+  set = calloc (1, sizeof (*set));
+  if (set == NULL)
+    return (NULL);
+
+  set->matches = calloc (matches_num + 1, sizeof (*set->matches));
+  set->seen = calloc (matches_num + 1, sizeof (*set->seen));
+  if ((set->matches == NULL) || (set->seen == NULL))
+  {
+    match_set_destroy (set);
+    return (NULL);
+  }
+  memcpy (set->matches, matches, matches_num * sizeof (*matches));
+  set->matches_num = matches_num;
+
+  /* Assign a column to every byte used in a literal. */
+  memset (set->classes, 0, sizeof (set->classes));
+  set->classes_num = 1;
+  states_max = 1;
+  for (i = 0; i < matches_num; i++)
+  {
+    for (j = 0; j < matches[i]->literal_len; j++)
+    {
+      unsigned char c = (unsigned char) matches[i]->literal[j];
+      if (set->classes[c] == 0)
+	set->classes[c] = (unsigned char) set->classes_num++;
+    }
+    states_max += matches[i]->literal_len;
+  }
+  k = set->classes_num;
+
+  if ((states_max * k) > (((size_t) UINT32_MAX) >> 1))
+  {
+    ERROR ("utils_match: match_set_create: Literals are too long.");
+    match_set_destroy (set);
+    return (NULL);
+  }
+
+  set->delta = calloc (states_max * k, sizeof (*set->delta));
+  set->out_head = malloc (states_max * sizeof (*set->out_head));
+  set->dict = calloc (states_max, sizeof (*set->dict));
+  set->out_match = calloc (matches_num + 1, sizeof (*set->out_match));
+  set->out_next = calloc (matches_num + 1, sizeof (*set->out_next));
+  fail = calloc (states_max, sizeof (*fail));
+  queue = calloc (states_max, sizeof (*queue));
+  if ((set->delta == NULL) || (set->out_head == NULL) || (set->dict == NULL)
+      || (set->out_match == NULL) || (set->out_next == NULL)
+      || (fail == NULL) || (queue == NULL))
+  {
+    sfree (fail);
+    sfree (queue);
+    match_set_destroy (set);
+    return (NULL);
+  }
+  for (i = 0; i < states_max; i++)
+    set->out_head[i] = MATCH_SET_NONE;
+
+  /* Build the trie of all literals. While building, `delta' holds state
+   * numbers and zero means "no transition"; the root is never the target of
+   * a trie edge. */
+  set->states_num = 1;
+  out_num = 0;
+  for (i = 0; i < matches_num; i++)
+  {
+    uint32_t state = 0;
+
+    if (matches[i]->literal_len == 0)
+      continue;
+
+    for (j = 0; j < matches[i]->literal_len; j++)
+    {
+      unsigned char c = (unsigned char) matches[i]->literal[j];
+      uint32_t *next = set->delta + (state * k) + set->classes[c];
+
+      if (*next == 0)
+	*next = (uint32_t) set->states_num++;
+      state = *next;
+    }
+
+    set->out_match[out_num] = (uint32_t) i;
+    set->out_next[out_num] = set->out_head[state];
+    set->out_head[state] = (uint32_t) out_num;
+    out_num++;
+  }
+
+  /* Compute the failure links in breadth first order and turn the trie into
+   * a complete transition table. */
+  queue_head = 0;
+  queue_tail = 0;
+  for (j = 0; j < k; j++)
+    if (set->delta[j] != 0)
+      queue[queue_tail++] = set->delta[j];
+
+  while (queue_head < queue_tail)
+  {
+    uint32_t state = queue[queue_head++];
+
+    for (j = 0; j < k; j++)
+    {
+      uint32_t *next = set->delta + (state * k) + j;
+      uint32_t fallback = set->delta[(fail[state] * k) + j];
+
+      if (*next == 0)
+      {
+	*next = fallback;
+	continue;
+      }
+
+      fail[*next] = fallback;
+      if (set->out_head[fallback] != MATCH_SET_NONE)
+	set->dict[*next] = fallback;
+      else
+	set->dict[*next] = set->dict[fallback];
+      queue[queue_tail++] = *next;
+    }
+  }
+
+  /* Encode row offsets and the "completes a literal" bit. */
+  for (i = 0; i < set->states_num * k; i++)
+  {
+    uint32_t state = set->delta[i];
+    uint32_t final = ((set->out_head[state] != MATCH_SET_NONE)
+	|| (set->dict[state] != 0)) ? 1 : 0;
+
+    set->delta[i] = ((state * (uint32_t) k) << 1) | final;
+  }
+
+  sfree (fail);
+  sfree (queue);
+
+  DEBUG ("utils_match: match_set_create: %zu matches, %zu states, "
+      "%zu columns.", matches_num, set->states_num, k);
+
+  return (set);
+} /* cu_match_set_t *match_set_create */
+
+void match_set_destroy (cu_match_set_t *set)
+{
+  if (set == NULL)
+    return;
+
+  sfree (set->matches);
+  sfree (set->seen);
+  sfree (set->delta);
+  sfree (set->out_head);
+  sfree (set->dict);
+  sfree (set->out_match);
+  sfree (set->out_next);
+  sfree (set);
+} /* void match_set_destroy */
+
+static void match_set_mark (cu_match_set_t *set, uint32_t state)
+{
+  while (42)
+  {
+    uint32_t out;
+
+    for (out = set->out_head[state];
+	out != MATCH_SET_NONE;
+	out = set->out_next[out])
+      set->seen[set->out_match[out]] = set->generation;
+
+    state = set->dict[state];
+    if (state == 0)
+      break;
+  }
+} /* void match_set_mark */
+
+int match_set_apply (cu_match_set_t *set, const char *str)
+{
+  const unsigned char *c;
+  uint32_t k;
+  uint32_t row;
+  int ret = 0;
+  size_t i;
+
+  if ((set == NULL) || (str == NULL))
+    return (-1);
+
+  set->generation++;
+  if (set->generation == 0)
+  {
+    memset (set->seen, 0, set->matches_num * sizeof (*set->seen));
+    set->generation = 1;
+  }
+
+  /* Find all literals contained in the string in one pass. */
+  k = (uint32_t) set->classes_num;
+  row = 0;
+  for (c = (const unsigned char *) str; *c != 0; c++)
+  {
+    uint32_t next = set->delta[row + set->classes[*c]];
+
+    row = next >> 1;
+    if (next & 1)
+      match_set_mark (set, row / k);
+  }
+
+  for (i = 0; i < set->matches_num; i++)
+  {
+    int status;
+
+    if ((set->matches[i]->literal_len != 0)
+	&& (set->seen[i] != set->generation))
+      continue;
+
+    status = match_apply (set->matches[i], str);
+    if (status != 0)
+      ret = status;
+  }
+
+  return (ret);
+} /* int match_set_apply */
+
 /* vim: set sw=2 sts=2 ts=8 : */
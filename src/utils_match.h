@@ -56,6 +56,9 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_match_set_s;
+typedef struct cu_match_set_s cu_match_set_t;
+
 struct cu_match_value_s
 {
   int ds_type;
@@ -150,6 +153,50 @@ int match_apply (cu_match_t *obj, const char *str);
  */
 void *match_get_user_data (cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_set_create
+ *
+ * DESCRIPTION
+ *  Combines several `cu_match_t' objects, so that a string can be matched
+ *  against all of them at once, see `match_set_apply'. For each regular
+ *  expression a string is determined that all matching lines must contain.
+ *  These strings are compiled into a single automaton (Aho-Corasick), so that
+ *  a line is scanned only once to find out which regular expressions may match
+ *  at all. Regular expressions without such a string are always tried.
+ *
+ *  The `cu_match_t' objects are not copied and must not be destroyed before
+ *  the set is destroyed.
+ *
+ * RETURN VALUE
+ *  The new set or NULL upon failure.
+ */
+cu_match_set_t *match_set_create (cu_match_t **matches, size_t matches_num);
+
+/*
+ * NAME
+ *  match_set_destroy
+ *
+ * DESCRIPTION
+ *  Destroys the set. The `cu_match_t' objects of the set are not destroyed.
+ */
+void match_set_destroy (cu_match_set_t *set);
+
+/*
+ * NAME
+ *  match_set_apply
+ *
+ * DESCRIPTION
+ *  Has the same effect as calling `match_apply' with `str' for each match of
+ *  the set, in the order they were passed to `match_set_create', but skips all
+ *  regular expressions which can't match.
+ *
+ * RETURN VALUE
+ *  Zero upon success, the last non-zero status returned by `match_apply'
+ *  otherwise.
+ */
+int match_set_apply (cu_match_set_t *set, const char *str);
+
 #endif /* UTILS_MATCH_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
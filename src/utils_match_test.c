@@ -0,0 +1,171 @@
+/**
+ * collectd - src/utils_match_test.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Checks match_apply(), which skips regexec(3) for regular expressions that
+ * are plain strings or start with one, against regexec(3) itself.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <regex.h>
+
+#include "utils_match.h"
+
+/* Provided by common.c and plugin.c in the daemon. */
+char *sstrncpy (char *dest, const char *src, size_t n) /* {{{ */
+{
+  strncpy (dest, src, n);
+  dest[n - 1] = 0;
+  return (dest);
+} /* }}} char *sstrncpy */
+
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  fprintf (stderr, "[severity %i] ", level);
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+  fprintf (stderr, "\n");
+} /* }}} void plugin_log */
+
+static const char *patterns[] =
+{
+  "foo",
+  "ab\\.c",
+  "a\\|b",
+  "\\(a\\)",
+  "x\\|",
+  "a|b",
+  "(a)",
+  "a.c",
+  "ab+c",
+  "foo[0-9]+",
+  "^foo",
+  "bar$",
+  "foo(bar|baz)",
+  "value=([0-9]+)"
+};
+
+static const char *inputs[] =
+{
+  "",
+  "foo",
+  "xfoox",
+  "ab.c",
+  "abxc",
+  "a|b",
+  "ab",
+  "(a)",
+  "a",
+  "x|",
+  "x|x|",
+  "foo12 bar",
+  "aaabbbc",
+  "foobaz bar",
+  "foo\nbar",
+  "value=42 value=23"
+};
+
+static char last_match[256];
+static int callback_num = 0;
+
+static int test_callback (const char __attribute__((unused)) *str,
+    char * const *matches, size_t matches_num,
+    void __attribute__((unused)) *user_data) /* {{{ */
+{
+  assert (matches_num > 0);
+  strncpy (last_match, matches[0], sizeof (last_match));
+  last_match[sizeof (last_match) - 1] = 0;
+  callback_num++;
+  return (0);
+} /* }}} int test_callback */
+
+static void check_pattern (const char *pattern) /* {{{ */
+{
+  cu_match_t *obj;
+  regex_t re;
+  size_t i;
+
+  obj = match_create_callback (pattern, NULL, test_callback, NULL);
+  assert (obj != NULL);
+  assert (regcomp (&re, pattern, REG_EXTENDED | REG_NEWLINE) == 0);
+
+  for (i = 0; i < sizeof (inputs) / sizeof (inputs[0]); i++)
+  {
+    regmatch_t pmatch[1];
+    int expected;
+    int status;
+
+    expected = callback_num;
+    if (regexec (&re, inputs[i], 1, pmatch, 0) == 0)
+      expected++;
+
+    last_match[0] = 0;
+    status = match_apply (obj, inputs[i]);
+    if ((status != 0) || (callback_num != expected))
+    {
+      fprintf (stderr, "\"%s\" on \"%s\": status %i, %s\n", pattern,
+          inputs[i], status,
+          (callback_num > expected) ? "unexpected match" : "no match");
+      exit (EXIT_FAILURE);
+    }
+
+    if (last_match[0] == 0)
+      continue;
+
+    if ((strlen (last_match) != (size_t) (pmatch[0].rm_eo - pmatch[0].rm_so))
+        || (strncmp (last_match, inputs[i] + pmatch[0].rm_so,
+            strlen (last_match)) != 0))
+    {
+      fprintf (stderr, "\"%s\" on \"%s\": matched \"%s\", regexec "
+          "matched \"%.*s\"\n", pattern, inputs[i], last_match,
+          (int) (pmatch[0].rm_eo - pmatch[0].rm_so),
+          inputs[i] + pmatch[0].rm_so);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  regfree (&re);
+  match_destroy (obj);
+} /* }}} void check_pattern */
+
+int main (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+    check_pattern (patterns[i]);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
@@ -0,0 +1,119 @@
+/**
+ * collectd - src/utils_pcap.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_PCAP_H
+#define UTILS_PCAP_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Minimal reader and writer for UDP datagrams in files using the classic
+ * "pcap" format, so that collectd network traffic can be recorded, inspected
+ * with tcpdump or wireshark and replayed. libpcap is not required.
+ */
+struct c_pcap_s;
+typedef struct c_pcap_s c_pcap_t;
+
+/*
+ * NAME
+ *   c_pcap_open_read
+ *
+ * DESCRIPTION
+ *   Opens a pcap file for reading. Captures with the Ethernet, Linux "cooked",
+ *   BSD loopback, raw IP and USER0 link types are understood; in the latter,
+ *   each record holds a bare UDP payload.
+ *
+ * RETURN VALUE
+ *   A c_pcap_t-pointer upon success or NULL upon failure, in which case
+ *   `errno' is set.
+ */
+c_pcap_t *c_pcap_open_read (const char *file);
+
+/*
+ * NAME
+ *   c_pcap_open_write
+ *
+ * DESCRIPTION
+ *   Creates (or truncates) a pcap file with the raw IP link type. Datagrams
+ *   are written with c_pcap_write_udp.
+ *
+ * RETURN VALUE
+ *   A c_pcap_t-pointer upon success or NULL upon failure, in which case
+ *   `errno' is set.
+ */
+c_pcap_t *c_pcap_open_write (const char *file);
+
+/*
+ * NAME
+ *   c_pcap_close
+ *
+ * DESCRIPTION
+ *   Flushes and closes the file and frees all memory used by `p'.
+ *
+ * RETURN VALUE
+ *   Zero upon success or an errno value if writing the file failed.
+ */
+int c_pcap_close (c_pcap_t *p);
+
+/*
+ * NAME
+ *   c_pcap_read_udp
+ *
+ * DESCRIPTION
+ *   Reads the next UDP datagram, skipping all other records. The payload
+ *   pointer is valid until the next call.
+ *
+ * PARAMETERS
+ *   `p'            Handle returned by c_pcap_open_read.
+ *   `ret_time'     Receives the time of the record in seconds since the
+ *                  epoch. May be NULL.
+ *   `ret_payload'  Receives a pointer to the UDP payload.
+ *   `ret_size'     Receives the size of the payload.
+ *
+ * RETURN VALUE
+ *   Zero upon success, ENOENT at the end of the file and another errno value
+ *   if the file is broken or reading failed.
+ */
+int c_pcap_read_udp (c_pcap_t *p, double *ret_time,
+    const void **ret_payload, size_t *ret_size);
+
+/*
+ * NAME
+ *   c_pcap_write_udp
+ *
+ * DESCRIPTION
+ *   Appends a UDP datagram with the given source and destination addresses.
+ *   Both addresses must belong to the same family, AF_INET or AF_INET6. If
+ *   `dst' is NULL, the unspecified address of the source's family is used.
+ *   Output is buffered, call c_pcap_close to make sure everything has been
+ *   written.
+ *
+ * RETURN VALUE
+ *   Zero upon success or an errno value otherwise.
+ */
+int c_pcap_write_udp (c_pcap_t *p, double time,
+    const struct sockaddr *src, const struct sockaddr *dst,
+    const void *payload, size_t size);
+
+#endif /* UTILS_PCAP_H */
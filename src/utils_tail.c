@@ -34,6 +34,10 @@ struct cu_tail_s
 	char  *file;
 	FILE  *fh;
 	struct stat stat;
+
+	/* See cu_tail_watched() and cu_tail_check(). */
+	_Bool watched;
+	_Bool check;
 };
 
 static int cu_tail_reopen (cu_tail_t *obj)
@@ -56,8 +60,12 @@ static int cu_tail_reopen (cu_tail_t *obj)
   /* The file is already open.. */
   if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino))
   {
-    /* Seek to the beginning if file was truncated */
-    if (stat_buf.st_size < obj->stat.st_size)
+    off_t pos = ftello (obj->fh);
+
+    /* Seek to the beginning if file was truncated. The size may be outdated
+     * if the file is watched, so compare with the position, too. */
+    if ((stat_buf.st_size < obj->stat.st_size)
+	|| ((pos > 0) && (stat_buf.st_size < pos)))
     {
       INFO ("utils_tail: File `%s' was truncated.", obj->file);
       status = fseek (obj->fh, 0, SEEK_SET);
@@ -70,6 +78,10 @@ static int cu_tail_reopen (cu_tail_t *obj)
 	obj->fh = NULL;
 	return (-1);
       }
+
+      /* There may be new data at the beginning already. */
+      memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
+      return (0);
     }
     memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
     return (1);
@@ -141,6 +153,17 @@ int cu_tail_destroy (cu_tail_t *obj)
 	return (0);
 } /* int cu_tail_destroy */
 
+void cu_tail_watched (cu_tail_t *obj, _Bool watched)
+{
+	obj->watched = watched;
+	obj->check = 1;
+} /* void cu_tail_watched */
+
+void cu_tail_check (cu_tail_t *obj)
+{
+	obj->check = 1;
+} /* void cu_tail_check */
+
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
 {
   int status;
@@ -216,40 +239,140 @@ int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
 int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 		void *data)
 {
-	int status;
+	size_t buf_size;
+	size_t buf_fill = 0;
+	_Bool reopened = 0;
+	_Bool have_data = 0;
+	int status = 0;
+
+	if (buflen < 2)
+	{
+		ERROR ("utils_tail: cu_tail_read: buflen too small: %i bytes.",
+				buflen);
+		return (-1);
+	}
+	/* Leave room for the terminating null byte. */
+	buf_size = ((size_t) buflen) - 1;
 
 	while (42)
 	{
+		char *line;
+		char *end;
 		size_t len;
 
-		status = cu_tail_readline (obj, buf, buflen);
-		if (status != 0)
+		if (obj->fh == NULL)
 		{
-			ERROR ("utils_tail: cu_tail_read: cu_tail_readline "
-					"failed.");
-			break;
+			status = cu_tail_reopen (obj);
+			if (status < 0)
+				break;
 		}
+		assert (obj->fh != NULL);
 
-		/* check for EOF */
-		if (buf[0] == 0)
-			break;
+		/* Read as much as fits into the buffer instead of line by line.
+		 * The lines are split with memchr(3) below. */
+		clearerr (obj->fh);
+		len = fread (buf + buf_fill, 1, buf_size - buf_fill, obj->fh);
+		if (len == 0)
+		{
+			/* Pass an incomplete last line on, like fgets(3) would. */
+			if (buf_fill > 0)
+			{
+				buf[buf_fill] = 0;
+				buf_fill = 0;
+				status = (*callback) (data, buf, buflen);
+				if (status != 0)
+				{
+					ERROR ("utils_tail: cu_tail_read: callback returned "
+							"status %i.", status);
+					break;
+				}
+			}
+
+			if (ferror (obj->fh) != 0)
+			{
+				if (reopened)
+				{
+					char errbuf[1024];
+					WARNING ("utils_tail: fread (%s) returned an error: %s",
+							obj->file,
+							sstrerror (errno, errbuf, sizeof (errbuf)));
+					fclose (obj->fh);
+					obj->fh = NULL;
+					status = -1;
+					break;
+				}
+
+				/* Force `cu_tail_reopen' to reopen the file. */
+				fclose (obj->fh);
+				obj->fh = NULL;
+			}
+
+			/* If somebody else watches the file for us, only stat(2)
+			 * it when asked to or if we were woken up for nothing,
+			 * e.g. because the file was truncated. */
+			if ((obj->fh != NULL) && obj->watched && !obj->check
+					&& have_data)
+			{
+				status = 0;
+				break;
+			}
+			obj->check = 0;
 
-		len = strlen (buf);
-		while (len > 0) {
-			if (buf[len - 1] != '\n')
+			/* EOF: Check if the file was moved away and reopen the new
+			 * file if so. */
+			status = cu_tail_reopen (obj);
+			if (status < 0)
 				break;
-			buf[len - 1] = '\0';
-			len--;
+			/* File end reached and file not reopened -> done. */
+			else if (status > 0)
+			{
+				status = 0;
+				break;
+			}
+
+			reopened = 1;
+			continue;
 		}
+		reopened = 0;
+		have_data = 1;
+		buf_fill += len;
 
-		status = callback (data, buf, buflen);
+		line = buf;
+		while ((end = memchr (line, '\n', buf_fill - (line - buf))) != NULL)
+		{
+			*end = 0;
+			status = (*callback) (data, line, (int) (end - line + 1));
+			if (status != 0)
+				break;
+			line = end + 1;
+		}
 		if (status != 0)
 		{
 			ERROR ("utils_tail: cu_tail_read: callback returned "
 					"status %i.", status);
 			break;
 		}
-	}
+
+		buf_fill -= (size_t) (line - buf);
+		if (buf_fill == buf_size)
+		{
+			/* The line doesn't fit into the buffer. Pass the first
+			 * part on, like fgets(3) would. */
+			buf[buf_fill] = 0;
+			buf_fill = 0;
+			status = (*callback) (data, buf, buflen);
+			if (status != 0)
+			{
+				ERROR ("utils_tail: cu_tail_read: callback returned "
+						"status %i.", status);
+				break;
+			}
+		}
+		else if ((buf_fill > 0) && (line != buf))
+		{
+			memmove (buf, line, buf_fill);
+		}
+	} /* while (42) */
 
 	return status;
 } /* int cu_tail_read */
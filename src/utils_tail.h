@@ -54,6 +54,26 @@ cu_tail_t *cu_tail_create (const char *file);
  */
 int cu_tail_destroy (cu_tail_t *obj);
 
+/*
+ * cu_tail_watched
+ *
+ * By default `cu_tail_read' calls stat(2) each time it reaches the end of the
+ * file, to find out whether the file was rotated or truncated. If `watched'
+ * is true, the caller promises to watch the file by other means, e.g.
+ * inotify(7), and to call `cu_tail_check' when the file may have been
+ * rotated. The check is then only done after `cu_tail_check' was called or
+ * when no data at all could be read.
+ */
+void cu_tail_watched (cu_tail_t *obj, _Bool watched);
+
+/*
+ * cu_tail_check
+ *
+ * Makes the next call of `cu_tail_read' check whether the file was rotated or
+ * truncated, see `cu_tail_watched'.
+ */
+void cu_tail_check (cu_tail_t *obj);
+
 /*
  * cu_tail_readline
  *
@@ -71,9 +91,12 @@ int cu_tail_destroy (cu_tail_t *obj);
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
  *
- * Reads from the file until eof condition or an error is encountered.
+ * Reads from the file until eof condition or an error is encountered and
+ * calls `callback' for each line, without the trailing newline. The file is
+ * read in blocks of up to `buflen' bytes, so a larger buffer means fewer
+ * reads. Lines longer than `buflen - 1' bytes are split.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
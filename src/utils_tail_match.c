@@ -31,6 +31,14 @@
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
+#include <pthread.h>
+
+/* Size of the buffer the file is read into. Lines longer than this are
+ * split. */
+#define TAIL_MATCH_BUFFER_SIZE 65536
+
+#define TAIL_MATCH_FLAGS_STATS 0x01
+
 struct cu_tail_match_simple_s
 {
   char plugin[DATA_MAX_NAME_LEN];
@@ -53,9 +61,24 @@ struct cu_tail_match_s
 {
   int flags;
   cu_tail_t *tail;
+  char *buffer;
+
+  /* Serializes reading and submitting, which may happen in different
+   * threads. */
+  pthread_mutex_t lock;
 
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* Combines all matches, built by `tail_match_read'. */
+  cu_match_set_t *match_set;
+  _Bool match_set_failed;
+
+  /* Statistics, see `tail_match_report_stats'. */
+  char stats_plugin[DATA_MAX_NAME_LEN];
+  char stats_plugin_instance[DATA_MAX_NAME_LEN];
+  derive_t lines_num;
+  cdtime_t match_time;
 };
 
 /*
@@ -103,14 +126,77 @@ static int tail_callback (void *data, char *buf,
     int __attribute__((unused)) buflen)
 {
   cu_tail_match_t *obj = (cu_tail_match_t *) data;
+  cdtime_t start = 0;
   size_t i;
 
-  for (i = 0; i < obj->matches_num; i++)
-    match_apply (obj->matches[i].match, buf);
+  if (obj->flags & TAIL_MATCH_FLAGS_STATS)
+    start = cdtime ();
+
+  if (obj->match_set != NULL)
+    match_set_apply (obj->match_set, buf);
+  else
+    for (i = 0; i < obj->matches_num; i++)
+      match_apply (obj->matches[i].match, buf);
+
+  if (obj->flags & TAIL_MATCH_FLAGS_STATS)
+  {
+    obj->lines_num++;
+    obj->match_time += cdtime () - start;
+  }
 
   return (0);
 } /* int tail_callback */
 
+static void tail_match_build_set (cu_tail_match_t *obj)
+{
+  cu_match_t **matches;
+  size_t i;
+
+  matches = calloc (obj->matches_num, sizeof (*matches));
+  if (matches == NULL)
+  {
+    ERROR ("tail_match: calloc failed.");
+    obj->match_set_failed = 1;
+    return;
+  }
+
+  for (i = 0; i < obj->matches_num; i++)
+    matches[i] = obj->matches[i].match;
+
+  obj->match_set = match_set_create (matches, obj->matches_num);
+  if (obj->match_set == NULL)
+  {
+    /* Not fatal: tail_callback falls back to trying all matches. */
+    WARNING ("tail_match: Combining the matches failed.");
+    obj->match_set_failed = 1;
+  }
+
+  sfree (matches);
+} /* void tail_match_build_set */
+
+static void tail_match_submit_stats (cu_tail_match_t *obj)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[1];
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, obj->stats_plugin, sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, obj->stats_plugin_instance,
+      sizeof (vl.plugin_instance));
+
+  values[0].derive = obj->lines_num;
+  sstrncpy (vl.type, "derive", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "lines", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  values[0].derive = (derive_t) CDTIME_T_TO_MS (obj->match_time);
+  sstrncpy (vl.type, "total_time_in_ms", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "match", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+} /* void tail_match_submit_stats */
+
 /*
  * Public functions
  */
@@ -130,6 +216,16 @@ cu_tail_match_t *tail_match_create (const char *filename)
     return (NULL);
   }
 
+  obj->buffer = malloc (TAIL_MATCH_BUFFER_SIZE);
+  if (obj->buffer == NULL)
+  {
+    cu_tail_destroy (obj->tail);
+    sfree (obj);
+    return (NULL);
+  }
+
+  pthread_mutex_init (&obj->lock, /* attr = */ NULL);
+
   return (obj);
 } /* cu_tail_match_t *tail_match_create */
 
@@ -146,6 +242,9 @@ void tail_match_destroy (cu_tail_match_t *obj)
     obj->tail = NULL;
   }
 
+  match_set_destroy (obj->match_set);
+  obj->match_set = NULL;
+
   for (i = 0; i < obj->matches_num; i++)
   {
     cu_tail_match_match_t *match = obj->matches + i;
@@ -162,6 +261,8 @@ void tail_match_destroy (cu_tail_match_t *obj)
   }
 
   sfree (obj->matches);
+  sfree (obj->buffer);
+  pthread_mutex_destroy (&obj->lock);
   sfree (obj);
 } /* void tail_match_destroy */
 
@@ -172,6 +273,11 @@ int tail_match_add_match (cu_tail_match_t *obj, cu_match_t *match,
 {
   cu_tail_match_match_t *temp;
 
+  /* The set is rebuilt with the new match on the next read. */
+  match_set_destroy (obj->match_set);
+  obj->match_set = NULL;
+  obj->match_set_failed = 0;
+
   temp = (cu_tail_match_match_t *) realloc (obj->matches,
       sizeof (cu_tail_match_match_t) * (obj->matches_num + 1));
   if (temp == NULL)
@@ -233,20 +339,47 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
   return (status);
 } /* int tail_match_add_match_simple */
 
-int tail_match_read (cu_tail_match_t *obj)
+int tail_match_report_stats (cu_tail_match_t *obj,
+    const char *plugin, const char *plugin_instance)
+{
+  if ((obj == NULL) || (plugin == NULL))
+    return (-1);
+
+  sstrncpy (obj->stats_plugin, plugin, sizeof (obj->stats_plugin));
+  if (plugin_instance != NULL)
+    sstrncpy (obj->stats_plugin_instance, plugin_instance,
+	sizeof (obj->stats_plugin_instance));
+  else
+    obj->stats_plugin_instance[0] = 0;
+
+  obj->flags |= TAIL_MATCH_FLAGS_STATS;
+
+  return (0);
+} /* int tail_match_report_stats */
+
+static int tail_match_update_locked (cu_tail_match_t *obj)
 {
-  char buffer[4096];
   int status;
-  size_t i;
 
-  status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
-      (void *) obj);
+  if ((obj->match_set == NULL) && !obj->match_set_failed
+      && (obj->matches_num > 0))
+    tail_match_build_set (obj);
+
+  status = cu_tail_read (obj->tail, obj->buffer, TAIL_MATCH_BUFFER_SIZE,
+      tail_callback, (void *) obj);
   if (status != 0)
   {
     ERROR ("tail_match: cu_tail_read failed.");
     return (status);
   }
 
+  return (0);
+} /* int tail_match_update_locked */
+
+static int tail_match_submit_locked (cu_tail_match_t *obj)
+{
+  size_t i;
+
   for (i = 0; i < obj->matches_num; i++)
   {
     cu_tail_match_match_t *lt_match = obj->matches + i;
@@ -257,7 +390,59 @@ int tail_match_read (cu_tail_match_t *obj)
     (*lt_match->submit) (lt_match->match, lt_match->user_data);
   }
 
+  if (obj->flags & TAIL_MATCH_FLAGS_STATS)
+    tail_match_submit_stats (obj);
+
   return (0);
+} /* int tail_match_submit_locked */
+
+int tail_match_update (cu_tail_match_t *obj)
+{
+  int status;
+
+  pthread_mutex_lock (&obj->lock);
+  status = tail_match_update_locked (obj);
+  pthread_mutex_unlock (&obj->lock);
+
+  return (status);
+} /* int tail_match_update */
+
+int tail_match_submit (cu_tail_match_t *obj)
+{
+  int status;
+
+  pthread_mutex_lock (&obj->lock);
+  status = tail_match_submit_locked (obj);
+  pthread_mutex_unlock (&obj->lock);
+
+  return (status);
+} /* int tail_match_submit */
+
+int tail_match_read (cu_tail_match_t *obj)
+{
+  int status;
+
+  pthread_mutex_lock (&obj->lock);
+  status = tail_match_update_locked (obj);
+  if (status == 0)
+    status = tail_match_submit_locked (obj);
+  pthread_mutex_unlock (&obj->lock);
+
+  return (status);
 } /* int tail_match_read */
 
+void tail_match_watched (cu_tail_match_t *obj, _Bool watched)
+{
+  pthread_mutex_lock (&obj->lock);
+  cu_tail_watched (obj->tail, watched);
+  pthread_mutex_unlock (&obj->lock);
+} /* void tail_match_watched */
+
+void tail_match_check (cu_tail_match_t *obj)
+{
+  pthread_mutex_lock (&obj->lock);
+  cu_tail_check (obj->tail);
+  pthread_mutex_unlock (&obj->lock);
+} /* void tail_match_check */
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -107,6 +107,23 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
     const char *plugin, const char *plugin_instance,
     const char *type, const char *type_instance);
 
+/*
+ * NAME
+ *   tail_match_report_stats
+ *
+ * DESCRIPTION
+ *   Enables statistics about the file: After each read, the number of lines
+ *   read so far is dispatched with the type "derive" and the type instance
+ *   "lines" and the time spent matching them, in milliseconds, with the type
+ *   "total_time_in_ms" and the type instance "match". `plugin' and
+ *   `plugin_instance' are used to dispatch these values.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int tail_match_report_stats (cu_tail_match_t *obj,
+    const char *plugin, const char *plugin_instance);
+
 /*
  * NAME
  *   tail_match_read
@@ -114,7 +131,9 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
  * DESCRIPTION
  *   This function should be called periodically by plugins. It reads new lines
  *   from the logfile using `utils_tail' and tries to match them using all
- *   added `utils_match' objects.
+ *   added `utils_match' objects. The regular expressions are combined, see
+ *   `match_set_create', so that each line is scanned only once to find the
+ *   regular expressions that may match.
  *   After all lines have been read and processed, the submit_match callback is
  *   called or, in case of tail_match_add_match_simple, the data is dispatched to
  *   the daemon directly.
@@ -124,4 +143,53 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
 */
 int tail_match_read (cu_tail_match_t *obj);
 
+/*
+ * NAME
+ *   tail_match_update
+ *
+ * DESCRIPTION
+ *   Reads new lines from the logfile and matches them, like
+ *   `tail_match_read', but does not call the submit_match callbacks. This
+ *   allows reading the file as soon as it changes, while values are still
+ *   dispatched in regular intervals with `tail_match_submit'.
+ *   All tail_match functions may be called from different threads.
+ *
+ * RETURN VALUE
+ *   Zero on success, nonzero on failure.
+ */
+int tail_match_update (cu_tail_match_t *obj);
+
+/*
+ * NAME
+ *   tail_match_submit
+ *
+ * DESCRIPTION
+ *   Calls the submit_match callbacks, like `tail_match_read' does after
+ *   reading the file, without reading the file.
+ *
+ * RETURN VALUE
+ *   Zero on success, nonzero on failure.
+ */
+int tail_match_submit (cu_tail_match_t *obj);
+
+/*
+ * NAME
+ *   tail_match_watched
+ *
+ * DESCRIPTION
+ *   Tells the object whether the file is watched for changes, see
+ *   `cu_tail_watched' in utils_tail.h. If it is, the caller must call
+ *   `tail_match_check' whenever the file may have been rotated.
+ */
+void tail_match_watched (cu_tail_match_t *obj, _Bool watched);
+
+/*
+ * NAME
+ *   tail_match_check
+ *
+ * DESCRIPTION
+ *   Makes the next read check whether the file was rotated or truncated.
+ */
+void tail_match_check (cu_tail_match_t *obj);
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -54,7 +54,10 @@
 #include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
 
 #ifndef WG_DEFAULT_NODE
 # define WG_DEFAULT_NODE "localhost"
@@ -73,9 +76,43 @@
 # define WG_SEND_BUF_SIZE 1428
 #endif
 
+/* Size of one spool segment. A line never spans two segments. */
+#ifndef WG_SPOOL_SEGMENT_SIZE
+# define WG_SPOOL_SEGMENT_SIZE 16384
+#endif
+
+/* Number of segments passed to a single writev(2) call. */
+#ifndef WG_SPOOL_IOV_MAX
+# define WG_SPOOL_IOV_MAX 64
+#endif
+
+/* Partially filled segments are sent at least this often (in seconds). */
+#ifndef WG_SPOOL_SEND_INTERVAL
+# define WG_SPOOL_SEND_INTERVAL 1
+#endif
+
+/* Bounds of the exponential reconnect backoff (in seconds). */
+#ifndef WG_RECONNECT_MIN
+# define WG_RECONNECT_MIN 1
+#endif
+#ifndef WG_RECONNECT_MAX
+# define WG_RECONNECT_MAX 64
+#endif
+
 /*
  * Private variables
  */
+struct wg_segment_s;
+typedef struct wg_segment_s wg_segment_t;
+struct wg_segment_s
+{
+    wg_segment_t *next;
+    size_t        fill;
+    size_t        offset; /* bytes already sent */
+    size_t        lines;
+    char          data[WG_SPOOL_SEGMENT_SIZE];
+};
+
 struct wg_callback
 {
     int      sock_fd;
@@ -97,6 +134,28 @@ struct wg_callback
 
     pthread_mutex_t send_lock;
     c_complain_t init_complaint;
+
+    /* Spool mode: lines are appended to a list of segments under
+     * "send_lock" and written by a dedicated sender thread. */
+    size_t          spool_size;
+    _Bool           report_stats;
+
+    wg_segment_t   *spool_head;
+    wg_segment_t   *spool_tail;
+    wg_segment_t   *spool_free;
+    size_t          spool_segments;     /* allocated, including in-flight */
+    size_t          spool_segments_max;
+    size_t          spool_bytes;        /* queued, not yet sent */
+
+    pthread_t       sender_thread;
+    _Bool           sender_running;
+    _Bool           sender_stop;
+    _Bool           flush_requested;
+    pthread_cond_t  spool_cond;
+
+    uint64_t        stats_lines_spooled;
+    uint64_t        stats_lines_sent;
+    uint64_t        stats_lines_dropped;
 };
 
 
@@ -237,6 +296,481 @@ static int wg_callback_init (struct wg_callback *cb)
     return (0);
 }
 
+/*
+ * Spool mode
+ */
+static wg_segment_t *wg_segment_alloc (struct wg_callback *cb)
+{
+    wg_segment_t *seg;
+
+    if (cb->spool_free != NULL)
+    {
+        seg = cb->spool_free;
+        cb->spool_free = seg->next;
+    }
+    else if (cb->spool_segments < cb->spool_segments_max)
+    {
+        seg = malloc (sizeof (*seg));
+        if (seg == NULL)
+            return (NULL);
+        cb->spool_segments++;
+    }
+    else
+    {
+        return (NULL);
+    }
+
+    seg->next = NULL;
+    seg->fill = 0;
+    seg->offset = 0;
+    seg->lines = 0;
+    return (seg);
+}
+
+static void wg_segment_release (struct wg_callback *cb, wg_segment_t *seg)
+{
+    seg->next = cb->spool_free;
+    cb->spool_free = seg;
+}
+
+static void wg_segment_list_free (wg_segment_t *seg)
+{
+    while (seg != NULL)
+    {
+        wg_segment_t *next = seg->next;
+        sfree (seg);
+        seg = next;
+    }
+}
+
+/* Connects without blocking for longer than the interval, so the sender
+ * thread remains responsive to shutdown requests. Sets cb->sock_fd. */
+static int wg_connect_nonblocking (struct wg_callback *cb)
+{
+    struct addrinfo ai_hints;
+    struct addrinfo *ai_list;
+    struct addrinfo *ai_ptr;
+    int status;
+    int fd = -1;
+
+    const char *node = cb->node ? cb->node : WG_DEFAULT_NODE;
+    const char *service = cb->service ? cb->service : WG_DEFAULT_SERVICE;
+
+    memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+    ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+    ai_hints.ai_family = AF_UNSPEC;
+    ai_hints.ai_socktype = SOCK_STREAM;
+
+    ai_list = NULL;
+
+    status = getaddrinfo (node, service, &ai_hints, &ai_list);
+    if (status != 0)
+    {
+        c_complain (LOG_ERR, &cb->init_complaint,
+                "write_graphite plugin: getaddrinfo (%s, %s) failed: %s",
+                node, service, gai_strerror (status));
+        return (-1);
+    }
+
+    for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+    {
+        struct pollfd pfd;
+        int timeout_ms;
+        int so_error = 0;
+        socklen_t so_error_len = sizeof (so_error);
+
+        fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+                ai_ptr->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+        status = connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        if ((status != 0) && (errno == EINPROGRESS))
+        {
+            timeout_ms = (int) CDTIME_T_TO_MS (plugin_get_interval ());
+
+            memset (&pfd, 0, sizeof (pfd));
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+
+            status = poll (&pfd, 1, timeout_ms);
+            if (status == 1)
+            {
+                status = getsockopt (fd, SOL_SOCKET, SO_ERROR,
+                        &so_error, &so_error_len);
+                if ((status == 0) && (so_error != 0))
+                {
+                    errno = so_error;
+                    status = -1;
+                }
+            }
+            else
+            {
+                if (status == 0)
+                    errno = ETIMEDOUT;
+                status = -1;
+            }
+        }
+
+        if (status != 0)
+        {
+            close (fd);
+            fd = -1;
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo (ai_list);
+
+    if (fd < 0)
+    {
+        char errbuf[1024];
+        c_complain (LOG_ERR, &cb->init_complaint,
+                "write_graphite plugin: Connecting to %s:%s failed. "
+                "The last error was: %s", node, service,
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    c_release (LOG_INFO, &cb->init_complaint,
+            "write_graphite plugin: Successfully connected to %s:%s.",
+            node, service);
+
+    cb->sock_fd = fd;
+    return (0);
+}
+
+/* Writes the segments in "list" using writev(2). Returns the first segment
+ * that could not be sent completely, or NULL if everything has been sent.
+ * Completely sent segments are returned to the free list. */
+static wg_segment_t *wg_spool_write (struct wg_callback *cb,
+        wg_segment_t *list)
+{
+    while (list != NULL)
+    {
+        struct iovec iov[WG_SPOOL_IOV_MAX];
+        struct pollfd pfd;
+        wg_segment_t *seg;
+        ssize_t status;
+        size_t written;
+        int iov_num = 0;
+
+        for (seg = list; (seg != NULL) && (iov_num < WG_SPOOL_IOV_MAX);
+                seg = seg->next)
+        {
+            iov[iov_num].iov_base = seg->data + seg->offset;
+            iov[iov_num].iov_len = seg->fill - seg->offset;
+            iov_num++;
+        }
+
+        memset (&pfd, 0, sizeof (pfd));
+        pfd.fd = cb->sock_fd;
+        pfd.events = POLLOUT;
+
+        status = poll (&pfd, 1,
+                (int) CDTIME_T_TO_MS (plugin_get_interval ()));
+        if (status == 0)
+        {
+            errno = ETIMEDOUT;
+            status = -1;
+        }
+        else if (status > 0)
+        {
+            status = writev (cb->sock_fd, iov, iov_num);
+        }
+
+        if (status < 0)
+        {
+            char errbuf[1024];
+
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                continue;
+
+            ERROR ("write_graphite plugin: send failed: %s",
+                    sstrerror (errno, errbuf, sizeof (errbuf)));
+            close (cb->sock_fd);
+            cb->sock_fd = -1;
+            return (list);
+        }
+
+        written = (size_t) status;
+        while ((list != NULL) && (written > 0))
+        {
+            size_t len = list->fill - list->offset;
+
+            if (written < len)
+            {
+                list->offset += written;
+                break;
+            }
+
+            written -= len;
+
+            seg = list;
+            list = list->next;
+
+            pthread_mutex_lock (&cb->send_lock);
+            cb->stats_lines_sent += seg->lines;
+            cb->spool_bytes -= seg->fill;
+            wg_segment_release (cb, seg);
+            pthread_mutex_unlock (&cb->send_lock);
+        }
+    }
+
+    return (NULL);
+}
+
+/* After a connection has been lost, the first segment may end with a
+ * partially sent line. Skip the rest of that line so the new connection
+ * starts at a line boundary. */
+static void wg_spool_skip_partial_line (struct wg_callback *cb,
+        wg_segment_t *seg)
+{
+    char *eol;
+
+    if ((seg == NULL) || (seg->offset == 0)
+            || (seg->data[seg->offset - 1] == '\n'))
+        return;
+
+    eol = memchr (seg->data + seg->offset, '\n', seg->fill - seg->offset);
+    if (eol == NULL)
+        seg->offset = seg->fill;
+    else
+        seg->offset = (size_t) (eol - seg->data) + 1;
+
+    if (seg->lines > 0)
+        seg->lines--;
+    cb->stats_lines_dropped++;
+}
+
+static void *wg_sender_thread (void *arg)
+{
+    struct wg_callback *cb = arg;
+    cdtime_t backoff = TIME_T_TO_CDTIME_T (WG_RECONNECT_MIN);
+    cdtime_t reconnect_time = 0;
+
+    pthread_mutex_lock (&cb->send_lock);
+    while (42)
+    {
+        wg_segment_t *list;
+        wg_segment_t *rest;
+        struct timespec ts_wait;
+
+        if (cb->sock_fd < 0)
+        {
+            cdtime_t now = cdtime ();
+
+            if (cb->sender_stop)
+                break;
+
+            if (now < reconnect_time)
+            {
+                CDTIME_T_TO_TIMESPEC (reconnect_time, &ts_wait);
+                pthread_cond_timedwait (&cb->spool_cond, &cb->send_lock,
+                        &ts_wait);
+                continue;
+            }
+
+            pthread_mutex_unlock (&cb->send_lock);
+            wg_connect_nonblocking (cb);
+            pthread_mutex_lock (&cb->send_lock);
+
+            if (cb->sock_fd < 0)
+            {
+                reconnect_time = cdtime () + backoff;
+                backoff *= 2;
+                if (backoff > TIME_T_TO_CDTIME_T (WG_RECONNECT_MAX))
+                    backoff = TIME_T_TO_CDTIME_T (WG_RECONNECT_MAX);
+                continue;
+            }
+
+            backoff = TIME_T_TO_CDTIME_T (WG_RECONNECT_MIN);
+        }
+
+        /* Wait until a segment is full, a flush has been requested or the
+         * send interval has passed. */
+        if (!cb->sender_stop && !cb->flush_requested
+                && ((cb->spool_head == NULL)
+                    || (cb->spool_head == cb->spool_tail)))
+        {
+            CDTIME_T_TO_TIMESPEC (cdtime ()
+                    + TIME_T_TO_CDTIME_T (WG_SPOOL_SEND_INTERVAL), &ts_wait);
+            pthread_cond_timedwait (&cb->spool_cond, &cb->send_lock, &ts_wait);
+        }
+
+        cb->flush_requested = 0;
+
+        list = cb->spool_head;
+        cb->spool_head = NULL;
+        cb->spool_tail = NULL;
+
+        if (list == NULL)
+        {
+            if (cb->sender_stop)
+                break;
+            continue;
+        }
+
+        pthread_mutex_unlock (&cb->send_lock);
+        rest = wg_spool_write (cb, list);
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (rest != NULL)
+        {
+            wg_segment_t *last;
+
+            /* Put unsent segments back in front of the spool. */
+            wg_spool_skip_partial_line (cb, rest);
+            for (last = rest; last->next != NULL; last = last->next)
+                /* do nothing */;
+            last->next = cb->spool_head;
+            cb->spool_head = rest;
+            if (cb->spool_tail == NULL)
+                cb->spool_tail = last;
+
+            reconnect_time = cdtime () + backoff;
+
+            if (cb->sender_stop)
+                break;
+        }
+    }
+    pthread_mutex_unlock (&cb->send_lock);
+
+    return ((void *) 0);
+}
+
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_spool_append (struct wg_callback *cb,
+        char const *message, size_t message_len)
+{
+    wg_segment_t *seg = cb->spool_tail;
+
+    if (!cb->sender_running && !cb->sender_stop)
+    {
+        int status = plugin_thread_create (&cb->sender_thread,
+                /* attr = */ NULL, wg_sender_thread, cb);
+        if (status != 0)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: pthread_create failed: %s",
+                    sstrerror (status, errbuf, sizeof (errbuf)));
+            return (-1);
+        }
+        cb->sender_running = 1;
+    }
+
+    if ((seg == NULL) || ((WG_SPOOL_SEGMENT_SIZE - seg->fill) < message_len))
+    {
+        seg = wg_segment_alloc (cb);
+        if (seg == NULL)
+        {
+            cb->stats_lines_dropped++;
+            return (-1);
+        }
+
+        if (cb->spool_tail == NULL)
+            cb->spool_head = seg;
+        else
+            cb->spool_tail->next = seg;
+        cb->spool_tail = seg;
+
+        /* The previous segment is complete. */
+        if (cb->spool_head != cb->spool_tail)
+            pthread_cond_signal (&cb->spool_cond);
+    }
+
+    memcpy (seg->data + seg->fill, message, message_len);
+    seg->fill += message_len;
+    seg->lines++;
+    cb->spool_bytes += message_len;
+    cb->stats_lines_spooled++;
+
+    return (0);
+}
+
+static void wg_spool_shutdown (struct wg_callback *cb)
+{
+    pthread_mutex_lock (&cb->send_lock);
+    cb->sender_stop = 1;
+    pthread_cond_signal (&cb->spool_cond);
+    pthread_mutex_unlock (&cb->send_lock);
+
+    if (cb->sender_running)
+    {
+        pthread_join (cb->sender_thread, /* retval = */ NULL);
+        cb->sender_running = 0;
+    }
+
+    if (cb->spool_head != NULL)
+    {
+        uint64_t lines = 0;
+        wg_segment_t *seg;
+
+        for (seg = cb->spool_head; seg != NULL; seg = seg->next)
+            lines += seg->lines;
+        WARNING ("write_graphite plugin: Dropping %"PRIu64" spooled lines "
+                "on shutdown.", lines);
+    }
+
+    wg_segment_list_free (cb->spool_head);
+    wg_segment_list_free (cb->spool_free);
+    cb->spool_head = NULL;
+    cb->spool_tail = NULL;
+    cb->spool_free = NULL;
+}
+
+static int wg_stats_read (user_data_t *user_data)
+{
+    struct wg_callback *cb = user_data->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    uint64_t spooled;
+    uint64_t sent;
+    uint64_t dropped;
+    size_t bytes;
+
+    pthread_mutex_lock (&cb->send_lock);
+    spooled = cb->stats_lines_spooled;
+    sent = cb->stats_lines_sent;
+    dropped = cb->stats_lines_dropped;
+    bytes = cb->spool_bytes;
+    pthread_mutex_unlock (&cb->send_lock);
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_graphite", sizeof (vl.plugin));
+    if (cb->name != NULL)
+        sstrncpy (vl.plugin_instance, cb->name, sizeof (vl.plugin_instance));
+
+    sstrncpy (vl.type, "total_values", sizeof (vl.type));
+
+    values[0].derive = (derive_t) spooled;
+    sstrncpy (vl.type_instance, "lines-spooled", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = (derive_t) sent;
+    sstrncpy (vl.type_instance, "lines-sent", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = (derive_t) dropped;
+    sstrncpy (vl.type_instance, "lines-dropped", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].gauge = (gauge_t) bytes;
+    sstrncpy (vl.type, "bytes", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "spool", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    return (0);
+}
+
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
@@ -246,11 +780,16 @@ static void wg_callback_free (void *data)
 
     cb = data;
 
+    if (cb->spool_size > 0)
+        wg_spool_shutdown (cb);
+
     pthread_mutex_lock (&cb->send_lock);
 
-    wg_flush_nolock (/* timeout = */ 0, cb);
+    if (cb->spool_size == 0)
+        wg_flush_nolock (/* timeout = */ 0, cb);
 
-    close(cb->sock_fd);
+    if (cb->sock_fd >= 0)
+        close(cb->sock_fd);
     cb->sock_fd = -1;
 
     sfree(cb->name);
@@ -259,7 +798,9 @@ static void wg_callback_free (void *data)
     sfree(cb->prefix);
     sfree(cb->postfix);
 
+    pthread_mutex_unlock (&cb->send_lock);
     pthread_mutex_destroy (&cb->send_lock);
+    pthread_cond_destroy (&cb->spool_cond);
 
     sfree(cb);
 }
@@ -278,6 +819,15 @@ static int wg_flush (cdtime_t timeout,
 
     pthread_mutex_lock (&cb->send_lock);
 
+    if (cb->spool_size > 0)
+    {
+        /* The sender thread sends everything it finds in the spool. */
+        cb->flush_requested = 1;
+        pthread_cond_signal (&cb->spool_cond);
+        pthread_mutex_unlock (&cb->send_lock);
+        return (0);
+    }
+
     if (cb->sock_fd < 0)
     {
         status = wg_callback_init (cb);
@@ -304,6 +854,13 @@ static int wg_send_message (char const *message, struct wg_callback *cb)
 
     pthread_mutex_lock (&cb->send_lock);
 
+    if (cb->spool_size > 0)
+    {
+        status = wg_spool_append (cb, message, message_len);
+        pthread_mutex_unlock (&cb->send_lock);
+        return (status);
+    }
+
     if (cb->sock_fd < 0)
     {
         status = wg_callback_init (cb);
@@ -459,6 +1016,7 @@ static int wg_config_node (oconfig_item_t *ci)
     }
 
     pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    pthread_cond_init (&cb->spool_cond, /* attr = */ NULL);
     C_COMPLAIN_INIT (&cb->init_complaint);
 
     for (i = 0; i < ci->children_num; i++)
@@ -484,6 +1042,16 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("SpoolSize", child->key) == 0)
+        {
+            int tmp = 0;
+            if ((cf_util_get_int (child, &tmp) == 0) && (tmp > 0))
+                cb->spool_size = (size_t) tmp;
+            else
+                cb->spool_size = 0;
+        }
+        else if (strcasecmp ("ReportStats", child->key) == 0)
+            cf_util_get_boolean (child, &cb->report_stats);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -500,6 +1068,13 @@ static int wg_config_node (oconfig_item_t *ci)
         ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s",
                 cb->name);
 
+    if (cb->spool_size > 0)
+    {
+        cb->spool_segments_max = cb->spool_size / WG_SPOOL_SEGMENT_SIZE;
+        if (cb->spool_segments_max < 2)
+            cb->spool_segments_max = 2;
+    }
+
     memset (&user_data, 0, sizeof (user_data));
     user_data.data = cb;
     user_data.free_func = wg_callback_free;
@@ -508,6 +1083,10 @@ static int wg_config_node (oconfig_item_t *ci)
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
 
+    if (cb->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                wg_stats_read, /* interval = */ NULL, &user_data);
+
     return (0);
 }
 
@@ -29,6 +29,7 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 #include "utils_format_json.h"
+#include "utils_format_network.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -36,6 +37,13 @@
 
 #include <curl/curl.h>
 
+#ifndef WH_DEFAULT_BUFFER_SIZE
+# define WH_DEFAULT_BUFFER_SIZE 4096
+#endif
+
+/* Must hold at least one PUTVAL command, see wh_write_command. */
+#define WH_MIN_BUFFER_SIZE 1024
+
 /*
  * Private variables
  */
@@ -53,40 +61,86 @@ struct wh_callback_s
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON    1
+#define WH_FORMAT_BINARY  2
         int format;
 
         CURL *curl;
         char curl_errbuf[CURL_ERROR_SIZE];
 
-        char   send_buffer[4096];
+        /* Command and binary format only */
+        char  *send_buffer;
+        size_t send_buffer_size;
         size_t send_buffer_free;
         size_t send_buffer_fill;
         cdtime_t send_buffer_init_time;
 
+        /* Binary format only: fields already present in the buffer */
+        value_list_t send_buffer_vl;
+
+        /* JSON format only */
+        format_json_buffer_t *json;
+
         pthread_mutex_t send_lock;
 };
 typedef struct wh_callback_s wh_callback_t;
 
 static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
 {
-        memset (cb->send_buffer, 0, sizeof (cb->send_buffer));
-        cb->send_buffer_free = sizeof (cb->send_buffer);
-        cb->send_buffer_fill = 0;
         cb->send_buffer_init_time = cdtime ();
 
         if (cb->format == WH_FORMAT_JSON)
         {
-                format_json_initialize (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free);
+                format_json_buffer_reset (cb->json);
+        }
+        else
+        {
+                memset (cb->send_buffer, 0, cb->send_buffer_size);
+                cb->send_buffer_free = cb->send_buffer_size;
+                cb->send_buffer_fill = 0;
+                memset (&cb->send_buffer_vl, 0, sizeof (cb->send_buffer_vl));
         }
 } /* }}} wh_reset_buffer */
 
+/* The JSON buffer is handed to libcurl chunk by chunk, so it never has to be
+ * joined into one string. */
+static size_t wh_read_json (char *buffer, size_t size, size_t nmemb, /* {{{ */
+                void *user_data)
+{
+        wh_callback_t *cb = user_data;
+
+        return (format_json_buffer_read (cb->json, buffer, size * nmemb));
+} /* }}} size_t wh_read_json */
+
+/* Called by libcurl when the request has to be sent again, e.g. after an
+ * authentication round trip. */
+static int wh_seek_json (void *user_data, curl_off_t offset, /* {{{ */
+                int origin)
+{
+        wh_callback_t *cb = user_data;
+
+        if ((offset != 0) || (origin != SEEK_SET))
+                return (CURL_SEEKFUNC_CANTSEEK);
+
+        format_json_buffer_rewind (cb->json);
+        return (CURL_SEEKFUNC_OK);
+} /* }}} int wh_seek_json */
+
 static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
 {
         int status = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+        if (cb->format == WH_FORMAT_JSON)
+        {
+                format_json_buffer_rewind (cb->json);
+                curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                                (curl_off_t) format_json_buffer_length (cb->json));
+        }
+        else
+        {
+                curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+                curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE,
+                                (long) cb->send_buffer_fill);
+        }
         status = curl_easy_perform (cb->curl);
         if (status != 0)
         {
@@ -118,6 +172,9 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
         headers = curl_slist_append (headers, "Accept:  */*");
         if (cb->format == WH_FORMAT_JSON)
                 headers = curl_slist_append (headers, "Content-Type: application/json");
+        else if (cb->format == WH_FORMAT_BINARY)
+                headers = curl_slist_append (headers,
+                                "Content-Type: " FORMAT_NETWORK_CONTENT_TYPE);
         else
                 headers = curl_slist_append (headers, "Content-Type: text/plain");
         headers = curl_slist_append (headers, "Expect:");
@@ -126,6 +183,15 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
         curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
         curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
 
+        if (cb->format == WH_FORMAT_JSON)
+        {
+                curl_easy_setopt (cb->curl, CURLOPT_POST, 1L);
+                curl_easy_setopt (cb->curl, CURLOPT_READFUNCTION, wh_read_json);
+                curl_easy_setopt (cb->curl, CURLOPT_READDATA, cb);
+                curl_easy_setopt (cb->curl, CURLOPT_SEEKFUNCTION, wh_seek_json);
+                curl_easy_setopt (cb->curl, CURLOPT_SEEKDATA, cb);
+        }
+
         if (cb->user != NULL)
         {
                 size_t credentials_size;
@@ -177,7 +243,8 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         return (0);
         }
 
-        if (cb->format == WH_FORMAT_COMMAND)
+        if ((cb->format == WH_FORMAT_COMMAND)
+                        || (cb->format == WH_FORMAT_BINARY))
         {
                 if (cb->send_buffer_fill <= 0)
                 {
@@ -190,19 +257,17 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
         }
         else if (cb->format == WH_FORMAT_JSON)
         {
-                if (cb->send_buffer_fill <= 2)
+                if (format_json_buffer_values_num (cb->json) == 0)
                 {
                         cb->send_buffer_init_time = cdtime ();
                         return (0);
                 }
 
-                status = format_json_finalize (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free);
+                status = format_json_buffer_finalize (cb->json);
                 if (status != 0)
                 {
                         ERROR ("write_http: wh_flush_nolock: "
-                                        "format_json_finalize failed.");
+                                        "format_json_buffer_finalize failed.");
                         wh_reset_buffer (cb);
                         return (status);
                 }
@@ -264,6 +329,8 @@ static void wh_callback_free (void *data) /* {{{ */
         wh_flush_nolock (/* timeout = */ 0, cb);
 
         curl_easy_cleanup (cb->curl);
+        sfree (cb->send_buffer);
+        format_json_buffer_destroy (cb->json);
         sfree (cb->location);
         sfree (cb->user);
         sfree (cb->pass);
@@ -350,8 +417,8 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 
         DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%) \"%s\"",
                         cb->location,
-                        cb->send_buffer_fill, sizeof (cb->send_buffer),
-                        100.0 * ((double) cb->send_buffer_fill) / ((double) sizeof (cb->send_buffer)),
+                        cb->send_buffer_fill, cb->send_buffer_size,
+                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size),
                         command);
 
         /* Check if we have enough space for this command. */
@@ -378,11 +445,8 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
                 }
         }
 
-        status = format_json_value_list (cb->send_buffer,
-                        &cb->send_buffer_fill,
-                        &cb->send_buffer_free,
-                        ds, vl, cb->store_rates);
-        if (status == (-ENOMEM))
+        status = format_json_buffer_add (cb->json, ds, vl, cb->store_rates);
+        if ((status == (-ENOMEM)) && (format_json_buffer_values_num (cb->json) > 0))
         {
                 status = wh_flush_nolock (/* timeout = */ 0, cb);
                 if (status != 0)
@@ -392,10 +456,8 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
                         return (status);
                 }
 
-                status = format_json_value_list (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free,
-                                ds, vl, cb->store_rates);
+                status = format_json_buffer_add (cb->json, ds, vl,
+                                cb->store_rates);
         }
         if (status != 0)
         {
@@ -405,8 +467,9 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
 
         DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%)",
                         cb->location,
-                        cb->send_buffer_fill, sizeof (cb->send_buffer),
-                        100.0 * ((double) cb->send_buffer_fill) / ((double) sizeof (cb->send_buffer)));
+                        format_json_buffer_length (cb->json), cb->send_buffer_size,
+                        100.0 * ((double) format_json_buffer_length (cb->json))
+                        / ((double) cb->send_buffer_size));
 
         /* Check if we have enough space for this command. */
         pthread_mutex_unlock (&cb->send_lock);
@@ -414,6 +477,63 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
         return (0);
 } /* }}} int wh_write_json */
 
+static int wh_write_binary (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+                wh_callback_t *cb)
+{
+        int status;
+
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (cb->curl == NULL)
+        {
+                status = wh_callback_init (cb);
+                if (status != 0)
+                {
+                        ERROR ("write_http plugin: wh_callback_init failed.");
+                        pthread_mutex_unlock (&cb->send_lock);
+                        return (-1);
+                }
+        }
+
+        status = format_network_value_list (cb->send_buffer + cb->send_buffer_fill,
+                        (int) cb->send_buffer_free, &cb->send_buffer_vl, ds, vl);
+        if ((status < 0) && (cb->send_buffer_fill > 0))
+        {
+                /* The partially written part is discarded by the flush,
+                 * which also resets "send_buffer_vl". */
+                status = wh_flush_nolock (/* timeout = */ 0, cb);
+                if (status != 0)
+                {
+                        pthread_mutex_unlock (&cb->send_lock);
+                        return (status);
+                }
+
+                status = format_network_value_list (cb->send_buffer,
+                                (int) cb->send_buffer_free, &cb->send_buffer_vl,
+                                ds, vl);
+        }
+        if (status < 0)
+        {
+                ERROR ("write_http plugin: Value list does not fit into a "
+                                "buffer of %zu bytes.", cb->send_buffer_size);
+                wh_reset_buffer (cb);
+                pthread_mutex_unlock (&cb->send_lock);
+                return (-1);
+        }
+
+        cb->send_buffer_fill += (size_t) status;
+        cb->send_buffer_free -= (size_t) status;
+
+        DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%)",
+                        cb->location,
+                        cb->send_buffer_fill, cb->send_buffer_size,
+                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size));
+
+        pthread_mutex_unlock (&cb->send_lock);
+
+        return (0);
+} /* }}} int wh_write_binary */
+
 static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
                 user_data_t *user_data)
 {
@@ -427,6 +547,8 @@ static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
 
         if (cb->format == WH_FORMAT_JSON)
                 status = wh_write_json (ds, vl, cb);
+        else if (cb->format == WH_FORMAT_BINARY)
+                status = wh_write_binary (ds, vl, cb);
         else
                 status = wh_write_command (ds, vl, cb);
 
@@ -492,6 +614,8 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
                 cb->format = WH_FORMAT_COMMAND;
         else if (strcasecmp ("JSON", string) == 0)
                 cb->format = WH_FORMAT_JSON;
+        else if (strcasecmp ("Binary", string) == 0)
+                cb->format = WH_FORMAT_BINARY;
         else
         {
                 ERROR ("write_http plugin: Invalid format string: %s",
@@ -524,6 +648,7 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
         cb->cacert = NULL;
         cb->format = WH_FORMAT_COMMAND;
         cb->curl = NULL;
+        cb->send_buffer_size = WH_DEFAULT_BUFFER_SIZE;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
 
@@ -549,6 +674,21 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                         config_set_format (cb, child);
                 else if (strcasecmp ("StoreRates", child->key) == 0)
                         config_set_boolean (&cb->store_rates, child);
+                else if (strcasecmp ("BufferSize", child->key) == 0)
+                {
+                        int tmp = 0;
+                        if (cf_util_get_int (child, &tmp) == 0)
+                        {
+                                if (tmp < WH_MIN_BUFFER_SIZE)
+                                {
+                                        WARNING ("write_http plugin: BufferSize "
+                                                        "must be at least %i.",
+                                                        WH_MIN_BUFFER_SIZE);
+                                        tmp = WH_MIN_BUFFER_SIZE;
+                                }
+                                cb->send_buffer_size = (size_t) tmp;
+                        }
+                }
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -556,6 +696,17 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                 }
         }
 
+        if (cb->format == WH_FORMAT_JSON)
+                cb->json = format_json_buffer_create (cb->send_buffer_size);
+        else
+                cb->send_buffer = malloc (cb->send_buffer_size);
+        if ((cb->json == NULL) && (cb->send_buffer == NULL))
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                wh_callback_free (cb);
+                return (-1);
+        }
+
         DEBUG ("write_http: Registering write callback with URL %s",
                         cb->location);
 
@@ -0,0 +1,351 @@
+/**
+ * collectd - src/write_shm.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+#include "utils_complain.h"
+
+#include "libcollectdclient/collectd/shm.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef WSHM_DEFAULT_FILE
+# define WSHM_DEFAULT_FILE "/dev/shm/collectd-values"
+#endif
+#define WSHM_DEFAULT_SLOTS 16384
+/* Keeps the size of the index, twice the number of slots rounded up to a
+ * power of two, within 32 bits. */
+#define WSHM_SLOTS_MAX 268435456
+
+/*
+ * Private variables
+ */
+static char *wshm_file = NULL;
+static uint32_t wshm_slots_num = WSHM_DEFAULT_SLOTS;
+static _Bool wshm_store_rates = 1;
+
+static void *wshm_map = NULL;
+static size_t wshm_map_size = 0;
+static lcc_shm_header_t *wshm_header = NULL;
+static volatile uint32_t *wshm_index = NULL;
+static lcc_shm_slot_t *wshm_slots = NULL;
+
+/* Serializes the writers. Readers are not affected by this lock, they rely on
+ * the sequence lock of each slot. */
+static pthread_mutex_t wshm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static c_complain_t wshm_full_complaint = C_COMPLAIN_INIT_STATIC;
+static c_complain_t wshm_ds_complaint = C_COMPLAIN_INIT_STATIC;
+
+/*
+ * Functions
+ */
+/* Returns the slot of `name', allocating one if necessary. Must be called with
+ * `wshm_lock' held. */
+static lcc_shm_slot_t *wshm_get_slot (const char *name) /* {{{ */
+{
+  lcc_shm_slot_t *slot;
+  uint32_t hash;
+  uint32_t mask;
+  uint32_t pos;
+  uint32_t i;
+
+  LCC_SHM_HASH (hash, name);
+  mask = wshm_header->index_size - 1;
+
+  for (i = 0; i <= mask; i++)
+  {
+    uint32_t entry;
+
+    pos = (hash + i) & mask;
+    entry = wshm_index[pos];
+    if (entry == 0)
+      break;
+
+    if (strcmp (wshm_slots[entry - 1].name, name) == 0)
+      return (wshm_slots + (entry - 1));
+  }
+
+  if ((i > mask) || (wshm_header->slots_used >= wshm_header->slots_num))
+  {
+    c_complain_once (LOG_WARNING, &wshm_full_complaint,
+        "write_shm plugin: All %"PRIu32" slots are in use. "
+        "Increase the \"Slots\" option to export more values.",
+        wshm_header->slots_num);
+    return (NULL);
+  }
+
+  slot = wshm_slots + wshm_header->slots_used;
+  memset (slot, 0, sizeof (*slot));
+  sstrncpy (slot->name, name, sizeof (slot->name));
+
+  /* Publish the slot only after it has been initialized, and the index entry
+   * only after the slot has been published. */
+  __sync_synchronize ();
+  wshm_header->slots_used++;
+  __sync_synchronize ();
+  wshm_index[pos] = wshm_header->slots_used;
+
+  return (slot);
+} /* }}} lcc_shm_slot_t *wshm_get_slot */
+
+static int wshm_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t __attribute__((unused)) *user_data)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  double values[LCC_SHM_VALUES_MAX];
+  gauge_t *rates = NULL;
+  lcc_shm_slot_t *slot;
+  int status;
+  int i;
+
+  if (0 != strcmp (ds->type, vl->type))
+  {
+    ERROR ("write_shm plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  if (ds->ds_num > LCC_SHM_VALUES_MAX)
+  {
+    c_complain (LOG_WARNING, &wshm_ds_complaint,
+        "write_shm plugin: Type \"%s\" has %i data sources, "
+        "but at most %i can be exported.",
+        ds->type, ds->ds_num, LCC_SHM_VALUES_MAX);
+    return (-1);
+  }
+
+  status = FORMAT_VL (name, sizeof (name), vl);
+  if (status != 0)
+    return (status);
+
+  if (wshm_store_rates)
+  {
+    rates = uc_get_rate (ds, vl);
+    if (rates == NULL)
+    {
+      ERROR ("write_shm plugin: uc_get_rate failed.");
+      return (-1);
+    }
+  }
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (rates != NULL)
+      values[i] = (double) rates[i];
+    else if (ds->ds[i].type == DS_TYPE_GAUGE)
+      values[i] = (double) vl->values[i].gauge;
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      values[i] = (double) vl->values[i].counter;
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      values[i] = (double) vl->values[i].derive;
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      values[i] = (double) vl->values[i].absolute;
+  }
+  sfree (rates);
+
+  pthread_mutex_lock (&wshm_lock);
+
+  if (wshm_header == NULL)
+  {
+    pthread_mutex_unlock (&wshm_lock);
+    return (-1);
+  }
+
+  slot = wshm_get_slot (name);
+  if (slot == NULL)
+  {
+    pthread_mutex_unlock (&wshm_lock);
+    return (-1);
+  }
+
+  slot->seq++;
+  __sync_synchronize ();
+
+  memcpy (slot->values, values, ds->ds_num * sizeof (*values));
+  slot->values_num = (uint32_t) ds->ds_num;
+  slot->time = (uint64_t) vl->time;
+  slot->interval = (uint64_t) vl->interval;
+
+  __sync_synchronize ();
+  slot->seq++;
+
+  pthread_mutex_unlock (&wshm_lock);
+
+  return (0);
+} /* }}} int wshm_write */
+
+static int wshm_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("File", child->key) == 0)
+      cf_util_get_string (child, &wshm_file);
+    else if (strcasecmp ("Slots", child->key) == 0)
+    {
+      int tmp = 0;
+
+      if (cf_util_get_int (child, &tmp) != 0)
+        continue;
+      if ((tmp < 1) || (tmp > WSHM_SLOTS_MAX))
+      {
+        WARNING ("write_shm plugin: The \"Slots\" option must be between "
+            "1 and %i.", WSHM_SLOTS_MAX);
+        continue;
+      }
+      wshm_slots_num = (uint32_t) tmp;
+    }
+    else if (strcasecmp ("StoreRates", child->key) == 0)
+      cf_util_get_boolean (child, &wshm_store_rates);
+    else
+    {
+      WARNING ("write_shm plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+    }
+  }
+
+  return (0);
+} /* }}} int wshm_config */
+
+static int wshm_init (void) /* {{{ */
+{
+  const char *file = (wshm_file != NULL) ? wshm_file : WSHM_DEFAULT_FILE;
+  char errbuf[1024];
+  uint32_t index_size;
+  uint64_t size;
+  void *map;
+  size_t map_size;
+  int fd;
+
+  if (wshm_map != NULL)
+    return (0);
+
+  /* Keep the load factor of the index at or below 50%. */
+  for (index_size = 1; index_size < (2 * wshm_slots_num); index_size *= 2)
+    /* do nothing */;
+
+  size = LCC_SHM_SIZE (wshm_slots_num, index_size);
+  if ((size > (uint64_t) SIZE_MAX) || ((uint64_t) ((off_t) size) != size))
+  {
+    ERROR ("write_shm plugin: %"PRIu32" slots don't fit into the address "
+        "space. Decrease the \"Slots\" option.", wshm_slots_num);
+    return (-1);
+  }
+  map_size = (size_t) size;
+
+  /* Readers of a previous instance keep their (stale) mapping, so remove the
+   * old file instead of truncating it. */
+  unlink (file);
+  fd = open (file, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    ERROR ("write_shm plugin: open (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (ftruncate (fd, (off_t) map_size) != 0)
+  {
+    ERROR ("write_shm plugin: ftruncate (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    unlink (file);
+    return (-1);
+  }
+
+  map = mmap (/* addr = */ NULL, map_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, /* offset = */ 0);
+  if (map == MAP_FAILED)
+  {
+    ERROR ("write_shm plugin: mmap (%s) failed: %s", file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    unlink (file);
+    return (-1);
+  }
+  close (fd);
+
+  pthread_mutex_lock (&wshm_lock);
+
+  wshm_map = map;
+  wshm_map_size = map_size;
+  wshm_header = map;
+  wshm_header->version = LCC_SHM_VERSION;
+  wshm_header->slots_num = wshm_slots_num;
+  wshm_header->index_size = index_size;
+  wshm_header->slots_used = 0;
+  wshm_index = LCC_SHM_INDEX (wshm_header);
+  wshm_slots = LCC_SHM_SLOTS (wshm_header);
+
+  /* Readers check the magic, so set it last. */
+  __sync_synchronize ();
+  wshm_header->magic = LCC_SHM_MAGIC;
+
+  pthread_mutex_unlock (&wshm_lock);
+
+  return (0);
+} /* }}} int wshm_init */
+
+static int wshm_shutdown (void) /* {{{ */
+{
+  const char *file = (wshm_file != NULL) ? wshm_file : WSHM_DEFAULT_FILE;
+
+  pthread_mutex_lock (&wshm_lock);
+
+  if (wshm_map != NULL)
+  {
+    /* Tell readers to re-open the file. */
+    wshm_header->magic = 0;
+    __sync_synchronize ();
+
+    munmap (wshm_map, wshm_map_size);
+    unlink (file);
+  }
+
+  wshm_map = NULL;
+  wshm_map_size = 0;
+  wshm_header = NULL;
+  wshm_index = NULL;
+  wshm_slots = NULL;
+
+  pthread_mutex_unlock (&wshm_lock);
+
+  sfree (wshm_file);
+
+  return (0);
+} /* }}} int wshm_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("write_shm", wshm_config);
+  plugin_register_init ("write_shm", wshm_init);
+  plugin_register_write ("write_shm", wshm_write, /* user_data = */ NULL);
+  plugin_register_shutdown ("write_shm", wshm_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */